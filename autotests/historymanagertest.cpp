@@ -20,7 +20,10 @@
 #include <QTest>
 #include <QSignalSpy>
 #include <konqhistorymanager.h>
+#include <konq_historyloader_p.h>
 
+#include <QDBusConnection>
+#include <QDBusConnectionInterface>
 #include <QObject>
 #include <QStandardPaths>
 
@@ -33,6 +36,8 @@ private Q_SLOTS:
     void testGetSetMaxCount();
     void testGetSetMaxAge();
     void testAddHistoryEntry();
+    void testBatchedBroadcast();
+    void testSavedByWriter();
 };
 
 QTEST_MAIN(HistoryManagerTest)
@@ -141,4 +146,73 @@ void HistoryManagerTest::testAddHistoryEntry()
     QCOMPARE(int(entry.numberOfTimesVisited), 1);
 }
 
+void HistoryManagerTest::testBatchedBroadcast()
+{
+    // The message counts include the broadcasts of other konqueror processes,
+    // and the extra messages sent to old ones. ctest runs this on its own bus.
+    QDBusConnectionInterface *dbusInterface = QDBusConnection::sessionBus().interface();
+    QVERIFY(dbusInterface);
+    foreach (const QString &service, dbusInterface->registeredServiceNames().value()) {
+        if (service.startsWith(QLatin1String("org.kde.konqueror"))) {
+            QSKIP("Other konqueror processes are running on this session bus");
+        }
+    }
+
+    KonqHistoryManager mgr(0);
+    qRegisterMetaType<KonqHistoryEntry>("KonqHistoryEntry");
+    QSignalSpy addedSpy(&mgr, SIGNAL(entryAdded(KonqHistoryEntry)));
+    const quint64 sent = mgr.sentMessageCount();
+    const quint64 received = mgr.receivedMessageCount();
+    const QUrl url1(QStringLiteral("http://batch1.historymgrtest.org/"));
+    const QUrl url2(QStringLiteral("http://batch2.historymgrtest.org/"));
+
+    // Visits in quick succession are sent in one message, repeated visits merged
+    mgr.addPending(url1);
+    mgr.addPending(url2);
+    mgr.confirmPending(url1, QString(), QStringLiteral("One"));
+    mgr.confirmPending(url2, QString(), QStringLiteral("Two"));
+
+    QVERIFY(addedSpy.wait());
+    QTRY_COMPARE(addedSpy.count(), 2);
+    QCOMPARE(mgr.sentMessageCount() - sent, quint64(1));
+    QCOMPARE(mgr.receivedMessageCount() - received, quint64(1));
+    KonqHistoryEntry entry = qvariant_cast<KonqHistoryEntry>(addedSpy[0][0]);
+    QCOMPARE(entry.url.url(), url1.url());
+    QCOMPARE(entry.title, QStringLiteral("One"));
+    QCOMPARE(int(entry.numberOfTimesVisited), 1);
+    entry = qvariant_cast<KonqHistoryEntry>(addedSpy[1][0]);
+    QCOMPARE(entry.url.url(), url2.url());
+    QCOMPARE(entry.title, QStringLiteral("Two"));
+
+    // Now clean it up
+    QSignalSpy removedSpy(&mgr, SIGNAL(entryRemoved(KonqHistoryEntry)));
+    mgr.emitRemoveListFromHistory(QList<QUrl>() << url1 << url2);
+    QTRY_COMPARE(removedSpy.count(), 2);
+}
+
+static bool isSaved(const QUrl &url)
+{
+    KonqHistoryLoader loader;
+    foreach (const KonqHistoryEntry &entry, loader.entries()) {
+        if (entry.url == url) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void HistoryManagerTest::testSavedByWriter()
+{
+    // This process is the history writer; it saves the changes once its
+    // notifyHistorySaving signal came back
+    KonqHistoryManager mgr(0);
+    const QUrl url(QStringLiteral("http://saved.historymgrtest.org/"));
+    QVERIFY(!isSaved(url));
+    mgr.addPending(url);
+    QTRY_VERIFY_WITH_TIMEOUT(isSaved(url), 5000);
+
+    mgr.emitRemoveFromHistory(url);
+    QTRY_VERIFY_WITH_TIMEOUT(!isSaved(url), 5000);
+}
+
 #include "historymanagertest.moc"
@@ -0,0 +1,402 @@
+/* This file is part of the KDE project
+    Copyright (c) 2016 The Konqueror developers
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Library General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Library General Public License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to
+    the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+    Boston, MA 02110-1301, USA.
+*/
+
+#include <QTest>
+#include <QSet>
+#include <QSignalSpy>
+
+#include <konq_historyentry.h>
+#include <konqcompletionindex.h>
+#include <konqcompletionmatcher.h>
+
+class KonqCompletionIndexTest : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void initTestCase();
+    void testMatches_data();
+    void testMatches();
+    void testWeights();
+    void testRemoveItem();
+    void testFrecency();
+    void testHistoryEntry();
+    void testSubstringMatches_data();
+    void testSubstringMatches();
+    void testCopy();
+    void testGeneratedHistory();
+    void testMatcher();
+    void testMatcherDropsStaleRequests();
+    void benchmarkTyping();
+    void benchmarkSubstring();
+
+private:
+    KonqCompletionIndex m_index;
+    QStringList m_typed;
+    QStringList m_words;
+};
+
+static KonqHistoryEntry historyEntry(const QString &url, quint32 visits, const QDateTime &lastVisited,
+                                     const QString &typedUrl = QString(), const QString &title = QString())
+{
+    KonqHistoryEntry entry;
+    entry.url = QUrl(url);
+    entry.typedUrl = typedUrl;
+    entry.title = title;
+    entry.numberOfTimesVisited = visits;
+    entry.firstVisited = lastVisited;
+    entry.lastVisited = lastVisited;
+    return entry;
+}
+
+// A history of 20000 visits to a few thousand sites, as
+// KonqHistoryManager feeds them
+void KonqCompletionIndexTest::initTestCase()
+{
+    const QDateTime now = QDateTime::currentDateTime();
+
+    static const char * const sites[] = { "kde", "konqueror", "kernel", "wikipedia", "news", "mail", "git", "planet" };
+    static const char * const paths[] = { "", "index.html", "docs/", "blog/2016/", "search?q=", "wiki/Main_Page" };
+    static const int siteCount = sizeof(sites) / sizeof(*sites);
+    static const int pathCount = sizeof(paths) / sizeof(*paths);
+
+    for (int i = 0; i < 20000; ++i) {
+        const QString host = QString::fromLatin1(sites[i % siteCount]) + QString::number(i % 2500)
+                             + QLatin1String(i % 3 ? ".org" : ".com");
+        const QString scheme = QLatin1String(i % 5 ? "https://" : "http://");
+        const QString www = QLatin1String(i % 2 ? "www." : "");
+        const QString url = scheme + www + host + QLatin1Char('/') + QString::fromLatin1(paths[(i / 7) % pathCount])
+                            + (i % 11 == 0 ? QString::number(i) : QString());
+        const int visits = 1 + i % 13;
+        const QString typedUrl = i % 17 == 0 ? host : QString();
+        m_index.addHistoryEntry(historyEntry(url, visits, now.addSecs(-i * 600), typedUrl,
+                                             QString::fromLatin1(sites[i % siteCount]) + QLatin1String(" home page")),
+                                url);
+    }
+
+    m_typed << QStringLiteral("kde42.org/docs") << QStringLiteral("www.konqueror7")
+            << QStringLiteral("https://wikipedia1") << QStringLiteral("planet2499.com/blog");
+    m_words << QStringLiteral("kde42") << QStringLiteral("docs") << QStringLiteral("blog/2016")
+            << QStringLiteral("Main_Page") << QStringLiteral("99.org") << QStringLiteral("1234");
+}
+
+void KonqCompletionIndexTest::testMatches_data()
+{
+    QTest::addColumn<QString>("text");
+    QTest::addColumn<QStringList>("items");
+
+    const QStringList all = QStringList() << QStringLiteral("http://www.kde.org/") << QStringLiteral("https://kde.org/")
+                                          << QStringLiteral("http://kde.org") << QStringLiteral("kde.org");
+
+    QTest::newRow("bare") << "kd" << (QStringList() << QStringLiteral("http://www.kde.org/") << QStringLiteral("https://kde.org/"));
+    QTest::newRow("www") << "www.kd" << (QStringList() << QStringLiteral("http://www.kde.org/") << QStringLiteral("https://kde.org/"));
+    QTest::newRow("scheme") << "https://kd" << QStringList(QStringLiteral("https://kde.org/"));
+    QTest::newRow("scheme and www") << "http://www.kde" << QStringList(QStringLiteral("http://www.kde.org/"));
+    QTest::newRow("trailing slash") << "kde.org/" << (QStringList() << QStringLiteral("http://www.kde.org/") << QStringLiteral("https://kde.org/"));
+    QTest::newRow("path") << "/usr/s" << QStringList(QStringLiteral("file:///usr/share/"));
+    QTest::newRow("file scheme") << "file:/usr" << QStringList(QStringLiteral("file:///usr/share/"));
+    QTest::newRow("common prefix") << "h" << QStringList();
+    QTest::newRow("www alone") << "www." << QStringList();
+    QTest::newRow("scheme alone") << "http://" << QStringList();
+    QTest::newRow("no match") << "kdf" << QStringList();
+}
+
+void KonqCompletionIndexTest::testMatches()
+{
+    QFETCH(QString, text);
+    QFETCH(QStringList, items);
+
+    KonqCompletionIndex index;
+    index.addItem(QStringLiteral("http://www.kde.org/"), 3);
+    index.addItem(QStringLiteral("https://kde.org/"), 2);
+    index.addItem(QStringLiteral("http://kde.org"), 1);
+    index.addItem(QStringLiteral("kde.org"), 1);
+    index.addItem(QStringLiteral("file:///usr/share/"), 1);
+    index.addItem(QStringLiteral("/usr/share"), 1);
+
+    QCOMPARE(index.count(), 3);
+    QCOMPARE(index.matches(text), items);
+}
+
+void KonqCompletionIndexTest::testWeights()
+{
+    KonqCompletionIndex index;
+    index.addItem(QStringLiteral("http://kde.org/"), 2);
+    index.addItem(QStringLiteral("http://kate-editor.org/"), 5);
+    QCOMPARE(index.matches(QStringLiteral("k")),
+             QStringList() << QStringLiteral("http://kate-editor.org/") << QStringLiteral("http://kde.org/"));
+
+    // weights add up, as in KCompletion
+    index.addItem(QStringLiteral("http://kde.org/"), 2);
+    // the typed url raises the weight of its entry, the url is shown
+    index.addItem(QStringLiteral("kde.org"), 2 + 10);
+    QCOMPARE(index.matches(QStringLiteral("k")),
+             QStringList() << QStringLiteral("http://kde.org/") << QStringLiteral("http://kate-editor.org/"));
+}
+
+void KonqCompletionIndexTest::testRemoveItem()
+{
+    KonqCompletionIndex index;
+    index.addItem(QStringLiteral("http://kde.org/"), 2);
+    index.addItem(QStringLiteral("kde.org"), 12);
+    index.removeItem(QStringLiteral("http://kde.org/"));
+    QCOMPARE(index.matches(QStringLiteral("kde")), QStringList(QStringLiteral("kde.org")));
+    index.removeItem(QStringLiteral("kde.org"));
+    QCOMPARE(index.count(), 0);
+    QVERIFY(index.matches(QStringLiteral("kde")).isEmpty());
+    index.removeItem(QStringLiteral("http://unknown.org/"));
+
+    // Removing an entry keeps the others with the same trigrams
+    index.addItem(QStringLiteral("http://kde.org/"));
+    index.addItem(QStringLiteral("http://planet.kde.org/"));
+    index.addItem(QStringLiteral("http://dot.kde.org/"));
+    index.removeItem(QStringLiteral("http://planet.kde.org/"));
+    QCOMPARE(index.substringMatches(QStringLiteral("kde")).count(), 2);
+    index.addItem(QStringLiteral("http://planet.kde.org/"));
+    QCOMPARE(index.substringMatches(QStringLiteral("kde.org")).count(), 3);
+    index.clear();
+    QCOMPARE(index.count(), 0);
+}
+
+void KonqCompletionIndexTest::testFrecency()
+{
+    const QDateTime now = QDateTime::currentDateTime();
+    KonqCompletionIndex index;
+    index.setReferenceTime(now);
+
+    // often, but months ago
+    index.addHistoryEntry(historyEntry(QStringLiteral("http://kde.org/"), 10, now.addDays(-100)),
+                          QStringLiteral("http://kde.org/"));
+    // less often, but yesterday
+    index.addHistoryEntry(historyEntry(QStringLiteral("http://kate-editor.org/"), 3, now.addDays(-1)),
+                          QStringLiteral("http://kate-editor.org/"));
+    QCOMPARE(index.matches(QStringLiteral("k")),
+             QStringList() << QStringLiteral("http://kate-editor.org/") << QStringLiteral("http://kde.org/"));
+
+    // typed urls count double
+    index.addHistoryEntry(historyEntry(QStringLiteral("http://kontact.org/"), 2, now.addDays(-2), QStringLiteral("kontact.org")),
+                          QStringLiteral("http://kontact.org/"));
+    QCOMPARE(index.matches(QStringLiteral("k")),
+             QStringList() << QStringLiteral("http://kontact.org/") << QStringLiteral("http://kate-editor.org/")
+             << QStringLiteral("http://kde.org/"));
+    QCOMPARE(index.matches(QStringLiteral("k"), 2),
+             QStringList() << QStringLiteral("http://kontact.org/") << QStringLiteral("http://kate-editor.org/"));
+
+    // a year later, only the visits count
+    index.setReferenceTime(now.addDays(365));
+    QCOMPARE(index.matches(QStringLiteral("k"), 1), QStringList(QStringLiteral("http://kde.org/")));
+}
+
+void KonqCompletionIndexTest::testHistoryEntry()
+{
+    const QDateTime now = QDateTime::currentDateTime();
+    KonqCompletionIndex index;
+    index.setReferenceTime(now);
+    index.addItem(QStringLiteral("http://kde.org/"), 1); // a bookmark
+
+    index.addHistoryEntry(historyEntry(QStringLiteral("http://kde.org/"), 1, now, QStringLiteral("kde.org"), QStringLiteral("KDE")),
+                          QStringLiteral("http://kde.org/"));
+    index.addHistoryEntry(historyEntry(QStringLiteral("http://kate-editor.org/"), 2, now),
+                          QStringLiteral("http://kate-editor.org/"));
+    QCOMPARE(index.count(), 2);
+    QCOMPARE(index.matches(QStringLiteral("k")),
+             QStringList() << QStringLiteral("http://kde.org/") << QStringLiteral("http://kate-editor.org/"));
+
+    // an update replaces the visits, it doesn't add them
+    index.addHistoryEntry(historyEntry(QStringLiteral("http://kate-editor.org/"), 5, now),
+                          QStringLiteral("http://kate-editor.org/"));
+    index.addHistoryEntry(historyEntry(QStringLiteral("http://kate-editor.org/"), 5, now),
+                          QStringLiteral("http://kate-editor.org/"));
+    QCOMPARE(index.matches(QStringLiteral("k")),
+             QStringList() << QStringLiteral("http://kate-editor.org/") << QStringLiteral("http://kde.org/"));
+    QCOMPARE(index.substringMatches(QStringLiteral("kde")), QStringList(QStringLiteral("http://kde.org/")));
+
+    // the bookmark stays, without the history and its title
+    index.removeHistoryEntry(QStringLiteral("http://kde.org/"), QStringLiteral("kde.org"));
+    QCOMPARE(index.count(), 2);
+    index.removeItem(QStringLiteral("http://kde.org/"));
+    QCOMPARE(index.count(), 1);
+    QVERIFY(index.substringMatches(QStringLiteral("kde")).isEmpty());
+}
+
+void KonqCompletionIndexTest::testSubstringMatches_data()
+{
+    QTest::addColumn<QString>("text");
+    QTest::addColumn<QStringList>("items");
+
+    const QString kde = QStringLiteral("http://www.kde.org/");
+    const QString planet = QStringLiteral("https://planet.kde.org/");
+    const QString kate = QStringLiteral("http://kate-editor.org/");
+
+    QTest::newRow("host") << "kde" << (QStringList() << kde << planet);
+    QTest::newRow("inside a word") << "anet" << QStringList(planet);
+    QTest::newRow("title") << "Planet" << QStringList(planet);
+    QTest::newRow("case") << "EDITOR" << QStringList(kate);
+    QTest::newRow("words") << "kde home" << QStringList(kde);
+    QTest::newRow("words in any order") << "home org" << (QStringList() << kde << kate);
+    QTest::newRow("short words") << "k e" << (QStringList() << kde << planet << kate);
+    QTest::newRow("short and long words") << "t editor" << QStringList(kate);
+    QTest::newRow("no match") << "gnome" << QStringList();
+    QTest::newRow("one word missing") << "kde gnome" << QStringList();
+    QTest::newRow("scheme isn't searched") << "https" << QStringList();
+    QTest::newRow("spaces") << "  " << QStringList();
+}
+
+void KonqCompletionIndexTest::testSubstringMatches()
+{
+    QFETCH(QString, text);
+    QFETCH(QStringList, items);
+
+    const QDateTime now = QDateTime::currentDateTime();
+    KonqCompletionIndex index;
+    index.setReferenceTime(now);
+    index.addHistoryEntry(historyEntry(QStringLiteral("http://www.kde.org/"), 5, now, QString(), QStringLiteral("KDE - Home")),
+                          QStringLiteral("http://www.kde.org/"));
+    index.addHistoryEntry(historyEntry(QStringLiteral("https://planet.kde.org/"), 3, now, QString(), QStringLiteral("Planet KDE")),
+                          QStringLiteral("https://planet.kde.org/"));
+    index.addHistoryEntry(historyEntry(QStringLiteral("http://kate-editor.org/"), 1, now, QString(), QStringLiteral("Kate - Home")),
+                          QStringLiteral("http://kate-editor.org/"));
+
+    QCOMPARE(index.substringMatches(text), items);
+    QCOMPARE(index.substringMatches(text, 1), items.mid(0, 1));
+}
+
+// Changing an index doesn't change its copies, and the other way around
+void KonqCompletionIndexTest::testCopy()
+{
+    KonqCompletionIndex index;
+    for (int i = 0; i < 1000; ++i) {
+        index.addItem(QStringLiteral("http://kde%1.org/").arg(i), i);
+    }
+    const KonqCompletionIndex copy(index);
+    const QStringList matches = copy.matches(QStringLiteral("kde1"));
+    const QStringList substringMatches = copy.substringMatches(QStringLiteral("de99"));
+
+    index.removeItem(QStringLiteral("http://kde1.org/"));
+    index.addItem(QStringLiteral("http://kde1000.org/"), 2000);
+    index.addItem(QStringLiteral("http://kde999.org/"), 1);
+    QCOMPARE(index.count(), 1000);
+    QCOMPARE(index.matches(QStringLiteral("kde1"), 1), QStringList(QStringLiteral("http://kde1000.org/")));
+    QVERIFY(!index.matches(QStringLiteral("kde1")).contains(QStringLiteral("http://kde1.org/")));
+
+    QCOMPARE(copy.count(), 1000);
+    QCOMPARE(copy.matches(QStringLiteral("kde1")), matches);
+    QCOMPARE(copy.substringMatches(QStringLiteral("de99")), substringMatches);
+    QVERIFY(matches.contains(QStringLiteral("http://kde1.org/")));
+
+    KonqCompletionIndex copy2(copy);
+    copy2.clear();
+    QCOMPARE(copy.matches(QStringLiteral("kde1")), matches);
+}
+
+// planet2499 was visited as i = 4999, 9999, 14999 and 19999 in initTestCase
+void KonqCompletionIndexTest::testGeneratedHistory()
+{
+    const QString com = QStringLiteral("https://www.planet2499.com/9999");
+    const QString org = QStringLiteral("https://www.planet2499.org/");
+    const QString orgIndex = QStringLiteral("https://www.planet2499.org/index.html");
+
+    QCOMPARE(m_index.matches(QStringLiteral("planet2499.")).toSet(),
+             QSet<QString>() << com << org << orgIndex);
+    QCOMPARE(m_index.matches(QStringLiteral("www.planet2499.org")).toSet(),
+             QSet<QString>() << org << orgIndex);
+    QCOMPARE(m_index.matches(QStringLiteral("planet2499.com/")), QStringList(com));
+    QVERIFY(m_index.matches(QStringLiteral("planet2499.com/blog")).isEmpty());
+
+    QCOMPARE(m_index.substringMatches(QStringLiteral("planet2499")).toSet(),
+             QSet<QString>() << com << org << orgIndex);
+    QCOMPARE(m_index.substringMatches(QStringLiteral("2499 index")), QStringList(orgIndex));
+}
+
+void KonqCompletionIndexTest::testMatcher()
+{
+    KonqCompletionMatcher matcher;
+    QSignalSpy spy(&matcher, SIGNAL(finished(QString,KonqCompletionMatcher::Mode,QStringList)));
+
+    matcher.start(m_index, QStringLiteral("kde42"), KonqCompletionMatcher::PrefixMatches, 10);
+    QVERIFY(matcher.isRunning());
+    QVERIFY(spy.wait());
+    QVERIFY(!matcher.isRunning());
+    QCOMPARE(spy.count(), 1);
+    QCOMPARE(spy.at(0).at(0).toString(), QStringLiteral("kde42"));
+    QCOMPARE(spy.at(0).at(1).value<KonqCompletionMatcher::Mode>(), KonqCompletionMatcher::PrefixMatches);
+    QCOMPARE(spy.at(0).at(2).toStringList(), m_index.matches(QStringLiteral("kde42"), 10));
+
+    spy.clear();
+    matcher.start(m_index, QStringLiteral("docs"), KonqCompletionMatcher::SubstringMatches, 10);
+    QVERIFY(spy.wait());
+    QCOMPARE(spy.at(0).at(2).toStringList(), m_index.substringMatches(QStringLiteral("docs"), 10));
+}
+
+// Only the latest keystroke gets an answer, from the index as it was then
+void KonqCompletionIndexTest::testMatcherDropsStaleRequests()
+{
+    KonqCompletionIndex index;
+    index.addItem(QStringLiteral("http://kde.org/"));
+    index.addItem(QStringLiteral("http://konqueror.org/"));
+
+    KonqCompletionMatcher matcher;
+    QSignalSpy spy(&matcher, SIGNAL(finished(QString,KonqCompletionMatcher::Mode,QStringList)));
+    matcher.start(index, QStringLiteral("k"), KonqCompletionMatcher::PrefixMatches, 10);
+    matcher.start(index, QStringLiteral("ko"), KonqCompletionMatcher::PrefixMatches, 10);
+    matcher.start(index, QStringLiteral("kon"), KonqCompletionMatcher::PrefixMatches, 10);
+    index.clear();
+    QVERIFY(spy.wait());
+    QTest::qWait(50);
+    QCOMPARE(spy.count(), 1);
+    QCOMPARE(spy.at(0).at(0).toString(), QStringLiteral("kon"));
+    QCOMPARE(spy.at(0).at(2).toStringList(), QStringList(QStringLiteral("http://konqueror.org/")));
+
+    spy.clear();
+    matcher.start(index, QStringLiteral("k"), KonqCompletionMatcher::PrefixMatches, 10);
+    matcher.cancel();
+    QVERIFY(!matcher.isRunning());
+    QVERIFY(!spy.wait(100));
+}
+
+// The lookups done while typing the urls, one keystroke after the other
+void KonqCompletionIndexTest::benchmarkTyping()
+{
+    int found = 0;
+    QBENCHMARK {
+        foreach (const QString &typed, m_typed) {
+            for (int length = 1; length <= typed.length(); ++length) {
+                const QString text = typed.left(length);
+                found += m_index.matches(text).count();
+            }
+        }
+    }
+    QVERIFY(found > 0);
+}
+
+// The substring completions of a few words, limited as the combo box does
+void KonqCompletionIndexTest::benchmarkSubstring()
+{
+    int found = 0;
+    QBENCHMARK {
+        foreach (const QString &word, m_words) {
+            found += m_index.substringMatches(word, 100).count();
+        }
+    }
+    QVERIFY(found > 0);
+}
+
+QTEST_GUILESS_MAIN(KonqCompletionIndexTest)
+
+#include "konqcompletionindextest.moc"
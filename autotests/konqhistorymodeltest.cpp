@@ -0,0 +1,253 @@
+/* This file is part of the KDE project
+    Copyright (c) 2016 The Konqueror developers
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Library General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Library General Public License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to
+    the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+    Boston, MA 02110-1301, USA.
+*/
+
+#include <QTest>
+#include <QSortFilterProxyModel>
+#include <QStandardPaths>
+
+#include <konq_historyprovider.h>
+#include <konqhistory.h>
+#include <konqhistorymodel.h>
+
+static KonqHistoryEntry historyEntry(const QString &url, const QDateTime &lastVisited)
+{
+    KonqHistoryEntry entry;
+    entry.url = QUrl(url);
+    entry.numberOfTimesVisited = 1;
+    entry.firstVisited = lastVisited;
+    entry.lastVisited = lastVisited;
+    return entry;
+}
+
+class KonqHistoryModelTest : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void initTestCase();
+    void cleanupTestCase();
+    void testAddRemove();
+    void testLastVisited();
+    void testFetchMore();
+    void benchmarkLoad_data();
+    void benchmarkLoad();
+    void benchmarkSort();
+
+private:
+    static void checkRows(const KonqHistoryModel &model);
+
+    KonqHistoryProvider *m_provider;
+    KonqHistoryList m_entries;
+};
+
+void KonqHistoryModelTest::initTestCase()
+{
+    QStandardPaths::setTestModeEnabled(true);
+    m_provider = new KonqHistoryProvider;
+
+    // 50000 pages of 500 sites, visited over a year
+    const QDateTime now = QDateTime::currentDateTime();
+    for (int i = 0; i < 50000; ++i) {
+        const QString url = QStringLiteral("http://site%1.org/page%2.html").arg(i % 500).arg(i / 500);
+        m_entries.append(historyEntry(url, now.addSecs(-((i * 7919) % (365 * 24 * 60)) * 60)));
+    }
+}
+
+void KonqHistoryModelTest::cleanupTestCase()
+{
+    delete m_provider;
+}
+
+// Every index knows its row and its parent
+void KonqHistoryModelTest::checkRows(const KonqHistoryModel &model)
+{
+    for (int group = 0; group < model.rowCount(); ++group) {
+        const QModelIndex groupIndex = model.index(group, 0);
+        QCOMPARE(model.parent(groupIndex), QModelIndex());
+        for (int row = 0; row < model.rowCount(groupIndex); ++row) {
+            const QModelIndex index = model.index(row, 0, groupIndex);
+            QCOMPARE(model.parent(index), groupIndex);
+        }
+    }
+}
+
+void KonqHistoryModelTest::testAddRemove()
+{
+    KonqHistoryModel model;
+    const QDateTime now = QDateTime::currentDateTime();
+    emit m_provider->entryAdded(historyEntry(QStringLiteral("http://kde.org/"), now));
+    emit m_provider->entryAdded(historyEntry(QStringLiteral("http://qt.io/"), now));
+    emit m_provider->entryAdded(historyEntry(QStringLiteral("http://kde.org/applications"), now));
+    emit m_provider->entryAdded(historyEntry(QStringLiteral("http://kde.org/community"), now));
+    // an entry added again isn't duplicated
+    emit m_provider->entryAdded(historyEntry(QStringLiteral("http://kde.org/"), now));
+    emit m_provider->entryAdded(historyEntry(QStringLiteral("http://kernel.org/"), now));
+
+    QCOMPARE(model.rowCount(), 3);
+    const QModelIndex kde = model.index(0, 0);
+    QCOMPARE(kde.data().toString(), QStringLiteral("kde.org"));
+    QCOMPARE(model.rowCount(kde), 3);
+    checkRows(model);
+
+    emit m_provider->entryRemoved(historyEntry(QStringLiteral("http://kde.org/applications"), now));
+    QCOMPARE(model.rowCount(kde), 2);
+    QCOMPARE(model.index(1, 0, kde).data(KonqHistory::UrlRole).toUrl(), QUrl(QStringLiteral("http://kde.org/community")));
+    checkRows(model);
+
+    // removing the last entry of a group removes the group
+    emit m_provider->entryRemoved(historyEntry(QStringLiteral("http://qt.io/"), now));
+    QCOMPARE(model.rowCount(), 2);
+    QCOMPARE(model.index(1, 0).data().toString(), QStringLiteral("kernel.org"));
+    checkRows(model);
+
+    // unknown entries are ignored
+    emit m_provider->entryRemoved(historyEntry(QStringLiteral("http://kde.org/unknown"), now));
+    emit m_provider->entryRemoved(historyEntry(QStringLiteral("http://unknown.org/"), now));
+    QCOMPARE(model.rowCount(), 2);
+    QCOMPARE(model.rowCount(kde), 2);
+
+    model.clear();
+    QCOMPARE(model.rowCount(), 0);
+}
+
+void KonqHistoryModelTest::testLastVisited()
+{
+    KonqHistoryModel model;
+    const QDateTime now = QDateTime::currentDateTime();
+    emit m_provider->entryAdded(historyEntry(QStringLiteral("http://kde.org/a"), now.addDays(-3)));
+    emit m_provider->entryAdded(historyEntry(QStringLiteral("http://kde.org/b"), now.addDays(-1)));
+    emit m_provider->entryAdded(historyEntry(QStringLiteral("http://kde.org/c"), now.addDays(-2)));
+
+    const QModelIndex kde = model.index(0, 0);
+    QCOMPARE(kde.data(KonqHistory::LastVisitedRole).toDateTime(), now.addDays(-1));
+
+    emit m_provider->entryRemoved(historyEntry(QStringLiteral("http://kde.org/c"), now.addDays(-2)));
+    QCOMPARE(kde.data(KonqHistory::LastVisitedRole).toDateTime(), now.addDays(-1));
+    emit m_provider->entryRemoved(historyEntry(QStringLiteral("http://kde.org/b"), now.addDays(-1)));
+    QCOMPARE(kde.data(KonqHistory::LastVisitedRole).toDateTime(), now.addDays(-3));
+
+    model.clear();
+}
+
+void KonqHistoryModelTest::testFetchMore()
+{
+    KonqHistoryList entries;
+    for (int i = 0; i < 5000; ++i) {
+        entries.append(m_entries.at(i));
+    }
+
+    // the first batch is there right away, the others come from the event loop
+    KonqHistoryModel model(entries);
+    QVERIFY(model.canFetchMore(QModelIndex()));
+    QCOMPARE(model.rowCount(), 500);
+
+    // visiting or removing pages meanwhile doesn't load the other entries,
+    // and the pending entries of those pages are skipped
+    emit m_provider->entryAdded(entries.at(4500));
+    emit m_provider->entryRemoved(entries.at(4001));
+    QVERIFY(model.canFetchMore(QModelIndex()));
+
+    // the entries of a group are created when it's expanded
+    const QModelIndex site0 = model.index(0, 0);
+    QVERIFY(model.hasChildren(site0));
+    QCOMPARE(model.rowCount(site0), 0);
+    QVERIFY(model.canFetchMore(site0));
+    model.fetchMore(site0);
+    QVERIFY(!model.canFetchMore(site0));
+    // the four loaded entries, and the page visited above (entry 4500),
+    // which is already part of the group though it wasn't expanded
+    QCOMPARE(model.rowCount(site0), 5);
+
+    QTRY_VERIFY(!model.canFetchMore(QModelIndex()));
+    QCOMPARE(model.rowCount(), 500);
+    // expanded groups get the later entries right away
+    QCOMPARE(model.rowCount(site0), 10);
+    const QModelIndex site1 = model.index(1, 0);
+    model.fetchMore(site1);
+    QCOMPARE(model.rowCount(site1), 9);
+
+    // the date of a group counts its entries before they are created
+    const QModelIndex site2 = model.index(2, 0);
+    QDateTime lastVisited = entries.at(2).lastVisited;
+    for (int i = 502; i < entries.count(); i += 500) {
+        lastVisited = qMax(lastVisited, entries.at(i).lastVisited);
+    }
+    QCOMPARE(site2.data(KonqHistory::LastVisitedRole).toDateTime(), lastVisited);
+    QCOMPARE(model.rowCount(site2), 0);
+    model.fetchMore(site2);
+    QCOMPARE(model.rowCount(site2), 10);
+
+    // an entry added again isn't duplicated, if its group wasn't expanded
+    // either; the group still isn't
+    const QModelIndex site3 = model.index(3, 0);
+    emit m_provider->entryAdded(entries.at(3));
+    QCOMPARE(model.rowCount(site3), 0);
+    model.fetchMore(site3);
+    QCOMPARE(model.rowCount(site3), 10);
+    checkRows(model);
+
+    model.fetchAllEntries();
+    QCOMPARE(model.rowCount(model.index(499, 0)), 10);
+    checkRows(model);
+}
+
+void KonqHistoryModelTest::benchmarkLoad_data()
+{
+    QTest::addColumn<bool>("fetchAll");
+
+    QTest::newRow("first batch") << false;
+    QTest::newRow("all entries") << true;
+}
+
+// Creating the model as the history sidebar does when it's opened
+void KonqHistoryModelTest::benchmarkLoad()
+{
+    QFETCH(bool, fetchAll);
+
+    QBENCHMARK {
+        KonqHistoryModel model(m_entries);
+        if (fetchAll) {
+            model.fetchAllEntries();
+        }
+        QCOMPARE(model.rowCount(), 500);
+    }
+}
+
+// Sorting it by date, as the history sidebar does by default
+void KonqHistoryModelTest::benchmarkSort()
+{
+    KonqHistoryModel model(m_entries);
+    model.fetchAllEntries();
+
+    QSortFilterProxyModel proxy;
+    proxy.setSortRole(KonqHistory::LastVisitedRole);
+    proxy.setSourceModel(&model);
+
+    QBENCHMARK {
+        proxy.invalidate();
+        proxy.sort(0, Qt::DescendingOrder);
+        for (int group = 0; group < proxy.rowCount(); ++group) {
+            QVERIFY(proxy.rowCount(proxy.index(group, 0)) > 0);
+        }
+    }
+}
+
+QTEST_MAIN(KonqHistoryModelTest)
+
+#include "konqhistorymodeltest.moc"
@@ -820,6 +820,139 @@ void ViewMgrTest::testSaveProfile()
     QFile::remove(filePath);
 }
 
+void ViewMgrTest::testRestoreTabsOnDemand()
+{
+    MyKonqMainWindow mainWindow;
+    const QUrl url(QStringLiteral("data:text/html, <p>Hello World</p>"));
+    mainWindow.openUrl(0, url, QStringLiteral("text/html"));
+    KonqView *view2 = mainWindow.viewManager()->addTab(QStringLiteral("text/html"));
+    const QUrl url2(QStringLiteral("data:text/html, <p>view2</p>"));
+    view2->openUrl(url2, QStringLiteral("2"));
+
+    KConfig cfg(QString(), KConfig::SimpleConfig);
+    KConfigGroup windowGroup(&cfg, "Window0");
+    mainWindow.saveProperties(windowGroup);
+
+    KonqSettings::setRestoreTabsOnDemand(true);
+    QScopedPointer<KonqMainWindow> restoredWindow(KonqViewManager::openSavedWindow(windowGroup));
+    restoredWindow->show();
+    KonqFrameTabs *tabs = restoredWindow->viewManager()->tabContainer();
+    QCOMPARE(tabs->count(), 2);
+    KonqView *restoredView1 = tabs->tabAt(0)->activeChildView();
+    KonqView *restoredView2 = tabs->tabAt(1)->activeChildView();
+
+    // The current tab is loaded once shown, the other one only has its URL
+    QTRY_VERIFY(!restoredView1->isRestorePending());
+    QCOMPARE(restoredView1->url(), url);
+    QVERIFY(restoredView2->isRestorePending());
+    QCOMPARE(restoredView2->url(), url2);
+    QVERIFY(restoredView2->part()->inherits("KonqPlaceholderPart"));
+    QVERIFY(restoredView2->part()->url().isEmpty());
+
+    // Saving it again keeps the history of the tab which wasn't loaded
+    KConfig cfg2(QString(), KConfig::SimpleConfig);
+    KConfigGroup windowGroup2(&cfg2, "Window0");
+    restoredWindow->saveProperties(windowGroup2);
+    QCOMPARE(windowGroup2.readEntry("HistoryItemViewT1_0Url"), url2.url());
+
+    tabs->setCurrentIndex(1);
+    QTRY_VERIFY(!restoredView2->isRestorePending());
+    QVERIFY(!restoredView2->part()->inherits("KonqPlaceholderPart"));
+    QCOMPARE(restoredView2->part()->url(), url2);
+}
+
+void ViewMgrTest::testAutosaveFile()
+{
+    MyKonqMainWindow mainWindow;
+    const QUrl url(QStringLiteral("data:text/html, <p>Hello World</p>"));
+    mainWindow.openUrl(0, url, QStringLiteral("text/html"));
+    KonqViewManager *viewManager = mainWindow.viewManager();
+    KonqView *view2 = viewManager->addTab(QStringLiteral("text/html"));
+    const QUrl url2(QStringLiteral("data:text/html, <p>view2</p>"));
+    view2->openUrl(url2, QStringLiteral("2"));
+    QTRY_VERIFY(!mainWindow.currentView()->isLoading() && !view2->isLoading());
+
+    // The autosaved state has the same entries as saveProperties(), binary ones too
+    KConfig cfg(QString(), KConfig::SimpleConfig);
+    KConfigGroup windowGroup(&cfg, "Window0");
+    mainWindow.saveProperties(windowGroup);
+    const QString filePath = QDir::currentPath() + "/unittest_autosave";
+    QVERIFY(KonqSessionManager::writeAutosaveFile(filePath, QList<QByteArray>() << KonqSessionManager::saveWindowState(&mainWindow)));
+    KonqSessionManager::convertAutosaveFile(filePath);
+    {
+        KConfig converted(filePath, KConfig::SimpleConfig);
+        QCOMPARE(KConfigGroup(&converted, "General").readEntry("Number of Windows", 0), 1);
+        KConfigGroup convertedGroup(&converted, "Window0");
+        QCOMPARE(convertedGroup.keyList(), windowGroup.keyList());
+        foreach (const QString &key, windowGroup.keyList()) {
+            QCOMPARE(convertedGroup.readEntry(key, QByteArray()), windowGroup.readEntry(key, QByteArray()));
+        }
+
+        // ... and restores the window
+        QScopedPointer<KonqMainWindow> restoredWindow(KonqViewManager::openSavedWindow(convertedGroup));
+        KonqFrameTabs *tabs = restoredWindow->viewManager()->tabContainer();
+        QCOMPARE(tabs->count(), 2);
+        QCOMPARE(tabs->tabAt(0)->activeChildView()->url(), url);
+        QCOMPARE(tabs->tabAt(1)->activeChildView()->url(), url2);
+    }
+
+    // Converting it again, or a file which isn't an autosave file, does nothing
+    KonqSessionManager::convertAutosaveFile(filePath);
+    {
+        KConfig converted(filePath, KConfig::SimpleConfig);
+        QCOMPARE(KConfigGroup(&converted, "Window0").readEntry("HistoryItemViewT1_0Url"), url2.url());
+    }
+    QFile::remove(filePath);
+
+    // The views which changed, or moved to another tab, are saved again
+    const QUrl url3(QStringLiteral("data:text/html, <p>view3</p>"));
+    view2->openUrl(url3, QStringLiteral("3"));
+    QTRY_VERIFY(!view2->isLoading());
+    viewManager->tabContainer()->moveTabBackward(1);
+    QVERIFY(KonqSessionManager::writeAutosaveFile(filePath, QList<QByteArray>() << KonqSessionManager::saveWindowState(&mainWindow)));
+    KonqSessionManager::convertAutosaveFile(filePath);
+    {
+        KConfig converted(filePath, KConfig::SimpleConfig);
+        KConfigGroup convertedGroup(&converted, "Window0");
+        QCOMPARE(convertedGroup.readEntry("HistoryItemViewT0_1Url"), url3.url());
+        QCOMPARE(convertedGroup.readEntry("HistoryItemViewT1_0Url"), url.url());
+    }
+    QFile::remove(filePath);
+}
+
+void ViewMgrTest::testDiscardTabs()
+{
+    MyKonqMainWindow mainWindow;
+    mainWindow.show();
+    const QUrl url(QStringLiteral("data:text/html, <p>Hello World</p>"));
+    mainWindow.openUrl(0, url, QStringLiteral("text/html"));
+    KonqViewManager *viewManager = mainWindow.viewManager();
+    KonqView *view1 = mainWindow.currentView();
+    KonqView *view2 = viewManager->addTab(QStringLiteral("text/html"));
+    const QUrl url2(QStringLiteral("data:text/html, <p>view2</p>"));
+    view2->openUrl(url2, QStringLiteral("2"));
+    KonqView *view3 = viewManager->addTab(QStringLiteral("text/html"));
+    const QUrl url3(QStringLiteral("data:text/html, <p>view3</p>"));
+    view3->openUrl(url3, QStringLiteral("3"));
+    QTRY_VERIFY(!view2->isLoading() && !view3->isLoading());
+
+    KonqSettings::setMaxLoadedTabs(2);
+    KonqViewManager::discardTabsOverBudget();
+    KonqSettings::setMaxLoadedTabs(0);
+
+    // Only the least recently activated hidden view is discarded
+    QVERIFY(!view1->isRestorePending());
+    QVERIFY(view2->isRestorePending());
+    QVERIFY(!view3->isRestorePending());
+    QCOMPARE(view2->url(), url2);
+    QVERIFY(view2->part()->inherits("KonqPlaceholderPart"));
+
+    // and loaded again when shown
+    viewManager->showTab(view2);
+    QTRY_VERIFY(!view2->isRestorePending());
+    QCOMPARE(view2->part()->url(), url2);
+}
+
 void ViewMgrTest::testDuplicateWindow()
 {
     MyKonqMainWindow mainWindow;
@@ -48,6 +48,9 @@ private Q_SLOTS:
     void testDuplicateSplittedTab();
     void testDeletePartInTab();
     void testSaveProfile();
+    void testRestoreTabsOnDemand();
+    void testAutosaveFile();
+    void testDiscardTabs();
 
     void testDuplicateWindow();
 
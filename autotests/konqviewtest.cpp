@@ -19,6 +19,9 @@
 #include <QSignalSpy>
 #include <konqmainwindow.h>
 #include <konqview.h>
+#include <KConfig>
+#include <KConfigGroup>
+#include "../src/konqsettingsxt.h"
 
 class KonqViewTest : public QObject
 {
@@ -56,6 +59,59 @@ private Q_SLOTS:
         QVERIFY(view->service()->entryPath() != firstService);
     }
 
+    void historyEntryState()
+    {
+        const QByteArray buffer(1000, 'a');
+        HistoryEntry entry;
+        entry.setState(buffer, QByteArrayLiteral("post"));
+        HistoryEntry copy(entry);
+        QCOMPARE(copy.buffer(), buffer);
+
+        // Compressing doesn't change the state, of the copies either
+        entry.compressState();
+        QCOMPARE(entry.buffer(), buffer);
+        QCOMPARE(copy.buffer(), buffer);
+        QCOMPARE(copy.postData(), QByteArrayLiteral("post"));
+        QVERIFY(entry.canRestoreState());
+
+        // Over the limit, the least recently used states are dropped
+        const int maxSize = KonqSettings::maximumHistoryStateSize();
+        KonqSettings::setMaximumHistoryStateSize(1);
+        HistoryEntry entry2;
+        entry2.setState(QByteArray(2000, 'b'), QByteArray());
+        KonqSettings::setMaximumHistoryStateSize(maxSize);
+        QVERIFY(!entry.canRestoreState());
+        QVERIFY(!copy.canRestoreState());
+        QVERIFY(entry.buffer().isEmpty());
+        QCOMPARE(entry.postData(), QByteArrayLiteral("post")); // to post it again
+        QVERIFY(entry2.canRestoreState());
+        QCOMPARE(entry2.buffer(), QByteArray(2000, 'b'));
+    }
+
+    void historyEntryCompressedConfig()
+    {
+        // A compressed state is saved as it is, and uncompressed when used
+        const QByteArray buffer(1000, 'c');
+        HistoryEntry entry;
+        entry.url = QUrl(QStringLiteral("http://www.kde.org/"));
+        entry.setState(buffer, QByteArray());
+        entry.compressState();
+
+        KConfig config(QString(), KConfig::SimpleConfig);
+        KConfigGroup group(&config, "View");
+        entry.saveConfig(group, QString(), KonqFrameBase::saveHistoryItems);
+        QVERIFY(group.readEntry("Buffer", QByteArray()).isEmpty());
+        const QByteArray saved = group.readEntry("CompressedBuffer", QByteArray());
+        QVERIFY(!saved.isEmpty());
+        QVERIFY(saved.size() < buffer.size());
+
+        HistoryEntry loaded;
+        loaded.loadItem(group, QString(), KonqFrameBase::saveHistoryItems);
+        QVERIFY(loaded.canRestoreState());
+        QCOMPARE(loaded.buffer(), buffer);
+        QCOMPARE(loaded.url, entry.url);
+    }
+
 };
 
 QTEST_MAIN(KonqViewTest)
@@ -0,0 +1,183 @@
+/* This file is part of the KDE project
+    Copyright (c) 2016 The Konqueror developers
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Library General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Library General Public License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to
+    the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+    Boston, MA 02110-1301, USA.
+*/
+
+#include <QTest>
+#include <QStandardItemModel>
+
+#include <ksortfilterproxymodel.h>
+
+// The rows shown by proxy, as "parent/child" paths
+static QStringList shownRows(const QAbstractItemModel &proxy, const QModelIndex &parent = QModelIndex(),
+                             const QString &prefix = QString())
+{
+    QStringList rows;
+    for (int row = 0; row < proxy.rowCount(parent); ++row) {
+        const QModelIndex index = proxy.index(row, 0, parent);
+        const QString path = prefix + index.data().toString();
+        rows.append(path);
+        rows += shownRows(proxy, index, path + QLatin1Char('/'));
+    }
+    return rows;
+}
+
+class KSortFilterProxyModelTest : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void initTestCase();
+    void testCachedFilter_data();
+    void testCachedFilter();
+    void testSourceChanges();
+    void benchmarkTyping_data();
+    void benchmarkTyping();
+
+private:
+    QStandardItemModel m_history;
+};
+
+// Something shaped like the history: 500 sites of 40 pages each
+void KSortFilterProxyModelTest::initTestCase()
+{
+    for (int site = 0; site < 500; ++site) {
+        QStandardItem *group = new QStandardItem(QStringLiteral("site%1.org").arg(site));
+        for (int page = 0; page < 40; ++page) {
+            group->appendRow(new QStandardItem(QStringLiteral("Page %1 of site %2").arg(page).arg(site)));
+        }
+        m_history.appendRow(group);
+    }
+}
+
+void KSortFilterProxyModelTest::testCachedFilter_data()
+{
+    QTest::addColumn<bool>("showAllChildren");
+
+    QTest::newRow("matching rows") << false;
+    QTest::newRow("all children") << true;
+}
+
+// The cached filter shows the same rows as the plain one, while the filter
+// is extended, shortened and replaced
+void KSortFilterProxyModelTest::testCachedFilter()
+{
+    QFETCH(bool, showAllChildren);
+
+    QStandardItemModel model;
+    const char * const groups[] = { "kde.org", "kernel.org", "qt.io" };
+    const char * const pages[] = { "Home", "Download", "Kate", "Planet KDE", "Qt Creator" };
+    for (int i = 0; i < 3; ++i) {
+        QStandardItem *group = new QStandardItem(QString::fromLatin1(groups[i]));
+        for (int j = i; j < 5; ++j) {
+            group->appendRow(new QStandardItem(QString::fromLatin1(pages[j])));
+        }
+        model.appendRow(group);
+    }
+
+    KSortFilterProxyModel plain;
+    plain.setShowAllChildren(showAllChildren);
+    plain.setFilterCaseSensitivity(Qt::CaseInsensitive);
+    plain.setSourceModel(&model);
+    KSortFilterProxyModel cached;
+    cached.setShowAllChildren(showAllChildren);
+    cached.setFilterCaseSensitivity(Qt::CaseInsensitive);
+    cached.setCachesFilterResults(true);
+    cached.setSourceModel(&model);
+
+    const QStringList filters = QStringList() << QStringLiteral("k") << QStringLiteral("ke") << QStringLiteral("ker")
+                                              << QStringLiteral("ke") << QStringLiteral("k") << QStringLiteral("kd")
+                                              << QStringLiteral("KDE") << QStringLiteral("o") << QStringLiteral("or")
+                                              << QStringLiteral("q") << QString() << QStringLiteral("e");
+    foreach (const QString &filter, filters) {
+        plain.setFilterFixedString(filter);
+        cached.setFilterFixedString(filter);
+        QCOMPARE(shownRows(cached), shownRows(plain));
+    }
+
+    // a regular expression isn't refined
+    plain.setFilterRegExp(QStringLiteral("^K"));
+    cached.setFilterRegExp(QStringLiteral("^K"));
+    QCOMPARE(shownRows(cached), shownRows(plain));
+    plain.setFilterRegExp(QStringLiteral("^Ka"));
+    cached.setFilterRegExp(QStringLiteral("^Ka"));
+    QCOMPARE(shownRows(cached), shownRows(plain));
+}
+
+// Changes of the source model aren't hidden by the cached results
+void KSortFilterProxyModelTest::testSourceChanges()
+{
+    QStandardItemModel model;
+    QStandardItem *group = new QStandardItem(QStringLiteral("kde.org"));
+    group->appendRow(new QStandardItem(QStringLiteral("Home")));
+    model.appendRow(group);
+
+    KSortFilterProxyModel proxy;
+    proxy.setCachesFilterResults(true);
+    proxy.setDynamicSortFilter(true);
+    proxy.setSourceModel(&model);
+    proxy.setFilterFixedString(QStringLiteral("Kate"));
+    QCOMPARE(proxy.rowCount(), 0);
+
+    // QSortFilterProxyModel doesn't filter the parents of changed rows again
+    group->appendRow(new QStandardItem(QStringLiteral("Kate")));
+    proxy.invalidate();
+    QCOMPARE(shownRows(proxy), QStringList() << QStringLiteral("kde.org") << QStringLiteral("kde.org/Kate"));
+
+    group->child(0)->setText(QStringLiteral("Kate editor"));
+    proxy.invalidate();
+    QCOMPARE(shownRows(proxy), QStringList() << QStringLiteral("kde.org") << QStringLiteral("kde.org/Kate editor")
+             << QStringLiteral("kde.org/Kate"));
+
+    group->removeRow(1);
+    group->child(0)->setText(QStringLiteral("Home"));
+    proxy.invalidate();
+    QCOMPARE(proxy.rowCount(), 0);
+}
+
+void KSortFilterProxyModelTest::benchmarkTyping_data()
+{
+    QTest::addColumn<bool>("cached");
+
+    QTest::newRow("plain") << false;
+    QTest::newRow("cached") << true;
+}
+
+// Searching the history, one keystroke after the other
+void KSortFilterProxyModelTest::benchmarkTyping()
+{
+    QFETCH(bool, cached);
+
+    const QString text = QStringLiteral("page 12 of site 42");
+    QBENCHMARK {
+        KSortFilterProxyModel proxy;
+        proxy.setFilterCaseSensitivity(Qt::CaseInsensitive);
+        proxy.setCachesFilterResults(cached);
+        proxy.setSourceModel(&m_history);
+        for (int length = 1; length <= text.length(); ++length) {
+            proxy.setFilterFixedString(text.left(length));
+            for (int row = 0; row < proxy.rowCount(); ++row) {
+                proxy.rowCount(proxy.index(row, 0));
+            }
+        }
+        QCOMPARE(proxy.rowCount(), 11);
+    }
+}
+
+QTEST_MAIN(KSortFilterProxyModelTest)
+
+#include "ksortfilterproxymodeltest.moc"
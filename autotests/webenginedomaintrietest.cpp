@@ -0,0 +1,161 @@
+/* This file is part of the KDE project
+    Copyright (c) 2016 The Konqueror developers
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Library General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Library General Public License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to
+    the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+    Boston, MA 02110-1301, USA.
+*/
+
+#include <QTest>
+
+#include <settings/webengine_domaintrie.h>
+
+using namespace KDEPrivate;
+
+static int trieLookup(const DomainTrie<int> &trie, const QString &hostname)
+{
+    const int *value = trie.lookup(hostname);
+    return value ? *value : -1;
+}
+
+class WebEngineDomainTrieTest : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void initTestCase();
+    void testLookup_data();
+    void testLookup();
+    void testInsert();
+    void testManyDomains();
+    void benchmarkLookup();
+
+private:
+    DomainTrie<int> m_trie;
+    QStringList m_hosts;
+    // the value each host in m_hosts finds
+    QList<int> m_values;
+};
+
+// Something resembling the per-domain policies of a managed setup: a few
+// thousand sites and the intranet, with and without their subdomains.
+void WebEngineDomainTrieTest::initTestCase()
+{
+    static const char * const tlds[] = { "com", "org", "net", "de", "co.uk", "fr", "example", "corp.example" };
+    static const char * const names[] = { "news", "mail", "shop", "bank", "video", "social", "wiki", "search" };
+    static const int tldCount = sizeof(tlds) / sizeof(*tlds);
+    static const int nameCount = sizeof(names) / sizeof(*names);
+
+    const int corpValue = 3000;
+    for (int i = 0; i < 3000; ++i) {
+        const QString tld = QString::fromLatin1(tlds[(i / nameCount) % tldCount]);
+        const QString domain = QString::fromLatin1(names[i % nameCount]) + QString::number(i)
+                               + QLatin1Char('.') + tld;
+        // every third site without its subdomains, the others only with them
+        const bool exact = (i % 3 == 0);
+        m_trie.insert(exact ? domain : QLatin1Char('.') + domain, i);
+        const int fallback = (tld == QLatin1String("corp.example")) ? corpValue : -1;
+
+        m_hosts.append(domain);
+        m_values.append(exact ? i : fallback);
+        m_hosts.append(QStringLiteral("www.") + domain);
+        m_values.append(exact ? fallback : i);
+        m_hosts.append(QStringLiteral("static.cdn.") + domain);
+        m_values.append(exact ? fallback : i);
+
+        const QString unknownTld = QString::fromLatin1(tlds[i % tldCount]);
+        m_hosts.append(QStringLiteral("www.unknown") + QString::number(i) + QLatin1Char('.') + unknownTld);
+        m_values.append((unknownTld == QLatin1String("corp.example")) ? corpValue : -1);
+    }
+    m_trie.insert(QStringLiteral(".corp.example"), corpValue);
+}
+
+void WebEngineDomainTrieTest::testLookup_data()
+{
+    QTest::addColumn<QStringList>("domains");
+    QTest::addColumn<QString>("host");
+    QTest::addColumn<int>("value");
+
+    const QStringList domains = QStringList() << QStringLiteral("kde.org") << QStringLiteral(".kde.org")
+                                              << QStringLiteral(".org") << QStringLiteral("www.kde.org")
+                                              << QStringLiteral("localhost");
+
+    QTest::newRow("exact") << domains << "kde.org" << 0;
+    QTest::newRow("exact before domain") << domains << "www.kde.org" << 3;
+    QTest::newRow("subdomain") << domains << "api.kde.org" << 1;
+    QTest::newRow("deep subdomain") << domains << "a.b.api.kde.org" << 1;
+    QTest::newRow("closest domain") << domains << "qt.org" << 2;
+    QTest::newRow("not a subdomain of itself") << QStringList(QStringLiteral(".kde.org")) << "kde.org" << -1;
+    QTest::newRow("label boundary") << domains << "notkde.com" << -1;
+    QTest::newRow("suffix isn't a label") << QStringList(QStringLiteral(".kde.org")) << "www.akde.org" << -1;
+    QTest::newRow("no dot") << domains << "localhost" << 4;
+    QTest::newRow("exact only") << domains << "www.localhost" << -1;
+    QTest::newRow("trailing dot") << QStringList(QStringLiteral(".kde.org")) << "www.kde.org." << -1;
+    QTest::newRow("empty label") << QStringList(QStringLiteral(".org")) << "www..org" << 0;
+}
+
+void WebEngineDomainTrieTest::testLookup()
+{
+    QFETCH(QStringList, domains);
+    QFETCH(QString, host);
+    QFETCH(int, value);
+
+    DomainTrie<int> trie;
+    for (int i = 0; i < domains.size(); ++i) {
+        trie.insert(domains.at(i), i);
+    }
+
+    QCOMPARE(trieLookup(trie, host), value);
+}
+
+void WebEngineDomainTrieTest::testInsert()
+{
+    DomainTrie<int> trie;
+    QVERIFY(trie.isEmpty());
+    QCOMPARE(trie.insert(QStringLiteral(".kde.org"), 1), 1);
+    // an existing value is kept
+    QCOMPARE(trie.insert(QStringLiteral(".kde.org"), 2), 1);
+    trie[QStringLiteral("kde.org")] = 3;
+    trie.insert(QStringLiteral("org"), 4) = 5;
+    QCOMPARE(trie.size(), 3);
+    QCOMPARE(trieLookup(trie, QStringLiteral("kde.org")), 3);
+    QCOMPARE(trieLookup(trie, QStringLiteral("www.kde.org")), 1);
+    QCOMPARE(trieLookup(trie, QStringLiteral("org")), 5);
+
+    trie.clear();
+    QVERIFY(trie.isEmpty());
+    QCOMPARE(trieLookup(trie, QStringLiteral("kde.org")), -1);
+}
+
+void WebEngineDomainTrieTest::testManyDomains()
+{
+    for (int i = 0; i < m_hosts.size(); ++i)
+        QCOMPARE(trieLookup(m_trie, m_hosts.at(i)), m_values.at(i));
+}
+
+void WebEngineDomainTrieTest::benchmarkLookup()
+{
+    int found = 0;
+    QBENCHMARK {
+        foreach (const QString &host, m_hosts) {
+            if (trieLookup(m_trie, host) != -1)
+                ++found;
+        }
+    }
+    QVERIFY(found > 0);
+}
+
+QTEST_GUILESS_MAIN(WebEngineDomainTrieTest)
+
+#include "webenginedomaintrietest.moc"
@@ -0,0 +1,594 @@
+/* This file is part of the KDE project
+    Copyright (c) 2016 The Konqueror developers
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Library General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Library General Public License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to
+    the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+    Boston, MA 02110-1301, USA.
+*/
+
+#include <QTest>
+#include <QFile>
+#include <QTextStream>
+#include <QTemporaryDir>
+#include <QThread>
+
+#include <settings/webengine_filter.h>
+
+#include "webenginelegacyfilter.h"
+
+using namespace KDEPrivate;
+
+class WebEngineFilterTest : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void initTestCase();
+    void testMatch_data();
+    void testMatch();
+    void testOptions_data();
+    void testOptions();
+    void testElementHiding();
+    void testMatchedBy();
+    void testManyFilters_data();
+    void testManyFilters();
+    void testConcurrentMatch();
+    void testLoadFilterList();
+    void testCacheInvalidation();
+    void benchmarkMatch_data();
+    void benchmarkMatch();
+    void benchmarkLoadFilterList_data();
+    void benchmarkLoadFilterList();
+
+private:
+    QStringList m_filters;
+    QStringList m_urls;
+    QTemporaryDir m_dir;
+};
+
+static void writeFilterList(const QString &fileName, const QStringList &filters)
+{
+    QFile file(fileName);
+    QVERIFY(file.open(QIODevice::WriteOnly | QIODevice::Truncate));
+    QTextStream stream(&file);
+    stream.setCodec("UTF-8");
+    foreach (const QString &filter, filters)
+        stream << filter << '\n';
+}
+
+// Set KONQ_ADBLOCK_LIST to the path of a real list (e.g. EasyList) to
+// benchmark with it instead of the generated one.
+static QStringList loadFilterList()
+{
+    QStringList filters;
+    const QString path = QString::fromLocal8Bit(qgetenv("KONQ_ADBLOCK_LIST"));
+    if (!path.isEmpty()) {
+        QFile file(path);
+        if (file.open(QIODevice::ReadOnly)) {
+            QTextStream stream(&file);
+            while (!stream.atEnd()) {
+                const QString line = stream.readLine().trimmed();
+                if (!line.isEmpty())
+                    filters.append(line);
+            }
+            return filters;
+        }
+        qWarning() << "Could not open" << path << ", using a generated list";
+    }
+
+    // Something resembling the shape of EasyList: mostly paths and host
+    // names, some wildcards, a few regexps, comments and options.
+    static const char * const words[] = {
+        "ad", "ads", "banner", "track", "pixel", "popup", "sponsor", "click",
+        "promo", "stats", "beacon", "affiliate", "counter", "widget", "leader"
+    };
+    const int wordCount = sizeof(words) / sizeof(*words);
+    for (int i = 0; i < 20000; ++i) {
+        const QString a = QLatin1String(words[i % wordCount]);
+        const QString b = QLatin1String(words[(i / wordCount) % wordCount]);
+        const QString n = QString::number(i);
+        switch (i % 10) {
+        case 0:
+            filters.append(QStringLiteral("||") + a + n + QStringLiteral(".example.com^"));
+            break;
+        case 1:
+            filters.append(QLatin1Char('/') + a + QLatin1Char('-') + b + QLatin1Char('/') + n);
+            break;
+        case 2:
+            filters.append(QLatin1Char('/') + a + n + QLatin1Char('*') + b + QLatin1Char('.'));
+            break;
+        case 3:
+            filters.append(QLatin1Char('-') + a + QLatin1Char('_') + b + n + QLatin1Char('.'));
+            break;
+        case 4:
+            filters.append(QStringLiteral("&") + a + QLatin1Char('=') + n);
+            break;
+        case 5:
+            filters.append(QStringLiteral("##.") + a + QLatin1Char('-') + n);
+            break;
+        case 6:
+            filters.append(QLatin1Char('.') + a + n + QStringLiteral("$third-party"));
+            break;
+        case 7:
+            filters.append(QStringLiteral("@@||cdn") + n + QStringLiteral(".") + a + QStringLiteral(".net^"));
+            break;
+        case 8:
+            filters.append(QLatin1Char('_') + b + n + QLatin1Char('*') + a + QLatin1Char('*') + QStringLiteral(".gif"));
+            break;
+        case 9:
+            if (i % 1000 == 9)
+                filters.append(QStringLiteral("/\\/") + a + QStringLiteral("[0-9]+x[0-9]+") + n + QStringLiteral("\\//"));
+            else
+                filters.append(QStringLiteral("?") + a + QLatin1Char('_') + n + QLatin1Char('='));
+            break;
+        }
+    }
+    filters.append(QStringLiteral("/ads-banner/"));
+    filters.append(QStringLiteral("/pixel?*=1"));
+    return filters;
+}
+
+static QStringList generateUrls()
+{
+    QStringList urls;
+    for (int i = 0; i < 2000; ++i) {
+        const QString n = QString::number(i * 7);
+        switch (i % 5) {
+        case 0:
+            urls.append(QStringLiteral("https://www.kde.org/announcements/announce-") + n + QStringLiteral(".php"));
+            break;
+        case 1:
+            urls.append(QStringLiteral("https://static.example.com/assets/js/app.") + n + QStringLiteral(".min.js?v=3"));
+            break;
+        case 2:
+            urls.append(QStringLiteral("http://news.example.org/2016/10/") + n + QStringLiteral("/article-title-with-words.html"));
+            break;
+        case 3:
+            urls.append(QStringLiteral("https://cdn.example.net/img/ads-banner/") + n + QStringLiteral("/ad") + n + QStringLiteral("x.gif"));
+            break;
+        case 4:
+            urls.append(QStringLiteral("http://track") + n + QStringLiteral(".example.com/pixel?click_") + n + QStringLiteral("=1"));
+            break;
+        }
+    }
+    return urls;
+}
+
+void WebEngineFilterTest::initTestCase()
+{
+    QVERIFY(m_dir.isValid());
+    m_filters = loadFilterList();
+    m_urls = generateUrls();
+}
+
+void WebEngineFilterTest::testMatch_data()
+{
+    QTest::addColumn<QString>("filter");
+    QTest::addColumn<QString>("url");
+    QTest::addColumn<bool>("matched");
+
+    QTest::newRow("plain") << "/banner/" << "http://a.com/banner/x.png" << true;
+    QTest::newRow("plain, no match") << "/banner/" << "http://a.com/banners/x.png" << false;
+    QTest::newRow("short") << "ad" << "http://a.com/load.js" << true;
+    QTest::newRow("case insensitive") << "Banner" << "http://a.com/banner.png" << true;
+    QTest::newRow("exception prefix") << "@@/adserver/" << "http://a.com/adserver/1" << true;
+    QTest::newRow("wildcard") << "/ads/*.gif" << "http://a.com/ads/foo/bar.gif" << true;
+    QTest::newRow("wildcard, wrong order") << "/ads/*.gif" << "http://a.com/x.gif/ads/" << false;
+    QTest::newRow("wildcard, overlapping") << "abab*abab" << "http://a.com/ababab" << false;
+    QTest::newRow("wildcard, repeated segment") << "ad*ad" << "http://a.com/ad-x-ad" << true;
+    QTest::newRow("wildcard, adjacent") << "foo*bar" << "http://a.com/foobar" << true;
+    QTest::newRow("wildcards at the ends") << "**tracker**" << "http://tracker.com/" << true;
+    QTest::newRow("only wildcards") << "***" << "http://a.com/" << true;
+    QTest::newRow("question mark is literal") << "a?b" << "http://a.com/axb" << false;
+    QTest::newRow("question mark, literal match") << "/x?ad=" << "http://a.com/x?ad=1" << true;
+    QTest::newRow("bracket is literal") << "[x]*y" << "http://a.com/[x]/y" << true;
+    QTest::newRow("regexp") << "/ad[0-9]+x/" << "http://a.com/ad300x250" << true;
+    QTest::newRow("regexp, no match") << "/ad[0-9]+x/" << "http://a.com/adx" << false;
+    QTest::newRow("comment") << "!/banner/" << "http://a.com/banner/" << false;
+    QTest::newRow("options, unknown type") << "/banner/$image" << "http://a.com/banner/" << true;
+    QTest::newRow("unsupported option") << "/banner/$popup" << "http://a.com/banner/" << false;
+    QTest::newRow("dollar in pattern") << "/x$y/z" << "http://a.com/x$y/z" << true;
+    QTest::newRow("element hiding") << "a.com##.ad" << "http://a.com/##.ad" << false;
+    QTest::newRow("header") << "[Adblock Plus 2.0]" << "http://a.com/[adblock plus 2.0]" << false;
+    QTest::newRow("ampersand") << "&ad_type=" << "http://a.com/?x=1&ad_type=2" << true;
+    QTest::newRow("host anchor") << "||ads.com^" << "http://img.ads.com/x.png" << true;
+    QTest::newRow("host anchor, whole host") << "||ads.com^" << "https://ads.com" << true;
+    QTest::newRow("host anchor, other host") << "||ads.com^" << "http://bads.com/x.png" << false;
+    QTest::newRow("host anchor, longer host") << "||ads.com^" << "http://ads.com.evil.org/" << false;
+    QTest::newRow("host anchor, in path") << "||ads.com^" << "http://a.com/ads.com/" << false;
+    QTest::newRow("host anchor, host prefix") << "||adserver" << "http://adserver1.com/" << true;
+    QTest::newRow("host anchor, path") << "||a.com/ads/" << "http://www.a.com/ads/1.png" << true;
+    QTest::newRow("start anchor") << "|http://ads." << "http://ads.a.com/" << true;
+    QTest::newRow("start anchor, not at start") << "|http://ads." << "http://a.com/?r=http://ads.b.com" << false;
+    QTest::newRow("end anchor") << ".swf|" << "http://a.com/movie.swf" << true;
+    QTest::newRow("end anchor, not at end") << ".swf|" << "http://a.com/movie.swf?x=1" << false;
+    QTest::newRow("separator") << "/ad^" << "http://a.com/ad?x=1" << true;
+    QTest::newRow("separator at the end") << "/ad^" << "http://a.com/ad" << true;
+    QTest::newRow("separator, no match") << "/ad^" << "http://a.com/ads" << false;
+    QTest::newRow("separator, no match in dots") << "/ad^" << "http://a.com/ad.png" << false;
+    QTest::newRow("non latin") << "\xd1\x80\xd0\xb5\xd0\xba*\xd0\xbb\xd0\xb0\xd0\xbc\xd0\xb0" << "http://a.com/\xd1\x80\xd0\xb5\xd0\xba\xd0\xbb\xd0\xb0\xd0\xbc\xd0\xb0" << true;
+}
+
+void WebEngineFilterTest::testMatch()
+{
+    QFETCH(QString, filter);
+    QFETCH(QString, url);
+    QFETCH(bool, matched);
+
+    FilterSet set;
+    set.addFilter(QStringLiteral("/unrelated/"));
+    set.addFilter(filter);
+    QCOMPARE(set.isUrlMatched(url), matched);
+    QCOMPARE(!set.urlMatchedBy(url).isEmpty(), matched);
+}
+
+void WebEngineFilterTest::testOptions_data()
+{
+    QTest::addColumn<QString>("filter");
+    QTest::addColumn<QString>("url");
+    QTest::addColumn<QString>("page");
+    QTest::addColumn<int>("type");
+    QTest::addColumn<bool>("matched");
+
+    const int script = FilterRequest::Script;
+    const int image = FilterRequest::Image;
+
+    QTest::newRow("third-party") << "||ads.net^$third-party" << "http://ads.net/x.js" << "http://news.com/" << script << true;
+    QTest::newRow("third-party, same site") << "||ads.net^$third-party" << "http://ads.net/x.js" << "http://www.ads.net/" << script << false;
+    QTest::newRow("third-party, same registrable domain") << "||img.news.co.uk^$third-party" << "http://img.news.co.uk/1.png" << "http://www.news.co.uk/" << image << false;
+    QTest::newRow("third-party, other registrable domain") << "||img.news.co.uk^$third-party" << "http://img.news.co.uk/1.png" << "http://other.co.uk/" << image << true;
+    QTest::newRow("~third-party") << "/track.js$~third-party" << "http://a.com/track.js" << "http://a.com/" << script << true;
+    QTest::newRow("~third-party, third party") << "/track.js$~third-party" << "http://b.com/track.js" << "http://a.com/" << script << false;
+    QTest::newRow("type") << "/ad.js$script" << "http://a.com/ad.js" << "http://a.com/" << script << true;
+    QTest::newRow("type, other type") << "/ad.js$script" << "http://a.com/ad.js" << "http://a.com/" << image << false;
+    QTest::newRow("several types") << "/ad.$script,image" << "http://a.com/ad.png" << "http://a.com/" << image << true;
+    QTest::newRow("inverse type") << "/banner$~image" << "http://a.com/banner" << "http://a.com/" << image << false;
+    QTest::newRow("inverse type, other type") << "/banner$~image" << "http://a.com/banner" << "http://a.com/" << script << true;
+    QTest::newRow("domain") << "/ad.gif$domain=a.com|~b.a.com" << "http://cdn.net/ad.gif" << "http://www.a.com/" << image << true;
+    QTest::newRow("domain, excluded") << "/ad.gif$domain=a.com|~b.a.com" << "http://cdn.net/ad.gif" << "http://b.a.com/" << image << false;
+    QTest::newRow("domain, other") << "/ad.gif$domain=a.com|~b.a.com" << "http://cdn.net/ad.gif" << "http://c.com/" << image << false;
+    QTest::newRow("excluded domain only") << "/ad.gif$domain=~a.com" << "http://cdn.net/ad.gif" << "http://c.com/" << image << true;
+    QTest::newRow("match-case") << "/Ad.gif$match-case" << "http://a.com/Ad.gif" << "http://a.com/" << image << true;
+    QTest::newRow("match-case, other case") << "/Ad.gif$match-case" << "http://a.com/ad.gif" << "http://a.com/" << image << false;
+    QTest::newRow("regexp with options") << "/\\/ad[0-9]\\.js/$script" << "http://a.com/ad3.js" << "http://a.com/" << script << true;
+    QTest::newRow("regexp with options, other type") << "/\\/ad[0-9]\\.js/$script" << "http://a.com/ad3.js" << "http://a.com/" << image << false;
+    QTest::newRow("collapse is ignored") << "/ad.png$image,collapse" << "http://a.com/ad.png" << "http://a.com/" << image << true;
+    QTest::newRow("document is unsupported") << "||a.com^$document" << "http://a.com/" << "http://a.com/" << script << false;
+
+    // Lines from EasyList
+    QTest::newRow("easylist, host") << "||doubleclick.net^$third-party" << "https://ad.doubleclick.net/ddm/ad.js" << "http://news.com/" << script << true;
+    QTest::newRow("easylist, host path") << "||google-analytics.com/analytics.js" << "https://www.google-analytics.com/analytics.js" << "http://news.com/" << script << true;
+    QTest::newRow("easylist, dash") << "-ad-banner." << "http://a.com/img/top-ad-banner.png" << "http://a.com/" << image << true;
+    QTest::newRow("easylist, query") << "&adurl=" << "http://a.com/click?x=1&adurl=http" << "http://a.com/" << script << true;
+    QTest::newRow("easylist, wildcard") << "/adserver/*$script" << "http://a.com/adserver/v1/get.js" << "http://a.com/" << script << true;
+    QTest::newRow("easylist, separators") << "^adsid=" << "http://a.com/x?adsid=3" << "http://a.com/" << script << true;
+    QTest::newRow("easylist, subdocument") << "||ad.example^$subdocument,domain=~example.org" << "http://ad.example/f.html" << "http://news.com/" << int(FilterRequest::SubDocument) << true;
+}
+
+void WebEngineFilterTest::testOptions()
+{
+    QFETCH(QString, filter);
+    QFETCH(QString, url);
+    QFETCH(QString, page);
+    QFETCH(int, type);
+    QFETCH(bool, matched);
+
+    FilterSet set;
+    set.addFilter(QStringLiteral("/unrelated/$script"));
+    set.addFilter(filter);
+    const FilterRequest request(QUrl(url), QUrl(page), FilterRequest::ResourceType(type));
+    QCOMPARE(set.isMatched(request), matched);
+    QCOMPARE(set.matchedBy(request), matched ? filter : QString());
+}
+
+void WebEngineFilterTest::testElementHiding()
+{
+    FilterSet set;
+    set.addFilter(QStringLiteral("##.ad-banner"));
+    set.addFilter(QStringLiteral("example.com,~shop.example.com###top-ad"));
+    set.addFilter(QStringLiteral("news.example.com#@#.ad-banner"));
+    set.addFilter(QStringLiteral("example.com##.sponsor"));
+    set.addFilter(QStringLiteral("example.com#?#.ad:-abp-has(.x)"));
+
+    QStringList selectors = set.elementHidingSelectors(QStringLiteral("www.example.com"));
+    selectors.sort();
+    QCOMPARE(selectors, QStringList() << QStringLiteral("#top-ad") << QStringLiteral(".ad-banner") << QStringLiteral(".sponsor"));
+
+    selectors = set.elementHidingSelectors(QStringLiteral("shop.example.com"));
+    selectors.sort();
+    QCOMPARE(selectors, QStringList() << QStringLiteral(".ad-banner") << QStringLiteral(".sponsor"));
+
+    selectors = set.elementHidingSelectors(QStringLiteral("news.example.com"));
+    selectors.sort();
+    QCOMPARE(selectors, QStringList() << QStringLiteral("#top-ad") << QStringLiteral(".sponsor"));
+
+    QCOMPARE(set.elementHidingSelectors(QStringLiteral("kde.org")), QStringList() << QStringLiteral(".ad-banner"));
+
+    // they don't block anything
+    QVERIFY(!set.isUrlMatched(QStringLiteral("http://example.com/##.sponsor")));
+}
+
+void WebEngineFilterTest::testMatchedBy()
+{
+    FilterSet set;
+    set.addFilter(QStringLiteral("||tracker.com^"));
+    set.addFilter(QStringLiteral("*/ads/*.gif*"));
+    set.addFilter(QStringLiteral("/pop[0-9]/"));
+
+    QCOMPARE(set.urlMatchedBy(QStringLiteral("http://a.com/ads/b.gif")), QStringLiteral("*/ads/*.gif*"));
+    QCOMPARE(set.urlMatchedBy(QStringLiteral("http://a.com/pop3")), QStringLiteral("/pop[0-9]/"));
+    QCOMPARE(set.urlMatchedBy(QStringLiteral("http://www.tracker.com/")), QStringLiteral("||tracker.com^"));
+    QCOMPARE(set.urlMatchedBy(QStringLiteral("http://a.com/")), QString());
+
+    // Filters added after matching are taken into account
+    set.addFilter(QStringLiteral("a.com"));
+    QCOMPARE(set.urlMatchedBy(QStringLiteral("http://a.com/")), QStringLiteral("a.com"));
+    QVERIFY(set.isUrlMatched(QStringLiteral("http://a.com/ads/b.gif")));
+
+    set.clear();
+    QVERIFY(!set.isUrlMatched(QStringLiteral("http://a.com/ads/b.gif")));
+}
+
+// Patterns which overlap, or are inside one another, in one set
+void WebEngineFilterTest::testManyFilters_data()
+{
+    QTest::addColumn<QString>("url");
+    QTest::addColumn<QString>("filter");
+
+    QTest::newRow("prefix of another") << "http://a.com/ads/1" << "/ads/1";
+    QTest::newRow("longer one") << "http://a.com/xads/banner" << "ads/banner";
+    QTest::newRow("none, partial") << "http://a.com/banner" << "";
+    QTest::newRow("across a separator") << "http://a.com/user/adx" << "er/ad";
+    QTest::newRow("after a partial match") << "http://a.com/xheadex/rad" << "rad";
+    QTest::newRow("short") << "http://a.com/radio" << "rad";
+    QTest::newRow("wildcard") << "http://a.com/pixel?x=1" << "/pixel?*=1";
+    QTest::newRow("wildcard, none") << "http://a.com/pixel?x=2" << "";
+    QTest::newRow("dash and underscore") << "http://a.com/top-ad_leader.png" << "-ad_leader";
+    QTest::newRow("two wildcards") << "http://a.com/x_leader-ad.gif" << "_leader*ad*.gif";
+    QTest::newRow("two wildcards, none") << "http://a.com/x_leader/1.gif" << "";
+    QTest::newRow("question mark") << "http://a.com/?promo_1" << "?promo_";
+    QTest::newRow("question mark, none") << "http://a.com/promo_1" << "";
+    QTest::newRow("regexp") << "http://a.com/ad300x/" << "/ad[0-9]+x/";
+    QTest::newRow("regexp, none") << "http://a.com/adx/" << "";
+    QTest::newRow("none") << "http://kde.org/" << "";
+}
+
+void WebEngineFilterTest::testManyFilters()
+{
+    QFETCH(QString, url);
+    QFETCH(QString, filter);
+
+    FilterSet set;
+    set.addFilter(QStringLiteral("/ads/1"));
+    set.addFilter(QStringLiteral("ads/banner"));
+    set.addFilter(QStringLiteral("/banner/x"));
+    set.addFilter(QStringLiteral("er/ad"));
+    set.addFilter(QStringLiteral("header"));
+    set.addFilter(QStringLiteral("rad"));
+    set.addFilter(QStringLiteral("/pixel?*=1"));
+    set.addFilter(QStringLiteral("-ad_leader"));
+    set.addFilter(QStringLiteral("_leader*ad*.gif"));
+    set.addFilter(QStringLiteral("?promo_"));
+    set.addFilter(QStringLiteral("/ad[0-9]+x/"));
+    QCOMPARE(set.urlMatchedBy(url), filter);
+    QCOMPARE(set.isUrlMatched(url), !filter.isEmpty());
+}
+
+class MatchThread : public QThread
+{
+public:
+    MatchThread(FilterSet *set, const QStringList &urls)
+        : m_set(set), m_urls(urls), m_matched(0)
+    {
+    }
+
+    int matched() const { return m_matched; }
+
+protected:
+    void run() Q_DECL_OVERRIDE
+    {
+        for (int i = 0; i < 20; ++i) {
+            foreach (const QString &url, m_urls) {
+                if (m_set->isUrlMatched(url))
+                    ++m_matched;
+            }
+        }
+    }
+
+private:
+    FilterSet *m_set;
+    QStringList m_urls;
+    int m_matched;
+};
+
+// Request interceptors match from the IO thread while the settings are loaded
+void WebEngineFilterTest::testConcurrentMatch()
+{
+    FilterSet set;
+    set.addFilter(QStringLiteral("/ads-banner/"));
+
+    QList<MatchThread *> threads;
+    for (int i = 0; i < 4; ++i) {
+        threads.append(new MatchThread(&set, m_urls));
+        threads.last()->start();
+    }
+    foreach (const QString &filter, m_filters)
+        set.addFilter(filter);
+
+    foreach (MatchThread *thread, threads) {
+        QVERIFY(thread->wait());
+        QVERIFY(thread->matched() > 0);
+    }
+    qDeleteAll(threads);
+}
+
+// A list loaded from its cache matches as when it is parsed
+void WebEngineFilterTest::testLoadFilterList()
+{
+    const QString listFile = m_dir.path() + QStringLiteral("/list.txt");
+    const QString cacheFile = m_dir.path() + QStringLiteral("/cache/list.txt.cache");
+    QStringList filters = m_filters;
+    filters << QStringLiteral("@@||example.com/ads/allowed^")
+            << QStringLiteral("example.com##.ad-banner")
+            << QStringLiteral("||tracker.com^$third-party");
+    writeFilterList(listFile, filters);
+    QFile::remove(cacheFile);
+
+    FilterSet parsedBlack, parsedWhite;
+    bool fromCache = true;
+    QVERIFY(FilterSet::loadFilterList(listFile, cacheFile, parsedBlack, parsedWhite, &fromCache));
+    QVERIFY(!fromCache);
+    QVERIFY(QFile::exists(cacheFile));
+
+    FilterSet cachedBlack, cachedWhite;
+    QVERIFY(FilterSet::loadFilterList(listFile, cacheFile, cachedBlack, cachedWhite, &fromCache));
+    QVERIFY(fromCache);
+
+    FilterSet reference, referenceWhite;
+    foreach (const QString &filter, filters) {
+        if (filter.startsWith(QLatin1String("@@")))
+            referenceWhite.addFilter(filter);
+        else
+            reference.addFilter(filter);
+    }
+
+    QStringList urls = m_urls;
+    urls << QStringLiteral("http://example.com/ads/allowed/1.png");
+    foreach (const QString &url, urls) {
+        QCOMPARE(cachedBlack.urlMatchedBy(url), reference.urlMatchedBy(url));
+        QCOMPARE(parsedBlack.urlMatchedBy(url), reference.urlMatchedBy(url));
+        QCOMPARE(cachedWhite.urlMatchedBy(url), referenceWhite.urlMatchedBy(url));
+    }
+    const FilterRequest request(QUrl(QStringLiteral("http://tracker.com/t.js")), QUrl(QStringLiteral("http://kde.org/")),
+                                FilterRequest::Script);
+    QCOMPARE(cachedBlack.matchedBy(request), QStringLiteral("||tracker.com^$third-party"));
+    QCOMPARE(cachedBlack.elementHidingSelectors(QStringLiteral("www.example.com")),
+             reference.elementHidingSelectors(QStringLiteral("www.example.com")));
+    QVERIFY(cachedBlack.elementHidingSelectors(QStringLiteral("www.example.com")).contains(QStringLiteral(".ad-banner")));
+
+    // Reloading a list replaces what was loaded from it
+    writeFilterList(listFile, QStringList() << QStringLiteral("/only-this/"));
+    QVERIFY(FilterSet::loadFilterList(listFile, cacheFile, cachedBlack, cachedWhite, &fromCache));
+    QVERIFY(!fromCache);
+    QVERIFY(cachedBlack.isUrlMatched(QStringLiteral("http://kde.org/only-this/")));
+    QVERIFY(!cachedBlack.isUrlMatched(QStringLiteral("http://tracker.com/t.js")));
+    QVERIFY(!cachedWhite.isUrlMatched(QStringLiteral("http://example.com/ads/allowed/1.png")));
+}
+
+// A cache is only used for the list it was made from, and not when it is damaged
+void WebEngineFilterTest::testCacheInvalidation()
+{
+    const QString listFile = m_dir.path() + QStringLiteral("/invalidation.txt");
+    const QString cacheFile = m_dir.path() + QStringLiteral("/invalidation.txt.cache");
+    writeFilterList(listFile, QStringList() << QStringLiteral("/first/"));
+
+    bool fromCache = true;
+    FilterSet black, white;
+    QVERIFY(FilterSet::loadFilterList(listFile, cacheFile, black, white, &fromCache));
+    QVERIFY(!fromCache);
+
+    writeFilterList(listFile, QStringList() << QStringLiteral("/second/"));
+    FilterSet black2, white2;
+    QVERIFY(FilterSet::loadFilterList(listFile, cacheFile, black2, white2, &fromCache));
+    QVERIFY(!fromCache);
+    QVERIFY(!black2.isUrlMatched(QStringLiteral("http://kde.org/first/")));
+    QVERIFY(black2.isUrlMatched(QStringLiteral("http://kde.org/second/")));
+
+    // Damage every byte of the blobs in turn: loading must not crash, whatever
+    // it makes of it, and the list must still load
+    QFile cache(cacheFile);
+    QVERIFY(cache.open(QIODevice::ReadOnly));
+    const QByteArray original = cache.readAll();
+    cache.close();
+    for (int i = 0; i < original.size(); i += 7) {
+        QByteArray damaged = original;
+        damaged[i] = char(damaged.at(i) ^ 0x5a);
+        QVERIFY(cache.open(QIODevice::WriteOnly | QIODevice::Truncate));
+        cache.write(damaged);
+        cache.close();
+        FilterSet black3, white3;
+        QVERIFY(FilterSet::loadFilterList(listFile, cacheFile, black3, white3));
+        black3.isUrlMatched(QStringLiteral("http://kde.org/second/"));
+    }
+
+    QVERIFY(!FilterSet::loadFilterList(m_dir.path() + QStringLiteral("/missing.txt"), cacheFile, black, white));
+}
+
+// The same filters and urls, with the matcher FilterSet used before as the baseline
+void WebEngineFilterTest::benchmarkMatch_data()
+{
+    QTest::addColumn<bool>("legacy");
+
+    QTest::newRow("rabin-karp") << true;
+    QTest::newRow("aho-corasick") << false;
+}
+
+void WebEngineFilterTest::benchmarkMatch()
+{
+    QFETCH(bool, legacy);
+
+    FilterSet set;
+    LegacyFilterSet legacySet;
+    foreach (const QString &filter, m_filters) {
+        if (legacy)
+            legacySet.addFilter(filter);
+        else
+            set.addFilter(filter);
+    }
+    // compile the automaton outside of the measurement
+    set.isUrlMatched(QString());
+
+    int matched = 0;
+    QBENCHMARK {
+        foreach (const QString &url, m_urls) {
+            if (legacy ? legacySet.isUrlMatched(url) : set.isUrlMatched(url))
+                ++matched;
+        }
+    }
+    QVERIFY(matched > 0);
+}
+
+// Startup cost of a filter list, parsed or mapped from its cache
+void WebEngineFilterTest::benchmarkLoadFilterList_data()
+{
+    QTest::addColumn<bool>("cached");
+
+    QTest::newRow("parse") << false;
+    QTest::newRow("cache") << true;
+}
+
+void WebEngineFilterTest::benchmarkLoadFilterList()
+{
+    QFETCH(bool, cached);
+
+    const QString listFile = m_dir.path() + QStringLiteral("/benchmark.txt");
+    const QString cacheFile = m_dir.path() + QStringLiteral("/benchmark.txt.cache");
+    writeFilterList(listFile, m_filters);
+    QFile::remove(cacheFile);
+
+    bool fromCache = false;
+    QBENCHMARK {
+        if (!cached)
+            QFile::remove(cacheFile);
+        FilterSet black, white;
+        QVERIFY(FilterSet::loadFilterList(listFile, cacheFile, black, white, &fromCache));
+        // the first match, which compiled the filters before
+        black.isUrlMatched(QStringLiteral("http://kde.org/"));
+    }
+    QCOMPARE(fromCache, cached);
+}
+
+QTEST_GUILESS_MAIN(WebEngineFilterTest)
+
+#include "webenginefiltertest.moc"
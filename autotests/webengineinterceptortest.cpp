@@ -0,0 +1,83 @@
+/* This file is part of the KDE project
+    Copyright (c) 2016 The Konqueror developers
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Library General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Library General Public License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to
+    the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+    Boston, MA 02110-1301, USA.
+*/
+
+#include <QTest>
+
+#include <QTest>
+#include <QStandardPaths>
+
+#include <KConfig>
+#include <KConfigGroup>
+
+#include <webengineurlrequestinterceptor.h>
+
+class WebEngineInterceptorTest : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void initTestCase();
+    void testBlockedRequestsCounted();
+};
+
+void WebEngineInterceptorTest::initTestCase()
+{
+    QStandardPaths::setTestModeEnabled(true);
+
+    // read by WebEngineSettings when first used
+    KConfig config(QStringLiteral("khtmlrc"), KConfig::NoGlobals);
+    KConfigGroup group(&config, "Filter Settings");
+    group.deleteGroup();
+    group.writeEntry("Enabled", true);
+    group.writeEntry("Filter-0", "ads/banner");
+    group.writeEntry("Count", 1);
+    config.sync();
+}
+
+void WebEngineInterceptorTest::testBlockedRequestsCounted()
+{
+    WebEngineUrlRequestInterceptor *interceptor = WebEngineUrlRequestInterceptor::self();
+    const QUrl page(QStringLiteral("http://a.com/"));
+    const QUrl otherPage(QStringLiteral("http://b.com/"));
+    const WebEngineUrlRequestInterceptor::Statistics total = interceptor->totalStatistics();
+
+    QVERIFY(interceptor->filterRequest(QUrl(QStringLiteral("http://cdn.com/ads/banner.png")), page,
+                                       QWebEngineUrlRequestInfo::ResourceTypeImage));
+    QVERIFY(interceptor->filterRequest(QUrl(QStringLiteral("http://cdn.com/ads/banner.js")), page,
+                                       QWebEngineUrlRequestInfo::ResourceTypeScript));
+    QVERIFY(!interceptor->filterRequest(QUrl(QStringLiteral("http://cdn.com/logo.png")), page,
+                                        QWebEngineUrlRequestInfo::ResourceTypeImage));
+
+    WebEngineUrlRequestInterceptor::Statistics statistics = interceptor->statistics(page);
+    QCOMPARE(statistics.blockedRequests, 2);
+    QVERIFY(statistics.savedBytes > 0);
+    QCOMPARE(interceptor->statistics(otherPage).blockedRequests, 0);
+    QCOMPARE(interceptor->totalStatistics().blockedRequests, total.blockedRequests + 2);
+    QCOMPARE(interceptor->totalStatistics().savedBytes, total.savedBytes + statistics.savedBytes);
+
+    // a new load of the page starts over, the totals stay
+    interceptor->resetStatistics(page);
+    QCOMPARE(interceptor->statistics(page).blockedRequests, 0);
+    QCOMPARE(interceptor->statistics(page).savedBytes, qint64(0));
+    QCOMPARE(interceptor->totalStatistics().blockedRequests, total.blockedRequests + 2);
+}
+
+QTEST_MAIN(WebEngineInterceptorTest)
+
+#include "webengineinterceptortest.moc"
@@ -0,0 +1,245 @@
+/* This file is part of KDE
+    Copyright (c) 2016 The Konqueror developers
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Library General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Library General Public License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to
+    the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+    Boston, MA 02110-1301, USA.
+*/
+
+#include <konq_historyentry.h>
+#include <konq_historyloader_p.h>
+
+#include <QTest>
+#include <QObject>
+#include <QDataStream>
+#include <QDir>
+#include <QFile>
+#include <QStandardPaths>
+
+#include <zlib.h> // for crc32
+
+class KonqHistoryLoaderTest : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void initTestCase();
+    void init();
+    void testJournal();
+    void testCompact();
+    void testReadVersion4();
+    void testDuplicateUrls();
+    void benchmarkLoadHistory_data();
+    void benchmarkLoadHistory();
+};
+
+QTEST_GUILESS_MAIN(KonqHistoryLoaderTest)
+
+static QString historyDir()
+{
+    return QStandardPaths::writableLocation(QStandardPaths::GenericDataLocation) + QLatin1String("/konqueror");
+}
+
+static KonqHistoryEntry makeEntry(int i)
+{
+    KonqHistoryEntry entry;
+    entry.url = QUrl(QStringLiteral("http://www.example%1.org/d%C3%A9j%C3%A0 vu.html").arg(i));
+    entry.typedUrl = QStringLiteral("example%1.org").arg(i);
+    entry.title = QStringLiteral("Example page number %1").arg(i);
+    entry.numberOfTimesVisited = 1 + i % 5;
+    entry.firstVisited = QDateTime(QDate(2016, 1, 1), QTime(12, 0)).addSecs(i);
+    entry.lastVisited = entry.firstVisited.addSecs(60);
+    return entry;
+}
+
+// What konqueror 4.x and 5.0 used to save
+static void writeVersion4(const KonqHistoryList &entries)
+{
+    QFile file(historyDir() + QLatin1String("/konq_history"));
+    QVERIFY(file.open(QIODevice::WriteOnly));
+    QDataStream fileStream(&file);
+    fileStream << quint32(4);
+
+    QByteArray data;
+    QDataStream stream(&data, QIODevice::WriteOnly);
+    foreach (const KonqHistoryEntry &entry, entries) {
+        entry.save(stream, KonqHistoryEntry::NoFlags);
+    }
+    quint32 crc = crc32(0, reinterpret_cast<unsigned char *>(data.data()), data.size());
+    fileStream << crc << data;
+}
+
+static void writeVersion4(int count)
+{
+    KonqHistoryList entries;
+    for (int i = 0; i < count; ++i) {
+        entries.append(makeEntry(i));
+    }
+    writeVersion4(entries);
+}
+
+void KonqHistoryLoaderTest::initTestCase()
+{
+    QStandardPaths::setTestModeEnabled(true);
+}
+
+void KonqHistoryLoaderTest::init()
+{
+    QDir(historyDir()).removeRecursively();
+    QVERIFY(QDir().mkpath(historyDir()));
+}
+
+void KonqHistoryLoaderTest::testJournal()
+{
+    QVERIFY(KonqHistoryLoader::journalAddEntry(makeEntry(1)));
+    QVERIFY(KonqHistoryLoader::journalAddEntry(makeEntry(2)));
+    QVERIFY(KonqHistoryLoader::journalAddEntry(makeEntry(3)));
+    KonqHistoryEntry updated = makeEntry(1);
+    updated.title = QStringLiteral("Updated");
+    updated.lastVisited = updated.lastVisited.addDays(1);
+    QVERIFY(KonqHistoryLoader::journalAddEntry(updated));
+    QVERIFY(KonqHistoryLoader::journalRemoveEntries(QList<QUrl>() << makeEntry(2).url));
+
+    KonqHistoryLoader loader;
+    QCOMPARE(loader.entries().count(), 2);
+    QCOMPARE(loader.entries().at(0), makeEntry(3));
+    QCOMPARE(loader.entries().at(1), updated);   // sorted by lastVisited
+    QCOMPARE(loader.displayUrl(0), makeEntry(3).url.toDisplayString());
+
+    // A record cut in the middle by a crash is ignored
+    QFile journal(historyDir() + QLatin1String("/konq_history.journal"));
+    QVERIFY(journal.open(QIODevice::WriteOnly | QIODevice::Append));
+    journal.write("\0\0\0\x40garbage", 11);
+    journal.close();
+    QVERIFY(loader.loadHistory());
+    QCOMPARE(loader.entries().count(), 2);
+
+    // and cut off by the next append
+    const qint64 size = journal.size();
+    QVERIFY(KonqHistoryLoader::journalAddEntry(makeEntry(4)));
+    QVERIFY(KonqHistoryLoader::journalSize() < size + KonqHistoryLoader::addEntryRecord(makeEntry(4)).size());
+    QVERIFY(loader.loadHistory());
+    QCOMPARE(loader.entries().count(), 3);
+    QVERIFY(KonqHistoryLoader::journalClear());
+    QVERIFY(loader.loadHistory());
+    QCOMPARE(loader.entries().count(), 0);
+
+    // A record with a wrong checksum is skipped, the next ones are replayed
+    QVERIFY(KonqHistoryLoader::journalAddEntry(makeEntry(5)));
+    QVERIFY(journal.open(QIODevice::ReadWrite));
+    QVERIFY(journal.seek(journal.size() - 1));
+    journal.write("X", 1);
+    journal.close();
+    QVERIFY(KonqHistoryLoader::journalAddEntry(makeEntry(6)));
+    QVERIFY(loader.loadHistory());
+    QCOMPARE(loader.entries().count(), 1);
+    QCOMPARE(loader.entries().at(0), makeEntry(6));
+
+    // and so is the rest of a journal with one, on compaction
+    QVERIFY(KonqHistoryLoader::compact(500, 0));
+    QVERIFY(loader.loadHistory());
+    QCOMPARE(loader.entries().count(), 1);
+    QCOMPARE(loader.entries().at(0), makeEntry(6));
+}
+
+void KonqHistoryLoaderTest::testCompact()
+{
+    for (int i = 0; i < 10; ++i) {
+        QVERIFY(KonqHistoryLoader::journalAddEntry(makeEntry(i)));
+    }
+    QVERIFY(KonqHistoryLoader::journalSize() > 0);
+    QVERIFY(KonqHistoryLoader::compact(8, 0));
+    QCOMPARE(KonqHistoryLoader::journalSize(), qint64(0));
+    QVERIFY(!QFile::exists(historyDir() + QLatin1String("/konq_history.journal.compacting")));
+
+    QVERIFY(KonqHistoryLoader::journalAddEntry(makeEntry(10)));
+    KonqHistoryLoader loader;
+    QCOMPARE(loader.entries().count(), 9);
+    for (int i = 0; i < 9; ++i) {
+        QCOMPARE(loader.entries().at(i), makeEntry(i + 2));
+        QCOMPARE(loader.displayUrl(i), makeEntry(i + 2).url.toDisplayString());
+    }
+}
+
+void KonqHistoryLoaderTest::testReadVersion4()
+{
+    writeVersion4(5);
+    KonqHistoryLoader loader;
+    QCOMPARE(loader.entries().count(), 5);
+    QCOMPARE(loader.entries().at(4), makeEntry(4));
+
+    // Converted on compaction
+    QVERIFY(KonqHistoryLoader::journalRemoveEntries(QList<QUrl>() << makeEntry(0).url));
+    QVERIFY(KonqHistoryLoader::compact(500, 0));
+    QVERIFY(loader.loadHistory());
+    QCOMPARE(loader.entries().count(), 4);
+    QCOMPARE(loader.entries().at(0), makeEntry(1));
+}
+
+void KonqHistoryLoaderTest::testDuplicateUrls()
+{
+    // An old history file with two entries for a url
+    KonqHistoryList entries;
+    for (int i = 0; i < 5; ++i) {
+        entries.append(makeEntry(i));
+    }
+    KonqHistoryEntry duplicate = makeEntry(1);
+    duplicate.title = QStringLiteral("Again");
+    duplicate.lastVisited = duplicate.lastVisited.addDays(1);
+    entries.append(duplicate);
+    writeVersion4(entries);
+    QVERIFY(KonqHistoryLoader::journalAddEntry(makeEntry(5)));
+
+    KonqHistoryLoader loader;
+    // Only the last one is kept, and is the one updated or removed
+    QCOMPARE(loader.entries().count(), 6);
+    QCOMPARE(loader.entries().last(), duplicate);
+    QVERIFY(KonqHistoryLoader::journalRemoveEntries(QList<QUrl>() << duplicate.url));
+    QVERIFY(loader.loadHistory());
+    QCOMPARE(loader.entries().count(), 5);
+    foreach (const KonqHistoryEntry &entry, loader.entries()) {
+        QVERIFY(entry.url != duplicate.url);
+    }
+}
+
+void KonqHistoryLoaderTest::benchmarkLoadHistory_data()
+{
+    QTest::addColumn<int>("version");
+    QTest::newRow("version 4") << 4;
+    QTest::newRow("version 6") << 6;
+}
+
+void KonqHistoryLoaderTest::benchmarkLoadHistory()
+{
+    QFETCH(int, version);
+    const int count = 100000;
+    writeVersion4(count);
+    if (version == 6) {
+        QVERIFY(KonqHistoryLoader::journalAddEntry(makeEntry(count)));
+        QVERIFY(KonqHistoryLoader::compact(count + 1, 0));
+    }
+
+    // What KonqHistoryProvider and KonqHistoryManager need at startup
+    KonqHistoryLoader loader;
+    QBENCHMARK {
+        QVERIFY(loader.loadHistory());
+        const KonqHistoryList &entries = loader.entries();
+        for (int i = 0; i < entries.count(); ++i) {
+            QVERIFY(!loader.displayUrl(i).isEmpty());
+        }
+    }
+    QVERIFY(loader.entries().count() >= count);
+}
+
+#include "konqhistoryloadertest.moc"
@@ -0,0 +1,227 @@
+/* This file is part of KDE
+    Copyright (c) 2016 The Konqueror developers
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Library General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Library General Public License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to
+    the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+    Boston, MA 02110-1301, USA.
+*/
+
+#include <konq_indexedhistorylist_p.h>
+
+#include <QTest>
+#include <QObject>
+
+class KonqIndexedHistoryListTest : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void testFindEntry();
+    void testRemoveFirst();
+    void testRemoveAt();
+    void testRemoveMany();
+    void testDuplicateUrls();
+    void benchmarkFindEntry();
+    void benchmarkRemoveAt();
+};
+
+QTEST_GUILESS_MAIN(KonqIndexedHistoryListTest)
+
+static QUrl urlForIndex(int i)
+{
+    return QUrl(QStringLiteral("http://www.example%1.org/page.html").arg(i));
+}
+
+static KonqHistoryEntry makeEntry(int i)
+{
+    KonqHistoryEntry entry;
+    entry.url = urlForIndex(i);
+    entry.numberOfTimesVisited = i;
+    return entry;
+}
+
+static void fillList(KonqIndexedHistoryList &list, int count)
+{
+    for (int i = 0; i < count; ++i) {
+        list.append(makeEntry(i));
+    }
+}
+
+void KonqIndexedHistoryListTest::testFindEntry()
+{
+    KonqIndexedHistoryList list;
+    fillList(list, 10);
+    QCOMPARE(list.list().count(), 10);
+    for (int i = 0; i < 10; ++i) {
+        QCOMPARE(list.indexOf(urlForIndex(i)), i);
+        KonqHistoryList::iterator it = list.findEntry(urlForIndex(i));
+        QVERIFY(it != list.end());
+        QCOMPARE(it - list.begin(), i);
+    }
+    QCOMPARE(list.indexOf(urlForIndex(10)), -1);
+    QVERIFY(list.findEntry(QUrl()) == list.end());
+
+    // Update in place
+    (*list.findEntry(urlForIndex(3))).title = QStringLiteral("Three");
+    QCOMPARE(list.list().at(3).title, QStringLiteral("Three"));
+}
+
+void KonqIndexedHistoryListTest::testRemoveFirst()
+{
+    // This is what KonqHistoryProvider does when trimming the history
+    KonqIndexedHistoryList list;
+    fillList(list, 10);
+    list.removeAt(0);
+    list.removeAt(0);
+    QCOMPARE(list.list().count(), 8);
+    QCOMPARE(list.indexOf(urlForIndex(0)), -1);
+    QCOMPARE(list.indexOf(urlForIndex(1)), -1);
+    for (int i = 2; i < 10; ++i) {
+        QCOMPARE(list.indexOf(urlForIndex(i)), i - 2);
+    }
+    list.append(makeEntry(10));
+    QCOMPARE(list.indexOf(urlForIndex(10)), 8);
+
+    list.clear();
+    QCOMPARE(list.indexOf(urlForIndex(5)), -1);
+    list.append(makeEntry(5));
+    QCOMPARE(list.indexOf(urlForIndex(5)), 0);
+}
+
+void KonqIndexedHistoryListTest::testRemoveAt()
+{
+    KonqIndexedHistoryList list;
+    fillList(list, 10);
+    list.removeAt(4);
+    QCOMPARE(list.list().count(), 9);
+    QCOMPARE(list.indexOf(urlForIndex(4)), -1);
+    QCOMPARE(list.indexOf(urlForIndex(3)), 3);
+    QCOMPARE(list.indexOf(urlForIndex(5)), 4);
+    QCOMPARE(list.indexOf(urlForIndex(9)), 8);
+    list.append(makeEntry(4));
+    QCOMPARE(list.indexOf(urlForIndex(4)), 9);
+}
+
+// Lookups stay right after removals anywhere, mixed with appends and trimming
+void KonqIndexedHistoryListTest::testRemoveMany()
+{
+    KonqIndexedHistoryList list;
+    fillList(list, 100);
+    QList<int> expected;
+    for (int i = 0; i < 100; ++i) {
+        expected.append(i);
+    }
+
+    for (int round = 0; round < 30; ++round) {
+        const int pos = (round * 37) % expected.count();
+        QCOMPARE(list.list().at(pos).url, urlForIndex(expected.at(pos)));
+        list.removeAt(pos);
+        expected.removeAt(pos);
+        if (round % 3 == 0) {
+            list.removeAt(0);
+            expected.removeFirst();
+        }
+        if (round % 4 == 0) {
+            list.append(makeEntry(100 + round));
+            expected.append(100 + round);
+        }
+    }
+
+    QCOMPARE(list.list().count(), expected.count());
+    for (int pos = 0; pos < expected.count(); ++pos) {
+        QCOMPARE(list.indexOf(urlForIndex(expected.at(pos))), pos);
+        QCOMPARE(list.findEntry(urlForIndex(expected.at(pos))) - list.begin(), pos);
+    }
+    for (int i = 0; i < 130; ++i) {
+        if (!expected.contains(i)) {
+            QCOMPARE(list.indexOf(urlForIndex(i)), -1);
+        }
+    }
+}
+
+void KonqIndexedHistoryListTest::testDuplicateUrls()
+{
+    KonqHistoryList entries;
+    for (int i = 0; i < 5; ++i) {
+        entries.append(makeEntry(i));
+    }
+    KonqHistoryEntry duplicate = makeEntry(1);
+    duplicate.title = QStringLiteral("Latest");
+    entries.append(duplicate);
+
+    KonqIndexedHistoryList list;
+    list.assign(entries);
+    // Only the last entry for a url is kept, like KonqHistoryList::findEntry would find
+    QCOMPARE(list.list().count(), 5);
+    QCOMPARE(list.indexOf(urlForIndex(0)), 0);
+    QCOMPARE(list.indexOf(urlForIndex(2)), 1);
+    QCOMPARE(list.indexOf(urlForIndex(4)), 3);
+    QCOMPARE(list.indexOf(urlForIndex(1)), 4);
+    QCOMPARE(list.list().at(4).title, QStringLiteral("Latest"));
+
+    // Without duplicates, the list is taken as is
+    entries.removeLast();
+    list.assign(entries);
+    QCOMPARE(list.list().count(), 5);
+    for (int i = 0; i < 5; ++i) {
+        QCOMPARE(list.indexOf(urlForIndex(i)), i);
+    }
+}
+
+void KonqIndexedHistoryListTest::benchmarkFindEntry()
+{
+    const int count = 100000;
+    KonqIndexedHistoryList list;
+    fillList(list, count);
+
+    // Look up a mix of old, recent and unknown URLs
+    QList<QUrl> urls;
+    for (int i = 0; i < 1000; ++i) {
+        urls.append(urlForIndex((i * 7919) % (count + count / 10)));
+    }
+
+    int found = 0;
+    QBENCHMARK {
+        found = 0;
+        foreach (const QUrl &url, urls) {
+            if (list.indexOf(url) != -1) {
+                ++found;
+            }
+        }
+    }
+    QVERIFY(found > 0);
+    QVERIFY(found < urls.count());
+}
+
+// Removing entries from the middle, as KonqHistoryProvider does for the
+// urls the user removes from the history
+void KonqIndexedHistoryListTest::benchmarkRemoveAt()
+{
+    const int count = 100000;
+    KonqIndexedHistoryList list;
+    fillList(list, count);
+
+    // appending new entries keeps the size of the list
+    int next = count;
+    QBENCHMARK {
+        for (int i = 0; i < 100; ++i) {
+            list.removeAt(list.list().count() / 2);
+            list.append(makeEntry(next++));
+        }
+    }
+    QCOMPARE(list.list().count(), count);
+    QCOMPARE(list.indexOf(urlForIndex(next - 1)), count - 1);
+}
+
+#include "konqindexedhistorylisttest.moc"
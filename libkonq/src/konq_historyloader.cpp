@@ -23,17 +23,100 @@
 
 #include <QDebug>
 #include <QDataStream>
+#include <QDir>
 #include <QFile>
+#include <QFileInfo>
+#include <QHash>
+#include <QLockFile>
+#include <QSaveFile>
 #include <QStandardPaths>
+#include <QStringList>
+#include <QVector>
+#include <QtEndian>
+
+#include <algorithm>
+#include <limits>
 
 #include <zlib.h> // for crc32
 
+// Types of the records in the history journal
+enum JournalRecordType {
+    AddEntryRecord = 1,     // followed by a KonqHistoryEntry (complete state)
+    RemoveEntryRecord = 2,  // followed by a QUrl
+    ClearRecord = 3
+};
+
+// Each journal record is: quint32 payload size, quint32 crc32 of the payload,
+// payload (quint8 JournalRecordType + data), all big endian.
+static const int s_journalRecordHeaderSize = 8;
+
+// Version 6 snapshot layout, meant to be mmapped:
+//   quint32 version (big endian, like older versions, so that they reject it)
+//   quint32 number of entries, quint32 crc32 of everything after the header
+//   quint32 offset of each record, in lastVisited order
+//   the records: qint64 lastVisited, qint64 firstVisited (ms since epoch),
+//   quint32 numberOfTimesVisited, then url (encoded), url for display,
+//   typedUrl and title, each as quint32 size + UTF-8 data.
+// Numbers are little endian, except for the version.
+static const int s_snapshotHeaderSize = 12;
+static const int s_snapshotRecordFixedSize = 20;
+static const qint64 s_invalidDateTime = std::numeric_limits<qint64>::min();
+
 class KonqHistoryLoaderPrivate
 {
 public:
+    KonqHistoryLoaderPrivate()
+        : m_map(0), m_mapSize(0)
+    {
+    }
+
+    bool readSnapshot(const QString &filename, bool *found);
+    bool readDataStreamSnapshot(QFile &file);
+    bool readMappedSnapshot();
+    void replayJournal(const QString &filename, QHash<QUrl, int> &positions, QVector<bool> &removed);
+    void replayJournals(const QStringList &filenames);
+    void sortEntries();
+    void closeSnapshot();
+    QString displayUrl(int index) const;
+
     KonqHistoryList m_history;
+
+    // The mapped version 6 snapshot, if any
+    QFile m_snapshotFile;
+    const uchar *m_map;
+    qint64 m_mapSize;
+    // For each entry of m_history, the offset of its record in the mapped
+    // snapshot, or 0 if it doesn't come from there (or was modified since).
+    QVector<quint32> m_recordOffsets;
 };
 
+static QString historyDir()
+{
+    return QStandardPaths::writableLocation(QStandardPaths::GenericDataLocation) + QLatin1String("/konqueror");
+}
+
+static QString snapshotFileName()
+{
+    return historyDir() + QLatin1String("/konq_history");
+}
+
+static QString journalFileName()
+{
+    return historyDir() + QLatin1String("/konq_history.journal");
+}
+
+// The journal being merged into the snapshot by compact()
+static QString compactingJournalFileName()
+{
+    return historyDir() + QLatin1String("/konq_history.journal.compacting");
+}
+
+// Protects appending to, renaming and removing journal files
+static QString journalLockFileName()
+{
+    return historyDir() + QLatin1String("/konq_history.lock");
+}
+
 KonqHistoryLoader::KonqHistoryLoader(QObject *parent)
     : QObject(parent), d(new KonqHistoryLoaderPrivate)
 {
@@ -54,19 +137,51 @@ static bool lastVisitedOrder(const KonqHistoryEntry &lhs, const KonqHistoryEntry
     return lhs.lastVisited < rhs.lastVisited;
 }
 
-bool KonqHistoryLoader::loadHistory()
+void KonqHistoryLoaderPrivate::closeSnapshot()
 {
-    d->m_history.clear();
+    if (m_map) {
+        m_snapshotFile.unmap(const_cast<uchar *>(m_map));
+        m_map = 0;
+        m_mapSize = 0;
+    }
+    m_snapshotFile.close();
+    m_recordOffsets.clear();
+}
 
-    const QString filename = QStandardPaths::writableLocation(QStandardPaths::GenericDataLocation) + QLatin1String("/konqueror/konq_history");
-    QFile file(filename);
-    if (!file.open(QIODevice::ReadOnly)) {
-        if (file.exists()) {
+/**
+ * Reads the snapshot file into m_history, unsorted.
+ * @p found is set to false if there is no snapshot file.
+ */
+bool KonqHistoryLoaderPrivate::readSnapshot(const QString &filename, bool *found)
+{
+    closeSnapshot();
+    m_snapshotFile.setFileName(filename);
+    *found = m_snapshotFile.exists();
+    if (!m_snapshotFile.open(QIODevice::ReadOnly)) {
+        if (*found) {
             qWarning() << "Can't open" << filename;
         }
         return false;
     }
 
+    bool ok;
+    const QByteArray header = m_snapshotFile.peek(4);
+    if (header.size() == 4 && qFromBigEndian<quint32>(reinterpret_cast<const uchar *>(header.constData())) == 6) {
+        ok = readMappedSnapshot();
+    } else {
+        ok = readDataStreamSnapshot(m_snapshotFile);
+        m_snapshotFile.close();
+    }
+    if (!ok) {
+        closeSnapshot();
+        m_history.clear();
+    }
+    return ok;
+}
+
+// Version 4 and 5 snapshots
+bool KonqHistoryLoaderPrivate::readDataStreamSnapshot(QFile &file)
+{
     QDataStream fileStream(&file);
     QByteArray data; // only used for version == 2
     // we construct the stream object now but fill in the data later.
@@ -82,7 +197,7 @@ bool KonqHistoryLoader::loadHistory()
         bool crcChecked = false;
         bool crcOk = false;
 
-        if (version >= 2 && version <= 4) {
+        if (version >= 2 && version <= 5) {
             quint32 crc;
             crcChecked = true;
             fileStream >> crc >> data;
@@ -92,31 +207,14 @@ bool KonqHistoryLoader::loadHistory()
 
         // We can't read v3 history anymore, because operator<<(KURL) disappeared.
 
-        if (version == 4) {
-            // Use QUrl marshalling for V4 format.
+        if (version == 4 || version == 5) {
+            // Use QUrl marshalling for V4 and V5 format.
+            // V5 snapshots are laid out like V4, the changes are in the journal.
             flags = KonqHistoryEntry::NoFlags;
         }
 
-#if 0 // who cares for versions 1 and 2 nowadays...
-        if (version != 0 && version < 3) { //Versions 1,2 (but not 0) are also valid
-            //Turn on backwards compatibility mode..
-            marshalURLAsStrings = true;
-            // it doesn't make sense to save to save maxAge and maxCount  in the
-            // binary file, this would make backups impossible (they would clear
-            // themselves on startup, because all entries expire).
-            // [But V1 and V2 formats did it, so we do a dummy read]
-            quint32 dummy;
-            *stream >> dummy;
-            *stream >> dummy;
-
-            //OK.
-            version = 3;
-        }
-#endif
-
-        if (historyVersion() != int(version) || (crcChecked && !crcOk)) {
+        if ((version != 4 && version != 5) || (crcChecked && !crcOk)) {
             qWarning() << "The history version doesn't match, aborting loading";
-            file.close();
             return false;
         }
 
@@ -124,18 +222,285 @@ bool KonqHistoryLoader::loadHistory()
             KonqHistoryEntry entry;
             entry.load(*stream, flags);
             // kDebug(1202) << "loaded entry:" << entry.url << ", Title:" << entry.title;
-            d->m_history.append(entry);
+            m_history.append(entry);
         }
 
         //kDebug(1202) << "loaded:" << m_history.count() << "entries.";
+    }
+    m_recordOffsets.fill(0, m_history.count());
+    return true;
+}
+
+static QDateTime dateTimeFromMSecs(qint64 msecs)
+{
+    return msecs == s_invalidDateTime ? QDateTime() : QDateTime::fromMSecsSinceEpoch(msecs);
+}
+
+/**
+ * Reads one size-prefixed string of a version 6 record at @p pos,
+ * moving @p pos past it. Returns false if it doesn't fit before @p end.
+ */
+static bool readRecordString(const uchar *&pos, const uchar *end, const char **data, int *size)
+{
+    if (end - pos < 4) {
+        return false;
+    }
+    const quint32 length = qFromLittleEndian<quint32>(pos);
+    pos += 4;
+    if (quint32(end - pos) < length) {
+        return false;
+    }
+    *data = reinterpret_cast<const char *>(pos);
+    *size = length;
+    pos += length;
+    return true;
+}
+
+// Version 6 snapshots
+bool KonqHistoryLoaderPrivate::readMappedSnapshot()
+{
+    m_mapSize = m_snapshotFile.size();
+    if (m_mapSize < s_snapshotHeaderSize || m_mapSize > std::numeric_limits<quint32>::max()) {
+        qWarning() << "Invalid history file" << m_snapshotFile.fileName();
+        return false;
+    }
+    m_map = m_snapshotFile.map(0, m_mapSize);
+    if (!m_map) {
+        qWarning() << "Can't map" << m_snapshotFile.fileName();
+        return false;
+    }
+
+    const quint32 count = qFromLittleEndian<quint32>(m_map + 4);
+    const quint32 crc = qFromLittleEndian<quint32>(m_map + 8);
+    if (crc32(0, m_map + s_snapshotHeaderSize, m_mapSize - s_snapshotHeaderSize) != crc ||
+            count > (m_mapSize - s_snapshotHeaderSize) / 4) {
+        qWarning() << "The history file is corrupted, aborting loading";
+        return false;
+    }
+
+    const uchar *end = m_map + m_mapSize;
+    m_history.reserve(count);
+    m_recordOffsets.reserve(count);
+    for (quint32 i = 0; i < count; ++i) {
+        const quint32 offset = qFromLittleEndian<quint32>(m_map + s_snapshotHeaderSize + 4 * i);
+        if (offset < s_snapshotHeaderSize || offset > m_mapSize - s_snapshotRecordFixedSize) {
+            qWarning() << "The history file is corrupted, aborting loading";
+            return false;
+        }
+        const uchar *pos = m_map + offset;
+        KonqHistoryEntry entry;
+        entry.lastVisited = dateTimeFromMSecs(qFromLittleEndian<qint64>(pos));
+        entry.firstVisited = dateTimeFromMSecs(qFromLittleEndian<qint64>(pos + 8));
+        entry.numberOfTimesVisited = qFromLittleEndian<quint32>(pos + 16);
+        pos += s_snapshotRecordFixedSize;
+
+        const char *url, *displayUrl, *typedUrl, *title;
+        int urlSize, displayUrlSize, typedUrlSize, titleSize;
+        if (!readRecordString(pos, end, &url, &urlSize) ||
+                !readRecordString(pos, end, &displayUrl, &displayUrlSize) ||
+                !readRecordString(pos, end, &typedUrl, &typedUrlSize) ||
+                !readRecordString(pos, end, &title, &titleSize)) {
+            qWarning() << "The history file is corrupted, aborting loading";
+            return false;
+        }
+        // The display url is only decoded when asked for, see displayUrl()
+        entry.url = QUrl::fromEncoded(QByteArray::fromRawData(url, urlSize));
+        entry.typedUrl = QString::fromUtf8(typedUrl, typedUrlSize);
+        entry.title = QString::fromUtf8(title, titleSize);
+        m_history.append(entry);
+        m_recordOffsets.append(offset);
+    }
+    return true;
+}
+
+/**
+ * Applies the records of the journal @p filename to m_history, looking up
+ * entries through @p positions and marking the removed ones in @p removed.
+ * Records whose checksum doesn't match are skipped. Replaying stops at a
+ * truncated record, which is what a crash in the middle of an append leaves
+ * behind; appendToJournal() cuts it off before appending again.
+ */
+void KonqHistoryLoaderPrivate::replayJournal(const QString &filename, QHash<QUrl, int> &positions, QVector<bool> &removed)
+{
+    QFile file(filename);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return;
+    }
+    const QByteArray journal = file.readAll();
+    const uchar *data = reinterpret_cast<const uchar *>(journal.constData());
+    int pos = 0;
+    while (journal.size() - pos >= s_journalRecordHeaderSize) {
+        const quint32 size = qFromBigEndian<quint32>(data + pos);
+        const quint32 crc = qFromBigEndian<quint32>(data + pos + 4);
+        pos += s_journalRecordHeaderSize;
+        if (size == 0 || size > quint32(journal.size() - pos)) {
+            qWarning() << "Truncated record in" << filename;
+            return;
+        }
+        if (crc32(0, data + pos, size) != crc) {
+            qWarning() << "Corrupted record in" << filename;
+            pos += size;
+            continue;
+        }
+        const QByteArray payload = QByteArray::fromRawData(journal.constData() + pos, size);
+        pos += size;
+
+        QDataStream stream(payload);
+        quint8 type;
+        stream >> type;
+        switch (type) {
+        case AddEntryRecord: {
+            KonqHistoryEntry entry;
+            entry.load(stream, KonqHistoryEntry::NoFlags);
+            QHash<QUrl, int>::const_iterator it = positions.constFind(entry.url);
+            if (it != positions.constEnd()) {
+                m_history[it.value()] = entry;
+                m_recordOffsets[it.value()] = 0;
+            } else {
+                positions.insert(entry.url, m_history.count());
+                m_history.append(entry);
+                m_recordOffsets.append(0);
+                removed.append(false);
+            }
+            break;
+        }
+        case RemoveEntryRecord: {
+            QUrl url;
+            stream >> url;
+            QHash<QUrl, int>::iterator it = positions.find(url);
+            if (it != positions.end()) {
+                removed[it.value()] = true;
+                positions.erase(it);
+            }
+            break;
+        }
+        case ClearRecord:
+            m_history.clear();
+            m_recordOffsets.clear();
+            positions.clear();
+            removed.clear();
+            break;
+        default:
+            qWarning() << "Unknown record type" << type << "in" << filename;
+            break;
+        }
+    }
+}
 
-        qSort(d->m_history.begin(), d->m_history.end(), lastVisitedOrder);
+/**
+ * Applies the records of the journals @p filenames to m_history, in order.
+ * This also drops all but the last entry for a url, so that the entries
+ * have unique urls even if an old history file had duplicates.
+ */
+void KonqHistoryLoaderPrivate::replayJournals(const QStringList &filenames)
+{
+    QHash<QUrl, int> positions;
+    positions.reserve(m_history.count());
+    QVector<bool> removed(m_history.count(), false);
+    for (int i = 0; i < m_history.count(); ++i) {
+        QHash<QUrl, int>::iterator it = positions.find(m_history.at(i).url);
+        if (it != positions.end()) {
+            removed[it.value()] = true;
+            it.value() = i;
+        } else {
+            positions.insert(m_history.at(i).url, i);
+        }
     }
 
+    foreach (const QString &filename, filenames) {
+        replayJournal(filename, positions, removed);
+    }
+
+    if (!removed.contains(true)) {
+        return;
+    }
+    const KonqHistoryList history = m_history;
+    const QVector<quint32> recordOffsets = m_recordOffsets;
+    m_history.clear();
+    m_recordOffsets.clear();
+    for (int i = 0; i < history.count(); ++i) {
+        if (!removed.at(i)) {
+            m_history.append(history.at(i));
+            m_recordOffsets.append(recordOffsets.at(i));
+        }
+    }
+}
+
+/**
+ * Sorts m_history by lastVisited date, unless it's sorted already
+ * (version 6 snapshots are).
+ */
+void KonqHistoryLoaderPrivate::sortEntries()
+{
+    if (std::is_sorted(m_history.constBegin(), m_history.constEnd(), lastVisitedOrder)) {
+        return;
+    }
+
+    QVector<int> order(m_history.count());
+    for (int i = 0; i < order.count(); ++i) {
+        order[i] = i;
+    }
+    const KonqHistoryList unsorted = m_history;
+    std::stable_sort(order.begin(), order.end(), [&unsorted](int lhs, int rhs) {
+        return lastVisitedOrder(unsorted.at(lhs), unsorted.at(rhs));
+    });
+
+    const QVector<quint32> unsortedOffsets = m_recordOffsets;
+    m_history.clear();
+    m_history.reserve(order.count());
+    for (int i = 0; i < order.count(); ++i) {
+        m_history.append(unsorted.at(order.at(i)));
+        m_recordOffsets[i] = unsortedOffsets.at(order.at(i));
+    }
+}
+
+QString KonqHistoryLoaderPrivate::displayUrl(int index) const
+{
+    const quint32 offset = m_recordOffsets.value(index);
+    if (offset && m_map) {
+        const uchar *pos = m_map + offset + s_snapshotRecordFixedSize;
+        const uchar *end = m_map + m_mapSize;
+        const char *data;
+        int size;
+        // The url, then the display url. Both were checked while loading.
+        if (readRecordString(pos, end, &data, &size) && readRecordString(pos, end, &data, &size)) {
+            return QString::fromUtf8(data, size);
+        }
+    }
+    return m_history.at(index).url.toDisplayString();
+}
+
+bool KonqHistoryLoader::loadHistory()
+{
+    d->m_history.clear();
+
+    QDir().mkpath(historyDir());
+    bool found;
+    {
+        // Make sure no compaction removes a journal while we read the files
+        QLockFile lock(journalLockFileName());
+        lock.lock();
+
+        if (!d->readSnapshot(snapshotFileName(), &found) && found) {
+            return false;
+        }
+        QStringList journals;
+        if (QFile::exists(compactingJournalFileName())) {
+            journals.append(compactingJournalFileName());
+        }
+        if (QFile::exists(journalFileName())) {
+            journals.append(journalFileName());
+        }
+        found = found || !journals.isEmpty();
+        d->replayJournals(journals);
+    }
+
+    d->sortEntries();
+
     // Theoretically, we should emit update() here, but as we only ever
     // load items on startup up to now, this doesn't make much sense.
     // emit KParts::HistoryProvider::update(some list);
-    return true;
+    return found;
 }
 
 const KonqHistoryList &KonqHistoryLoader::entries() const
@@ -143,7 +508,236 @@ const KonqHistoryList &KonqHistoryLoader::entries() const
     return d->m_history;
 }
 
+QString KonqHistoryLoader::displayUrl(int index) const
+{
+    return d->displayUrl(index);
+}
+
 int KonqHistoryLoader::historyVersion()
 {
-    return 4;
+    return 6;
+}
+
+static QByteArray journalRecord(const QByteArray &payload)
+{
+    QByteArray record;
+    QDataStream stream(&record, QIODevice::WriteOnly);
+    stream << quint32(payload.size());
+    stream << quint32(crc32(0, reinterpret_cast<const unsigned char *>(payload.constData()), payload.size()));
+    stream.writeRawData(payload.constData(), payload.size());
+    return record;
+}
+
+QByteArray KonqHistoryLoader::addEntryRecord(const KonqHistoryEntry &entry)
+{
+    QByteArray payload;
+    QDataStream stream(&payload, QIODevice::WriteOnly);
+    stream << quint8(AddEntryRecord);
+    entry.save(stream, KonqHistoryEntry::NoFlags);
+    return journalRecord(payload);
+}
+
+QByteArray KonqHistoryLoader::removeEntryRecord(const QUrl &url)
+{
+    QByteArray payload;
+    QDataStream stream(&payload, QIODevice::WriteOnly);
+    stream << quint8(RemoveEntryRecord) << url;
+    return journalRecord(payload);
+}
+
+QByteArray KonqHistoryLoader::clearRecord()
+{
+    QByteArray payload;
+    QDataStream stream(&payload, QIODevice::WriteOnly);
+    stream << quint8(ClearRecord);
+    return journalRecord(payload);
+}
+
+/**
+ * @returns the size of the complete records at the start of the journal
+ * @p file, i.e. without the half record a crash while appending leaves.
+ */
+static qint64 completeJournalSize(QFile &file)
+{
+    const qint64 fileSize = file.size();
+    if (fileSize == 0) {
+        return 0;
+    }
+    const uchar *data = file.map(0, fileSize);
+    if (!data) {
+        return fileSize;
+    }
+    qint64 pos = 0;
+    while (fileSize - pos >= s_journalRecordHeaderSize) {
+        const quint32 size = qFromBigEndian<quint32>(data + pos);
+        if (size == 0 || size > fileSize - pos - s_journalRecordHeaderSize) {
+            break;
+        }
+        pos += s_journalRecordHeaderSize + size;
+    }
+    file.unmap(const_cast<uchar *>(data));
+    return pos;
+}
+
+bool KonqHistoryLoader::appendToJournal(const QByteArray &records)
+{
+    QDir().mkpath(historyDir());
+    QLockFile lock(journalLockFileName());
+    if (!lock.lock()) {
+        qWarning() << "Can't lock" << journalLockFileName() << "for saving history";
+        return false;
+    }
+    QFile file(journalFileName());
+    if (!file.open(QIODevice::ReadWrite | QIODevice::Append)) {
+        qWarning() << "Can't open" << file.fileName() << "for saving history";
+        return false;
+    }
+    // Records appended after a broken one would never be replayed
+    const qint64 completeSize = completeJournalSize(file);
+    if (completeSize < file.size()) {
+        qWarning() << "Dropping a truncated record at the end of" << file.fileName();
+        if (!file.resize(completeSize)) {
+            return false;
+        }
+    }
+    // One write call per batch, so that readers never see half a record
+    // unless we crash.
+    return file.write(records) == records.size();
+}
+
+bool KonqHistoryLoader::journalAddEntry(const KonqHistoryEntry &entry)
+{
+    return appendToJournal(addEntryRecord(entry));
+}
+
+bool KonqHistoryLoader::journalRemoveEntries(const QList<QUrl> &urls)
+{
+    QByteArray records;
+    foreach (const QUrl &url, urls) {
+        records += removeEntryRecord(url);
+    }
+    return records.isEmpty() || appendToJournal(records);
+}
+
+bool KonqHistoryLoader::journalClear()
+{
+    return appendToJournal(clearRecord());
+}
+
+qint64 KonqHistoryLoader::journalSize()
+{
+    return QFileInfo(journalFileName()).size();
+}
+
+static void appendLittleEndian(QByteArray &data, quint32 value)
+{
+    uchar buffer[4];
+    qToLittleEndian<quint32>(value, buffer);
+    data.append(reinterpret_cast<const char *>(buffer), 4);
+}
+
+static void appendLittleEndian(QByteArray &data, qint64 value)
+{
+    uchar buffer[8];
+    qToLittleEndian<qint64>(value, buffer);
+    data.append(reinterpret_cast<const char *>(buffer), 8);
+}
+
+static void appendRecordString(QByteArray &data, const QByteArray &string)
+{
+    appendLittleEndian(data, quint32(string.size()));
+    data.append(string);
+}
+
+static qint64 dateTimeToMSecs(const QDateTime &dateTime)
+{
+    return dateTime.isValid() ? dateTime.toMSecsSinceEpoch() : s_invalidDateTime;
+}
+
+/**
+ * Writes @p entries, which must be sorted, as a version 6 snapshot.
+ */
+static bool writeSnapshot(const QString &filename, const KonqHistoryList &entries)
+{
+    QSaveFile file(filename);
+    if (!file.open(QIODevice::WriteOnly)) {
+        qWarning() << "Can't open" << file.fileName() << "for saving history";
+        return false;
+    }
+
+    QByteArray records;
+    QByteArray data;
+    quint32 offset = s_snapshotHeaderSize + 4 * entries.count();
+    QListIterator<KonqHistoryEntry> it(entries);
+    while (it.hasNext()) {
+        const KonqHistoryEntry &entry = it.next();
+        appendLittleEndian(data, offset + records.size());
+        appendLittleEndian(records, dateTimeToMSecs(entry.lastVisited));
+        appendLittleEndian(records, dateTimeToMSecs(entry.firstVisited));
+        appendLittleEndian(records, quint32(entry.numberOfTimesVisited));
+        appendRecordString(records, entry.url.toEncoded());
+        appendRecordString(records, entry.url.toDisplayString().toUtf8());
+        appendRecordString(records, entry.typedUrl.toUtf8());
+        appendRecordString(records, entry.title.toUtf8());
+    }
+    data += records;
+
+    uchar header[s_snapshotHeaderSize];
+    qToBigEndian<quint32>(KonqHistoryLoader::historyVersion(), header);
+    qToLittleEndian<quint32>(entries.count(), header + 4);
+    qToLittleEndian<quint32>(crc32(0, reinterpret_cast<const unsigned char *>(data.constData()), data.size()), header + 8);
+    file.write(reinterpret_cast<const char *>(header), s_snapshotHeaderSize);
+    file.write(data);
+
+    return file.commit();
+}
+
+bool KonqHistoryLoader::compact(int maxCount, int maxAgeDays)
+{
+    QDir().mkpath(historyDir());
+    QLockFile compactionLock(historyDir() + QLatin1String("/konq_history.compact.lock"));
+    if (!compactionLock.tryLock(0)) {
+        return false;
+    }
+
+    {
+        // Move the journal aside, new records go to a fresh journal meanwhile.
+        // A leftover from an interrupted compaction gets merged first.
+        QLockFile lock(journalLockFileName());
+        lock.lock();
+        if (!QFile::exists(compactingJournalFileName())) {
+            if (!QFile::exists(journalFileName())) {
+                return true;
+            }
+            if (!QFile::rename(journalFileName(), compactingJournalFileName())) {
+                qWarning() << "Can't rename" << journalFileName();
+                return false;
+            }
+        }
+    }
+
+    // Replaying records is idempotent, so readers seeing both the new snapshot
+    // and the compacting journal until it's removed below is fine.
+    KonqHistoryLoaderPrivate data;
+    bool found;
+    data.readSnapshot(snapshotFileName(), &found);
+    data.replayJournals(QStringList() << compactingJournalFileName());
+    data.sortEntries();
+    data.closeSnapshot();
+
+    KonqHistoryList &sorted = data.m_history;
+    const QDateTime expirationDate(QDate::currentDate().addDays(-maxAgeDays));
+    while (!sorted.isEmpty() &&
+            (sorted.count() > maxCount ||
+             (maxAgeDays > 0 && sorted.first().lastVisited.isValid() && sorted.first().lastVisited < expirationDate))) {
+        sorted.removeFirst();
+    }
+
+    if (!writeSnapshot(snapshotFileName(), sorted)) {
+        return false;
+    }
+
+    QLockFile lock(journalLockFileName());
+    lock.lock();
+    return QFile::remove(compactingJournalFileName());
 }
@@ -23,16 +23,32 @@
 
 #include "libkonq_export.h"
 #include <QObject>
+#include <QList>
 
+class QUrl;
+class KonqHistoryEntry;
 class KonqHistoryList;
 class KonqHistoryLoaderPrivate;
 
 /**
  * @internal
  * This class loads the Konqueror history file.
+ *
+ * Since version 5, the history is stored as a snapshot ("konq_history")
+ * plus an append-only journal
+ * ("konq_history.journal") of add/update/remove/clear records, each with
+ * its own checksum. Recording a visit only appends one record to the journal;
+ * compact() merges the journal back into the snapshot from time to time.
+ * Version 4 snapshots are still read.
+ *
+ * Since version 6, the snapshot is kept sorted and laid out so that it can be
+ * mmapped and decoded without QDataStream; the url strings for display
+ * are stored as well, and only decoded on request (see displayUrl()).
+ * The checksum still covers the whole file and the other fields of all
+ * entries are decoded while loading.
  * @since 4.3
  */
-class KonqHistoryLoader : public QObject
+class LIBKONQ_EXPORT KonqHistoryLoader : public QObject
 {
     Q_OBJECT
 
@@ -47,12 +63,60 @@ public:
 
     /**
      * @returns the list of all history entries, sorted by date
-     * (oldest entries first)
+     * (oldest entries first). No two entries have the same url.
      */
     const KonqHistoryList &entries() const;
 
+    /**
+     * @returns the url of entries().at(@p index) for display, i.e.
+     * url.toDisplayString(), read from the history file when possible.
+     */
+    QString displayUrl(int index) const;
+
     static int historyVersion();
 
+    /**
+     * Appends an add/update record for @p entry to the journal.
+     * @p entry must hold the complete, merged state of the entry.
+     */
+    static bool journalAddEntry(const KonqHistoryEntry &entry);
+
+    /**
+     * Appends a remove record for each of @p urls to the journal.
+     */
+    static bool journalRemoveEntries(const QList<QUrl> &urls);
+
+    /**
+     * Appends a record clearing the whole history to the journal.
+     */
+    static bool journalClear();
+
+    /**
+     * The journal records written by the methods above, to collect several
+     * of them and write them at once with appendToJournal().
+     */
+    static QByteArray addEntryRecord(const KonqHistoryEntry &entry);
+    static QByteArray removeEntryRecord(const QUrl &url);
+    static QByteArray clearRecord();
+
+    /**
+     * Appends @p records to the journal, in one write.
+     */
+    static bool appendToJournal(const QByteArray &records);
+
+    /**
+     * @returns the current size of the journal, in bytes.
+     */
+    static qint64 journalSize();
+
+    /**
+     * Merges the journal into a new snapshot, dropping the oldest entries
+     * beyond @p maxCount and the ones older than @p maxAgeDays (0 for no limit).
+     * This only works on the files, not on any in-memory history, so it can
+     * run in any thread. Returns false if another compaction is in progress.
+     */
+    static bool compact(int maxCount, int maxAgeDays);
+
 private:
     KonqHistoryLoaderPrivate *const d;
 };
@@ -24,13 +24,72 @@
 #include <kconfiggroup.h>
 #include <ksharedconfig.h>
 #include "konq_historyloader_p.h"
+#include "konq_indexedhistorylist_p.h"
 #include <KSharedConfig>
 
+#include <QCoreApplication>
 #include <QtDBus>
-#include <QSaveFile>
-#include <QStandardPaths>
+#include <QRunnable>
+#include <QThreadPool>
+#include <QTimer>
 
-#include <zlib.h> // for crc32
+// Version of the history broadcast protocol.
+// 1: one notifyHistoryEntry signal per entry
+// 2: entries are coalesced into notifyHistoryEntries signals
+static const int s_broadcastProtocolVersion = 2;
+
+// How long new entries are collected before being broadcast, in ms
+static const int s_broadcastDelay = 100;
+
+// The process owning this D-Bus name saves the history for all processes
+static const char s_historyWriterDBusName[] = "org.kde.konqueror.historywriter";
+
+// How long changes are collected before the history writer saves them, in ms
+static const int s_saveDelay = 1000;
+
+// Beyond this size, the writer doesn't seem to confirm saving, and the other
+// processes stop keeping the changes for it
+static const int s_maxUnconfirmedSize = 4 * 1024 * 1024;
+
+// Beyond this size, the history journal gets merged into the snapshot
+static const qint64 s_maxJournalSize = 256 * 1024;
+
+/**
+ * Merges the visits recorded in @p visit into @p entry, for the same url.
+ * This is how the receivers of a broadcast entry update their list.
+ */
+static void mergeVisit(KonqHistoryEntry &entry, const KonqHistoryEntry &visit)
+{
+    if (!visit.typedUrl.isEmpty()) {
+        entry.typedUrl = visit.typedUrl;
+    }
+    if (!visit.title.isEmpty()) {
+        entry.title = visit.title;
+    }
+    entry.numberOfTimesVisited += visit.numberOfTimesVisited;
+    entry.lastVisited = visit.lastVisited;
+}
+
+/**
+ * Merges the history journal into the snapshot file, in a worker thread.
+ */
+class KonqHistoryCompactionJob : public QRunnable
+{
+public:
+    KonqHistoryCompactionJob(int maxCount, int maxAgeDays)
+        : m_maxCount(maxCount), m_maxAgeDays(maxAgeDays)
+    {
+    }
+
+    void run() Q_DECL_OVERRIDE
+    {
+        KonqHistoryLoader::compact(m_maxCount, m_maxAgeDays);
+    }
+
+private:
+    int m_maxCount;
+    int m_maxAgeDays;
+};
 
 class KonqHistoryProviderPrivate : public QObject, QDBusContext
 {
@@ -46,16 +105,87 @@ public:
     void adjustSize();
 
     /**
-     * Saves the entire history.
+     * Merges the history journal into a new snapshot of the history file,
+     * in a worker thread. Changes are saved by appending to the journal
+     * (see KonqHistoryLoader), this only keeps the journal short.
      */
-    bool saveHistory();
+    void compactHistory();
+
+    /**
+     * Calls compactHistory() if the journal grew too big.
+     */
+    void compactHistoryIfNeeded();
+
+    /**
+     * Queues the journal @p records of a change this process was notified
+     * about. The history writer saves them shortly, and tells the other
+     * processes when it did; until then, they keep them in case the writer
+     * goes away and they have to take over. If the election failed
+     * (no D-Bus daemon...), the process which made the change saves it.
+     */
+    void recordChange(const QByteArray &records, bool isSender);
+
+    /**
+     * Appends the first @p length bytes of the queued records to the journal.
+     */
+    void writeUnsavedRecords(int length);
+
+    /**
+     * Compacts the history once the queued records are saved,
+     * if this process saves them.
+     */
+    void compactAfterSaving(bool isSender);
+
+    /**
+     * Tries to become the history writer, or queues for it.
+     */
+    void registerAsWriter();
+
+    /**
+     * Called when this process exits: saves what we know about and hands
+     * the history writer name over to the next process in the queue.
+     */
+    void unregisterAsWriter();
+
+    /**
+     * Adds @p entry to the entries broadcast by the next
+     * notifyHistoryEntries signal, merging it with a previous
+     * entry for the same url.
+     */
+    void queueHistoryEntry(const KonqHistoryEntry &entry);
+
+    /**
+     * Adds (or updates) the entry received from a broadcast to the history.
+     */
+    void addEntry(const KonqHistoryEntry &e, bool isSender);
+
+    /**
+     * Remembers that @p service only understands the version 1 protocol,
+     * until it goes away.
+     */
+    void addLegacyPeer(const QString &service);
+
+    /**
+     * Asks the other konqueror processes which broadcast protocol they use.
+     */
+    void probePeers();
+
+public Q_SLOTS: // DBUS methods
+    /**
+     * @returns the version of the history broadcast protocol this process
+     * understands. Processes without this method only know version 1.
+     */
+    Q_SCRIPTABLE int historyProtocolVersion() const
+    {
+        return s_broadcastProtocolVersion;
+    }
 
 Q_SIGNALS: // DBUS methods/signals,  they have to match org.kde.Konqueror.HistoryManager.xml
     friend class KonqHistoryProvider;
     /**
      * Every konqueror instance broadcasts new history entries to the other
      * konqueror instances. Those add the entry to their list, but don't
-     * save the list, because the sender saves the list.
+     * save the list, because the history writer process saves the list.
      *
      * @param e the new history entry
      * @param saveId is the dbus service of the sender so that
@@ -63,6 +193,15 @@ Q_SIGNALS: // DBUS methods/signals,  they have to match org.kde.Konqueror.Histor
      */
     void notifyHistoryEntry(const QByteArray &historyEntry);
 
+    /**
+     * Like notifyHistoryEntry, for several entries at once: entries added
+     * shortly one after the other are collected and sent together, with
+     * repeated visits to the same url merged into one entry.
+     *
+     * @param historyEntries the number of entries, then the entries
+     */
+    void notifyHistoryEntries(const QByteArray &historyEntries);
+
     /**
      * Called when the configuration of the maximum count changed.
      * Called via DBUS by some config-module
@@ -82,23 +221,59 @@ Q_SIGNALS: // DBUS methods/signals,  they have to match org.kde.Konqueror.Histor
 
     /**
      * Notifes about a url that has to be removed from the history.
-     * The sender instance has to save the history.
+     * The history writer process has to save the history.
      */
     void notifyRemove(const QString &url);
 
     /**
      * Notifes about a list of urls that has to be removed from the history.
-     * The sender instance has to save the history.
+     * The history writer process has to save the history.
      */
     void notifyRemoveList(const QStringList &urls);
 
+    /**
+     * Sent by the history writer before saving. When it receives it back,
+     * it got every change broadcast before, and so did the other processes:
+     * it saves them, then sends notifyHistorySaved with the same @p token.
+     * This relies on the bus delivering the signals to everyone in the
+     * same order, which dbus-daemon does.
+     */
+    void notifyHistorySaving(uint token);
+
+    /**
+     * Sent by the history writer when it saved the changes broadcast before
+     * its notifyHistorySaving signal with the same @p token. The other
+     * processes don't need to keep those anymore.
+     */
+    void notifyHistorySaved(uint token);
+
 private Q_SLOTS: // connected to DBUS signals
     void slotNotifyHistoryEntry(const QByteArray &historyEntry);
+    void slotNotifyHistoryEntries(const QByteArray &historyEntries);
     void slotNotifyMaxCount(int count);
     void slotNotifyMaxAge(int days);
     void slotNotifyClear();
     void slotNotifyRemove(const QString &url);
     void slotNotifyRemoveList(const QStringList &urls);
+    void slotNotifyHistorySaving(uint token);
+    void slotNotifyHistorySaved(uint token);
+
+    /**
+     * Sends the queued entries.
+     */
+    void flushHistoryEntries();
+
+    void slotListNamesFinished(QDBusPendingCallWatcher *watcher);
+    void slotProbeFinished(QDBusPendingCallWatcher *watcher);
+    void slotLegacyPeerUnregistered(const QString &service);
+
+    /**
+     * Saves the queued journal records, if this process saves them.
+     * The history writer only starts saving them, see notifyHistorySaving.
+     */
+    void flushUnsavedRecords();
+
+    void slotServiceRegistered(const QString &service);
 
 public:
     KSharedConfig::Ptr konqConfig()
@@ -108,14 +283,44 @@ public:
         return KSharedConfig::openConfig(QStringLiteral("konquerorrc"));
     }
 
-    KonqHistoryList m_history;
+    KonqIndexedHistoryList m_history;
+    QStringList m_loadedDisplayUrls; // for KonqHistoryManager, see takeLoadedDisplayUrls()
     int m_maxCount;   // maximum of history entries
     int m_maxAgeDays; // maximum age of a history entry
     KonqHistoryProvider *q;
+
+    QList<KonqHistoryEntry> m_queuedEntries; // not broadcast yet
+    QTimer m_broadcastTimer;
+    // Processes which need a notifyHistoryEntry signal per entry
+    QSet<QString> m_legacyPeers;
+    QDBusServiceWatcher *m_legacyPeerWatcher;
+    quint64 m_sentMessages;
+    quint64 m_receivedMessages;
+
+    enum WriterState {
+        NoElection,  // couldn't register or queue for the writer name
+        IsWriter,
+        OtherWriter
+    };
+    WriterState m_writerState;
+    // Journal records not written yet; in the other processes, not confirmed
+    // to be written by the history writer yet
+    QByteArray m_unsavedRecords;
+    QTimer m_saveTimer;
+    uint m_saveToken; // of our last notifyHistorySaving
+    bool m_compactAfterSave;
+    // The last notifyHistorySaving received: its sender, its token, and
+    // how much of m_unsavedRecords it covers
+    QString m_saveMarkService;
+    uint m_saveMarkToken;
+    int m_saveMarkLength;
 };
 
 KonqHistoryProviderPrivate::KonqHistoryProviderPrivate(KonqHistoryProvider *qq)
-    : QObject(), QDBusContext(), q(qq)
+    : QObject(), QDBusContext(), q(qq),
+      m_legacyPeerWatcher(0), m_sentMessages(0), m_receivedMessages(0),
+      m_writerState(NoElection), m_saveToken(0), m_compactAfterSave(false),
+      m_saveMarkToken(0), m_saveMarkLength(0)
 {
     // defaults
     KConfigGroup cs(konqConfig(), "HistorySettings");
@@ -127,13 +332,191 @@ KonqHistoryProviderPrivate::KonqHistoryProviderPrivate(KonqHistoryProvider *qq)
     const QString dbusInterface = QStringLiteral("org.kde.Konqueror.HistoryManager");
 
     QDBusConnection dbus = QDBusConnection::sessionBus();
-    dbus.registerObject(dbusPath, this, QDBusConnection::ExportAllSignals);
+    dbus.registerObject(dbusPath, this, QDBusConnection::ExportAllSignals | QDBusConnection::ExportScriptableSlots);
     dbus.connect(QString(), dbusPath, dbusInterface, QStringLiteral("notifyClear"), this, SLOT(slotNotifyClear()));
     dbus.connect(QString(), dbusPath, dbusInterface, QStringLiteral("notifyHistoryEntry"), this, SLOT(slotNotifyHistoryEntry(QByteArray)));
+    dbus.connect(QString(), dbusPath, dbusInterface, QStringLiteral("notifyHistoryEntries"), this, SLOT(slotNotifyHistoryEntries(QByteArray)));
     dbus.connect(QString(), dbusPath, dbusInterface, QStringLiteral("notifyMaxAge"), this, SLOT(slotNotifyMaxAge(int)));
     dbus.connect(QString(), dbusPath, dbusInterface, QStringLiteral("notifyMaxCount"), this, SLOT(slotNotifyMaxCount(int)));
     dbus.connect(QString(), dbusPath, dbusInterface, QStringLiteral("notifyRemove"), this, SLOT(slotNotifyRemove(QString)));
     dbus.connect(QString(), dbusPath, dbusInterface, QStringLiteral("notifyRemoveList"), this, SLOT(slotNotifyRemoveList(QStringList)));
+    dbus.connect(QString(), dbusPath, dbusInterface, QStringLiteral("notifyHistorySaving"), this, SLOT(slotNotifyHistorySaving(uint)));
+    dbus.connect(QString(), dbusPath, dbusInterface, QStringLiteral("notifyHistorySaved"), this, SLOT(slotNotifyHistorySaved(uint)));
+
+    m_broadcastTimer.setSingleShot(true);
+    m_broadcastTimer.setInterval(s_broadcastDelay);
+    connect(&m_broadcastTimer, SIGNAL(timeout()), this, SLOT(flushHistoryEntries()));
+
+    m_legacyPeerWatcher = new QDBusServiceWatcher(this);
+    m_legacyPeerWatcher->setConnection(dbus);
+    m_legacyPeerWatcher->setWatchMode(QDBusServiceWatcher::WatchForUnregistration);
+    connect(m_legacyPeerWatcher, SIGNAL(serviceUnregistered(QString)), this, SLOT(slotLegacyPeerUnregistered(QString)));
+
+    probePeers();
+
+    m_saveTimer.setSingleShot(true);
+    m_saveTimer.setInterval(s_saveDelay);
+    connect(&m_saveTimer, SIGNAL(timeout()), this, SLOT(flushUnsavedRecords()));
+    registerAsWriter();
+}
+
+static QString dbusService()
+{
+    return QDBusConnection::sessionBus().baseService();
+}
+
+/**
+ * Returns whether the D-Bus call we are handling was a call from us self
+ */
+static bool isSenderOfSignal(const QDBusMessage &msg)
+{
+    return dbusService() == msg.service();
+}
+
+void KonqHistoryProviderPrivate::registerAsWriter()
+{
+    QDBusConnectionInterface *dbusInterface = QDBusConnection::sessionBus().interface();
+    if (!dbusInterface) {
+        return;
+    }
+    // Queue for the name, so that the bus hands it over to the next process
+    // when the writer exits
+    connect(dbusInterface, SIGNAL(serviceRegistered(QString)), this, SLOT(slotServiceRegistered(QString)));
+    QDBusReply<QDBusConnectionInterface::RegisterServiceReply> reply =
+        dbusInterface->registerService(QString::fromLatin1(s_historyWriterDBusName),
+                                       QDBusConnectionInterface::QueueService,
+                                       QDBusConnectionInterface::DontAllowReplacement);
+    if (!reply.isValid() || reply.value() == QDBusConnectionInterface::ServiceNotRegistered) {
+        qWarning() << "Can't queue for" << s_historyWriterDBusName << reply.error().message();
+        return;
+    }
+    if (m_writerState == NoElection) { // unless slotServiceRegistered got called already
+        m_writerState = reply.value() == QDBusConnectionInterface::ServiceRegistered ? IsWriter : OtherWriter;
+    }
+}
+
+void KonqHistoryProviderPrivate::slotServiceRegistered(const QString &service)
+{
+    if (service == QLatin1String(s_historyWriterDBusName)) {
+        m_writerState = IsWriter;
+        // Save what the previous writer may not have saved
+        flushUnsavedRecords();
+    }
+}
+
+void KonqHistoryProviderPrivate::unregisterAsWriter()
+{
+    if (m_writerState != IsWriter) {
+        return;
+    }
+    // Our last visits are broadcast, and the other processes keep them for
+    // the next writer, but there may be no other process: save them now,
+    // together with what we didn't save yet. Saving some records twice is
+    // fine, they contain the whole entry.
+    foreach (const KonqHistoryEntry &e, m_queuedEntries) {
+        KonqHistoryEntry entry = e;
+        KonqHistoryList::const_iterator existingEntry = q->constFindEntry(e.url);
+        if (existingEntry != m_history.list().constEnd()) {
+            entry = *existingEntry;
+            mergeVisit(entry, e);
+        }
+        m_unsavedRecords += KonqHistoryLoader::addEntryRecord(entry);
+    }
+    flushHistoryEntries();
+    writeUnsavedRecords(m_unsavedRecords.size());
+
+    QDBusConnectionInterface *dbusInterface = QDBusConnection::sessionBus().interface();
+    if (dbusInterface) {
+        dbusInterface->unregisterService(QString::fromLatin1(s_historyWriterDBusName));
+    }
+    m_writerState = OtherWriter;
+}
+
+void KonqHistoryProviderPrivate::recordChange(const QByteArray &records, bool isSender)
+{
+    switch (m_writerState) {
+    case NoElection:
+        if (!isSender) {
+            return;
+        }
+        break;
+    case OtherWriter:
+        m_unsavedRecords += records;
+        if (m_unsavedRecords.size() > s_maxUnconfirmedSize) {
+            qWarning() << "The history writer doesn't confirm saving the history";
+            m_unsavedRecords.clear();
+            m_saveMarkService.clear();
+        }
+        return;
+    case IsWriter:
+        break;
+    }
+    m_unsavedRecords += records;
+    // Not restarted by later changes, so that they are never delayed
+    // by more than s_saveDelay
+    if (!m_saveTimer.isActive()) {
+        m_saveTimer.start();
+    }
+}
+
+void KonqHistoryProviderPrivate::flushUnsavedRecords()
+{
+    m_saveTimer.stop();
+    if (m_unsavedRecords.isEmpty()) {
+        return;
+    }
+    if (m_writerState == IsWriter) {
+        // See slotNotifyHistorySaving()
+        emit notifyHistorySaving(++m_saveToken);
+    } else if (m_writerState == NoElection) {
+        writeUnsavedRecords(m_unsavedRecords.size());
+    }
+}
+
+void KonqHistoryProviderPrivate::writeUnsavedRecords(int length)
+{
+    if (length > 0) {
+        KonqHistoryLoader::appendToJournal(m_unsavedRecords.left(length));
+        m_unsavedRecords.remove(0, length);
+    }
+    if (m_compactAfterSave) {
+        m_compactAfterSave = false;
+        compactHistory();
+    } else {
+        compactHistoryIfNeeded();
+    }
+}
+
+void KonqHistoryProviderPrivate::compactAfterSaving(bool isSender)
+{
+    if (m_writerState == IsWriter && !m_unsavedRecords.isEmpty()) {
+        m_compactAfterSave = true;
+        flushUnsavedRecords();
+    } else if (m_writerState == IsWriter || (m_writerState == NoElection && isSender)) {
+        flushUnsavedRecords();
+        compactHistory();
+    }
+}
+
+void KonqHistoryProviderPrivate::slotNotifyHistorySaving(uint token)
+{
+    m_saveMarkService = message().service();
+    m_saveMarkToken = token;
+    m_saveMarkLength = m_unsavedRecords.size();
+    if (m_writerState == IsWriter && isSenderOfSignal(message())) {
+        // Every change broadcast before this signal is in m_unsavedRecords now
+        writeUnsavedRecords(m_saveMarkLength);
+        m_saveMarkService.clear();
+        emit notifyHistorySaved(token);
+    }
+}
+
+void KonqHistoryProviderPrivate::slotNotifyHistorySaved(uint token)
+{
+    if (message().service() == m_saveMarkService && token == m_saveMarkToken) {
+        m_unsavedRecords.remove(0, m_saveMarkLength);
+        m_saveMarkService.clear();
+    }
 }
 
 ////
@@ -145,12 +528,16 @@ KonqHistoryProvider::KonqHistoryProvider(QObject *parent)
 
 KonqHistoryProvider::~KonqHistoryProvider()
 {
+    // Don't lose the last visits
+    d->unregisterAsWriter();
+    d->flushHistoryEntries();
+    d->flushUnsavedRecords();
     delete d;
 }
 
 const KonqHistoryList &KonqHistoryProvider::entries() const
 {
-    return d->m_history;
+    return d->m_history.list();
 }
 
 bool KonqHistoryProvider::loadHistory()
@@ -160,11 +547,14 @@ bool KonqHistoryProvider::loadHistory()
         return false;
     }
 
-    d->m_history = loader.entries();
+    d->m_history.assign(loader.entries());
+    d->m_loadedDisplayUrls.clear();
 
     d->adjustSize();
 
-    QListIterator<KonqHistoryEntry> it(d->m_history);
+    // adjustSize() only removes the oldest entries
+    int loaderIndex = loader.entries().count() - d->m_history.list().count();
+    QListIterator<KonqHistoryEntry> it(d->m_history.list());
     while (it.hasNext()) {
         const KonqHistoryEntry &entry = it.next();
 
@@ -173,56 +563,113 @@ bool KonqHistoryProvider::loadHistory()
         KParts::HistoryProvider::insert(urlString);
         // DF: also insert the "pretty" version if different
         // This helps getting 'visited' links on websites which don't use fully-escaped urls.
-        const QString prettyUrlString = entry.url.toDisplayString();
+        const QString prettyUrlString = loader.displayUrl(loaderIndex++);
         if (urlString != prettyUrlString) {
             KParts::HistoryProvider::insert(prettyUrlString);
         }
+        d->m_loadedDisplayUrls.append(prettyUrlString);
     }
 
     return true;
 }
 
+QStringList KonqHistoryProvider::takeLoadedDisplayUrls()
+{
+    QStringList urls;
+    urls.swap(d->m_loadedDisplayUrls);
+    return urls;
+}
+
 void KonqHistoryProviderPrivate::adjustSize()
 {
-    if (m_history.isEmpty()) {
+    if (m_history.list().isEmpty()) {
         return;
     }
 
-    KonqHistoryEntry entry = m_history.first();
+    KonqHistoryEntry entry = m_history.list().first();
     const QDateTime expirationDate(QDate::currentDate().addDays(-m_maxAgeDays));
 
-    while (m_history.count() > qint32(m_maxCount) ||
+    while (m_history.list().count() > qint32(m_maxCount) ||
             (m_maxAgeDays > 0 && entry.lastVisited.isValid() && entry.lastVisited < expirationDate)) { // i.e. entry is expired
         q->removeEntry(m_history.begin());
 
-        if (m_history.isEmpty()) {
+        if (m_history.list().isEmpty()) {
             break;
         }
-        entry = m_history.first();
+        entry = m_history.list().first();
     }
 }
 
-static QString dbusService()
+void KonqHistoryProvider::emitAddToHistory(const KonqHistoryEntry &entry)
 {
-    return QDBusConnection::sessionBus().baseService();
+    d->queueHistoryEntry(entry);
 }
 
-void KonqHistoryProvider::emitAddToHistory(const KonqHistoryEntry &entry)
+void KonqHistoryProviderPrivate::queueHistoryEntry(const KonqHistoryEntry &entry)
 {
     QByteArray data;
     QDataStream stream(&data, QIODevice::WriteOnly);
     entry.save(stream, KonqHistoryEntry::MarshalUrlAsStrings);
-    stream << dbusService();
     // Protection against very long urls (like data:)
     if (data.size() > 4096) {
         return;
     }
-    emit d->notifyHistoryEntry(data);
+
+    // Merge it the same way the receivers would do
+    QList<KonqHistoryEntry>::iterator it = m_queuedEntries.begin();
+    for (; it != m_queuedEntries.end(); ++it) {
+        if ((*it).url == entry.url) {
+            mergeVisit(*it, entry);
+            return;
+        }
+    }
+    m_queuedEntries.append(entry);
+
+    // Not restarted by later entries, so that entries are never delayed
+    // by more than s_broadcastDelay
+    if (!m_broadcastTimer.isActive()) {
+        m_broadcastTimer.start();
+    }
+}
+
+void KonqHistoryProviderPrivate::flushHistoryEntries()
+{
+    m_broadcastTimer.stop();
+    if (m_queuedEntries.isEmpty()) {
+        return;
+    }
+
+    QByteArray data;
+    QDataStream stream(&data, QIODevice::WriteOnly);
+    stream << quint32(m_queuedEntries.count());
+    foreach (const KonqHistoryEntry &entry, m_queuedEntries) {
+        entry.save(stream, KonqHistoryEntry::MarshalUrlAsStrings);
+    }
+    emit notifyHistoryEntries(data);
+    ++m_sentMessages;
+
+    if (!m_legacyPeers.isEmpty()) {
+        // Old processes only listen to notifyHistoryEntry. The protocol version
+        // tells the other processes to ignore these, they got the entries already.
+        foreach (const KonqHistoryEntry &entry, m_queuedEntries) {
+            QByteArray single;
+            QDataStream singleStream(&single, QIODevice::WriteOnly);
+            entry.save(singleStream, KonqHistoryEntry::MarshalUrlAsStrings);
+            singleStream << dbusService() << qint32(s_broadcastProtocolVersion);
+            emit notifyHistoryEntry(single);
+            ++m_sentMessages;
+        }
+    }
+
+    m_queuedEntries.clear();
 }
 
 void KonqHistoryProvider::emitRemoveFromHistory(const QUrl &url)
 {
+    // Keep the order of the changes
+    d->flushHistoryEntries();
     emit d->notifyRemove(url.url());
+    ++d->m_sentMessages;
 }
 
 void KonqHistoryProvider::emitRemoveListFromHistory(const QList<QUrl> &urls)
@@ -231,34 +678,128 @@ void KonqHistoryProvider::emitRemoveListFromHistory(const QList<QUrl> &urls)
     foreach (const QUrl &url, urls) {
         result << url.url();
     }
+    d->flushHistoryEntries();
     emit d->notifyRemoveList(result);
+    ++d->m_sentMessages;
 }
 
 void KonqHistoryProvider::emitClear()
 {
+    d->flushHistoryEntries();
     emit d->notifyClear();
+    ++d->m_sentMessages;
 }
 
 void KonqHistoryProvider::emitSetMaxCount(int count)
 {
+    d->flushHistoryEntries();
     emit d->notifyMaxCount(count);
+    ++d->m_sentMessages;
 }
 
 void KonqHistoryProvider::emitSetMaxAge(int days)
 {
+    d->flushHistoryEntries();
     emit d->notifyMaxAge(days);
+    ++d->m_sentMessages;
+}
+
+quint64 KonqHistoryProvider::sentMessageCount() const
+{
+    return d->m_sentMessages;
+}
+
+quint64 KonqHistoryProvider::receivedMessageCount() const
+{
+    return d->m_receivedMessages;
 }
 
 /**
- * Returns whether the D-Bus call we are handling was a call from us self
+ * @returns whether @p service is the name of a konqueror process:
+ * org.kde.konqueror or, with KDBusService::Multiple, org.kde.konqueror-<pid>
  */
-static bool isSenderOfSignal(const QDBusMessage &msg)
+static bool isKonquerorService(const QString &service)
 {
-    return dbusService() == msg.service();
+    const QLatin1String prefix("org.kde.konqueror");
+    if (service == prefix) {
+        return true;
+    }
+    if (!service.startsWith(prefix) || service.length() < prefix.size() + 2 ||
+            service.at(prefix.size()) != QLatin1Char('-')) {
+        return false;
+    }
+    bool ok;
+    service.mid(prefix.size() + 1).toLongLong(&ok);
+    return ok;
+}
+
+void KonqHistoryProviderPrivate::probePeers()
+{
+    // Asynchronously, not to block the startup on the bus
+    QDBusConnection dbus = QDBusConnection::sessionBus();
+    if (!dbus.isConnected()) {
+        return;
+    }
+    QDBusMessage call = QDBusMessage::createMethodCall(QStringLiteral("org.freedesktop.DBus"),
+                        QStringLiteral("/org/freedesktop/DBus"),
+                        QStringLiteral("org.freedesktop.DBus"),
+                        QStringLiteral("ListNames"));
+    QDBusPendingCallWatcher *watcher = new QDBusPendingCallWatcher(dbus.asyncCall(call), this);
+    connect(watcher, SIGNAL(finished(QDBusPendingCallWatcher*)), this, SLOT(slotListNamesFinished(QDBusPendingCallWatcher*)));
+}
+
+void KonqHistoryProviderPrivate::slotListNamesFinished(QDBusPendingCallWatcher *watcher)
+{
+    watcher->deleteLater();
+    QDBusPendingReply<QStringList> reply = *watcher;
+    if (reply.isError()) {
+        return;
+    }
+    QDBusConnection dbus = QDBusConnection::sessionBus();
+    const QString ourService = QStringLiteral("org.kde.konqueror-%1").arg(QCoreApplication::applicationPid());
+    foreach (const QString &service, reply.value()) {
+        // If we own org.kde.konqueror, we answer with our own protocol version,
+        // which is fine
+        if (!isKonquerorService(service) || service == ourService) {
+            continue;
+        }
+        QDBusMessage call = QDBusMessage::createMethodCall(service, QStringLiteral("/KonqHistoryManager"),
+                            QStringLiteral("org.kde.Konqueror.HistoryManager"),
+                            QStringLiteral("historyProtocolVersion"));
+        QDBusPendingCallWatcher *probeWatcher = new QDBusPendingCallWatcher(dbus.asyncCall(call), this);
+        probeWatcher->setProperty("service", service);
+        connect(probeWatcher, SIGNAL(finished(QDBusPendingCallWatcher*)), this, SLOT(slotProbeFinished(QDBusPendingCallWatcher*)));
+    }
+}
+
+void KonqHistoryProviderPrivate::slotProbeFinished(QDBusPendingCallWatcher *watcher)
+{
+    const QDBusMessage reply = watcher->reply();
+    // UnknownObject: this process doesn't maintain a history at all
+    if (reply.type() == QDBusMessage::ErrorMessage &&
+            reply.errorName() == QLatin1String("org.freedesktop.DBus.Error.UnknownMethod")) {
+        addLegacyPeer(watcher->property("service").toString());
+    }
+    watcher->deleteLater();
+}
+
+void KonqHistoryProviderPrivate::addLegacyPeer(const QString &service)
+{
+    if (!m_legacyPeers.contains(service)) {
+        m_legacyPeers.insert(service);
+        m_legacyPeerWatcher->addWatchedService(service);
+    }
+}
+
+void KonqHistoryProviderPrivate::slotLegacyPeerUnregistered(const QString &service)
+{
+    m_legacyPeers.remove(service);
+    m_legacyPeerWatcher->removeWatchedService(service);
 }
 
 void KonqHistoryProviderPrivate::slotNotifyHistoryEntry(const QByteArray &data)
 {
+    ++m_receivedMessages;
     KonqHistoryEntry e;
     QDataStream stream(const_cast<QByteArray *>(&data), QIODevice::ReadOnly);
 
@@ -269,6 +810,40 @@ void KonqHistoryProviderPrivate::slotNotifyHistoryEntry(const QByteArray &data)
     e.load(stream, KonqHistoryEntry::MarshalUrlAsStrings);
     //kDebug(1202) << "Got new entry from Broadcast:" << e.url;
 
+    QString senderService;
+    qint32 protocolVersion = 1;
+    stream >> senderService;
+    if (!stream.atEnd()) {
+        stream >> protocolVersion;
+    }
+    const bool isSender = isSenderOfSignal(message());
+    if (protocolVersion >= 2) {
+        return; // a copy of an entry we got via notifyHistoryEntries
+    }
+    if (!isSender) {
+        // This process will only hear from us via notifyHistoryEntry
+        addLegacyPeer(message().service());
+    }
+
+    addEntry(e, isSender);
+}
+
+void KonqHistoryProviderPrivate::slotNotifyHistoryEntries(const QByteArray &data)
+{
+    ++m_receivedMessages;
+    QDataStream stream(data);
+    quint32 count;
+    stream >> count;
+    const bool isSender = isSenderOfSignal(message());
+    for (quint32 i = 0; i < count && !stream.atEnd(); ++i) {
+        KonqHistoryEntry e;
+        e.load(stream, KonqHistoryEntry::MarshalUrlAsStrings);
+        addEntry(e, isSender);
+    }
+}
+
+void KonqHistoryProviderPrivate::addEntry(const KonqHistoryEntry &e, bool isSender)
+{
     KonqHistoryList::iterator existingEntry = q->findEntry(e.url);
     QString urlString = e.url.url();
     const bool newEntry = existingEntry == m_history.end();
@@ -284,14 +859,7 @@ void KonqHistoryProviderPrivate::slotNotifyHistoryEntry(const QByteArray &data)
         q->KParts::HistoryProvider::insert(urlString);
     }
 
-    if (!e.typedUrl.isEmpty()) {
-        entry.typedUrl = e.typedUrl;
-    }
-    if (!e.title.isEmpty()) {
-        entry.title = e.title;
-    }
-    entry.numberOfTimesVisited += e.numberOfTimesVisited;
-    entry.lastVisited = e.lastVisited;
+    mergeVisit(entry, e);
 
     if (newEntry) {
         m_history.append(entry);
@@ -301,13 +869,14 @@ void KonqHistoryProviderPrivate::slotNotifyHistoryEntry(const QByteArray &data)
 
     adjustSize();
 
-    q->finishAddingEntry(entry, isSenderOfSignal(message()));
+    q->finishAddingEntry(entry, isSender);
 
     emit q->entryAdded(entry);
 }
 
 void KonqHistoryProviderPrivate::slotNotifyMaxCount(int count)
 {
+    ++m_receivedMessages;
     m_maxCount = count;
     // TODO clearPending();
     adjustSize();
@@ -315,14 +884,15 @@ void KonqHistoryProviderPrivate::slotNotifyMaxCount(int count)
     KConfigGroup cs(konqConfig(), "HistorySettings");
     cs.writeEntry("Maximum of History entries", m_maxCount);
 
+    compactAfterSaving(isSenderOfSignal(message()));
     if (isSenderOfSignal(message())) {
-        saveHistory();
         cs.sync();
     }
 }
 
 void KonqHistoryProviderPrivate::slotNotifyMaxAge(int days)
 {
+    ++m_receivedMessages;
     m_maxAgeDays = days;
     // TODO clearPending();
     adjustSize();
@@ -330,52 +900,48 @@ void KonqHistoryProviderPrivate::slotNotifyMaxAge(int days)
     KConfigGroup cs(konqConfig(), "HistorySettings");
     cs.writeEntry("Maximum age of History entries", m_maxAgeDays);
 
+    compactAfterSaving(isSenderOfSignal(message()));
     if (isSenderOfSignal(message())) {
-        saveHistory();
         cs.sync();
     }
 }
 
 void KonqHistoryProviderPrivate::slotNotifyClear()
 {
+    ++m_receivedMessages;
     m_history.clear();
 
-    if (isSenderOfSignal(message())) {
-        saveHistory();
-    }
+    recordChange(KonqHistoryLoader::clearRecord(), isSenderOfSignal(message()));
+    compactAfterSaving(isSenderOfSignal(message()));
 
     q->KParts::HistoryProvider::clear(); // also emits the cleared() signal
 }
 
 void KonqHistoryProviderPrivate::slotNotifyRemove(const QString &urlStr)
 {
+    ++m_receivedMessages;
     QUrl url(urlStr);
 
     KonqHistoryList::iterator existingEntry = q->findEntry(url);
     if (existingEntry != m_history.end()) {
         q->removeEntry(existingEntry);
-        if (isSenderOfSignal(message())) {
-            saveHistory();
-        }
+        recordChange(KonqHistoryLoader::removeEntryRecord(url), isSenderOfSignal(message()));
     }
 }
 
 void KonqHistoryProviderPrivate::slotNotifyRemoveList(const QStringList &urls)
 {
-    bool doSave = false;
+    ++m_receivedMessages;
+    const bool isSender = isSenderOfSignal(message());
     QStringList::const_iterator it = urls.begin();
     for (; it != urls.end(); ++it) {
         QUrl url(*it);
-        KonqHistoryList::iterator existingEntry = m_history.findEntry(url);
+        KonqHistoryList::iterator existingEntry = q->findEntry(url);
         if (existingEntry != m_history.end()) {
             q->removeEntry(existingEntry);
-            doSave = true;
+            recordChange(KonqHistoryLoader::removeEntryRecord(url), isSender);
         }
     }
-
-    if (doSave && isSenderOfSignal(message())) {
-        saveHistory();
-    }
 }
 
 void KonqHistoryProvider::removeEntry(KonqHistoryList::iterator existingEntry)
@@ -385,7 +951,7 @@ void KonqHistoryProvider::removeEntry(KonqHistoryList::iterator existingEntry)
 
     KParts::HistoryProvider::remove(urlString);
 
-    d->m_history.erase(existingEntry);
+    d->m_history.removeAt(existingEntry - d->m_history.begin());
     emit entryRemoved(entry);
 }
 
@@ -399,61 +965,33 @@ int KonqHistoryProvider::maxAge() const
     return d->m_maxAgeDays;
 }
 
-bool KonqHistoryProviderPrivate::saveHistory()
+void KonqHistoryProviderPrivate::compactHistory()
 {
-    const QString dir = QStandardPaths::writableLocation(QStandardPaths::GenericDataLocation) + QLatin1String("/konqueror");
-    QDir().mkpath(dir);
-    const QString filename = dir + QLatin1String("/konq_history");
-    QSaveFile file(filename);
-    if (!file.open(QIODevice::WriteOnly)) {
-        qWarning() << "Can't open" << file.fileName() << "for saving history";
-        return false;
-    }
-
-    QDataStream fileStream(&file);
-    fileStream << KonqHistoryLoader::historyVersion();
-
-    QByteArray data;
-    QDataStream stream(&data, QIODevice::WriteOnly);
+    QThreadPool::globalInstance()->start(new KonqHistoryCompactionJob(m_maxCount, m_maxAgeDays));
+}
 
-    QListIterator<KonqHistoryEntry> it(m_history);
-    while (it.hasNext()) {
-        //We use QUrl for marshalling URLs in entries in the V4
-        //file format
-        it.next().save(stream, KonqHistoryEntry::NoFlags);
+void KonqHistoryProviderPrivate::compactHistoryIfNeeded()
+{
+    if (KonqHistoryLoader::journalSize() > s_maxJournalSize) {
+        compactHistory();
     }
-
-    quint32 crc = crc32(0, reinterpret_cast<unsigned char *>(data.data()), data.size());
-    fileStream << crc << data;
-
-    return file.commit();
 }
 
 KonqHistoryList::iterator KonqHistoryProvider::findEntry(const QUrl &url)
 {
-    // small optimization (dict lookup) for items _not_ in our history
-    if (!KParts::HistoryProvider::contains(url.url())) {
-        return d->m_history.end();
-    }
     return d->m_history.findEntry(url);
 }
 
 KonqHistoryList::const_iterator KonqHistoryProvider::constFindEntry(const QUrl &url) const
 {
-    // small optimization (dict lookup) for items _not_ in our history
-    if (!KParts::HistoryProvider::contains(url.url())) {
-        return d->m_history.constEnd();
-    }
-    return d->m_history.constFindEntry(url);
+    const int pos = d->m_history.indexOf(url);
+    return pos == -1 ? d->m_history.list().constEnd() : d->m_history.list().constBegin() + pos;
 }
 
 void KonqHistoryProvider::finishAddingEntry(const KonqHistoryEntry &entry, bool isSender)
 {
-    Q_UNUSED(entry); // this arg is used by konq's reimplementation
-    if (isSender) {
-        // we are the sender of the broadcast, so we save
-        d->saveHistory();
-    }
+    // Saved a bit later, together with the next changes
+    d->recordChange(KonqHistoryLoader::addEntryRecord(entry), isSender);
 }
 
 #include "konq_historyprovider.moc"
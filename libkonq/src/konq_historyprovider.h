@@ -24,6 +24,7 @@
 
 #include <kparts/historyprovider.h>
 #include <QUrl>
+#include <QStringList>
 #include "libkonq_export.h"
 #include "konq_historyentry.h"
 
@@ -36,6 +37,10 @@ class KonqHistoryProviderPrivate;
  * It synchronizes the history with other KonqHistoryProvider instances in
  * other processes (konqueror, history list, krunner etc.) via D-Bus to keep
  * one global and persistent history.
+ *
+ * Only one of those processes, the owner of the
+ * "org.kde.konqueror.historywriter" D-Bus name, writes the history to disk;
+ * when it exits, the name goes to the next process waiting for it.
  */
 class LIBKONQ_EXPORT KonqHistoryProvider : public KParts::HistoryProvider
 {
@@ -120,6 +125,21 @@ public:
      */
     bool loadHistory();
 
+    /**
+     * @returns the number of D-Bus messages this process sent to synchronize
+     * the history with the other processes. New entries are collected for a
+     * short while and sent together, so this is usually less than the number
+     * of calls to emitAddToHistory(). The messages of the history writer
+     * about saving the history are not counted.
+     */
+    quint64 sentMessageCount() const;
+
+    /**
+     * @returns the number of history D-Bus messages this process received,
+     * including its own, and not counting the ones about saving the history.
+     */
+    quint64 receivedMessageCount() const;
+
 Q_SIGNALS:
     /**
      * Emitted after a new entry was added
@@ -139,16 +159,22 @@ protected: // only to be used by konqueror's KonqHistoryManager
     virtual void removeEntry(KonqHistoryList::iterator it);
 
     /**
-     * a little optimization for KonqHistoryList::findEntry(),
-     * checking the dict of KParts::HistoryProvider before traversing the list.
-     * Can't be used everywhere, because it always returns end() for "pending"
-     * entries, as those are not added to the dict, currently.
+     * @returns entry.url.toDisplayString() for each of entries(), as read from
+     * the history file by the last call to loadHistory(), and forgets them.
+     */
+    QStringList takeLoadedDisplayUrls();
+
+    /**
+     * Finds the entry for @p url in the history, using a hash of the urls
+     * rather than traversing the list. Returns end() if there is no such entry.
      */
     KonqHistoryList::iterator findEntry(const QUrl &url);
     KonqHistoryList::const_iterator constFindEntry(const QUrl &url) const;
 
     /**
      * Notifies all running instances about a new HistoryEntry via D-Bus.
+     * The notification is delayed a little, to be sent together with the
+     * next entries.
      */
     void emitAddToHistory(const KonqHistoryEntry &entry);
 
@@ -0,0 +1,109 @@
+/* This file is part of the KDE project
+   Copyright (c) 2016 The Konqueror developers
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Library General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library; see the file COPYING.LIB.  If not, write to
+   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+*/
+
+#include "konq_indexedhistorylist_p.h"
+
+#include <QDebug>
+
+#include <algorithm>
+
+KonqIndexedHistoryList::KonqIndexedHistoryList()
+    : m_nextHandle(0)
+{
+}
+
+void KonqIndexedHistoryList::assign(const KonqHistoryList &list)
+{
+    clear();
+    m_index.reserve(list.count());
+    bool duplicates = false;
+    for (int i = 0; i < list.count(); ++i) {
+        // Later entries win, like the backwards search of KonqHistoryList does
+        if (m_index.contains(list.at(i).url)) {
+            duplicates = true;
+        }
+        m_index.insert(list.at(i).url, i);
+    }
+    if (!duplicates) {
+        m_list = list;
+    } else {
+        // The loader doesn't produce duplicates, but an old history file might
+        qWarning() << "History entries with the same url, keeping the last one";
+        m_list.reserve(list.count());
+        for (int i = 0; i < list.count(); ++i) {
+            if (m_index.value(list.at(i).url) == i) {
+                m_list.append(list.at(i));
+            }
+        }
+        m_index.clear();
+        for (int i = 0; i < m_list.count(); ++i) {
+            m_index.insert(m_list.at(i).url, i);
+        }
+    }
+
+    m_handles.reserve(m_list.count());
+    for (int i = 0; i < m_list.count(); ++i) {
+        m_handles.append(i);
+    }
+    m_nextHandle = m_list.count();
+}
+
+int KonqIndexedHistoryList::indexOf(const QUrl &url) const
+{
+    QHash<QUrl, qint64>::const_iterator it = m_index.constFind(url);
+    if (it == m_index.constEnd()) {
+        return -1;
+    }
+    // Handles only grow along the list
+    const QList<qint64>::const_iterator slot = std::lower_bound(m_handles.constBegin(), m_handles.constEnd(), it.value());
+    const int pos = int(slot - m_handles.constBegin());
+    Q_ASSERT(pos < m_list.count() && *slot == it.value() && m_list.at(pos).url == url);
+    return pos;
+}
+
+KonqHistoryList::iterator KonqIndexedHistoryList::findEntry(const QUrl &url)
+{
+    const int pos = indexOf(url);
+    return pos == -1 ? m_list.end() : m_list.begin() + pos;
+}
+
+void KonqIndexedHistoryList::append(const KonqHistoryEntry &entry)
+{
+    Q_ASSERT(!m_index.contains(entry.url));
+    m_index.insert(entry.url, m_nextHandle);
+    m_handles.append(m_nextHandle);
+    ++m_nextHandle;
+    m_list.append(entry);
+}
+
+void KonqIndexedHistoryList::removeAt(int pos)
+{
+    // The handles of the other entries stay valid
+    m_index.remove(m_list.at(pos).url);
+    m_handles.removeAt(pos);
+    m_list.removeAt(pos);
+}
+
+void KonqIndexedHistoryList::clear()
+{
+    m_list.clear();
+    m_index.clear();
+    m_handles.clear();
+    m_nextHandle = 0;
+}
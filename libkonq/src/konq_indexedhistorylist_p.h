@@ -0,0 +1,99 @@
+/* This file is part of the KDE project
+   Copyright (c) 2016 The Konqueror developers
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Library General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library; see the file COPYING.LIB.  If not, write to
+   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+*/
+
+#ifndef KONQ_INDEXEDHISTORYLIST_P_H
+#define KONQ_INDEXEDHISTORYLIST_P_H
+
+#include "libkonq_export.h"
+#include "konq_historyentry.h"
+
+#include <QHash>
+
+/**
+ * @internal
+ * The history list of KonqHistoryProvider, with a hash from url to
+ * a handle for each entry, so that finding an entry doesn't need to
+ * scan the list.
+ *
+ * Handles are assigned in increasing order as entries are appended and
+ * never change, so removing an entry doesn't touch the hash. The position
+ * of a handle is found by a binary search in the handles of the entries,
+ * kept in list order. Appending and removing are constant time but for
+ * moving the items after a removed one in the lists, lookups are logarithmic.
+ *
+ * No two entries may have the same url.
+ */
+class LIBKONQ_EXPORT KonqIndexedHistoryList
+{
+public:
+    KonqIndexedHistoryList();
+
+    const KonqHistoryList &list() const
+    {
+        return m_list;
+    }
+
+    /**
+     * Replaces all entries with @p list. If it has several entries for
+     * a url, only the last one is kept.
+     */
+    void assign(const KonqHistoryList &list);
+
+    /**
+     * @returns the position of the entry for @p url, or -1
+     */
+    int indexOf(const QUrl &url) const;
+
+    /**
+     * @returns an iterator to the entry for @p url, or end()
+     */
+    KonqHistoryList::iterator findEntry(const QUrl &url);
+
+    KonqHistoryList::iterator begin()
+    {
+        return m_list.begin();
+    }
+
+    KonqHistoryList::iterator end()
+    {
+        return m_list.end();
+    }
+
+    /**
+     * Appends @p entry, whose url must not be in the list yet.
+     */
+    void append(const KonqHistoryEntry &entry);
+
+    /**
+     * Removes the entry at @p pos.
+     */
+    void removeAt(int pos);
+
+    void clear();
+
+private:
+    KonqHistoryList m_list;
+    // url -> handle
+    QHash<QUrl, qint64> m_index;
+    // the handle of each entry of m_list, increasing
+    QList<qint64> m_handles;
+    qint64 m_nextHandle;
+};
+
+#endif /* KONQ_INDEXEDHISTORYLIST_P_H */
@@ -34,12 +34,18 @@
 #include <kauthorized.h>
 #include <kconfiggroup.h>
 #include <kurlauthorized.h>
+#include <kdirwatch.h>
 
 #include "fsview.h"
 
+// directories watched for live updates, below the current path
+static const int s_maxWatchDepth = 4;
+static const int s_maxWatchedDirs = 4096;
+
 // FSView
 
 QMap<QString, MetricEntry> FSView::_dirMetric;
+ScanIndex FSView::_dirIndex;
 
 FSView::FSView(Inode *base, QWidget *parent)
     : TreeMapWidget(base, parent)
@@ -76,6 +82,15 @@ FSView::FSView(Inode *base, QWidget *parent)
     _dirsFinished = 0;
     _lastDir = 0;
 
+    _liveUpdates = false;
+    _dirWatch = new KDirWatch(this);
+    connect(_dirWatch, SIGNAL(dirty(QString)), this, SLOT(dirChanged(QString)));
+    connect(_dirWatch, SIGNAL(created(QString)), this, SLOT(dirChanged(QString)));
+    connect(_dirWatch, SIGNAL(deleted(QString)), this, SLOT(dirDeleted(QString)));
+    _liveUpdateTimer = new QTimer(this);
+    _liveUpdateTimer->setSingleShot(true);
+    connect(_liveUpdateTimer, SIGNAL(timeout()), this, SLOT(doLiveUpdate()));
+
     _config = new KConfig(QStringLiteral("fsviewrc"));
 
     // restore TreeMap visualization options of last execution
@@ -109,7 +124,14 @@ FSView::FSView(Inode *base, QWidget *parent)
         }
     }
 
+    if (!_dirIndex.isLoaded()) {
+        _dirIndex.load(ScanIndex::defaultFile());
+    }
+    _sm.setIndex(&_dirIndex);
     _sm.setListener(this);
+
+    KConfigGroup gconfig(_config, "General");
+    setLiveUpdates(gconfig.readEntry("LiveUpdates", false));
 }
 
 FSView::~FSView()
@@ -133,6 +155,7 @@ void FSView::setPath(const QString &p)
 
     // stop any previous updating
     stop();
+    unwatchAll();
 
     QFileInfo fi(p);
     _path = fi.absoluteFilePath();
@@ -154,7 +177,7 @@ void FSView::setPath(const QString &p)
     b->setPeer(d);
 
     setWindowTitle(QStringLiteral("%1 - FSView").arg(_path));
-    requestUpdate(b);
+    requestUpdate(b, true);
 }
 
 KUrl::List FSView::selectedUrls()
@@ -201,7 +224,7 @@ void FSView::setDirMetric(const QString &k,
     _dirMetric.insert(k, MetricEntry(s, f, d));
 }
 
-void FSView::requestUpdate(Inode *i)
+void FSView::requestUpdate(Inode *i, bool reuseIndexed)
 {
     if (0) kDebug(90100) << "FSView::requestUpdate(" << i->path()
                              << ")" << endl;
@@ -214,6 +237,11 @@ void FSView::requestUpdate(Inode *i)
     peer->clear();
     i->clear();
 
+    requestUpdate(peer, reuseIndexed);
+}
+
+void FSView::requestUpdate(ScanDir *peer, bool reuseIndexed)
+{
     if (!_sm.scanRunning()) {
         QTimer::singleShot(0, this, SLOT(doUpdate()));
         QTimer::singleShot(100, this, SLOT(doRedraw()));
@@ -235,7 +263,20 @@ void FSView::requestUpdate(Inode *i)
         emit started();
     }
 
-    _sm.startScan(peer);
+    _sm.startScan(peer, reuseIndexed);
+}
+
+void FSView::scanStarted(ScanDir *d)
+{
+    if (!_liveUpdates) {
+        return;
+    }
+
+    int depth = 0;
+    for (ScanDir *p = d->parent(); p; p = p->parent()) {
+        depth++;
+    }
+    watch(d, depth);
 }
 
 void FSView::scanFinished(ScanDir *d)
@@ -314,6 +355,9 @@ void FSView::contextMenu(TreeMapItem *i, const QPoint &p)
     if (i) {
         actionRefreshSelected = popup.addAction(i18n("Refresh '%1'", i->text(0)));
     }
+    QAction *actionLiveUpdates = popup.addAction(i18n("Live Updates"));
+    actionLiveUpdates->setCheckable(true);
+    actionLiveUpdates->setChecked(_liveUpdates);
     popup.addSeparator();
     addDepthStopItems(dpopup, 1001, i);
     popup.addMenu(dpopup);
@@ -353,6 +397,103 @@ void FSView::contextMenu(TreeMapItem *i, const QPoint &p)
         if (i) {
             requestUpdate(i);
         }
+    } else if (action == actionLiveUpdates) {
+        setLiveUpdates(!_liveUpdates);
+    }
+}
+
+void FSView::setLiveUpdates(bool enabled)
+{
+    if (_liveUpdates == enabled) {
+        return;
+    }
+
+    _liveUpdates = enabled;
+    if (!enabled) {
+        unwatchAll();
+    } else if (_sm.top()) {
+        watch(_sm.top(), 0);
+    }
+}
+
+void FSView::watch(ScanDir *d, int depth)
+{
+    if (depth > s_maxWatchDepth || _watchedDirs.count() >= s_maxWatchedDirs ||
+            !d->scanStarted()) {
+        return;
+    }
+
+    const QString p = d->path();
+    if (!_watchedDirs.contains(p)) {
+        _watchedDirs.insert(p);
+        _dirWatch->addDir(p, KDirWatch::WatchFiles);
+    }
+
+    ScanDirVector &dirs = d->dirs();
+    for (int i = 0; i < dirs.count(); i++) {
+        watch(&dirs[i], depth + 1);
+    }
+}
+
+void FSView::unwatchAll()
+{
+    foreach (const QString &p, _watchedDirs) {
+        _dirWatch->removeDir(p);
+    }
+    _watchedDirs.clear();
+    _changedDirs.clear();
+    _liveUpdateTimer->stop();
+}
+
+void FSView::dirChanged(const QString &path)
+{
+    // a file in a watched directory
+    QString dir = path;
+    if (!_watchedDirs.contains(dir)) {
+        dir = QFileInfo(path).absolutePath();
+    }
+
+    if (!_changedDirs.contains(dir)) {
+        _changedDirs.append(dir);
+    }
+    // wait for a series of changes to end
+    _liveUpdateTimer->start(1000);
+}
+
+void FSView::dirDeleted(const QString &path)
+{
+    if (_watchedDirs.remove(path)) {
+        _dirWatch->removeDir(path);
+    }
+    dirChanged(QFileInfo(path).absolutePath());
+}
+
+void FSView::doLiveUpdate()
+{
+    if (_changedDirs.isEmpty()) {
+        return;
+    }
+
+    // one directory at a time, after the current scan
+    if (_sm.scanRunning() || !_allowRefresh) {
+        _liveUpdateTimer->start(1000);
+        return;
+    }
+
+    ScanDir *d = _sm.findDir(_changedDirs.takeFirst());
+    if (d) {
+        // the listener of a directory is the Inode showing it, if any
+        Inode *i = static_cast<Inode *>(d->listener());
+        if (i) {
+            requestUpdate(i, true);
+        } else {
+            d->clear();
+            requestUpdate(d, true);
+        }
+    }
+
+    if (!_changedDirs.isEmpty()) {
+        _liveUpdateTimer->start(1000);
     }
 }
 
@@ -470,9 +611,12 @@ void FSView::saveFSOptions()
 
     KConfigGroup gconfig(_config, "General");
     gconfig.writeEntry("Path", _path);
+    gconfig.writeEntry("LiveUpdates", _liveUpdates);
 
     KConfigGroup cconfig(_config, "MetricCache");
     saveMetric(&cconfig);
+
+    _dirIndex.saveInBackground(ScanIndex::defaultFile());
 }
 
 void FSView::quit()
@@ -505,7 +649,8 @@ void FSView::doRedraw()
         if (0) {
             kDebug(90100) << "doRedraw " << _sm.scanLength();
         }
-        redraw();
+        // only draw directories whose size changed since the last time
+        redrawChanged();
     } else {
         redo = true;
     }
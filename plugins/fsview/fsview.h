@@ -24,6 +24,7 @@
 #define FSVIEW_H
 
 #include <qmap.h>
+#include <qset.h>
 #include <qfileinfo.h>
 #include <qstring.h>
 
@@ -34,9 +35,12 @@
 #include "treemap.h"
 #include "inode.h"
 #include "scan.h"
+#include "scanindex.h"
 
 class QMenu;
+class QTimer;
 class KConfig;
+class KDirWatch;
 
 /* Cached Metric info config */
 class MetricEntry
@@ -99,10 +103,17 @@ public:
     bool setColorMode(const QString &);
     QString colorModeString() const;
 
-    void requestUpdate(Inode *);
+    /* with reuseIndexed, unchanged directories are taken from the index */
+    void requestUpdate(Inode *, bool reuseIndexed = false);
+
+    bool liveUpdates() const
+    {
+        return _liveUpdates;
+    }
 
     /* Implementation of listener interface of ScanManager.
-     * Used to calculate progress info */
+     * Used to calculate progress info, and to watch directories */
+    void scanStarted(ScanDir *) Q_DECL_OVERRIDE;
     void scanFinished(ScanDir *) Q_DECL_OVERRIDE;
 
     void stop();
@@ -124,6 +135,13 @@ public slots:
     void doUpdate();
     void doRedraw();
     void colorActivated(QAction *);
+    /* Watch the directories shown for changes, and update them */
+    void setLiveUpdates(bool);
+
+private slots:
+    void dirChanged(const QString &);
+    void dirDeleted(const QString &);
+    void doLiveUpdate();
 
 signals:
     void started();
@@ -134,6 +152,10 @@ protected:
     void keyPressEvent(QKeyEvent *) Q_DECL_OVERRIDE;
 
 private:
+    void requestUpdate(ScanDir *, bool reuseIndexed);
+    void watch(ScanDir *, int depth);
+    void unwatchAll();
+
     KConfig *_config;
     ScanManager _sm;
 
@@ -141,6 +163,15 @@ private:
     bool _allowRefresh;
     // a cache for directory sizes with long lasting updates
     static QMap<QString, MetricEntry> _dirMetric;
+    // the content of directories read, to skip unchanged ones
+    static ScanIndex _dirIndex;
+
+    // live updates
+    bool _liveUpdates;
+    KDirWatch *_dirWatch;
+    QSet<QString> _watchedDirs;
+    QStringList _changedDirs;
+    QTimer *_liveUpdateTimer;
 
     // current root path
     int _pathDepth;
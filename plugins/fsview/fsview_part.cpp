@@ -36,6 +36,7 @@
 #include <kio/paste.h>
 #include <kmessagebox.h>
 #include <kactionmenu.h>
+#include <ktoggleaction.h>
 #include <kactioncollection.h>
 #include <kpropertiesdialog.h>
 #include <KMimeTypeEditor>
@@ -111,7 +112,8 @@ FSViewPart::FSViewPart(QWidget *parentWidget,
                              "by using a tree map visualization.</p>"
                              "<p>Note that in this mode, automatic updating "
                              "when filesystem changes are made "
-                             "is intentionally <b>not</b> done.</p>"
+                             "is only done with 'Live Updates' enabled "
+                             "in the View menu.</p>"
                              "<p>For details on usage and options available, "
                              "see the online help under "
                              "menu 'Help/FSView Manual'.</p>"));
@@ -145,6 +147,12 @@ FSViewPart::FSViewPart(QWidget *parentWidget,
                               "FSView documentation"));
     connect(action, SIGNAL(triggered()), this, SLOT(showHelp()));
 
+    KToggleAction *liveUpdatesAction = new KToggleAction(i18n("&Live Updates"), this);
+    actionCollection()->addAction(QStringLiteral("treemap_liveupdates"), liveUpdatesAction);
+    liveUpdatesAction->setToolTip(i18n("Update the view when folders change"));
+    liveUpdatesAction->setChecked(_view->liveUpdates());
+    connect(liveUpdatesAction, SIGNAL(toggled(bool)), _view, SLOT(setLiveUpdates(bool)));
+
     QObject::connect(_visMenu->menu(), SIGNAL(aboutToShow()),
                      SLOT(slotShowVisMenu()));
     QObject::connect(_areaMenu->menu(), SIGNAL(aboutToShow()),
@@ -240,9 +248,9 @@ void FSViewPart::slotSettingsChanged(int category)
 void FSViewPart::showInfo()
 {
     QString info;
-    info = i18n("FSView intentionally does not support automatic updates "
-                "when changes are made to files or directories, "
-                "currently visible in FSView, from the outside.\n"
+    info = i18n("FSView only updates automatically when changes are made "
+                "to files or directories, currently visible in FSView, "
+                "from the outside, if 'Live Updates' is enabled in the View menu.\n"
                 "For details, see the 'Help/FSView Manual'.");
 
     KMessageBox::information(_view, info, QString(), QStringLiteral("ShowFSViewInfo"));
@@ -0,0 +1,233 @@
+/* This file is part of FSView.
+   Copyright (c) 2016 The Konqueror developers
+
+   KCachegrind is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public
+   License as published by the Free Software Foundation, version 2.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; see the file COPYING.  If not, write to
+   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+*/
+
+/*
+ * Scan a folder without the treemap, and write the totals of
+ * each directory as soon as its subtree is read, one per line,
+ * as JSON objects or CSV:
+ *
+ *   fsviewscan --format csv --max-depth 2 --exclude '*.o' /home
+ */
+
+#include <stdio.h>
+
+#include <qdir.h>
+#include <qfile.h>
+#include <qfileinfo.h>
+#include <QCommandLineParser>
+#include <QCommandLineOption>
+#include <QCoreApplication>
+#include <QElapsedTimer>
+
+#include <KLocalizedString>
+
+#include "scan.h"
+
+/**
+ * Writes a line for every directory whose scan finished,
+ * down to a depth below the top directory.
+ */
+class ScanReport : public ScanListener
+{
+public:
+    enum Format { Json, Csv };
+
+    ScanReport(QFile *out, Format format, int maxDepth)
+        : _out(out), _format(format), _maxDepth(maxDepth) {}
+
+    void writeHeader();
+    void scanFinished(ScanDir *) Q_DECL_OVERRIDE;
+
+private:
+    static QByteArray jsonString(const QString &);
+    static QByteArray csvString(const QString &);
+
+    QFile *_out;
+    Format _format;
+    int _maxDepth;
+};
+
+void ScanReport::writeHeader()
+{
+    if (_format == Csv) {
+        _out->write("path,size,files,dirs,depth\n");
+    }
+}
+
+void ScanReport::scanFinished(ScanDir *d)
+{
+    int depth = 0;
+    for (ScanDir *p = d->parent(); p; p = p->parent()) {
+        depth++;
+    }
+    if ((_maxDepth >= 0) && (depth > _maxDepth)) {
+        return;
+    }
+
+    QByteArray line;
+    if (_format == Json) {
+        line = "{\"path\":" + jsonString(d->path()) +
+               ",\"size\":" + QByteArray::number(d->size()) +
+               ",\"files\":" + QByteArray::number(d->fileCount()) +
+               ",\"dirs\":" + QByteArray::number(d->dirCount()) +
+               ",\"depth\":" + QByteArray::number(depth) + "}\n";
+    } else {
+        line = csvString(d->path()) +
+               ',' + QByteArray::number(d->size()) +
+               ',' + QByteArray::number(d->fileCount()) +
+               ',' + QByteArray::number(d->dirCount()) +
+               ',' + QByteArray::number(depth) + '\n';
+    }
+    _out->write(line);
+}
+
+QByteArray ScanReport::jsonString(const QString &s)
+{
+    const QByteArray utf8 = s.toUtf8();
+    QByteArray result;
+    result.reserve(utf8.length() + 2);
+    result += '"';
+    foreach (char c, utf8) {
+        if (c == '"' || c == '\\') {
+            result += '\\';
+            result += c;
+        } else if (uchar(c) < 0x20) {
+            char escape[8];
+            qsnprintf(escape, sizeof(escape), "\\u%04x", uchar(c));
+            result += escape;
+        } else {
+            result += c;
+        }
+    }
+    result += '"';
+    return result;
+}
+
+QByteArray ScanReport::csvString(const QString &s)
+{
+    QByteArray result = s.toUtf8();
+    result.replace('"', "\"\"");
+    return '"' + result + '"';
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName(QStringLiteral("fsviewscan"));
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription(i18n("Writes the size, file and folder count "
+                                          "of every folder below a folder"));
+    parser.addHelpOption();
+    parser.addPositionalArgument(QStringLiteral("folder"), i18n("The folder to scan"),
+                                 QStringLiteral("[folder]"));
+    QCommandLineOption formatOption(QStringList() << QStringLiteral("f") << QStringLiteral("format"),
+                                    i18n("Output format: json, one object per line, or csv"),
+                                    QStringLiteral("format"), QStringLiteral("json"));
+    QCommandLineOption depthOption(QStringList() << QStringLiteral("d") << QStringLiteral("max-depth"),
+                                   i18n("Only write folders down to this depth below the folder; "
+                                        "totals still include everything"),
+                                   QStringLiteral("depth"), QStringLiteral("-1"));
+    QCommandLineOption excludeOption(QStringList() << QStringLiteral("x") << QStringLiteral("exclude"),
+                                     i18n("Skip files and folders matching this wildcard; "
+                                          "with a '/', it is matched against the absolute path"),
+                                     QStringLiteral("pattern"));
+    QCommandLineOption threadsOption(QStringList() << QStringLiteral("j") << QStringLiteral("threads"),
+                                     i18n("Number of threads reading folders, 0 for none"),
+                                     QStringLiteral("count"));
+    QCommandLineOption outputOption(QStringList() << QStringLiteral("o") << QStringLiteral("output"),
+                                    i18n("Write to this file instead of the standard output"),
+                                    QStringLiteral("file"));
+    parser.addOption(formatOption);
+    parser.addOption(depthOption);
+    parser.addOption(excludeOption);
+    parser.addOption(threadsOption);
+    parser.addOption(outputOption);
+    parser.process(app);
+
+    ScanReport::Format format;
+    const QString formatName = parser.value(formatOption);
+    if (formatName == QLatin1String("json")) {
+        format = ScanReport::Json;
+    } else if (formatName == QLatin1String("csv")) {
+        format = ScanReport::Csv;
+    } else {
+        fprintf(stderr, "%s\n", qPrintable(i18n("Unknown format: %1", formatName)));
+        return 1;
+    }
+
+    bool ok;
+    const int maxDepth = parser.value(depthOption).toInt(&ok);
+    if (!ok) {
+        fprintf(stderr, "%s\n", qPrintable(i18n("Invalid depth: %1", parser.value(depthOption))));
+        return 1;
+    }
+
+    QString path = QStringLiteral(".");
+    if (parser.positionalArguments().count() > 0) {
+        path = parser.positionalArguments().at(0);
+    }
+    QFileInfo info(path);
+    if (!info.isDir()) {
+        fprintf(stderr, "%s\n", qPrintable(i18n("Not a folder: %1", path)));
+        return 1;
+    }
+    path = QDir::cleanPath(info.absoluteFilePath());
+
+    QFile out;
+    if (parser.isSet(outputOption)) {
+        out.setFileName(parser.value(outputOption));
+        if (!out.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+            fprintf(stderr, "%s\n", qPrintable(i18n("Cannot write %1: %2",
+                                                    out.fileName(), out.errorString())));
+            return 1;
+        }
+    } else if (!out.open(stdout, QIODevice::WriteOnly)) {
+        return 1;
+    }
+
+    ScanManager m;
+    if (parser.isSet(threadsOption)) {
+        m.setThreadCount(parser.value(threadsOption).toInt());
+    }
+    m.setExcludes(parser.values(excludeOption));
+
+    ScanReport report(&out, format, maxDepth);
+    report.writeHeader();
+    m.setListener(&report);
+
+    ScanDir *top = m.setTop(path);
+    QElapsedTimer timer;
+    timer.start();
+    m.startScan();
+    while (m.scanRunning()) {
+        m.scan(0);
+        out.flush();
+    }
+    const qint64 msecs = timer.elapsed();
+    const bool written = out.flush() && (out.error() == QFileDevice::NoError);
+    out.close();
+
+    fprintf(stderr, "%s\n",
+            qPrintable(i18n("%1 folders, %2 files, %3 bytes in %4 s: %5 files/s",
+                            top->dirCount(), top->fileCount(), top->size(),
+                            QString::number(msecs / 1000.0, 'f', 2),
+                            QString::number(msecs > 0 ? top->fileCount() * 1000.0 / msecs : 0.0,
+                                            'f', 0))));
+    return written ? 0 : 1;
+}
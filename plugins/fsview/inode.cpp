@@ -62,11 +62,9 @@ Inode::Inode(ScanDir *d, Inode *parent)
 Inode::Inode(ScanFile *f, Inode *parent)
     : TreeMapItem(parent)
 {
-    QString absPath;
-    if (parent) {
-        absPath = parent->path() + QLatin1Char('/');
-    }
-    absPath += f->name();
+    // files are always created as children of their directory
+    QString absPath = parent->path() + QLatin1Char('/');
+    absPath += parent->_dirPeer->files().name(*f);
 
     _dirPeer = 0;
     _filePeer = f;
@@ -83,9 +81,6 @@ Inode::~Inode()
     if (_dirPeer) {
         _dirPeer->setListener(0);
     }
-    if (_filePeer) {
-        _filePeer->setListener(0);
-    }
 }
 
 void Inode::setPeer(ScanDir *d)
@@ -94,9 +89,6 @@ void Inode::setPeer(ScanDir *d)
     if (_dirPeer) {
         _dirPeer->setListener(0);
     }
-    if (_filePeer) {
-        _filePeer->setListener(0);
-    }
 
     _dirPeer = d;
     _filePeer = 0;
@@ -129,13 +121,12 @@ void Inode::init(const QString &path)
 
     clear();
 
-    /* we want to get notifications about dir changes */
+    /* we want to get notifications about dir changes.
+     * Files have none: they only go away with their directory,
+     * which removes our children then */
     if (_dirPeer) {
         _dirPeer->setListener(this);
     }
-    if (_filePeer) {
-        _filePeer->setListener(this);
-    }
 
     if (_dirPeer && _dirPeer->scanFinished()) {
         scanFinished(_dirPeer);
@@ -149,6 +140,7 @@ void Inode::sizeChanged(ScanDir *d)
                              << d->name() << ": size " << d->size() << endl;
 
     _resortNeeded = true;
+    setChanged();
 }
 
 void Inode::scanFinished(ScanDir *d)
@@ -157,6 +149,7 @@ void Inode::scanFinished(ScanDir *d)
                              << d->name() << ": size " << d->size() << endl;
 
     _resortNeeded = true;
+    setChanged();
 
     /* no estimation any longer */
     _sizeEstimation = 0.0;
@@ -187,10 +180,10 @@ void Inode::destroyed(ScanDir *d)
     clear();
 }
 
-void Inode::destroyed(ScanFile *f)
+void Inode::cleared(ScanDir *d)
 {
-    if (_filePeer == f) {
-        _filePeer = 0;
+    if (_dirPeer == d) {
+        clear();
     }
 }
 
@@ -346,7 +339,7 @@ QString Inode::text(int i) const
                 name += QLatin1Char('/');
             }
         } else if (_filePeer) {
-            name = _filePeer->name();
+            name = _info.fileName();
         }
 
         return name;
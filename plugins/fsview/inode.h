@@ -84,7 +84,7 @@ public:
     void sizeChanged(ScanDir *) Q_DECL_OVERRIDE;
     void scanFinished(ScanDir *) Q_DECL_OVERRIDE;
     void destroyed(ScanDir *) Q_DECL_OVERRIDE;
-    void destroyed(ScanFile *) Q_DECL_OVERRIDE;
+    void cleared(ScanDir *) Q_DECL_OVERRIDE;
 
 private:
     void setMetrics(double, unsigned int);
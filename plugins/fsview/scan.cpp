@@ -20,41 +20,626 @@
 #include <qstringlist.h>
 #include <qset.h>
 #include <qplatformdefs.h>
+#include <QDataStream>
+#include <QElapsedTimer>
+#include <QMutex>
+#include <QRegularExpression>
+#include <QRunnable>
+#include <QThread>
+#include <QThreadPool>
+#include <QVarLengthArray>
+#include <QWaitCondition>
 
 #include <kdebug.h>
 #include <kurl.h>
 #include <kauthorized.h>
 #include <kurlauthorized.h>
 
+#ifdef Q_OS_LINUX
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
 #include "scan.h"
-#include "inode.h"
+#include "scanindex.h"
+
+/**
+ * A directory, read or to be read.
+ *
+ * Nodes are created and read by the scanner threads.
+ * The ScanDir peer is set by the ScanManager when it
+ * adds the parent directory, and only used by it.
+ */
+struct ScanNode {
+    ScanNode(const QString &n, const QString &p)
+        : name(n), path(p), dir(0), reuse(false), listed(false), indexed(false),
+          dev(0), ino(0), mtime(0), ctime(0), fileSize(0) {}
+
+    QString name, path;
+    ScanDir *dir;
+    // may be taken from the index
+    bool reuse;
+
+    // content, set when read
+    bool listed, indexed;
+    quint64 dev, ino;
+    qint64 mtime, ctime;
+    ScanFileVector files;
+    KIO::fileoffset_t fileSize;
+    QVector<ScanNode *> children;
+};
+
+static bool isForbiddenDir(const QString &d)
+{
+    // directories without real files on Linux
+    // TODO: should be OS specific
+    static const QSet<QString> s = QSet<QString>()
+                                   << QStringLiteral("/proc")
+                                   << QStringLiteral("/dev")
+                                   << QStringLiteral("/sys");
+    return s.contains(d);
+}
+
+static QString childPath(const QString &path, const QString &name)
+{
+    if (path.endsWith(QLatin1Char('/'))) {
+        return path + name;
+    }
+    return path + QLatin1Char('/') + name;
+}
+
+/**
+ * Files and directories not to scan, see ScanManager::setExcludes().
+ * Only read once set, so the scanner threads may share it.
+ */
+class ScanExcludes
+{
+public:
+    explicit ScanExcludes(const QStringList &patterns);
+
+    QStringList patterns() const
+    {
+        return _patterns;
+    }
+    bool excluded(const QString &dirPath, const QString &name) const;
+
+private:
+    static QRegularExpression wildcard(const QString &pattern);
+
+    QStringList _patterns;
+    QVector<QRegularExpression> _names, _paths;
+};
+
+ScanExcludes::ScanExcludes(const QStringList &patterns)
+    : _patterns(patterns)
+{
+    foreach (const QString &pattern, patterns) {
+        if (pattern.isEmpty()) {
+            continue;
+        }
+        if (pattern.contains(QLatin1Char('/'))) {
+            _paths.append(wildcard(pattern));
+        } else {
+            _names.append(wildcard(pattern));
+        }
+    }
+}
+
+/* QRegExp::Wildcard, but without matching '/', and thread-safe */
+QRegularExpression ScanExcludes::wildcard(const QString &pattern)
+{
+    QString rx = QStringLiteral("^");
+    for (int i = 0; i < pattern.length(); i++) {
+        const QChar c = pattern.at(i);
+        if (c == QLatin1Char('*')) {
+            rx += QLatin1String("[^/]*");
+        } else if (c == QLatin1Char('?')) {
+            rx += QLatin1String("[^/]");
+        } else if (c == QLatin1Char('[')) {
+            const int end = pattern.indexOf(QLatin1Char(']'), i + 2);
+            if (end < 0) {
+                rx += QLatin1String("\\[");
+                continue;
+            }
+            QString set = pattern.mid(i + 1, end - i - 1);
+            if (set.startsWith(QLatin1Char('!'))) {
+                set[0] = QLatin1Char('^');
+            }
+            set.replace(QLatin1Char('\\'), QLatin1String("\\\\"));
+            rx += QLatin1Char('[') + set + QLatin1Char(']');
+            i = end;
+        } else {
+            rx += QRegularExpression::escape(QString(c));
+        }
+    }
+    rx += QLatin1Char('$');
+    return QRegularExpression(rx);
+}
+
+bool ScanExcludes::excluded(const QString &dirPath, const QString &name) const
+{
+    foreach (const QRegularExpression &rx, _names) {
+        if (rx.match(name).hasMatch()) {
+            return true;
+        }
+    }
+    if (!_paths.isEmpty()) {
+        const QString path = childPath(dirPath, name);
+        foreach (const QRegularExpression &rx, _paths) {
+            if (rx.match(path).hasMatch()) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+static bool mayList(const QString &path)
+{
+    if (isForbiddenDir(path)) {
+        return false;
+    }
+
+    // KAuthorized guards its rules with a mutex, this is called
+    // from the scanner threads
+    KUrl u;
+    u.setPath(path);
+    return KUrlAuthorized::authorizeUrlAction(QStringLiteral("list"), KUrl(), u);
+}
+
+/* Read with QDir, as FSView always did */
+static void readDirWithQDir(ScanNode *node, const ScanExcludes *excludes)
+{
+    QDir d(node->path);
+    const QStringList fileList = d.entryList(QDir::Files |
+                                 QDir::Hidden | QDir::NoSymLinks);
+
+    if (fileList.count() > 0) {
+        QT_STATBUF buff;
+
+        node->files.reserve(fileList.count());
+
+        QStringList::ConstIterator it;
+        for (it = fileList.constBegin(); it != fileList.constEnd(); ++it) {
+            if (excludes && excludes->excluded(node->path, *it)) {
+                continue;
+            }
+            QString tmp(childPath(node->path, *it));
+            if (QT_LSTAT(QFile::encodeName(tmp).constData(), &buff) != 0) {
+                continue;
+            }
+            node->files.append(*it, buff.st_size);
+            node->fileSize += buff.st_size;
+        }
+        node->files.squeeze();
+    }
+
+    const QStringList dirList = d.entryList(QDir::Dirs |
+                                            QDir::Hidden | QDir::NoSymLinks | QDir::NoDotAndDotDot);
+
+    node->children.reserve(dirList.count());
+    QStringList::ConstIterator it;
+    for (it = dirList.constBegin(); it != dirList.constEnd(); ++it) {
+        if (excludes && excludes->excluded(node->path, *it)) {
+            continue;
+        }
+        node->children.append(new ScanNode(*it, childPath(node->path, *it)));
+    }
+}
+
+#ifdef Q_OS_LINUX
+/* Record returned by getdents64, glibc only wraps it since 2.30 */
+struct KernelDirent64 {
+    quint64 d_ino;
+    qint64 d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[1];
+};
+
+/*
+ * Read the entries in large blocks with getdents64 and stat
+ * relative to the directory fd, so that neither the path
+ * nor the entry name has to be resolved again.
+ * The entry type spares the stat of subdirectories.
+ */
+static void readDirWithFd(ScanNode *node, const ScanExcludes *excludes)
+{
+    const int fd = openat(AT_FDCWD, QFile::encodeName(node->path).constData(),
+                          O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    if (fd < 0) {
+        return;
+    }
+
+    quint64 buffer[4096]; // 32 KiB, aligned for the records
+    forever {
+        const long n = syscall(SYS_getdents64, fd, buffer, sizeof(buffer));
+        if (n <= 0) {
+            break;
+        }
+
+        const char *data = reinterpret_cast<const char *>(buffer);
+        for (long pos = 0; pos < n;) {
+            const KernelDirent64 *entry = reinterpret_cast<const KernelDirent64 *>(data + pos);
+            pos += entry->d_reclen;
+
+            const char *name = entry->d_name;
+            if (name[0] == '.' && (name[1] == 0 || (name[1] == '.' && name[2] == 0))) {
+                continue;
+            }
+
+            if (excludes && excludes->excluded(node->path, QFile::decodeName(name))) {
+                continue;
+            }
+
+            unsigned char type = entry->d_type;
+            struct stat buff;
+            if (type == DT_REG || type == DT_UNKNOWN) {
+                if (fstatat(fd, name, &buff, AT_SYMLINK_NOFOLLOW) != 0) {
+                    continue;
+                }
+                type = S_ISREG(buff.st_mode) ? DT_REG : S_ISDIR(buff.st_mode) ? DT_DIR : DT_UNKNOWN;
+            }
+
+            if (type == DT_REG) {
+                node->files.append(name, qstrlen(name), buff.st_size);
+                node->fileSize += buff.st_size;
+            } else if (type == DT_DIR) {
+                const QString n = QFile::decodeName(name);
+                node->children.append(new ScanNode(n, childPath(node->path, n)));
+            }
+        }
+    }
+
+    close(fd);
+    node->files.squeeze();
+}
+#endif
+
+/*
+ * Read the directory in a scanner thread, or take its content
+ * from the index if it did not change since.
+ */
+static void readDir(ScanNode *node, const ScanIndex *index, const ScanExcludes *excludes)
+{
+    node->listed = mayList(node->path);
+    if (!node->listed) {
+        return;
+    }
+
+#ifdef Q_OS_UNIX
+    // stat'ed before reading: if the directory changes meanwhile,
+    // the times stored in the index are older than its content
+    QT_STATBUF buff;
+    if (index && QT_LSTAT(QFile::encodeName(node->path).constData(), &buff) == 0) {
+        node->dev = buff.st_dev;
+        node->ino = buff.st_ino;
+#ifdef Q_OS_LINUX
+        node->mtime = qint64(buff.st_mtim.tv_sec) * 1000000000 + buff.st_mtim.tv_nsec;
+        node->ctime = qint64(buff.st_ctim.tv_sec) * 1000000000 + buff.st_ctim.tv_nsec;
+#else
+        node->mtime = buff.st_mtime;
+        node->ctime = buff.st_ctime;
+#endif
+
+        QStringList dirs;
+        if (node->reuse &&
+                index->find(node->dev, node->ino, node->mtime, node->ctime,
+                            node->files, dirs)) {
+            node->indexed = true;
+            ScanFileVector::const_iterator it;
+            for (it = node->files.constBegin(); it != node->files.constEnd(); ++it) {
+                node->fileSize += (*it).size();
+            }
+            node->children.reserve(dirs.count());
+            foreach (const QString &dir, dirs) {
+                node->children.append(new ScanNode(dir, childPath(node->path, dir)));
+            }
+            return;
+        }
+    }
+#else
+    Q_UNUSED(index);
+#endif
+
+#ifdef Q_OS_LINUX
+    readDirWithFd(node, excludes);
+#else
+    readDirWithQDir(node, excludes);
+#endif
+}
+
+// ScanThreads
+
+/**
+ * The scanner threads.
+ *
+ * Every thread has a queue of directories to read. It takes the
+ * last one of its own queue, to stay in the subtree it just read,
+ * or else steals the first one of the queue of another thread,
+ * the one with the largest subtree left.
+ * A read directory is handed over to the ScanManager before its
+ * subdirectories are queued, so that it always gets the parents
+ * before their children.
+ * The threads end when all directories are read.
+ */
+class ScanThreads
+{
+public:
+    explicit ScanThreads(int count);
+    ~ScanThreads();
+
+    /* with reuse, the directories below the node may be taken from the index */
+    void start(ScanNode *, const ScanIndex *index, bool reuse,
+               const ScanExcludes *excludes);
+    /* cancel the scan, moving the nodes not handed over yet to nodes */
+    void stop(QList<ScanNode *> &nodes);
+    /* true while there are directories to read */
+    bool running();
+    int pending();
+    /* append the nodes read since the last call, waiting up to msecs for one */
+    void takeFinished(QList<ScanNode *> &nodes, int msecs);
+
+    void run(int thread);
+
+private:
+    struct Queue {
+        QMutex mutex;
+        QList<ScanNode *> nodes;
+    };
+
+    ScanNode *takeWork(int thread);
+
+    QVector<Queue *> _queues;
+    QThreadPool _pool;
+    const ScanIndex *_index;
+    bool _reuse;
+    const ScanExcludes *_excludes;
+
+    QMutex _mutex; // for everything below
+    QWaitCondition _workQueued, _nodeFinished;
+    QList<ScanNode *> _finished;
+    int _pending; // queued or being read
+    int _queued;
+    bool _canceled;
+};
+
+class ScanWorker : public QRunnable
+{
+public:
+    ScanWorker(ScanThreads *threads, int thread)
+        : _threads(threads), _thread(thread) {}
+
+    void run() Q_DECL_OVERRIDE
+    {
+        _threads->run(_thread);
+    }
+
+private:
+    ScanThreads *_threads;
+    int _thread;
+};
+
+ScanThreads::ScanThreads(int count)
+{
+    _index = 0;
+    _reuse = false;
+    _excludes = 0;
+    _pending = 0;
+    _queued = 0;
+    _canceled = false;
+
+    _queues.reserve(count);
+    for (int i = 0; i < count; i++) {
+        _queues.append(new Queue);
+    }
+    _pool.setMaxThreadCount(count);
+}
+
+ScanThreads::~ScanThreads()
+{
+    QList<ScanNode *> nodes;
+    stop(nodes);
+    qDeleteAll(nodes);
+    qDeleteAll(_queues);
+}
+
+void ScanThreads::start(ScanNode *node, const ScanIndex *index, bool reuse,
+                        const ScanExcludes *excludes)
+{
+    // threads of a finished scan may not have returned yet
+    _pool.waitForDone();
+
+    _index = index;
+    _reuse = reuse;
+    _excludes = excludes;
+    _pending = 1;
+    _queued = 1;
+    _queues[0]->nodes.append(node);
+
+    for (int i = 0; i < _queues.count(); i++) {
+        _pool.start(new ScanWorker(this, i));
+    }
+}
+
+void ScanThreads::stop(QList<ScanNode *> &nodes)
+{
+    _mutex.lock();
+    _canceled = true;
+    _workQueued.wakeAll();
+    _mutex.unlock();
+
+    _pool.waitForDone();
+
+    nodes += _finished;
+    _finished.clear();
+    foreach (Queue *q, _queues) {
+        nodes += q->nodes;
+        q->nodes.clear();
+    }
+    _pending = 0;
+    _queued = 0;
+    _canceled = false;
+}
+
+bool ScanThreads::running()
+{
+    QMutexLocker locker(&_mutex);
+    return (_pending > 0) || !_finished.isEmpty();
+}
+
+int ScanThreads::pending()
+{
+    QMutexLocker locker(&_mutex);
+    return _pending + _finished.count();
+}
+
+void ScanThreads::takeFinished(QList<ScanNode *> &nodes, int msecs)
+{
+    QMutexLocker locker(&_mutex);
+    if (_finished.isEmpty() && (_pending > 0)) {
+        _nodeFinished.wait(&_mutex, msecs);
+    }
+    nodes += _finished;
+    _finished.clear();
+}
+
+ScanNode *ScanThreads::takeWork(int thread)
+{
+    ScanNode *node = 0;
+    const int count = _queues.count();
+    for (int i = 0; !node && (i < count); i++) {
+        Queue *q = _queues[(thread + i) % count];
+        QMutexLocker locker(&q->mutex);
+        if (!q->nodes.isEmpty()) {
+            node = (i == 0) ? q->nodes.takeLast() : q->nodes.takeFirst();
+        }
+    }
+
+    if (node) {
+        QMutexLocker locker(&_mutex);
+        _queued--;
+    }
+    return node;
+}
+
+void ScanThreads::run(int thread)
+{
+    forever {
+        ScanNode *node = takeWork(thread);
+        if (!node) {
+            QMutexLocker locker(&_mutex);
+            while (!_canceled && (_pending > 0) && (_queued == 0)) {
+                _workQueued.wait(&_mutex);
+            }
+            if (_canceled || (_pending == 0)) {
+                return;
+            }
+            continue;
+        }
+
+        readDir(node, _index, _excludes);
+        foreach (ScanNode *child, node->children) {
+            child->reuse = _reuse;
+        }
+
+        QMutexLocker locker(&_mutex);
+        if (_canceled) {
+            // as if never read, stop() frees it
+            qDeleteAll(node->children);
+            node->children.clear();
+            _finished.append(node);
+            return;
+        }
+
+        _finished.append(node);
+        _nodeFinished.wakeAll();
+
+        const int count = node->children.count();
+        _pending += count - 1;
+        if (count > 0) {
+            Queue *q = _queues[thread];
+            q->mutex.lock();
+            for (int i = 0; i < count; i++) {
+                q->nodes.append(node->children[i]);
+            }
+            q->mutex.unlock();
+            _queued += count;
+            _workQueued.wakeAll();
+        } else if (_pending == 0) {
+            // the last one: let the others return
+            _workQueued.wakeAll();
+        }
+    }
+}
 
 // ScanManager
 
 ScanManager::ScanManager()
 {
-    _topDir = 0;
-    _listener = 0;
+    init();
 }
 
 ScanManager::ScanManager(const QString &path)
 {
-    _topDir = 0;
-    _listener = 0;
+    init();
     setTop(path);
 }
 
 ScanManager::~ScanManager()
 {
     stopScan();
+    delete _threads;
+    delete _excludes;
     delete _topDir;
 }
 
+void ScanManager::init()
+{
+    _topDir = 0;
+    _listener = 0;
+    _threads = 0;
+    _threadCount = 0;
+    _index = 0;
+    _excludes = 0;
+    // more threads mostly contend for the disk
+    setThreadCount(qBound(1, QThread::idealThreadCount(), 8));
+}
+
 void ScanManager::setListener(ScanListener *l)
 {
     _listener = l;
 }
 
+void ScanManager::setThreadCount(int count)
+{
+    if (count < 0) {
+        count = 0;
+    }
+    if (count == _threadCount) {
+        return;
+    }
+
+    stopScan();
+    delete _threads;
+    _threadCount = count;
+    _threads = (count > 0) ? new ScanThreads(count) : 0;
+}
+
+void ScanManager::setExcludes(const QStringList &patterns)
+{
+    stopScan();
+    delete _excludes;
+    _excludes = patterns.isEmpty() ? 0 : new ScanExcludes(patterns);
+}
+
+QStringList ScanManager::excludes() const
+{
+    return _excludes ? _excludes->patterns() : QStringList();
+}
+
 ScanDir *ScanManager::setTop(const QString &path, int data)
 {
     stopScan();
@@ -68,16 +653,60 @@ ScanDir *ScanManager::setTop(const QString &path, int data)
     return _topDir;
 }
 
+ScanDir *ScanManager::findDir(const QString &path)
+{
+    if (!_topDir) {
+        return 0;
+    }
+
+    const QString top = _topDir->path();
+    if (path == top) {
+        return _topDir;
+    }
+    if (!path.startsWith(top) ||
+            (!top.endsWith(QLatin1Char('/')) && path.at(top.length()) != QLatin1Char('/'))) {
+        return 0;
+    }
+
+    ScanDir *d = _topDir;
+    const QStringList names = path.mid(top.length()).split(QLatin1Char('/'), QString::SkipEmptyParts);
+    foreach (const QString &name, names) {
+        ScanDir *found = 0;
+        ScanDirVector &dirs = d->dirs();
+        for (int i = 0; i < dirs.count(); i++) {
+            if (dirs[i].name() == name) {
+                found = &dirs[i];
+                break;
+            }
+        }
+        if (!found) {
+            return 0;
+        }
+        d = found;
+    }
+    return d;
+}
+
 bool ScanManager::scanRunning()
 {
     if (!_topDir) {
         return false;
     }
 
-    return _topDir->scanRunning();
+    return _topDir->scanRunning() || !_list.isEmpty() ||
+           !_finished.isEmpty() || (_threads && _threads->running());
+}
+
+int ScanManager::scanLength() const
+{
+    int length = _list.count() + _finished.count();
+    if (_threads) {
+        length += _threads->pending();
+    }
+    return length;
 }
 
-void ScanManager::startScan(ScanDir *from)
+void ScanManager::startScan(ScanDir *from, bool reuseIndexed)
 {
     if (!_topDir) {
         return;
@@ -95,7 +724,14 @@ void ScanManager::startScan(ScanDir *from)
         from->parent()->setupChildRescan();
     }
 
-    _list.append(new ScanItem(from->path(), from));
+    ScanNode *node = new ScanNode(from->name(), from->path());
+    node->dir = from;
+    if (_threads) {
+        // the index would get directories without their excluded entries
+        _threads->start(node, _excludes ? 0 : _index, reuseIndexed, _excludes);
+    } else {
+        _list.append(node);
+    }
 }
 
 void ScanManager::stopScan()
@@ -105,48 +741,104 @@ void ScanManager::stopScan()
     }
 
     if (0) kDebug(90100) << "ScanManager::stopScan, scanLength "
-                             << _list.count() << endl;
+                             << scanLength() << endl;
+
+    QList<ScanNode *> nodes = _list + _finished;
+    _list.clear();
+    _finished.clear();
+    if (_threads) {
+        _threads->stop(nodes);
+    }
 
-    while (!_list.isEmpty()) {
-        ScanItem *si = _list.takeFirst();
-        si->dir->finish();
-        delete si;
+    // nodes without peer belong to a directory which was not added
+    foreach (ScanNode *node, nodes) {
+        if (node->dir) {
+            node->dir->finish();
+        }
+        delete node;
     }
 }
 
 int ScanManager::scan(int data)
 {
-    if (_list.isEmpty()) {
-        return false;
+    if (!_threads) {
+        if (_list.isEmpty()) {
+            return false;
+        }
+        ScanNode *node = _list.takeFirst();
+        readDirWithQDir(node, _excludes);
+
+        int newCount = node->dir->scan(node, data);
+        _list += node->children.toList();
+        delete node;
+
+        return newCount;
     }
-    ScanItem *si = _list.takeFirst();
 
-    int newCount = si->dir->scan(si, _list, data);
-    delete si;
+    if (_finished.isEmpty()) {
+        _threads->takeFinished(_finished, 5);
+    }
+
+    // keep the batch short enough not to block the event loop
+    QElapsedTimer timer;
+    timer.start();
+    int newCount = 0;
+    while (!_finished.isEmpty() && (timer.elapsed() < 10)) {
+        ScanNode *node = _finished.takeFirst();
+        if (_index && !_excludes && node->listed && !node->indexed && node->ino) {
+            QStringList dirs;
+            dirs.reserve(node->children.count());
+            foreach (ScanNode *child, node->children) {
+                dirs.append(child->name);
+            }
+            _index->insert(node->dev, node->ino, node->mtime, node->ctime,
+                           node->files, dirs);
+        }
+        newCount += node->dir->scan(node, data);
+        delete node;
+    }
 
     return newCount;
 }
 
-// ScanFile
+// ScanFileVector
 
-ScanFile::ScanFile()
+void ScanFileVector::append(const char *name, int length, KIO::fileoffset_t size)
 {
-    _size = 0;
-    _listener = 0;
+    ScanFile f;
+    f._nameOffset = _names.length();
+    f._nameLength = length;
+    f._size = size;
+    _files.append(f);
+    _names.append(name, length);
 }
 
-ScanFile::ScanFile(const QString &n, KIO::fileoffset_t s)
+QDataStream &operator<<(QDataStream &s, const ScanFileVector &v)
 {
-    _name = n;
-    _size = s;
-    _listener = 0;
+    s << v._names << quint32(v._files.count());
+    ScanFileVector::const_iterator it;
+    for (it = v._files.constBegin(); it != v._files.constEnd(); ++it) {
+        s << (*it)._nameOffset << (*it)._nameLength << (*it)._size;
+    }
+    return s;
 }
 
-ScanFile::~ScanFile()
+QDataStream &operator>>(QDataStream &s, ScanFileVector &v)
 {
-    if (_listener) {
-        _listener->destroyed(this);
+    quint32 count;
+    s >> v._names >> count;
+    v._files.clear();
+    v._files.reserve(qMin(count, quint32(1 << 20)));
+    for (quint32 i = 0; i < count && s.status() == QDataStream::Ok; i++) {
+        ScanFile f;
+        s >> f._nameOffset >> f._nameLength >> f._size;
+        if (f._nameOffset + quint64(f._nameLength) > quint64(v._names.length())) {
+            s.setStatus(QDataStream::ReadCorruptData);
+            break;
+        }
+        v._files.append(f);
     }
+    return s;
 }
 
 // ScanDir
@@ -189,15 +881,22 @@ void ScanDir::setListener(ScanListener *l)
 
 QString ScanDir::path()
 {
-    if (_parent) {
-        QString p = _parent->path();
-        if (!p.endsWith(QLatin1Char('/'))) {
+    QVarLengthArray<ScanDir *, 32> dirs;
+    int length = 0;
+    for (ScanDir *d = this; d; d = d->_parent) {
+        dirs.append(d);
+        length += d->_name.length() + 1;
+    }
+
+    QString p;
+    p.reserve(length);
+    for (int i = dirs.count() - 1; i >= 0; i--) {
+        p += dirs[i]->_name;
+        if (i > 0 && !p.endsWith(QLatin1Char('/'))) {
             p += QLatin1Char('/');
         }
-        return p + _name;
     }
-
-    return _name;
+    return p;
 }
 
 void ScanDir::clear()
@@ -205,8 +904,13 @@ void ScanDir::clear()
     _dirty = true;
     _dirsFinished = -1; /* scan not started */
 
+    bool hadItems = !_files.isEmpty() || !_dirs.isEmpty();
     _files.clear();
     _dirs.clear();
+
+    if (hadItems && _listener) {
+        _listener->cleared(this);
+    }
 }
 
 void ScanDir::update()
@@ -240,80 +944,29 @@ void ScanDir::update()
     }
 }
 
-bool ScanDir::isForbiddenDir(QString &d)
-{
-    static QSet<QString> *s = 0;
-
-    if (!s) {
-        s = new QSet<QString>;
-        // directories without real files on Linux
-        // TODO: should be OS specific
-        s->insert(QStringLiteral("/proc"));
-        s->insert(QStringLiteral("/dev"));
-        s->insert(QStringLiteral("/sys"));
-    }
-    return (s->contains(d));
-}
-
-int ScanDir::scan(ScanItem *si, ScanItemList &list, int data)
+int ScanDir::scan(ScanNode *node, int data)
 {
     clear();
     _dirsFinished = 0;
     _fileSize = 0;
     _dirty = true;
 
-    if (isForbiddenDir(si->absPath)) {
+    if (!node->listed) {
         if (_parent) {
             _parent->subScanFinished();
         }
         return 0;
     }
 
-    KUrl u;
-    u.setPath(si->absPath);
-    if (!KUrlAuthorized::authorizeUrlAction(QStringLiteral("list"), KUrl(), u)) {
-        if (_parent) {
-            _parent->subScanFinished();
-        }
-
-        return 0;
-    }
+    _files.swap(node->files);
+    _fileSize = node->fileSize;
 
-    QDir d(si->absPath);
-    const QStringList fileList = d.entryList(QDir::Files |
-                                 QDir::Hidden | QDir::NoSymLinks);
+    if (node->children.count() > 0) {
+        _dirs.reserve(node->children.count());
 
-    if (fileList.count() > 0) {
-        QT_STATBUF buff;
-
-        _files.reserve(fileList.count());
-
-        QStringList::ConstIterator it;
-        for (it = fileList.constBegin(); it != fileList.constEnd(); ++it) {
-            QString tmp(si->absPath + QLatin1Char('/') + (*it));
-            if (QT_LSTAT(tmp.toStdString().c_str(), &buff) != 0) {
-                continue;
-            }
-            _files.append(ScanFile(*it, buff.st_size));
-            _fileSize += buff.st_size;
-        }
-    }
-
-    const QStringList dirList = d.entryList(QDir::Dirs |
-                                            QDir::Hidden | QDir::NoSymLinks | QDir::NoDotAndDotDot);
-
-    if (dirList.count() > 0) {
-        _dirs.reserve(dirList.count());
-
-        QStringList::ConstIterator it;
-        for (it = dirList.constBegin(); it != dirList.constEnd(); ++it) {
-            _dirs.append(ScanDir(*it, _manager, this, data));
-            QString newpath = si->absPath;
-            if (!newpath.endsWith(QChar('/'))) {
-                newpath.append("/");
-            }
-            newpath.append(*it);
-            list.append(new ScanItem(newpath, &(_dirs.last())));
+        foreach (ScanNode *child, node->children) {
+            _dirs.append(ScanDir(child->name, _manager, this, data));
+            child->dir = &(_dirs.last());
         }
         _dirCount += _dirs.count();
     }
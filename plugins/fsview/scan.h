@@ -24,26 +24,20 @@
 #define KONQ_PLUGIN_SCAN_H
 
 #include <qfile.h>
+#include <QByteArray>
+#include <QList>
+#include <QStringList>
 #include <QVector>
 #include <kio/global.h>
 
+class QDataStream;
+
 class ScanDir;
 class ScanFile;
-
-class ScanItem
-{
-public:
-    ScanItem(const QString &p, ScanDir *d)
-    {
-        absPath = p;
-        dir = d;
-    }
-
-    QString absPath;
-    ScanDir *dir;
-};
-
-typedef QList<ScanItem *> ScanItemList;
+struct ScanNode;
+class ScanThreads;
+class ScanIndex;
+class ScanExcludes;
 
 /**
  * Listener for events from directory scanning.
@@ -62,9 +56,10 @@ public:
     virtual void scanStarted(ScanDir *) {}
     virtual void sizeChanged(ScanDir *) {}
     virtual void scanFinished(ScanDir *) {}
-    // destroyed events are not delivered to listeners of ScanManager
+    // destroyed and cleared events are not delivered to listeners of ScanManager
     virtual void destroyed(ScanDir *) {}
-    virtual void destroyed(ScanFile *) {}
+    /* the files and subdirectories of the ScanDir were removed */
+    virtual void cleared(ScanDir *) {}
 };
 
 /**
@@ -74,7 +69,12 @@ public:
  *
  *   ScanManager m("/opt");
  *   m.startScan();
- *   while(m.scan());
+ *   while(m.scanRunning()) m.scan(0);
+ *
+ * Directories are read by a pool of threads, each working through
+ * its own queue of directories and stealing from the queues of the
+ * others when it runs out of work. The ScanDir objects are only
+ * created and changed in scan(), on the thread of the manager.
  */
 class ScanManager
 {
@@ -91,13 +91,49 @@ public:
     {
         return _topDir;
     }
+    /* the directory with the absolute path, if scanned */
+    ScanDir *findDir(const QString &path);
 
     bool scanRunning();
-    int scanLength() const
+    /* number of directories still to read or to add */
+    int scanLength() const;
+
+    /**
+     * Set the number of threads reading directories.
+     * With 0, scan() reads one directory itself, with QDir,
+     * as FSView did before it used threads.
+     * The default is QThread::idealThreadCount(), at most 8.
+     */
+    void setThreadCount(int);
+    int threadCount() const
+    {
+        return _threadCount;
+    }
+
+    /**
+     * Set the index the scanner threads store the directories
+     * they read in. Not owned.
+     */
+    void setIndex(ScanIndex *index)
+    {
+        _index = index;
+    }
+    ScanIndex *index()
     {
-        return _list.count();
+        return _index;
     }
 
+    /**
+     * Set wildcard patterns of files and directories to skip, in
+     * addition to the directories without real files, like /proc.
+     * A pattern with a '/' is matched against the absolute path,
+     * others against the name; '*' and '?' do not match a '/'.
+     * Stops a running scan. With excludes, the index is not used,
+     * as it has to store all files of a directory.
+     */
+    void setExcludes(const QStringList &patterns);
+    QStringList excludes() const;
+
     /**
      * Starts the scan. Stop previous scan if running.
      * For the actual scan to happen, you have to call
@@ -105,8 +141,12 @@ public:
      *
      * If from !=0, restart scan at given position; from must
      * be from the previous scan of this manager.
+     *
+     * With reuseIndexed, the directories below from which did
+     * not change since they were stored in the index are taken
+     * from there instead of being read.
      */
-    void startScan(ScanDir *from = 0);
+    void startScan(ScanDir *from = 0, bool reuseIndexed = false);
 
     /** Stop a current running scan.
      * Make all directories to finish their scan.
@@ -114,7 +154,9 @@ public:
     void stopScan();
 
     /**
-     * Scan first directory from todo list.
+     * Scan first directory from todo list, or with threads,
+     * add the directories read since the last call, in a batch.
+     * If none was read, this waits for a few milliseconds.
      * Directories added to the todo list are attributed with data.
      * Returns the number of new subdirectories created for scanning.
      */
@@ -128,44 +170,143 @@ public:
     }
 
 private:
-    ScanItemList _list;
+    void init();
+
+    // directories to read without threads
+    QList<ScanNode *> _list;
+    // directories read by the threads, not added yet
+    QList<ScanNode *> _finished;
+    ScanThreads *_threads;
+    int _threadCount;
+    ScanIndex *_index;
+    ScanExcludes *_excludes;
     ScanDir *_topDir;
     ScanListener *_listener;
 };
 
+/**
+ * A file: its size and where its name is in the ScanFileVector.
+ * 16 bytes, plus the name bytes.
+ */
 class ScanFile
 {
 public:
-    ScanFile();
-    ScanFile(const QString &n, KIO::fileoffset_t s);
-    ~ScanFile();
-
-    const QString &name()
+    ScanFile()
     {
-        return _name;
+        _nameOffset = 0;
+        _nameLength = 0;
+        _size = 0;
     }
-    KIO::fileoffset_t size()
+
+    KIO::fileoffset_t size() const
     {
         return _size;
     }
 
-    /* set listener to get callbacks from this ScanDir */
-    void setListener(ScanListener *l)
+private:
+    friend class ScanFileVector;
+
+    quint32 _nameOffset, _nameLength;
+    quint64 _size;
+};
+
+Q_DECLARE_TYPEINFO(ScanFile, Q_PRIMITIVE_TYPE);
+
+/**
+ * The files of a directory.
+ *
+ * The names are stored one after the other in one block, as
+ * read from the filesystem, and only decoded when asked for.
+ */
+class ScanFileVector
+{
+public:
+    typedef QVector<ScanFile>::iterator iterator;
+    typedef QVector<ScanFile>::const_iterator const_iterator;
+
+    int count() const
     {
-        _listener = l;
+        return _files.count();
     }
-    ScanListener *listener()
+    bool isEmpty() const
     {
-        return _listener;
+        return _files.isEmpty();
+    }
+
+    void append(const char *name, int length, KIO::fileoffset_t size);
+    void append(const QString &name, KIO::fileoffset_t size)
+    {
+        const QByteArray n = QFile::encodeName(name);
+        append(n.constData(), n.length(), size);
+    }
+
+    QString name(const ScanFile &f) const
+    {
+        return QFile::decodeName(QByteArray::fromRawData(_names.constData() + f._nameOffset,
+                                 f._nameLength));
+    }
+    QByteArray encodedName(const ScanFile &f) const
+    {
+        return _names.mid(f._nameOffset, f._nameLength);
+    }
+
+    ScanFile &operator[](int i)
+    {
+        return _files[i];
+    }
+    const ScanFile &at(int i) const
+    {
+        return _files.at(i);
+    }
+    iterator begin()
+    {
+        return _files.begin();
+    }
+    iterator end()
+    {
+        return _files.end();
+    }
+    const_iterator constBegin() const
+    {
+        return _files.constBegin();
+    }
+    const_iterator constEnd() const
+    {
+        return _files.constEnd();
+    }
+
+    void reserve(int files)
+    {
+        _files.reserve(files);
+    }
+    /* free the room reserved for more files */
+    void squeeze()
+    {
+        _files.squeeze();
+        _names.squeeze();
+    }
+    void clear()
+    {
+        _files.clear();
+        _names.clear();
+    }
+    void swap(ScanFileVector &other)
+    {
+        _files.swap(other._files);
+        _names.swap(other._names);
     }
 
 private:
-    QString _name;
-    KIO::fileoffset_t _size;
-    ScanListener *_listener;
+    friend QDataStream &operator<<(QDataStream &, const ScanFileVector &);
+    friend QDataStream &operator>>(QDataStream &, ScanFileVector &);
+
+    QVector<ScanFile> _files;
+    QByteArray _names;
 };
 
-typedef QVector<ScanFile> ScanFileVector;
+QDataStream &operator<<(QDataStream &, const ScanFileVector &);
+QDataStream &operator>>(QDataStream &, ScanFileVector &);
+
 typedef QVector<ScanDir> ScanDirVector;
 
 /**
@@ -181,13 +322,13 @@ public:
             ScanDir *p = 0, int data = 0);
     ~ScanDir();
 
-    /* Get items of this directory
-     * and append subdirectories to todo list.
+    /* Set the items of this directory from the read node,
+     * and point the child nodes to the new subdirectories.
      *
-     * Directories added to the todo list are attributed with data.
+     * Subdirectories are attributed with data.
      * Returns the number of new subdirectories created for scanning.
      */
-    int scan(ScanItem *si, ScanItemList &list, int data);
+    int scan(ScanNode *node, int data);
 
     /* clear scan objects below */
     void clear();
@@ -197,7 +338,7 @@ public:
      */
     void setupChildRescan();
 
-    /* Absolute path. Warning: Slow, loops to top parent. */
+    /* Absolute path, built in one go from the names up to the top */
     QString path();
 
     /* get integer data attribute */
@@ -270,7 +411,6 @@ public:
 
 private:
     void update();
-    bool isForbiddenDir(QString &);
 
     /* this propagates file count and size to upper dirs */
     void subScanFinished();
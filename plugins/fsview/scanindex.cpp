@@ -0,0 +1,295 @@
+/* This file is part of FSView.
+   Copyright (c) 2016 The Konqueror developers
+
+   KCachegrind is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public
+   License as published by the Free Software Foundation, version 2.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; see the file COPYING.  If not, write to
+   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+*/
+
+#include <qdir.h>
+#include <qfile.h>
+#include <QDataStream>
+#include <QDateTime>
+#include <QRunnable>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <QVector>
+
+#include <algorithm>
+
+#include <kdebug.h>
+
+#include "scanindex.h"
+
+// "FSVI"
+static const quint32 s_indexMagic = 0x46535649;
+static const quint32 s_indexVersion = 2;
+// entries not used for that many days are dropped on save
+static const int s_maxUnusedDays = 60;
+// files and subdirectories held in memory
+static const int s_maxFileCount = 1000000;
+
+static int today()
+{
+    return QDate::currentDate().toJulianDay();
+}
+
+uint qHash(const ScanIndex::Key &k, uint seed)
+{
+    return qHash(k.ino, seed) ^ qHash(k.dev);
+}
+
+/**
+ * Writes the index in a worker thread.
+ */
+class ScanIndexSaveJob : public QRunnable
+{
+public:
+    ScanIndexSaveJob(ScanIndex *index, const QString &file)
+        : _index(index), _file(file)
+    {
+    }
+
+    void run() Q_DECL_OVERRIDE
+    {
+        if (!_index->save(_file)) {
+            kDebug(90100) << "Cannot write directory index" << _file;
+        }
+    }
+
+private:
+    ScanIndex *_index;
+    QString _file;
+};
+
+ScanIndex::ScanIndex()
+{
+    _fileCount = 0;
+    _maxFileCount = s_maxFileCount;
+    _loaded = false;
+    _modified = false;
+    _savePool.setMaxThreadCount(1);
+}
+
+ScanIndex::~ScanIndex()
+{
+    _savePool.waitForDone();
+    clear();
+}
+
+QString ScanIndex::defaultFile()
+{
+    return QStandardPaths::writableLocation(QStandardPaths::GenericCacheLocation) +
+           QLatin1String("/fsview/dirindex");
+}
+
+void ScanIndex::clear()
+{
+    qDeleteAll(_entries);
+    _entries.clear();
+    _fileCount = 0;
+}
+
+bool ScanIndex::lessRecentlyAccessed(const QPair<int, Key> &a, const QPair<int, Key> &b)
+{
+    return a.first < b.first;
+}
+
+// Drops the least recently used entries down to 3/4 of the bound,
+// so that the entries aren't sorted again on each insert
+void ScanIndex::evict()
+{
+    QVector<QPair<int, Key> > order;
+    order.reserve(_entries.count());
+    QHash<Key, Entry *>::const_iterator it;
+    for (it = _entries.constBegin(); it != _entries.constEnd(); ++it) {
+        order.append(qMakePair(it.value()->lastAccess.load(), it.key()));
+    }
+    std::sort(order.begin(), order.end(), lessRecentlyAccessed);
+
+    const int target = _maxFileCount - _maxFileCount / 4;
+    for (int i = 0; i < order.count() && _fileCount > target; i++) {
+        Entry *e = _entries.take(order.at(i).second);
+        _fileCount -= e->fileCount();
+        delete e;
+    }
+    kDebug(90100) << "Directory index evicted down to" << _entries.count() << "directories";
+}
+
+bool ScanIndex::load(const QString &file)
+{
+    QWriteLocker locker(&_lock);
+    clear();
+    _loaded = true;
+    _modified = false;
+
+    QFile f(file);
+    if (!f.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+
+    QDataStream stream(&f);
+    stream.setVersion(QDataStream::Qt_5_6);
+
+    quint32 magic, version, count;
+    stream >> magic >> version;
+    if (magic != s_indexMagic || version != s_indexVersion) {
+        kDebug(90100) << "Ignoring directory index of unknown format" << file;
+        return false;
+    }
+
+    stream >> count;
+    _entries.reserve(qMin(count, quint32(1 << 20)));
+    for (quint32 i = 0; i < count && stream.status() == QDataStream::Ok; i++) {
+        Key k;
+        Entry *e = new Entry;
+        qint32 lastUsed;
+        stream >> k.dev >> k.ino >> e->mtime >> e->ctime >> lastUsed
+               >> e->files >> e->dirs;
+        e->lastUsed = lastUsed;
+        // older than anything looked up since
+        e->lastAccess = 0;
+        if (Entry *old = _entries.value(k)) {
+            _fileCount -= old->fileCount();
+            delete old;
+        }
+        _entries.insert(k, e);
+        _fileCount += e->fileCount();
+    }
+
+    if (stream.status() != QDataStream::Ok) {
+        kDebug(90100) << "Directory index truncated" << file;
+        clear();
+        return false;
+    }
+    if (_fileCount > _maxFileCount) {
+        evict();
+    }
+    return true;
+}
+
+bool ScanIndex::save(const QString &file)
+{
+    // resets _modified
+    QWriteLocker locker(&_lock);
+    if (!_modified) {
+        return true;
+    }
+
+    QDir().mkpath(QFileInfo(file).absolutePath());
+    QSaveFile f(file);
+    if (!f.open(QIODevice::WriteOnly)) {
+        return false;
+    }
+
+    QDataStream stream(&f);
+    stream.setVersion(QDataStream::Qt_5_6);
+
+    const int oldest = today() - s_maxUnusedDays;
+    quint32 count = 0;
+    QHash<Key, Entry *>::const_iterator it;
+    for (it = _entries.constBegin(); it != _entries.constEnd(); ++it) {
+        if (it.value()->lastUsed.load() >= oldest) {
+            count++;
+        }
+    }
+
+    stream << s_indexMagic << s_indexVersion << count;
+    for (it = _entries.constBegin(); it != _entries.constEnd(); ++it) {
+        const Entry *e = it.value();
+        if (e->lastUsed.load() < oldest) {
+            continue;
+        }
+        stream << it.key().dev << it.key().ino << e->mtime << e->ctime
+               << qint32(e->lastUsed.load()) << e->files << e->dirs;
+    }
+
+    if (!f.commit()) {
+        return false;
+    }
+    _modified = false;
+    return true;
+}
+
+void ScanIndex::saveInBackground(const QString &file)
+{
+    _savePool.start(new ScanIndexSaveJob(this, file));
+}
+
+void ScanIndex::waitForSave()
+{
+    _savePool.waitForDone();
+}
+
+bool ScanIndex::find(quint64 dev, quint64 ino, qint64 mtime, qint64 ctime,
+                     ScanFileVector &files, QStringList &dirs) const
+{
+    Key k = { dev, ino };
+    QReadLocker locker(&_lock);
+    const Entry *e = _entries.value(k);
+    if (!e || e->mtime != mtime || e->ctime != ctime) {
+        return false;
+    }
+
+    files = e->files;
+    dirs = e->dirs;
+    e->lastUsed.store(today());
+    e->lastAccess.store(_accessCount.fetchAndAddRelaxed(1) + 1);
+    return true;
+}
+
+void ScanIndex::insert(quint64 dev, quint64 ino, qint64 mtime, qint64 ctime,
+                       const ScanFileVector &files, const QStringList &dirs)
+{
+    Key k = { dev, ino };
+    QWriteLocker locker(&_lock);
+    Entry *&e = _entries[k];
+    if (!e) {
+        e = new Entry;
+    } else {
+        _fileCount -= e->fileCount();
+    }
+    e->mtime = mtime;
+    e->ctime = ctime;
+    e->files = files;
+    e->dirs = dirs;
+    e->lastUsed.store(today());
+    e->lastAccess.store(_accessCount.fetchAndAddRelaxed(1) + 1);
+    _fileCount += e->fileCount();
+    _modified = true;
+
+    if (_fileCount > _maxFileCount) {
+        evict();
+    }
+}
+
+int ScanIndex::count() const
+{
+    QReadLocker locker(&_lock);
+    return _entries.count();
+}
+
+int ScanIndex::fileCount() const
+{
+    QReadLocker locker(&_lock);
+    return _fileCount;
+}
+
+void ScanIndex::setMaxFileCount(int count)
+{
+    QWriteLocker locker(&_lock);
+    _maxFileCount = count;
+    if (_fileCount > _maxFileCount) {
+        evict();
+    }
+}
@@ -0,0 +1,129 @@
+/* This file is part of FSView.
+   Copyright (c) 2016 The Konqueror developers
+
+   KCachegrind is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public
+   License as published by the Free Software Foundation, version 2.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; see the file COPYING.  If not, write to
+   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+*/
+
+/*
+ * Persistent index of directory contents
+ */
+
+#ifndef KONQ_PLUGIN_SCANINDEX_H
+#define KONQ_PLUGIN_SCANINDEX_H
+
+#include <QAtomicInt>
+#include <QHash>
+#include <QPair>
+#include <QReadWriteLock>
+#include <QStringList>
+#include <QThreadPool>
+
+#include "scan.h"
+
+/**
+ * The content of the directories read before, keyed by
+ * device and inode, with the modification and change
+ * times of the directory when it was read.
+ *
+ * A directory whose times did not change since has the
+ * same entries, and needs not be read again. Note that
+ * the size of a file can change without its directory
+ * noticing: such changes are only seen when the directory
+ * is read again.
+ *
+ * Lookups are done from the scanner threads.
+ *
+ * The index holds at most maxFileCount() files and
+ * subdirectories in memory: above that, the least recently
+ * used directories are dropped.
+ */
+class ScanIndex
+{
+public:
+    ScanIndex();
+    ~ScanIndex();
+
+    /* the default file, in the cache directory */
+    static QString defaultFile();
+
+    bool load(const QString &file);
+    /* only writes if something changed since loaded */
+    bool save(const QString &file);
+    /* save() in a worker thread */
+    void saveInBackground(const QString &file);
+    void waitForSave();
+    bool isLoaded() const
+    {
+        return _loaded;
+    }
+
+    /**
+     * Get the content of the directory if its times
+     * are still the ones stored. Thread-safe.
+     */
+    bool find(quint64 dev, quint64 ino, qint64 mtime, qint64 ctime,
+              ScanFileVector &files, QStringList &dirs) const;
+
+    void insert(quint64 dev, quint64 ino, qint64 mtime, qint64 ctime,
+                const ScanFileVector &files, const QStringList &dirs);
+
+    int count() const;
+    /* files and subdirectories of all directories */
+    int fileCount() const;
+
+    int maxFileCount() const
+    {
+        return _maxFileCount;
+    }
+    void setMaxFileCount(int count);
+
+private:
+    struct Key {
+        quint64 dev, ino;
+        bool operator==(const Key &k) const
+        {
+            return dev == k.dev && ino == k.ino;
+        }
+    };
+    friend uint qHash(const Key &k, uint seed);
+
+    struct Entry {
+        qint64 mtime, ctime;
+        ScanFileVector files;
+        QStringList dirs;
+        // day of the last use, entries unused for long are not saved
+        mutable QAtomicInt lastUsed;
+        // order of the last use, to drop the least recently used
+        mutable QAtomicInt lastAccess;
+
+        int fileCount() const
+        {
+            return files.count() + dirs.count();
+        }
+    };
+
+    void clear();
+    void evict();
+    static bool lessRecentlyAccessed(const QPair<int, Key> &a, const QPair<int, Key> &b);
+
+    mutable QReadWriteLock _lock;
+    QHash<Key, Entry *> _entries;
+    mutable QAtomicInt _accessCount;
+    int _fileCount, _maxFileCount;
+    bool _loaded, _modified;
+    QThreadPool _savePool;
+};
+
+#endif // KONQ_PLUGIN_SCANINDEX_H
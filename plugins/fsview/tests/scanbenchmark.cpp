@@ -0,0 +1,121 @@
+/* This file is part of FSView.
+   Copyright (c) 2016 The Konqueror developers
+
+   KCachegrind is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public
+   License as published by the Free Software Foundation, version 2.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; see the file COPYING.  If not, write to
+   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+*/
+
+/*
+ * Compare the scan without threads, reading with QDir, to the
+ * threaded scan, on a synthetic tree or on the given directory.
+ *
+ *   scanbenchmark [depth [fanout [files]]]
+ *   scanbenchmark -p path
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <qdir.h>
+#include <qfile.h>
+#include <QElapsedTimer>
+#include <QTemporaryDir>
+#include <QThread>
+
+#include "scan.h"
+
+static void createTree(const QString &path, int depth, int fanout, int files)
+{
+    QDir dir(path);
+    for (int i = 0; i < files; i++) {
+        QFile f(dir.filePath(QStringLiteral("file%1").arg(i)));
+        if (f.open(QIODevice::WriteOnly)) {
+            f.write(QByteArray(i * 7 % 512, 'x'));
+        }
+    }
+    if (depth == 0) {
+        return;
+    }
+    for (int i = 0; i < fanout; i++) {
+        QString sub = QStringLiteral("dir%1").arg(i);
+        dir.mkdir(sub);
+        createTree(dir.filePath(sub), depth - 1, fanout, files);
+    }
+}
+
+static qint64 run(const QString &path, int threads, ScanDir **result, ScanManager *m)
+{
+    m->setThreadCount(threads);
+    *result = m->setTop(path);
+
+    QElapsedTimer timer;
+    timer.start();
+    m->startScan();
+    while (m->scanRunning()) {
+        m->scan(0);
+    }
+    return timer.elapsed();
+}
+
+static void report(const char *what, qint64 msecs, ScanDir *d)
+{
+    printf("%-22s %6lld ms: %u dirs, %u files, %llu bytes",
+           what, (long long)msecs, d->dirCount(), d->fileCount(),
+           (unsigned long long)d->size());
+    if (msecs > 0) {
+        printf(", %.0f files/s", d->fileCount() * 1000.0 / msecs);
+    }
+    printf("\n");
+}
+
+int main(int argc, char *argv[])
+{
+    QString path;
+    QTemporaryDir tmp;
+    if (argc > 2 && strcmp(argv[1], "-p") == 0) {
+        path = QFile::decodeName(argv[2]);
+    } else {
+        int depth = (argc > 1) ? atoi(argv[1]) : 4;
+        int fanout = (argc > 2) ? atoi(argv[2]) : 8;
+        int files = (argc > 3) ? atoi(argv[3]) : 20;
+        path = tmp.path();
+        printf("Creating tree of depth %d, fanout %d, %d files per directory\n",
+               depth, fanout, files);
+        createTree(path, depth, fanout, files);
+    }
+
+    int threads = qBound(1, QThread::idealThreadCount(), 8);
+    ScanManager m1, m2;
+    ScanDir *serial, *parallel;
+
+    // warm up the caches, so that both scans read from memory
+    run(path, threads, &parallel, &m2);
+
+    qint64 t1 = run(path, 0, &serial, &m1);
+    report("QDir, no threads:", t1, serial);
+
+    qint64 t2 = run(path, threads, &parallel, &m2);
+    char what[32];
+    snprintf(what, sizeof(what), "%d threads:", threads);
+    report(what, t2, parallel);
+
+    if (serial->fileCount() != parallel->fileCount() ||
+            serial->dirCount() != parallel->dirCount() ||
+            serial->size() != parallel->size()) {
+        printf("Results differ!\n");
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,313 @@
+/* This file is part of FSView.
+   Copyright (c) 2016 The Konqueror developers
+
+   KCachegrind is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public
+   License as published by the Free Software Foundation, version 2.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; see the file COPYING.  If not, write to
+   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+*/
+
+/* Test the persisted directory index. */
+
+#include <qdir.h>
+#include <qfile.h>
+#include <QDataStream>
+#include <QDate>
+#include <QTemporaryDir>
+#include <QTest>
+
+#include "scan.h"
+#include "scanindex.h"
+
+// the format of the file written by ScanIndex::save()
+static const quint32 s_magic = 0x46535649;
+static const quint32 s_version = 2;
+
+class ScanIndexTest : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void init();
+    void testFind();
+    void testSaveLoad();
+    void testSaveInBackground();
+    void testEvict();
+    void testLoadInvalid_data();
+    void testLoadInvalid();
+    void testReuse();
+
+private:
+    QString indexFile() const
+    {
+        return _dir.path() + QLatin1String("/dirindex");
+    }
+    void writeIndex(quint32 magic, quint32 version, quint32 nameLength, bool truncate);
+
+    QTemporaryDir _dir;
+};
+
+void ScanIndexTest::init()
+{
+    QFile::remove(indexFile());
+}
+
+static ScanFileVector twoFiles()
+{
+    ScanFileVector files;
+    files.append(QStringLiteral("a.txt"), 10);
+    files.append(QStringLiteral("b\xc3\xa4.png"), 2000);
+    return files;
+}
+
+static void compareFiles(const ScanFileVector &files, const ScanFileVector &expected)
+{
+    QCOMPARE(files.count(), expected.count());
+    for (int i = 0; i < files.count(); i++) {
+        QCOMPARE(files.name(files.at(i)), expected.name(expected.at(i)));
+        QCOMPARE(files.at(i).size(), expected.at(i).size());
+    }
+}
+
+void ScanIndexTest::testFind()
+{
+    ScanIndex index;
+    index.insert(1, 100, 5, 6, twoFiles(), QStringList(QStringLiteral("sub")));
+    QCOMPARE(index.count(), 1);
+
+    ScanFileVector files;
+    QStringList dirs;
+    QVERIFY(index.find(1, 100, 5, 6, files, dirs));
+    compareFiles(files, twoFiles());
+    QCOMPARE(dirs, QStringList(QStringLiteral("sub")));
+
+    // the directory changed since
+    QVERIFY(!index.find(1, 100, 7, 6, files, dirs));
+    QVERIFY(!index.find(1, 100, 5, 7, files, dirs));
+    // another directory
+    QVERIFY(!index.find(2, 100, 5, 6, files, dirs));
+    QVERIFY(!index.find(1, 101, 5, 6, files, dirs));
+
+    // inserting again replaces
+    index.insert(1, 100, 7, 7, ScanFileVector(), QStringList());
+    QCOMPARE(index.count(), 1);
+    QVERIFY(index.find(1, 100, 7, 7, files, dirs));
+    QVERIFY(files.isEmpty());
+    QVERIFY(dirs.isEmpty());
+}
+
+void ScanIndexTest::testSaveLoad()
+{
+    ScanIndex index;
+    QVERIFY(!index.load(indexFile()));
+    QVERIFY(index.isLoaded());
+
+    // nothing to write
+    QVERIFY(index.save(indexFile()));
+    QVERIFY(!QFile::exists(indexFile()));
+
+    index.insert(1, 100, 5, 6, twoFiles(), QStringList() << QStringLiteral("sub") << QStringLiteral("sub2"));
+    index.insert(1, 101, 8, 9, ScanFileVector(), QStringList());
+    QVERIFY(index.save(indexFile()));
+    QVERIFY(QFile::exists(indexFile()));
+
+    // only written again once changed
+    QVERIFY(QFile::remove(indexFile()));
+    QVERIFY(index.save(indexFile()));
+    QVERIFY(!QFile::exists(indexFile()));
+    index.insert(2, 100, 1, 1, ScanFileVector(), QStringList());
+    QVERIFY(index.save(indexFile()));
+
+    ScanIndex loaded;
+    QVERIFY(loaded.load(indexFile()));
+    QCOMPARE(loaded.count(), 3);
+    ScanFileVector files;
+    QStringList dirs;
+    QVERIFY(loaded.find(1, 100, 5, 6, files, dirs));
+    compareFiles(files, twoFiles());
+    QCOMPARE(dirs, QStringList() << QStringLiteral("sub") << QStringLiteral("sub2"));
+    QVERIFY(loaded.find(1, 101, 8, 9, files, dirs));
+    QVERIFY(files.isEmpty());
+    QVERIFY(dirs.isEmpty());
+    QVERIFY(!loaded.find(1, 100, 5, 7, files, dirs));
+}
+
+void ScanIndexTest::testSaveInBackground()
+{
+    ScanIndex index;
+    index.insert(1, 100, 5, 6, twoFiles(), QStringList());
+    index.saveInBackground(indexFile());
+    index.waitForSave();
+    QVERIFY(QFile::exists(indexFile()));
+
+    ScanIndex loaded;
+    QVERIFY(loaded.load(indexFile()));
+    QCOMPARE(loaded.count(), 1);
+}
+
+// Above the bound, the least recently used directories are dropped
+void ScanIndexTest::testEvict()
+{
+    ScanIndex index;
+    index.setMaxFileCount(8);
+    for (quint64 ino = 1; ino <= 4; ino++) {
+        index.insert(1, ino, 5, 6, twoFiles(), QStringList());
+    }
+    QCOMPARE(index.count(), 4);
+    QCOMPARE(index.fileCount(), 8);
+
+    ScanFileVector files;
+    QStringList dirs;
+    QVERIFY(index.find(1, 1, 5, 6, files, dirs));
+
+    // drops 2 and 3, down to 3/4 of the bound
+    index.insert(1, 5, 5, 6, twoFiles(), QStringList());
+    QCOMPARE(index.count(), 3);
+    QCOMPARE(index.fileCount(), 6);
+    QVERIFY(!index.find(1, 2, 5, 6, files, dirs));
+    QVERIFY(!index.find(1, 3, 5, 6, files, dirs));
+    QVERIFY(index.find(1, 1, 5, 6, files, dirs));
+    QVERIFY(index.find(1, 4, 5, 6, files, dirs));
+    QVERIFY(index.find(1, 5, 5, 6, files, dirs));
+
+    // replacing a directory counts its new files only
+    index.insert(1, 4, 7, 7, ScanFileVector(), QStringList(QStringLiteral("sub")));
+    QCOMPARE(index.count(), 3);
+    QCOMPARE(index.fileCount(), 5);
+
+    // lowering the bound evicts too, 4 being used last stays
+    index.setMaxFileCount(2);
+    QCOMPARE(index.count(), 1);
+    QVERIFY(index.find(1, 4, 7, 7, files, dirs));
+}
+
+// An index with one directory whose file name is nameLength long,
+// the name stored being 3 bytes long
+void ScanIndexTest::writeIndex(quint32 magic, quint32 version, quint32 nameLength, bool truncate)
+{
+    QByteArray data;
+    QDataStream stream(&data, QIODevice::WriteOnly);
+    stream.setVersion(QDataStream::Qt_5_6);
+    stream << magic << version << quint32(1);
+    stream << quint64(1) << quint64(100) << qint64(5) << qint64(6)
+           << qint32(QDate::currentDate().toJulianDay());
+    stream << QByteArray("abc") << quint32(1) << quint32(0) << nameLength << quint64(10);
+    stream << QStringList(QStringLiteral("sub"));
+    if (truncate) {
+        data.chop(4);
+    }
+
+    QFile f(indexFile());
+    QVERIFY(f.open(QIODevice::WriteOnly));
+    QCOMPARE(f.write(data), qint64(data.size()));
+}
+
+void ScanIndexTest::testLoadInvalid_data()
+{
+    QTest::addColumn<quint32>("magic");
+    QTest::addColumn<quint32>("version");
+    QTest::addColumn<quint32>("nameLength");
+    QTest::addColumn<bool>("truncate");
+    QTest::addColumn<bool>("valid");
+
+    QTest::newRow("valid") << s_magic << s_version << quint32(3) << false << true;
+    QTest::newRow("magic") << quint32(0x46535650) << s_version << quint32(3) << false << false;
+    QTest::newRow("older version") << s_magic << s_version - 1 << quint32(3) << false << false;
+    QTest::newRow("newer version") << s_magic << s_version + 1 << quint32(3) << false << false;
+    QTest::newRow("name past the end") << s_magic << s_version << quint32(4) << false << false;
+    QTest::newRow("name length overflow") << s_magic << s_version << quint32(0xffffffff) << false << false;
+    QTest::newRow("truncated") << s_magic << s_version << quint32(3) << true << false;
+}
+
+void ScanIndexTest::testLoadInvalid()
+{
+    QFETCH(quint32, magic);
+    QFETCH(quint32, version);
+    QFETCH(quint32, nameLength);
+    QFETCH(bool, truncate);
+    QFETCH(bool, valid);
+
+    writeIndex(magic, version, nameLength, truncate);
+
+    ScanIndex index;
+    index.insert(2, 200, 1, 1, ScanFileVector(), QStringList());
+    QCOMPARE(index.load(indexFile()), valid);
+    QVERIFY(index.isLoaded());
+    // a file which can't be read leaves an empty index
+    QCOMPARE(index.count(), valid ? 1 : 0);
+
+    ScanFileVector files;
+    QStringList dirs;
+    QCOMPARE(index.find(1, 100, 5, 6, files, dirs), valid);
+    if (valid) {
+        QCOMPARE(files.count(), 1);
+        QCOMPARE(files.name(files.at(0)), QStringLiteral("abc"));
+        QCOMPARE(files.at(0).size(), KIO::fileoffset_t(10));
+        QCOMPARE(dirs, QStringList(QStringLiteral("sub")));
+    }
+}
+
+static KIO::fileoffset_t scanSize(ScanManager &m, bool reuseIndexed)
+{
+    m.startScan(0, reuseIndexed);
+    while (m.scanRunning()) {
+        m.scan(0);
+    }
+    return m.top()->size();
+}
+
+static void appendToFile(const QString &path, const QByteArray &data)
+{
+    QFile f(path);
+    QVERIFY(f.open(QIODevice::WriteOnly | QIODevice::Append));
+    QCOMPARE(f.write(data), qint64(data.size()));
+}
+
+// Directories whose times did not change are taken from the index
+void ScanIndexTest::testReuse()
+{
+    QTemporaryDir top;
+    QVERIFY(QDir(top.path()).mkdir(QStringLiteral("sub")));
+    const QString file = top.path() + QLatin1String("/sub/file");
+    appendToFile(file, "abc");
+
+    ScanIndex index;
+    ScanManager m;
+    m.setThreadCount(2);
+    m.setIndex(&index);
+    m.setTop(top.path());
+    const KIO::fileoffset_t size = scanSize(m, false);
+    QCOMPARE(m.top()->fileCount(), 1u);
+    QCOMPARE(index.count(), 2);
+
+    // the directory doesn't see a file growing
+    appendToFile(file, "def");
+    QCOMPARE(scanSize(m, true), size);
+    QCOMPARE(scanSize(m, false), size + 3);
+
+    // but a new file changes its times
+    appendToFile(top.path() + QLatin1String("/sub/new"), "1234");
+    QCOMPARE(scanSize(m, true), size + 3 + 4);
+    QCOMPARE(m.top()->fileCount(), 2u);
+
+    // after a reload from the file too
+    QVERIFY(index.save(indexFile()));
+    ScanIndex loaded;
+    QVERIFY(loaded.load(indexFile()));
+    m.setIndex(&loaded);
+    appendToFile(file, "ghi");
+    QCOMPARE(scanSize(m, true), size + 3 + 4);
+}
+
+QTEST_GUILESS_MAIN(ScanIndexTest)
+
+#include "scanindextest.moc"
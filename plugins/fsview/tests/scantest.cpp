@@ -54,5 +54,7 @@ int main(int argc, char *argv[])
 
     m.setListener(new MyListener());
     m.startScan();
-    while (m.scan(1));
+    while (m.scanRunning()) {
+        m.scan(1);
+    }
 }
@@ -903,6 +903,101 @@ public:
 
 TreeMapItemLessThan treeMapItemLessThan;
 
+//
+// TreeMapHitGrid
+//
+
+/**
+ * The children of an item, by position: the item rectangle is divided
+ * into cells, and each cell lists the children overlapping it, in the
+ * order of the children. Finding the child at a position then only
+ * checks the few children of one cell.
+ * Built from the current item rectangles of the children; it has
+ * to be rebuilt when they change.
+ */
+class TreeMapHitGrid
+{
+public:
+    TreeMapHitGrid(const QRect &rect, TreeMapItemList *list);
+
+    // index of the child at x/y, or -1
+    int find(TreeMapItemList *list, int x, int y) const;
+
+    // below, children are checked one by one
+    static const int minChildren = 16;
+
+private:
+    int cell(int pos, int start, int length, int cells) const
+    {
+        return qBound(0, (pos - start) * cells / length, cells - 1);
+    }
+
+    QRect _rect;
+    int _columns, _rows;
+    // children of cell c are _items[_start[c]] to _items[_start[c+1]-1]
+    QVector<int> _start, _items;
+};
+
+TreeMapHitGrid::TreeMapHitGrid(const QRect &rect, TreeMapItemList *list)
+{
+    _rect = rect;
+    // about as many cells as children
+    int cells = qBound(1, (int)sqrt((double)list->size()), 64);
+    _columns = qMax(1, qMin(cells, _rect.width()));
+    _rows = qMax(1, qMin(cells, _rect.height()));
+
+    QVector<QRect> cellRects(list->size());
+    _start.fill(0, _columns * _rows + 1);
+    for (int idx = 0; idx < list->size(); idx++) {
+        QRect r = list->at(idx)->itemRect() & _rect;
+        if (!r.isValid()) {
+            continue;
+        }
+        r.setCoords(cell(r.left(), _rect.x(), _rect.width(), _columns),
+                    cell(r.top(), _rect.y(), _rect.height(), _rows),
+                    cell(r.right(), _rect.x(), _rect.width(), _columns),
+                    cell(r.bottom(), _rect.y(), _rect.height(), _rows));
+        cellRects[idx] = r;
+        for (int row = r.top(); row <= r.bottom(); row++)
+            for (int col = r.left(); col <= r.right(); col++) {
+                _start[row * _columns + col + 1]++;
+            }
+    }
+    for (int c = 0; c < _columns * _rows; c++) {
+        _start[c + 1] += _start[c];
+    }
+
+    QVector<int> next = _start;
+    _items.resize(_start.last());
+    for (int idx = 0; idx < list->size(); idx++) {
+        const QRect &r = cellRects.at(idx);
+        if (!r.isValid()) {
+            continue;
+        }
+        for (int row = r.top(); row <= r.bottom(); row++)
+            for (int col = r.left(); col <= r.right(); col++) {
+                _items[next[row * _columns + col]++] = idx;
+            }
+    }
+}
+
+int TreeMapHitGrid::find(TreeMapItemList *list, int x, int y) const
+{
+    if (!_rect.contains(x, y)) {
+        return -1;
+    }
+
+    int c = cell(y, _rect.y(), _rect.height(), _rows) * _columns +
+            cell(x, _rect.x(), _rect.width(), _columns);
+    for (int n = _start.at(c); n < _start.at(c + 1); n++) {
+        int idx = _items.at(n);
+        if (list->at(idx)->itemRect().contains(x, y)) {
+            return idx;
+        }
+    }
+    return -1;
+}
+
 // TreeMapItem
 
 TreeMapItem::TreeMapItem(TreeMapItem *parent, double value)
@@ -916,6 +1011,8 @@ TreeMapItem::TreeMapItem(TreeMapItem *parent, double value)
     _index = -1;
     _depth = -1; // not set
     _unused_self = 0;
+    _changed = true;
+    _hitGrid = 0;
 
     if (_parent) {
         // take sorting from parent
@@ -952,6 +1049,8 @@ TreeMapItem::TreeMapItem(TreeMapItem *parent, double value,
     _index = -1;
     _depth = -1; // not set
     _unused_self = 0;
+    _changed = true;
+    _hitGrid = 0;
 
     if (_parent) {
         _parent->addItem(this);
@@ -965,6 +1064,7 @@ TreeMapItem::~TreeMapItem()
         delete _children;
         _children = 0;
     }
+    clearHitGrid();
 
     // finally, notify widget about deletion
     if (_widget) {
@@ -1011,6 +1111,22 @@ void TreeMapItem::redraw()
     }
 }
 
+// parents have to be drawn again, too: they paint below this item.
+// Do not stop at a changed parent, as it may be not drawn itself
+// while its parents were
+void TreeMapItem::setChanged()
+{
+    for (TreeMapItem *i = this; i; i = i->_parent) {
+        i->_changed = true;
+    }
+}
+
+void TreeMapItem::clearHitGrid()
+{
+    delete _hitGrid;
+    _hitGrid = 0;
+}
+
 void TreeMapItem::clear()
 {
     if (_children) {
@@ -1022,6 +1138,8 @@ void TreeMapItem::clear()
         qDeleteAll(*_children);
         delete _children;
         _children = 0;
+        clearHitGrid();
+        setChanged();
     }
 }
 
@@ -1085,6 +1203,8 @@ void TreeMapItem::addItem(TreeMapItem *i)
     if (sorting(0) != -1) {
         qSort(_children->begin(), _children->end(), treeMapItemLessThan);
     }
+    clearHitGrid();
+    i->setChanged();
 }
 
 // default implementations of virtual functions
@@ -1155,6 +1275,7 @@ void TreeMapItem::setSorting(int textNo, bool ascending)
 
     if (_children && _sortTextNo != -1) {
         qSort(_children->begin(), _children->end(), treeMapItemLessThan);
+        clearHitGrid();
     }
 }
 
@@ -1166,6 +1287,7 @@ void TreeMapItem::resort(bool recursive)
 
     if (_sortTextNo != -1) {
         qSort(_children->begin(), _children->end(), treeMapItemLessThan);
+        clearHitGrid();
     }
 
     if (recursive)
@@ -1292,6 +1414,8 @@ TreeMapWidget::TreeMapWidget(TreeMapItem *base,
     _pressed = 0;
     _lastOver = 0;
     _needsRefresh = _base;
+    _onlyChanged = false;
+    _drawOnlyChanged = false;
 
     setAttribute(Qt::WA_NoSystemBackground, true);
     setFocusPolicy(Qt::StrongFocus);
@@ -1732,7 +1856,17 @@ TreeMapItem *TreeMapWidget::item(int x, int y) const
     while (1) {
         TreeMapItemList *list = p->children();
         i = 0;
-        if (list) {
+        if (list && list->size() >= TreeMapHitGrid::minChildren &&
+                p->itemRect().isValid()) {
+            if (!p->_hitGrid) {
+                p->_hitGrid = new TreeMapHitGrid(p->itemRect(), list);
+            }
+            int idx = p->_hitGrid->find(list, x, y);
+            if (idx >= 0) {
+                i = list->at(idx);
+                p->setIndex(idx);
+            }
+        } else if (list) {
             int idx;
             for (idx = 0; idx < list->size(); idx++) {
                 i = list->at(idx);
@@ -2449,15 +2583,21 @@ void TreeMapWidget::drawTreeMap()
 
     if (_pixmap.size() != size()) {
         _needsRefresh = _base;
+        _onlyChanged = false;
     }
 
     if (_needsRefresh) {
 
         if (DEBUG_DRAWING) {
-            kDebug(90100) << "Redrawing " << _needsRefresh->path(0).join(QStringLiteral("/"));
+            kDebug(90100) << "Redrawing " << _needsRefresh->path(0).join(QStringLiteral("/"))
+                          << (_onlyChanged ? " (only changes)" : "");
         }
 
-        if (_needsRefresh == _base) {
+        if (_onlyChanged) {
+            // unchanged items are copied from the last drawing
+            _lastPixmap = _pixmap;
+            _drawOnlyChanged = true;
+        } else if (_needsRefresh == _base) {
             // redraw whole widget
             _pixmap = QPixmap(size());
             _pixmap.fill(palette().color(backgroundRole()));
@@ -2470,6 +2610,8 @@ void TreeMapWidget::drawTreeMap()
         } else {
             // only subitem
             if (!_needsRefresh->itemRect().isValid()) {
+                _drawOnlyChanged = false;
+                _lastPixmap = QPixmap();
                 return;
             }
         }
@@ -2480,6 +2622,9 @@ void TreeMapWidget::drawTreeMap()
 
         drawItems(&p, _needsRefresh);
         _needsRefresh = 0;
+        _onlyChanged = false;
+        _drawOnlyChanged = false;
+        _lastPixmap = QPixmap();
     }
 
     QStylePainter p(this);
@@ -2500,6 +2645,9 @@ void TreeMapWidget::redraw(TreeMapItem *i)
         return;
     }
 
+    // e.g. selection or colors changed: draw everything below i
+    _onlyChanged = false;
+
     if (!_needsRefresh) {
         _needsRefresh = i;
     } else {
@@ -2514,6 +2662,24 @@ void TreeMapWidget::redraw(TreeMapItem *i)
     }
 }
 
+void TreeMapWidget::redrawChanged(TreeMapItem *i)
+{
+    if (!i) {
+        return;
+    }
+
+    if (!_needsRefresh) {
+        _needsRefresh = i;
+        _onlyChanged = true;
+    } else if (!i->isChildOf(_needsRefresh)) {
+        _needsRefresh = _needsRefresh->commonParent(i);
+    }
+
+    if (isVisible()) {
+        update();
+    }
+}
+
 void TreeMapWidget::drawItem(QPainter *p,
                              TreeMapItem *item)
 {
@@ -2581,6 +2747,9 @@ void TreeMapWidget::drawItems(QPainter *p,
 
     drawItem(p, item);
     item->clearFreeRects();
+    // rectangles of children are set again below
+    item->clearHitGrid();
+    item->_changed = false;
 
     QRect origRect = item->itemRect();
     int bw = item->borderWidth();
@@ -3093,8 +3262,21 @@ bool TreeMapWidget::drawItemArray(QPainter *p, TreeMapItem *item,
 
         // do not draw very small rectangles:
         if (nextPos >= _visibleWidth) {
-            i->setItemRect(currRect);
-            drawItems(p, i);
+            if (_drawOnlyChanged && i->itemRect() == currRect) {
+                if (!i->isChanged() && !isTransparent(i->depth())) {
+                    // same as in last drawing
+                    p->drawPixmap(currRect, _lastPixmap, currRect);
+                } else {
+                    drawItems(p, i);
+                }
+            } else {
+                // moved: the last drawing has nothing to reuse below
+                bool drawOnlyChanged = _drawOnlyChanged;
+                _drawOnlyChanged = false;
+                i->setItemRect(currRect);
+                drawItems(p, i);
+                _drawOnlyChanged = drawOnlyChanged;
+            }
         } else {
             i->clearItemRect();
             drawFill(item, p, currRect);
@@ -45,6 +45,7 @@
 class TreeMapWidget;
 class TreeMapItem;
 class TreeMapItemList;
+class TreeMapHitGrid;
 
 /**
  * Drawing parameters for an object.
@@ -311,6 +312,17 @@ public:
     // force a redraw of this item
     void redraw();
 
+    /**
+     * Mark this item as changed, e.g. its value or texts, without
+     * redrawing it yet. The next redraw of a parent draws it again.
+     * See TreeMapWidget::redrawChanged().
+     */
+    void setChanged();
+    bool isChanged() const
+    {
+        return _changed;
+    }
+
     // delete all children
     void clear();
 
@@ -462,6 +474,10 @@ protected:
     double _sum, _value;
 
 private:
+    friend class TreeMapWidget;
+
+    void clearHitGrid();
+
     TreeMapWidget *_widget;
     TreeMapItem *_parent;
 
@@ -478,6 +494,11 @@ private:
 
     // index of last active subitem
     int _index;
+
+    // not drawn since changed
+    bool _changed;
+    // children by position, built when looking up an item
+    TreeMapHitGrid *_hitGrid;
 };
 
 /**
@@ -786,6 +807,19 @@ public:
         redraw(_base);
     }
 
+    /**
+     * Redraws an item, but below it, only the items marked with
+     * TreeMapItem::setChanged() or whose rectangle moved are drawn
+     * again. The others are copied from the last drawing.
+     * For frequent updates of a few values, e.g. while they are
+     * calculated.
+     */
+    void redrawChanged(TreeMapItem *);
+    void redrawChanged()
+    {
+        redrawChanged(_base);
+    }
+
     /**
      * Resort all TreeMapItems. See TreeMapItem::resort().
      */
@@ -876,6 +910,8 @@ private:
     bool _allowRotation;
     bool _transparent[4], _drawFrame[4];
     TreeMapItem *_needsRefresh;
+    // only items changed or moved need to be drawn again
+    bool _onlyChanged, _drawOnlyChanged;
     TreeMapItemList _selection;
     int _markNo;
 
@@ -893,8 +929,8 @@ private:
     QFont _font;
     int _fontHeight;
 
-    // back buffer pixmap
-    QPixmap _pixmap;
+    // back buffer pixmap, and the last one while drawing only changes
+    QPixmap _pixmap, _lastPixmap;
 };
 
 #endif
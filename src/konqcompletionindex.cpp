@@ -0,0 +1,493 @@
+/* This file is part of the KDE project
+   Copyright (c) 2016 The Konqueror developers
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; see the file COPYING.  If not, write to
+   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+*/
+
+#include "konqcompletionindex.h"
+
+#include "konq_historyentry.h"
+
+#include <QtCore/QSet>
+
+#include <algorithm>
+
+struct KonqCompletionIndex::Candidate {
+    qreal score;
+    int order;      // of the lookup, for the same score
+    int id;
+};
+
+// Keeps the best candidates in a heap, the worst of them on top, so that
+// finding the best k of n matches is O(n log k) and holds k at most.
+class KonqCompletionIndex::TopItems
+{
+public:
+    explicit TopItems(int maxItems)
+        : m_maxItems(maxItems), m_order(0)
+    {
+    }
+
+    void add(qreal score, int id)
+    {
+        const Candidate candidate = { score, m_order++, id };
+        if (m_maxItems < 0 || m_heap.count() < m_maxItems) {
+            m_heap.append(candidate);
+            std::push_heap(m_heap.begin(), m_heap.end(), isBetter);
+        } else if (m_maxItems > 0 && isBetter(candidate, m_heap.first())) {
+            std::pop_heap(m_heap.begin(), m_heap.end(), isBetter);
+            m_heap.last() = candidate;
+            std::push_heap(m_heap.begin(), m_heap.end(), isBetter);
+        }
+    }
+
+    QStringList items(const KonqCompletionIndex &index)
+    {
+        std::sort_heap(m_heap.begin(), m_heap.end(), isBetter);
+        QStringList items;
+        items.reserve(m_heap.count());
+        for (int i = 0; i < m_heap.count(); ++i) {
+            items.append(index.entryAt(m_heap.at(i).id).bestItem);
+        }
+        return items;
+    }
+
+private:
+    static bool isBetter(const Candidate &a, const Candidate &b)
+    {
+        return a.score > b.score || (a.score == b.score && a.order < b.order);
+    }
+
+    int m_maxItems;
+    int m_order;
+    QVector<Candidate> m_heap;
+};
+
+static const int s_entryBlockSize = 256;
+static const int s_trigramHashCount = 1024;
+
+static inline quint64 trigram(const QChar *c)
+{
+    return (quint64(c[0].unicode()) << 32) | (quint64(c[1].unicode()) << 16) | c[2].unicode();
+}
+
+static QSet<quint64> trigrams(const QString &text)
+{
+    QSet<quint64> result;
+    for (int i = 0; i + 3 <= text.length(); ++i) {
+        result.insert(trigram(text.unicode() + i));
+    }
+    return result;
+}
+
+// How much the visits count, from how long ago the last one was
+static qreal recency(qint64 age)
+{
+    static const qint64 day = 24 * 60 * 60;
+    if (age <= 4 * day) {
+        return 1.0;
+    } else if (age <= 14 * day) {
+        return 0.7;
+    } else if (age <= 31 * day) {
+        return 0.5;
+    } else if (age <= 90 * day) {
+        return 0.3;
+    }
+    return 0.1;
+}
+
+// The key map of key, see m_keys
+static inline QString keyMapName(const QString &key)
+{
+    return key.left(2);
+}
+
+KonqCompletionIndex::KonqCompletionIndex()
+    : m_count(0),
+      m_trigrams(s_trigramHashCount)
+{
+}
+
+const KonqCompletionIndex::Entry &KonqCompletionIndex::entryAt(int id) const
+{
+    return m_entryBlocks.at(id / s_entryBlockSize).at(id % s_entryBlockSize);
+}
+
+KonqCompletionIndex::Entry &KonqCompletionIndex::modifyEntry(int id)
+{
+    return m_entryBlocks[id / s_entryBlockSize][id % s_entryBlockSize];
+}
+
+const KonqCompletionIndex::TrigramHash &KonqCompletionIndex::trigramHash(quint64 trigram) const
+{
+    return m_trigrams.at(qHash(trigram) % s_trigramHashCount);
+}
+
+KonqCompletionIndex::TrigramHash &KonqCompletionIndex::modifyTrigramHash(quint64 trigram)
+{
+    return m_trigrams[qHash(trigram) % s_trigramHashCount];
+}
+
+// Strips the scheme, "www." and the trailing slash from text.
+// Items without a scheme are typed URLs and bookmarks, which are http
+// unless they are paths.
+QString KonqCompletionIndex::normalize(const QString &text, QString *scheme, bool *hasScheme)
+{
+    static const struct {
+        const char *prefix;
+        const char *scheme;
+    } prefixes[] = {
+        { "http://", "http" },
+        { "https://", "https" },
+        { "ftp://", "ftp" },
+        { "file://", "file" },
+        { "file:", "file" }, // without /, because people enter /usr etc.
+    };
+
+    QString key = text;
+    *hasScheme = false;
+    for (unsigned int i = 0; i < sizeof(prefixes) / sizeof(*prefixes); ++i) {
+        const QLatin1String prefix(prefixes[i].prefix);
+        if (key.startsWith(prefix)) {
+            key.remove(0, prefix.size());
+            *scheme = QLatin1String(prefixes[i].scheme);
+            *hasScheme = true;
+            break;
+        }
+    }
+    if (!*hasScheme) {
+        const bool isPath = key.startsWith(QLatin1Char('/')) || key.startsWith(QLatin1Char('~'));
+        *scheme = isPath ? QStringLiteral("file") : QStringLiteral("http");
+    }
+
+    if (key.startsWith(QLatin1String("www."))) {
+        key.remove(0, 4);
+    }
+    if (key.endsWith(QLatin1Char('/'))) {
+        key.chop(1);
+    }
+    return key;
+}
+
+// The frecency of the best variant of entry
+qreal KonqCompletionIndex::score(const Entry &entry, qint64 now)
+{
+    qreal best = 0;
+    foreach (const Variant &variant, entry.variants) {
+        qreal score = variant.weight;
+        if (variant.lastVisited != 0) {
+            score += variant.visits * recency(now - variant.lastVisited) * (variant.typed ? 2 : 1);
+        }
+        best = qMax(best, score);
+    }
+    return best;
+}
+
+qint64 KonqCompletionIndex::now() const
+{
+    const QDateTime time = m_referenceTime.isValid() ? m_referenceTime : QDateTime::currentDateTime();
+    return time.toMSecsSinceEpoch() / 1000;
+}
+
+// Returns the id of the entry of item, creating it and the variant if add
+int KonqCompletionIndex::findVariant(const QString &item, bool add, int *variant)
+{
+    QString scheme;
+    bool hasScheme;
+    const QString key = normalize(item, &scheme, &hasScheme) + QChar(0) + scheme;
+
+    int id = -1;
+    QMap<QString, KeyMap>::const_iterator keyMap = m_keys.constFind(keyMapName(key));
+    if (keyMap != m_keys.constEnd()) {
+        id = keyMap.value().value(key, -1);
+    }
+    if (id == -1) {
+        if (!add) {
+            return -1;
+        }
+        if (!m_freeIds.isEmpty()) {
+            id = m_freeIds.takeLast();
+        } else {
+            if (m_entryBlocks.isEmpty() || m_entryBlocks.last().count() == s_entryBlockSize) {
+                m_entryBlocks.append(QVector<Entry>());
+                m_entryBlocks.last().reserve(s_entryBlockSize);
+            }
+            m_entryBlocks.last().append(Entry());
+            id = (m_entryBlocks.count() - 1) * s_entryBlockSize + m_entryBlocks.last().count() - 1;
+        }
+        Entry &entry = modifyEntry(id);
+        entry.key = key;
+        entry.scheme = scheme;
+        m_keys[keyMapName(key)].insert(key, id);
+        ++m_count;
+    }
+
+    const QVector<Variant> &variants = entryAt(id).variants;
+    for (int i = 0; i < variants.count(); ++i) {
+        if (variants.at(i).item == item) {
+            *variant = i;
+            return id;
+        }
+    }
+    if (!add) {
+        return -1;
+    }
+    const Variant newVariant = { item, QString(), 0, 0, 0, false, hasScheme };
+    QVector<Variant> &newVariants = modifyEntry(id).variants;
+    newVariants.append(newVariant);
+    *variant = newVariants.count() - 1;
+    return id;
+}
+
+// Updates what derives from the variants of the entry
+void KonqCompletionIndex::updateEntry(int id)
+{
+    Entry &entry = modifyEntry(id);
+    if (entry.variants.isEmpty()) {
+        removeEntry(id);
+        return;
+    }
+
+    // The item shown is the most visited one with a scheme, as that is
+    // what gets opened; the typed "kde.org" shows as "http://kde.org/".
+    const Variant *best = 0;
+    QString text = entry.key.left(entry.key.indexOf(QChar(0)));
+    for (int i = 0; i < entry.variants.count(); ++i) {
+        const Variant &variant = entry.variants.at(i);
+        const qreal weight = variant.weight + variant.visits;
+        if (!best || (variant.hasScheme && !best->hasScheme)
+                || (variant.hasScheme == best->hasScheme && weight > best->weight + best->visits)) {
+            best = &variant;
+        }
+        if (!variant.title.isEmpty()) {
+            text += QLatin1Char('\n') + variant.title;
+        }
+    }
+    entry.bestItem = best->item;
+
+    text = text.toLower();
+    if (text != entry.text) {
+        indexText(id, false);
+        entry.text = text;
+        indexText(id, true);
+    }
+}
+
+void KonqCompletionIndex::removeEntry(int id)
+{
+    indexText(id, false);
+    const QString key = entryAt(id).key;
+    QMap<QString, KeyMap>::iterator keyMap = m_keys.find(keyMapName(key));
+    keyMap.value().remove(key);
+    if (keyMap.value().isEmpty()) {
+        m_keys.erase(keyMap);
+    }
+    modifyEntry(id) = Entry();
+    m_freeIds.append(id);
+    --m_count;
+}
+
+// The lists of entries of a trigram are sorted by id, so that removing an
+// entry from the list of a common trigram doesn't scan it
+void KonqCompletionIndex::indexText(int id, bool add)
+{
+    foreach (quint64 t, trigrams(entryAt(id).text)) {
+        TrigramHash &hash = modifyTrigramHash(t);
+        if (add) {
+            QVector<int> &ids = hash[t];
+            ids.insert(std::lower_bound(ids.begin(), ids.end(), id), id);
+        } else {
+            TrigramHash::iterator it = hash.find(t);
+            if (it != hash.end()) {
+                QVector<int> &ids = it.value();
+                const QVector<int>::iterator pos = std::lower_bound(ids.begin(), ids.end(), id);
+                if (pos != ids.end() && *pos == id) {
+                    ids.erase(pos);
+                }
+                if (ids.isEmpty()) {
+                    hash.erase(it);
+                }
+            }
+        }
+    }
+}
+
+void KonqCompletionIndex::addItem(const QString &item, int weight)
+{
+    if (item.isEmpty()) {
+        return;
+    }
+
+    int variant;
+    const int id = findVariant(item, true, &variant);
+    modifyEntry(id).variants[variant].weight += weight;
+    updateEntry(id);
+}
+
+void KonqCompletionIndex::removeItem(const QString &item)
+{
+    if (item.isEmpty()) {
+        return;
+    }
+
+    int variant;
+    const int id = findVariant(item, false, &variant);
+    if (id != -1) {
+        modifyEntry(id).variants.remove(variant);
+        updateEntry(id);
+    }
+}
+
+void KonqCompletionIndex::addHistoryEntry(const KonqHistoryEntry &entry, const QString &prettyUrl)
+{
+    const qint64 lastVisited = qMax(entry.lastVisited.toMSecsSinceEpoch() / 1000, qint64(1));
+    const bool typed = !entry.typedUrl.isEmpty();
+
+    int variant;
+    int id = findVariant(prettyUrl, true, &variant);
+    Variant &urlVariant = modifyEntry(id).variants[variant];
+    urlVariant.title = entry.title;
+    urlVariant.visits = entry.numberOfTimesVisited;
+    urlVariant.lastVisited = lastVisited;
+    urlVariant.typed = typed;
+    updateEntry(id);
+
+    if (typed) {
+        id = findVariant(entry.typedUrl, true, &variant);
+        Variant &typedVariant = modifyEntry(id).variants[variant];
+        typedVariant.visits = entry.numberOfTimesVisited;
+        typedVariant.lastVisited = lastVisited;
+        typedVariant.typed = true;
+        updateEntry(id);
+    }
+}
+
+void KonqCompletionIndex::removeHistoryEntry(const QString &prettyUrl, const QString &typedUrl)
+{
+    removeHistory(prettyUrl);
+    removeHistory(typedUrl);
+}
+
+// Removes the history of item, keeping it if it's also a bookmark
+void KonqCompletionIndex::removeHistory(const QString &item)
+{
+    if (item.isEmpty()) {
+        return;
+    }
+
+    int variant;
+    const int id = findVariant(item, false, &variant);
+    if (id == -1) {
+        return;
+    }
+    QVector<Variant> &variants = modifyEntry(id).variants;
+    if (variants.at(variant).weight == 0) {
+        variants.remove(variant);
+    } else {
+        Variant &kept = variants[variant];
+        kept.title.clear();
+        kept.visits = 0;
+        kept.lastVisited = 0;
+        kept.typed = false;
+    }
+    updateEntry(id);
+}
+
+void KonqCompletionIndex::clear()
+{
+    m_entryBlocks.clear();
+    m_freeIds.clear();
+    m_count = 0;
+    m_keys.clear();
+    m_trigrams = QVector<TrigramHash>(s_trigramHashCount);
+}
+
+QStringList KonqCompletionIndex::matches(const QString &text, int maxItems) const
+{
+    QString scheme;
+    bool hasScheme;
+    const QString prefix = normalize(text, &scheme, &hasScheme);
+    // "www." or "http://" alone would match everything
+    if (prefix.isEmpty()) {
+        return QStringList();
+    }
+
+    const qint64 time = now();
+    TopItems top(maxItems);
+    const QString keyMapPrefix = keyMapName(prefix);
+    for (QMap<QString, KeyMap>::const_iterator keyMap = m_keys.lowerBound(keyMapPrefix);
+            keyMap != m_keys.constEnd() && keyMap.key().startsWith(keyMapPrefix); ++keyMap) {
+        for (KeyMap::const_iterator it = keyMap.value().lowerBound(prefix);
+                it != keyMap.value().constEnd() && it.key().startsWith(prefix); ++it) {
+            const Entry &entry = entryAt(it.value());
+            if (!hasScheme || entry.scheme == scheme) {
+                top.add(score(entry, time), it.value());
+            }
+        }
+    }
+    return top.items(*this);
+}
+
+QStringList KonqCompletionIndex::substringMatches(const QString &text, int maxItems) const
+{
+    const QStringList words = text.toLower().split(QLatin1Char(' '), QString::SkipEmptyParts);
+    if (words.isEmpty()) {
+        return QStringList();
+    }
+
+    // The candidates are the entries with the rarest trigram of the words,
+    // or all entries when the words are too short to have any
+    const QVector<int> *candidates = 0;
+    foreach (const QString &word, words) {
+        foreach (quint64 t, trigrams(word)) {
+            const TrigramHash &hash = trigramHash(t);
+            TrigramHash::const_iterator it = hash.constFind(t);
+            if (it == hash.constEnd()) {
+                return QStringList();
+            }
+            if (!candidates || it.value().count() < candidates->count()) {
+                candidates = &it.value();
+            }
+        }
+    }
+    QVector<int> allIds;
+    if (!candidates) {
+        allIds.reserve(m_count);
+        foreach (const KeyMap &keyMap, m_keys) {
+            foreach (int id, keyMap) {
+                allIds.append(id);
+            }
+        }
+        candidates = &allIds;
+    }
+
+    const qint64 time = now();
+    TopItems top(maxItems);
+    foreach (int id, *candidates) {
+        const Entry &entry = entryAt(id);
+        bool matches = true;
+        foreach (const QString &word, words) {
+            if (!entry.text.contains(word)) {
+                matches = false;
+                break;
+            }
+        }
+        if (matches) {
+            top.add(score(entry, time), id);
+        }
+    }
+    return top.items(*this);
+}
@@ -0,0 +1,167 @@
+/* This file is part of the KDE project
+   Copyright (c) 2016 The Konqueror developers
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; see the file COPYING.  If not, write to
+   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+*/
+
+#ifndef KONQ_COMPLETIONINDEX_H
+#define KONQ_COMPLETIONINDEX_H
+
+#include <QtCore/QDateTime>
+#include <QtCore/QHash>
+#include <QtCore/QMap>
+#include <QtCore/QStringList>
+#include <QtCore/QVector>
+
+#include <konqprivate_export.h>
+
+class KonqHistoryEntry;
+
+/**
+ * The index behind the completion of the location bar.
+ *
+ * Every item (URL, typed URL, bookmark) is stored once, under a key without
+ * its scheme, its "www." and its trailing slash. The variants of one address,
+ * like "http://kde.org/", "http://www.kde.org" and the typed "kde.org", share
+ * an entry. So whatever the user types, with or without scheme or "www.",
+ * the matches come from one prefix lookup, without duplicates.
+ *
+ * Matches are ranked by frecency: the number of visits, weighted by how
+ * recent the last one was, doubled for the URLs the user typed. Entries are
+ * also indexed by the trigrams of their address and title, for the substring
+ * completion.
+ *
+ * Copies are cheap and the index is split in implicitly shared parts: blocks
+ * of entries, maps of keys by their first two characters, hashes of a part of
+ * the trigrams and the list of each trigram. Changing an index while a copy
+ * of it is used, e.g. by KonqCompletionMatcher, only copies the parts which
+ * change.
+ */
+class KONQUERORPRIVATE_EXPORT KonqCompletionIndex
+{
+public:
+    KonqCompletionIndex();
+
+    /**
+     * Adds @p weight to the weight of @p item, as KCompletion::addItem() does.
+     * Used for the items which aren't history entries, like bookmarks.
+     */
+    void addItem(const QString &item, int weight = 1);
+
+    /**
+     * Removes @p item, whatever its weight and history.
+     */
+    void removeItem(const QString &item);
+
+    /**
+     * Adds or updates the history entry @p entry, shown as @p prettyUrl,
+     * and its typed URL.
+     */
+    void addHistoryEntry(const KonqHistoryEntry &entry, const QString &prettyUrl);
+
+    /**
+     * Removes the history entry shown as @p prettyUrl, and its @p typedUrl.
+     */
+    void removeHistoryEntry(const QString &prettyUrl, const QString &typedUrl);
+
+    void clear();
+
+    /**
+     * @returns the @p maxItems items starting with @p text, the best ranked
+     * first, or all of them if @p maxItems is negative. If @p text has a
+     * scheme, only the items with that scheme match.
+     */
+    QStringList matches(const QString &text, int maxItems = -1) const;
+
+    /**
+     * @returns the @p maxItems items whose address or title contains every
+     * word of @p text, whatever the case, the best ranked first.
+     */
+    QStringList substringMatches(const QString &text, int maxItems = -1) const;
+
+    /**
+     * @returns the number of entries, i.e. of distinct addresses
+     */
+    int count() const
+    {
+        return m_count;
+    }
+
+    /**
+     * Sets the time recency is measured from, the current time by default.
+     * For unit tests.
+     */
+    void setReferenceTime(const QDateTime &time)
+    {
+        m_referenceTime = time;
+    }
+
+private:
+    struct Variant {
+        QString item;
+        QString title;
+        qreal weight;           // from addItem()
+        quint32 visits;         // from the history
+        qint64 lastVisited;     // seconds since the epoch, 0 without history
+        bool typed;
+        bool hasScheme;
+    };
+
+    struct Entry {
+        QString key;            // in m_keys
+        QString scheme;
+        QVector<Variant> variants;
+        QString bestItem;       // the one to show
+        QString text;           // searched by substringMatches(), lower case
+    };
+
+    struct Candidate;
+    class TopItems;
+
+    typedef QMap<QString, int> KeyMap;
+    typedef QHash<quint64, QVector<int> > TrigramHash;
+
+    static QString normalize(const QString &text, QString *scheme, bool *hasScheme);
+    static qreal score(const Entry &entry, qint64 now);
+
+    const Entry &entryAt(int id) const;
+    // detaches the block of the entry only
+    Entry &modifyEntry(int id);
+    const TrigramHash &trigramHash(quint64 trigram) const;
+    TrigramHash &modifyTrigramHash(quint64 trigram);
+
+    int findVariant(const QString &item, bool add, int *variant);
+    void removeHistory(const QString &item);
+    void updateEntry(int id);
+    void removeEntry(int id);
+    void indexText(int id, bool add);
+    qint64 now() const;
+
+    // by id, in blocks of s_entryBlockSize
+    QVector<QVector<Entry> > m_entryBlocks;
+    QVector<int> m_freeIds;     // of removed entries
+    int m_count;
+    // keyed by the normalized item followed by '\0' and the scheme, so that
+    // the entries matching a prefix are contiguous, in maps by the first two
+    // characters of the key
+    QMap<QString, KeyMap> m_keys;
+    // entries by the trigrams of their text, sorted by id, in
+    // s_trigramHashCount hashes
+    QVector<TrigramHash> m_trigrams;
+    QDateTime m_referenceTime;
+};
+
+#endif // KONQ_COMPLETIONINDEX_H
@@ -0,0 +1,116 @@
+/* This file is part of the KDE project
+   Copyright (c) 2016 The Konqueror developers
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; see the file COPYING.  If not, write to
+   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+*/
+
+#include "konqcompletionmatcher.h"
+#include "konqcompletionindex.h"
+
+#include <QtCore/QRunnable>
+
+/**
+ * Looks up the matches of one request, in a worker thread.
+ */
+class KonqCompletionRunnable : public QObject, public QRunnable
+{
+    Q_OBJECT
+public:
+    KonqCompletionRunnable(const KonqCompletionIndex &index, const QString &text,
+                           KonqCompletionMatcher::Mode mode, int maxItems,
+                           const QSharedPointer<QAtomicInt> &latestSerial)
+        : m_index(index), // changing the index meanwhile only copies what changes
+          m_text(text),
+          m_mode(mode),
+          m_maxItems(maxItems),
+          m_latestSerial(latestSerial),
+          m_serial(latestSerial->load())
+    {
+        // deleted in the GUI thread, where it lives, see run()
+        setAutoDelete(false);
+    }
+
+    void run() Q_DECL_OVERRIDE
+    {
+        // replaced by a later keystroke while it was queued
+        if (m_latestSerial->load() == m_serial) {
+            const QStringList matches = m_mode == KonqCompletionMatcher::PrefixMatches
+                                        ? m_index.matches(m_text, m_maxItems)
+                                        : m_index.substringMatches(m_text, m_maxItems);
+            emit matched(m_serial, m_text, m_mode, matches);
+        }
+        deleteLater();
+    }
+
+Q_SIGNALS:
+    void matched(int serial, const QString &text, int mode, const QStringList &matches);
+
+private:
+    const KonqCompletionIndex m_index;
+    const QString m_text;
+    const KonqCompletionMatcher::Mode m_mode;
+    const int m_maxItems;
+    const QSharedPointer<QAtomicInt> m_latestSerial;
+    const int m_serial;
+};
+
+KonqCompletionMatcher::KonqCompletionMatcher(QObject *parent)
+    : QObject(parent),
+      m_serial(new QAtomicInt(0)),
+      m_running(false)
+{
+    // one lookup at a time, the queued ones are usually replaced already
+    m_pool.setMaxThreadCount(1);
+}
+
+KonqCompletionMatcher::~KonqCompletionMatcher()
+{
+    cancel();
+    m_pool.waitForDone();
+}
+
+void KonqCompletionMatcher::start(const KonqCompletionIndex &index, const QString &text, Mode mode, int maxItems)
+{
+    m_serial->ref();
+    m_running = true;
+    KonqCompletionRunnable *runnable = new KonqCompletionRunnable(index, text, mode, maxItems, m_serial);
+    // queued, as emitted from the worker thread
+    connect(runnable, &KonqCompletionRunnable::matched, this, &KonqCompletionMatcher::slotMatched);
+    m_pool.start(runnable);
+}
+
+void KonqCompletionMatcher::cancel()
+{
+    m_serial->ref();
+    m_running = false;
+}
+
+bool KonqCompletionMatcher::isRunning() const
+{
+    return m_running;
+}
+
+void KonqCompletionMatcher::slotMatched(int serial, const QString &text, int mode, const QStringList &matches)
+{
+    // a later request was started meanwhile
+    if (serial != m_serial->load()) {
+        return;
+    }
+    m_running = false;
+    emit finished(text, static_cast<Mode>(mode), matches);
+}
+
+#include "konqcompletionmatcher.moc"
@@ -0,0 +1,87 @@
+/* This file is part of the KDE project
+   Copyright (c) 2016 The Konqueror developers
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; see the file COPYING.  If not, write to
+   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+*/
+
+#ifndef KONQ_COMPLETIONMATCHER_H
+#define KONQ_COMPLETIONMATCHER_H
+
+#include <QtCore/QObject>
+#include <QtCore/QSharedPointer>
+#include <QtCore/QStringList>
+#include <QtCore/QThreadPool>
+
+#include <konqprivate_export.h>
+
+class KonqCompletionIndex;
+
+/**
+ * Looks up completion matches in a worker thread, so that typing in the
+ * location bar doesn't wait for the history to be searched.
+ *
+ * Every request works on a snapshot of the index, taken when it starts,
+ * which the GUI thread can't change under it. Taking it is cheap, and so is
+ * changing the index while a request holds it, see KonqCompletionIndex. Only the latest request
+ * counts: the ones it replaces are skipped if they haven't started yet,
+ * and their results are dropped if they have.
+ */
+class KONQUERORPRIVATE_EXPORT KonqCompletionMatcher : public QObject
+{
+    Q_OBJECT
+public:
+    enum Mode {
+        PrefixMatches,      // KonqCompletionIndex::matches()
+        SubstringMatches    // KonqCompletionIndex::substringMatches()
+    };
+    Q_ENUM(Mode)
+
+    explicit KonqCompletionMatcher(QObject *parent = Q_NULLPTR);
+    ~KonqCompletionMatcher();
+
+    /**
+     * Starts looking up the @p maxItems best matches of @p text in @p index,
+     * replacing the previous request. finished() is emitted with them.
+     */
+    void start(const KonqCompletionIndex &index, const QString &text, Mode mode, int maxItems);
+
+    /**
+     * Drops the current request, if any.
+     */
+    void cancel();
+
+    /**
+     * @returns whether a request was started and didn't finish yet
+     */
+    bool isRunning() const;
+
+Q_SIGNALS:
+    /**
+     * Emitted with the matches of the latest request, in the GUI thread.
+     */
+    void finished(const QString &text, KonqCompletionMatcher::Mode mode, const QStringList &matches);
+
+private Q_SLOTS:
+    void slotMatched(int serial, const QString &text, int mode, const QStringList &matches);
+
+private:
+    QThreadPool m_pool;
+    // the serial of the latest request, shared with the worker threads
+    QSharedPointer<QAtomicInt> m_serial;
+    bool m_running;
+};
+
+#endif // KONQ_COMPLETIONMATCHER_H
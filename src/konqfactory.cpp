@@ -39,10 +39,12 @@
 #include <kservicetypetrader.h>
 #include <kdeversion.h>
 #include <KParts/ReadOnlyPart>
+#include <KPluginFactory>
 
 // Local
 #include "konqsettings.h"
 #include "konqmainwindow.h"
+#include "konqplaceholderpart.h"
 
 KonqViewFactory::KonqViewFactory(const QString &libName, KLibFactory *factory)
     : m_libName(libName), m_factory(factory),
@@ -74,6 +76,23 @@ KParts::ReadOnlyPart *KonqViewFactory::create(QWidget *parentWidget, QObject *pa
     return part;
 }
 
+namespace {
+class PlaceholderPartFactory : public KPluginFactory
+{
+public:
+    PlaceholderPartFactory()
+    {
+        registerPlugin<KonqPlaceholderPart>();
+    }
+};
+}
+Q_GLOBAL_STATIC(PlaceholderPartFactory, placeholderPartFactory)
+
+KonqViewFactory KonqViewFactory::placeholder()
+{
+    return KonqViewFactory(QStringLiteral("konqplaceholderpart"), placeholderPartFactory());
+}
+
 static KonqViewFactory tryLoadingService(KService::Ptr service)
 {
     KPluginLoader pluginLoader(*service);
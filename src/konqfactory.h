@@ -54,6 +54,12 @@ public:
         return m_factory ? false : true;
     }
 
+    /**
+     * Returns the factory of KonqPlaceholderPart, the part of a view
+     * whose page isn't loaded yet
+     */
+    static KonqViewFactory placeholder();
+
 private:
     QString m_libName;
     KPluginFactory *m_factory;
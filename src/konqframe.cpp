@@ -247,6 +247,16 @@ void KonqFrame::activateChild()
     }
 }
 
+void KonqFrame::showEvent(QShowEvent *event)
+{
+    QWidget::showEvent(event);
+    if (m_pView && m_pView->isRestorePending()) {
+        // First time the tab of a restored session is shown: load its page,
+        // once the tab switch is done
+        QMetaObject::invokeMethod(m_pView, "restorePendingHistory", Qt::QueuedConnection);
+    }
+}
+
 KonqView *KonqFrame::childView() const
 {
     return m_pView;
@@ -58,7 +58,10 @@ public:
     enum Option {
         None = 0x0,
         saveURLs = 0x01, // TODO rename to SaveUrls
-        saveHistoryItems = 0x02 // TODO rename to SaveHistoryItems
+        saveHistoryItems = 0x02, // TODO rename to SaveHistoryItems
+        // With saveHistoryItems: reuse the history a view saved the last time,
+        // if it didn't change since. See KonqView::saveConfig()
+        saveCachedHistory = 0x04
     };
     Q_DECLARE_FLAGS(Options, Option)
 
@@ -209,6 +212,9 @@ public Q_SLOTS:
      */
     void slotRemoveView();
 
+protected:
+    void showEvent(QShowEvent *event) Q_DECL_OVERRIDE;
+
 private:
     QVBoxLayout *m_pLayout;
     QPointer<KonqView> m_pView;
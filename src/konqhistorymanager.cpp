@@ -19,6 +19,7 @@
 */
 
 #include "konqhistorymanager.h"
+#include "konqcompletionindex.h"
 #include <kbookmarkmanager.h>
 
 #include <QtDBus/QtDBus>
@@ -38,6 +39,7 @@ KonqHistoryManager::KonqHistoryManager(KBookmarkManager *bookmarkManager, QObjec
     // take care of the completion object
     m_pCompletion = new KCompletion;
     m_pCompletion->setOrder(KCompletion::Weighted);
+    m_pCompletionIndex = new KonqCompletionIndex;
 
     // and load the history
     loadHistory();
@@ -50,6 +52,7 @@ KonqHistoryManager::KonqHistoryManager(KBookmarkManager *bookmarkManager, QObjec
 KonqHistoryManager::~KonqHistoryManager()
 {
     delete m_pCompletion;
+    delete m_pCompletionIndex;
     clearPending();
 }
 
@@ -57,16 +60,19 @@ bool KonqHistoryManager::loadHistory()
 {
     clearPending();
     m_pCompletion->clear();
+    m_pCompletionIndex->clear();
 
     if (!KonqHistoryProvider::loadHistory()) {
         return false;
     }
 
-    QListIterator<KonqHistoryEntry> it(entries());
-    while (it.hasNext()) {
-        const KonqHistoryEntry &entry = it.next();
-        const QString prettyUrlString = entry.url.toDisplayString();
-        addToCompletion(prettyUrlString, entry.typedUrl, entry.numberOfTimesVisited);
+    // The pretty urls come from the history file, no need to compute them
+    const QStringList prettyUrls = takeLoadedDisplayUrls();
+    const KonqHistoryList &history = entries();
+    for (int i = 0; i < history.count(); ++i) {
+        const KonqHistoryEntry &entry = history.at(i);
+        addToCompletion(prettyUrls.at(i), entry.typedUrl, entry.numberOfTimesVisited);
+        m_pCompletionIndex->addHistoryEntry(entry, prettyUrls.at(i));
     }
 
     return true;
@@ -238,6 +244,7 @@ void KonqHistoryManager::removeFromCompletion(const QString &url, const QString
 {
     m_pCompletion->removeItem(url);
     m_pCompletion->removeItem(typedUrl);
+    m_pCompletionIndex->removeHistoryEntry(url, typedUrl);
 }
 
 void KonqHistoryManager::addToUpdateList(const QString &url)
@@ -252,12 +259,14 @@ void KonqHistoryManager::slotCleared()
 {
     clearPending();
     m_pCompletion->clear();
+    m_pCompletionIndex->clear();
 }
 
 void KonqHistoryManager::finishAddingEntry(const KonqHistoryEntry &entry, bool isSender)
 {
     const QString urlString = entry.url.url();
     addToCompletion(entry.url.toDisplayString(), entry.typedUrl);
+    m_pCompletionIndex->addHistoryEntry(entry, entry.url.toDisplayString());
     addToUpdateList(urlString);
     KonqHistoryProvider::finishAddingEntry(entry, isSender);
 
@@ -33,13 +33,15 @@
 class QTimer;
 class KBookmarkManager;
 class KCompletion;
+class KonqCompletionIndex;
 
 /**
  * This class maintains and manages a history of all URLs visited by one
  * Konqueror instance. Additionally it synchronizes the history with other
  * Konqueror instances via DBUS to keep one global and persistant history.
  *
- * It keeps the history in sync with one KCompletion object
+ * It keeps the history in sync with one KCompletion object, and with the
+ * index of the popup completion.
  */
 class KONQUERORPRIVATE_EXPORT KonqHistoryManager : public KonqHistoryProvider
 {
@@ -101,6 +103,15 @@ public:
         return m_pCompletion;
     }
 
+    /**
+     * @returns the index of the popup completion, which holds the same
+     * items as the KCompletion object.
+     */
+    KonqCompletionIndex *completionIndex() const
+    {
+        return m_pCompletionIndex;
+    }
+
     // HistoryProvider interface, let konq handle this
     /**
      * Reimplemented in such a way that all URLs that would be filtered
@@ -175,6 +186,7 @@ private:
     QMap<QString, KonqHistoryEntry *> m_pending;
 
     KCompletion *m_pCompletion; // the completion object we sync with
+    KonqCompletionIndex *m_pCompletionIndex;
 
     /**
      * A timer that will emit the KParts::HistoryProvider::updated() signal
@@ -29,7 +29,13 @@
 #include <QHash>
 #include <QList>
 #include <QLocale>
+#include <QSet>
 #include <QIcon>
+#include <QTimer>
+
+// How many history entries are sorted into groups per event loop iteration
+// while the model is being filled
+static const int s_fetchBatchSize = 2000;
 
 namespace KHM
 {
@@ -42,7 +48,7 @@ struct Entry {
     };
 
     Entry(Type _type)
-        : type(_type)
+        : type(_type), row(-1)
     {}
 
     virtual ~Entry()
@@ -54,6 +60,7 @@ struct Entry {
     }
 
     const Type type;
+    int row;    // in the parent, kept up to date for indexFor()
 };
 
 struct HistoryEntry : public Entry {
@@ -77,13 +84,22 @@ struct GroupEntry : public Entry {
 
     QVariant data(int role, int column) const Q_DECL_OVERRIDE;
     HistoryEntry *findChild(const KonqHistoryEntry &entry, int *index = 0) const;
+    int indexOfPendingEntry(const QUrl &url) const;
     QList<QUrl> urls() const;
+    void addChild(HistoryEntry *child);
+    void removeChild(int index);
+    void updateLastVisited(const QDateTime &lastVisited);
 
     QList<HistoryEntry *> entries;
+    QHash<QUrl, HistoryEntry *> entriesByUrl;
+    // the entries to create when the group is expanded, see fetchMore()
+    QList<KonqHistoryEntry> pendingEntries;
+    QDateTime lastVisited;  // the latest of the entries, pending ones included
     QUrl url;
     QString key;
     QIcon icon;
     bool hasFavIcon : 1;
+    bool fetched : 1;       // entries are created right away
 };
 
 struct RootEntry : public Entry {
@@ -96,14 +112,26 @@ struct RootEntry : public Entry {
         qDeleteAll(groups);
     }
 
+    void addGroup(GroupEntry *group);
+    void removeGroup(int index);
+
     QList<GroupEntry *> groups;
     QHash<QString, GroupEntry *> groupsByName;
 };
 
+// Numbers the entries of list from index on, after an insertion or removal
+template<typename T>
+static void updateRows(const QList<T *> &list, int index)
+{
+    for (int i = index; i < list.count(); ++i) {
+        list.at(i)->row = i;
+    }
+}
+
 HistoryEntry::HistoryEntry(const KonqHistoryEntry &_entry, GroupEntry *_parent)
     : Entry(History), entry(_entry), parent(_parent)
 {
-    parent->entries.append(this);
+    parent->addChild(this);
 
     update(entry);
 }
@@ -146,6 +174,7 @@ QVariant HistoryEntry::data(int role, int /*column*/) const
 void HistoryEntry::update(const KonqHistoryEntry &_entry)
 {
     entry = _entry;
+    parent->updateLastVisited(entry.lastVisited);
 
     const QString path = entry.url.path();
     if (parent->hasFavIcon && (path.isNull() || path == QLatin1String("/"))) {
@@ -156,7 +185,7 @@ void HistoryEntry::update(const KonqHistoryEntry &_entry)
 }
 
 GroupEntry::GroupEntry(const QUrl &_url, const QString &_key)
-    : Entry(Group), url(_url), key(_key), hasFavIcon(false)
+    : Entry(Group), url(_url), key(_key), hasFavIcon(false), fetched(false)
 {
     const QString iconPath = KIO::favIconForUrl(url);
     if (iconPath.isEmpty()) {
@@ -176,48 +205,86 @@ QVariant GroupEntry::data(int role, int /*column*/) const
         return icon;
     case KonqHistory::TypeRole:
         return int(KonqHistory::GroupType);
-    case KonqHistory::LastVisitedRole: {
-        if (entries.isEmpty()) {
-            return QDateTime();
-        }
-        QDateTime dt = entries.first()->entry.lastVisited;
-        Q_FOREACH (HistoryEntry *e, entries) {
-            if (e->entry.lastVisited > dt) {
-                dt = e->entry.lastVisited;
-            }
-        }
-        return dt;
-    }
+    case KonqHistory::LastVisitedRole:
+        return lastVisited;
     }
     return QVariant();
 }
 
 HistoryEntry *GroupEntry::findChild(const KonqHistoryEntry &entry, int *index) const
 {
-    HistoryEntry *item = 0;
-    QList<HistoryEntry *>::const_iterator it = entries.constBegin(), itEnd = entries.constEnd();
-    int i = 0;
-    for (; it != itEnd; ++it, ++i) {
-        if ((*it)->entry.url == entry.url) {
-            item = *it;
-            break;
-        }
-    }
+    HistoryEntry *item = entriesByUrl.value(entry.url);
     if (index) {
-        *index = item ? i : -1;
+        *index = item ? item->row : -1;
     }
     return item;
 }
 
+int GroupEntry::indexOfPendingEntry(const QUrl &url) const
+{
+    for (int i = 0; i < pendingEntries.count(); ++i) {
+        if (pendingEntries.at(i).url == url) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+void GroupEntry::addChild(HistoryEntry *child)
+{
+    child->row = entries.count();
+    entries.append(child);
+    entriesByUrl.insert(child->entry.url, child);
+}
+
+void GroupEntry::removeChild(int index)
+{
+    HistoryEntry *child = entries.takeAt(index);
+    entriesByUrl.remove(child->entry.url);
+    updateRows(entries, index);
+
+    // only look for the latest visit again when it went away
+    if (child->entry.lastVisited == lastVisited) {
+        lastVisited = QDateTime();
+        Q_FOREACH (HistoryEntry *e, entries) {
+            updateLastVisited(e->entry.lastVisited);
+        }
+    }
+}
+
+void GroupEntry::updateLastVisited(const QDateTime &dt)
+{
+    if (!lastVisited.isValid() || dt > lastVisited) {
+        lastVisited = dt;
+    }
+}
+
 QList<QUrl> GroupEntry::urls() const
 {
     QList<QUrl> list;
     Q_FOREACH (HistoryEntry *e, entries) {
         list.append(e->entry.url);
     }
+    Q_FOREACH (const KonqHistoryEntry &e, pendingEntries) {
+        list.append(e.url);
+    }
     return list;
 }
 
+void RootEntry::addGroup(GroupEntry *group)
+{
+    group->row = groups.count();
+    groups.append(group);
+    groupsByName.insert(group->key, group);
+}
+
+void RootEntry::removeGroup(int index)
+{
+    GroupEntry *group = groups.takeAt(index);
+    groupsByName.remove(group->key);
+    updateRows(groups, index);
+}
+
 }
 
 static QString groupForUrl(const QUrl &url)
@@ -232,6 +299,17 @@ static QString groupForUrl(const QUrl &url)
 
 KonqHistoryModel::KonqHistoryModel(QObject *parent)
     : QAbstractItemModel(parent), m_root(new KHM::RootEntry())
+{
+    init(KonqHistoryProvider::self()->entries());
+}
+
+KonqHistoryModel::KonqHistoryModel(const KonqHistoryList &entries, QObject *parent)
+    : QAbstractItemModel(parent), m_root(new KHM::RootEntry())
+{
+    init(entries);
+}
+
+void KonqHistoryModel::init(const KonqHistoryList &entries)
 {
     KonqHistoryProvider *provider = KonqHistoryProvider::self();
 
@@ -241,14 +319,13 @@ KonqHistoryModel::KonqHistoryModel(QObject *parent)
     connect(provider, SIGNAL(entryRemoved(KonqHistoryEntry)),
             this, SLOT(slotEntryRemoved(KonqHistoryEntry)));
 
-    KonqHistoryList entries(provider->entries());
-
-    KonqHistoryList::const_iterator it = entries.constBegin();
-    const KonqHistoryList::const_iterator end = entries.constEnd();
-    for (; it != end; ++it) {
-        KHM::GroupEntry *group = getGroupItem((*it).url, DontEmitSignals);
-        KHM::HistoryEntry *item = new KHM::HistoryEntry((*it), group);
-        Q_UNUSED(item);
+    // The groups are built a batch of entries at a time, from the event loop,
+    // and the entries of a group only once it's expanded
+    m_pendingEntries = entries;
+    m_pendingIndex = 0;
+    fetchBatch(DontEmitSignals);
+    if (canFetchMore(QModelIndex())) {
+        QTimer::singleShot(0, this, SLOT(slotFetchMore()));
     }
 }
 
@@ -324,6 +401,51 @@ QModelIndex KonqHistoryModel::parent(const QModelIndex &index) const
     return QModelIndex();
 }
 
+bool KonqHistoryModel::hasChildren(const QModelIndex &parent) const
+{
+    KHM::Entry *entry = entryFromIndex(parent, true);
+    switch (entry->type) {
+    case KHM::Entry::History:
+        return false;
+    case KHM::Entry::Group: {
+        const KHM::GroupEntry *ge = static_cast<KHM::GroupEntry *>(entry);
+        return !ge->entries.isEmpty() || !ge->pendingEntries.isEmpty();
+    }
+    case KHM::Entry::Root:
+        return !m_root->groups.isEmpty() || canFetchMore(parent);
+    }
+    return false;
+}
+
+bool KonqHistoryModel::canFetchMore(const QModelIndex &parent) const
+{
+    KHM::Entry *entry = entryFromIndex(parent, true);
+    switch (entry->type) {
+    case KHM::Entry::History:
+        return false;
+    case KHM::Entry::Group:
+        return !static_cast<KHM::GroupEntry *>(entry)->fetched;
+    case KHM::Entry::Root:
+        return m_pendingIndex < m_pendingEntries.count();
+    }
+    return false;
+}
+
+void KonqHistoryModel::fetchMore(const QModelIndex &parent)
+{
+    KHM::Entry *entry = entryFromIndex(parent, true);
+    switch (entry->type) {
+    case KHM::Entry::History:
+        break;
+    case KHM::Entry::Group:
+        fetchGroup(static_cast<KHM::GroupEntry *>(entry));
+        break;
+    case KHM::Entry::Root:
+        fetchBatch(EmitSignals);
+        break;
+    }
+}
+
 int KonqHistoryModel::rowCount(const QModelIndex &parent) const
 {
     KHM::Entry *entry = entryFromIndex(parent, true);
@@ -360,6 +482,9 @@ void KonqHistoryModel::deleteItem(const QModelIndex &index)
 
 void KonqHistoryModel::clear()
 {
+    m_pendingEntries.clear();
+    m_pendingIndex = 0;
+    m_supersededUrls.clear();
     if (m_root->groups.isEmpty()) {
         return;
     }
@@ -369,22 +494,49 @@ void KonqHistoryModel::clear()
     reset();
 }
 
+void KonqHistoryModel::slotFetchMore()
+{
+    fetchMore(QModelIndex());
+    if (canFetchMore(QModelIndex())) {
+        QTimer::singleShot(0, this, SLOT(slotFetchMore()));
+    }
+}
+
 void KonqHistoryModel::slotEntryAdded(const KonqHistoryEntry &entry)
 {
+    // Only the group of the entry is updated, the others are still sorted
+    // and created lazily. The entry supersedes the one for its url which
+    // isn't sorted into its group yet, if any.
+    if (canFetchMore(QModelIndex())) {
+        m_supersededUrls.insert(entry.url);
+    }
     KHM::GroupEntry *group = getGroupItem(entry.url, EmitSignals);
-    KHM::HistoryEntry *item = group->findChild(entry);
-    if (!item) {
-        beginInsertRows(indexFor(group), group->entries.count(), group->entries.count());
-        item = new KHM::HistoryEntry(entry, group);
-        endInsertRows();
-    } else {
-        // Do not update existing entries, otherwise items jump around when clicking on them (#61450)
-        if (item->entry.lastVisited.isValid()) {
+    if (!group->fetched) {
+        const int index = group->indexOfPendingEntry(entry.url);
+        if (index == -1) {
+            group->pendingEntries.append(entry);
+        } else if (group->pendingEntries.at(index).lastVisited.isValid()) {
+            // see below
             return;
+        } else {
+            group->pendingEntries[index] = entry;
+        }
+        group->updateLastVisited(entry.lastVisited);
+    } else {
+        KHM::HistoryEntry *item = group->findChild(entry);
+        if (!item) {
+            beginInsertRows(indexFor(group), group->entries.count(), group->entries.count());
+            item = new KHM::HistoryEntry(entry, group);
+            endInsertRows();
+        } else {
+            // Do not update existing entries, otherwise items jump around when clicking on them (#61450)
+            if (item->entry.lastVisited.isValid()) {
+                return;
+            }
+            item->update(entry);
+            const QModelIndex index = indexFor(item);
+            emit dataChanged(index, index);
         }
-        item->update(entry);
-        const QModelIndex index = indexFor(item);
-        emit dataChanged(index, index);
     }
     // update the parent item, so the sorting by date is updated accordingly
     const QModelIndex groupIndex = indexFor(group);
@@ -393,35 +545,50 @@ void KonqHistoryModel::slotEntryAdded(const KonqHistoryEntry &entry)
 
 void KonqHistoryModel::slotEntryRemoved(const KonqHistoryEntry &entry)
 {
-    const QString groupKey = groupForUrl(entry.url);
-    KHM::GroupEntry *group = m_root->groupsByName.value(groupKey);
-    if (!group) {
-        return;
+    if (canFetchMore(QModelIndex())) {
+        m_supersededUrls.insert(entry.url);
     }
-
-    int index = 0;
-    KHM::HistoryEntry *item = group->findChild(entry, &index);
-    if (index == -1) {
+    KHM::GroupEntry *group = m_root->groupsByName.value(groupForUrl(entry.url));
+    if (!group) {
         return;
     }
 
-    if (group->entries.count() > 1) {
-        beginRemoveRows(indexFor(group), index, index);
-        group->entries.removeAt(index);
-        delete item;
-        endRemoveRows();
+    if (group->fetched) {
+        int index = 0;
+        KHM::HistoryEntry *item = group->findChild(entry, &index);
+        if (index == -1) {
+            return;
+        }
+        if (group->entries.count() > 1) {
+            beginRemoveRows(indexFor(group), index, index);
+            group->removeChild(index);
+            delete item;
+            endRemoveRows();
+            return;
+        }
     } else {
-        index = m_root->groups.indexOf(group);
+        const int index = group->indexOfPendingEntry(entry.url);
         if (index == -1) {
             return;
         }
-
-        beginRemoveRows(QModelIndex(), index, index);
-        m_root->groupsByName.remove(groupKey);
-        m_root->groups.removeAt(index);
-        delete group;
-        endRemoveRows();
+        if (group->pendingEntries.count() > 1) {
+            // like GroupEntry::removeChild()
+            if (group->pendingEntries.takeAt(index).lastVisited == group->lastVisited) {
+                group->lastVisited = QDateTime();
+                Q_FOREACH (const KonqHistoryEntry &e, group->pendingEntries) {
+                    group->updateLastVisited(e.lastVisited);
+                }
+            }
+            return;
+        }
     }
+
+    // the last entry of the group
+    const int row = group->row;
+    beginRemoveRows(QModelIndex(), row, row);
+    m_root->removeGroup(row);
+    delete group;
+    endRemoveRows();
 }
 
 KHM::Entry *KonqHistoryModel::entryFromIndex(const QModelIndex &index, bool returnRootIfNull) const
@@ -441,8 +608,9 @@ KHM::GroupEntry *KonqHistoryModel::getGroupItem(const QUrl &url, SignalEmission
             beginInsertRows(QModelIndex(), m_root->groups.count(), m_root->groups.count());
         }
         group = new KHM::GroupEntry(url, groupKey);
-        m_root->groups.append(group);
-        m_root->groupsByName.insert(groupKey, group);
+        // a new group shows its entries right away
+        group->fetched = (se == EmitSignals);
+        m_root->addGroup(group);
         if (se == EmitSignals) {
             endInsertRows();
         }
@@ -453,19 +621,125 @@ KHM::GroupEntry *KonqHistoryModel::getGroupItem(const QUrl &url, SignalEmission
 
 QModelIndex KonqHistoryModel::indexFor(KHM::HistoryEntry *entry) const
 {
-    const int row = entry->parent->entries.indexOf(entry);
-    if (row < 0) {
+    if (entry->row < 0) {
         return QModelIndex();
     }
-    return createIndex(row, 0, entry);
+    return createIndex(entry->row, 0, entry);
 }
 
 QModelIndex KonqHistoryModel::indexFor(KHM::GroupEntry *entry) const
 {
-    const int row = m_root->groups.indexOf(entry);
-    if (row < 0) {
+    if (entry->row < 0) {
         return QModelIndex();
     }
-    return createIndex(row, 0, entry);
+    return createIndex(entry->row, 0, entry);
 }
 
+
+// Sorts the next batch of pending entries into their groups, creating the
+// groups which don't exist yet
+void KonqHistoryModel::fetchBatch(SignalEmission se)
+{
+    const int end = qMin(m_pendingIndex + s_fetchBatchSize, m_pendingEntries.count());
+    if (m_pendingIndex >= end) {
+        return;
+    }
+
+    // first the new groups, all inserted at once
+    QList<int> newGroups;   // the first entry of each
+    QSet<QString> newKeys;
+    for (int i = m_pendingIndex; i < end; ++i) {
+        if (m_supersededUrls.contains(m_pendingEntries.at(i).url)) {
+            continue;
+        }
+        const QString key = groupForUrl(m_pendingEntries.at(i).url);
+        if (!m_root->groupsByName.contains(key) && !newKeys.contains(key)) {
+            newKeys.insert(key);
+            newGroups.append(i);
+        }
+    }
+    if (!newGroups.isEmpty()) {
+        const int first = m_root->groups.count();
+        if (se == EmitSignals) {
+            beginInsertRows(QModelIndex(), first, first + newGroups.count() - 1);
+        }
+        Q_FOREACH (int i, newGroups) {
+            const QUrl &url = m_pendingEntries.at(i).url;
+            m_root->addGroup(new KHM::GroupEntry(url, groupForUrl(url)));
+        }
+        if (se == EmitSignals) {
+            endInsertRows();
+        }
+    }
+
+    QSet<KHM::GroupEntry *> changedGroups;
+    for (; m_pendingIndex < end; ++m_pendingIndex) {
+        const KonqHistoryEntry &entry = m_pendingEntries.at(m_pendingIndex);
+        if (m_supersededUrls.contains(entry.url)) {
+            continue;
+        }
+        KHM::GroupEntry *group = m_root->groupsByName.value(groupForUrl(entry.url));
+        if (group->fetched) {
+            // expanded meanwhile
+            const QModelIndex groupIndex = indexFor(group);
+            beginInsertRows(groupIndex, group->entries.count(), group->entries.count());
+            new KHM::HistoryEntry(entry, group);
+            endInsertRows();
+        } else {
+            group->pendingEntries.append(entry);
+            group->updateLastVisited(entry.lastVisited);
+        }
+        if (group->row < m_root->groups.count() - newGroups.count()) {
+            changedGroups.insert(group);
+        }
+    }
+
+    if (m_pendingIndex == m_pendingEntries.count()) {
+        m_pendingEntries.clear();
+        m_pendingIndex = 0;
+        m_supersededUrls.clear();
+    }
+
+    // the older groups may sort differently now
+    if (se == EmitSignals) {
+        Q_FOREACH (KHM::GroupEntry *group, changedGroups) {
+            const QModelIndex groupIndex = indexFor(group);
+            emit dataChanged(groupIndex, groupIndex);
+        }
+    }
+}
+
+void KonqHistoryModel::fetchAll()
+{
+    while (canFetchMore(QModelIndex())) {
+        fetchBatch(EmitSignals);
+    }
+}
+
+// Creates the items of the pending entries of group
+void KonqHistoryModel::fetchGroup(KHM::GroupEntry *group)
+{
+    if (group->fetched) {
+        return;
+    }
+    group->fetched = true;
+    if (group->pendingEntries.isEmpty()) {
+        return;
+    }
+
+    const QList<KonqHistoryEntry> entries = group->pendingEntries;
+    group->pendingEntries.clear();
+    beginInsertRows(indexFor(group), 0, entries.count() - 1);
+    Q_FOREACH (const KonqHistoryEntry &entry, entries) {
+        new KHM::HistoryEntry(entry, group);
+    }
+    endInsertRows();
+}
+
+void KonqHistoryModel::fetchAllEntries()
+{
+    fetchAll();
+    Q_FOREACH (KHM::GroupEntry *group, m_root->groups) {
+        fetchGroup(group);
+    }
+}
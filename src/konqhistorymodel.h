@@ -21,8 +21,10 @@
 #define KONQ_HISTORYMODEL_H
 
 #include <QtCore/QAbstractItemModel>
+#include <QtCore/QSet>
 
 #include "konq_historyentry.h"
+#include "konqprivate_export.h"
 
 namespace KHM
 {
@@ -32,12 +34,17 @@ struct RootEntry;
 struct HistoryEntry;
 }
 
-class KonqHistoryModel : public QAbstractItemModel
+class KONQUERORPRIVATE_EXPORT KonqHistoryModel : public QAbstractItemModel
 {
     Q_OBJECT
 
 public:
     explicit KonqHistoryModel(QObject *parent = Q_NULLPTR);
+    /**
+     * Creates a model of @p entries instead of the whole history,
+     * for unit tests. It follows the changes of the history all the same.
+     */
+    explicit KonqHistoryModel(const KonqHistoryList &entries, QObject *parent = Q_NULLPTR);
     ~KonqHistoryModel();
 
     // reimplementations from QAbstractItemModel
@@ -46,24 +53,43 @@ public:
     QModelIndex index(int row, int column, const QModelIndex &parent = QModelIndex()) const Q_DECL_OVERRIDE;
     QModelIndex parent(const QModelIndex &index) const Q_DECL_OVERRIDE;
     int rowCount(const QModelIndex &parent = QModelIndex()) const Q_DECL_OVERRIDE;
+    bool hasChildren(const QModelIndex &parent = QModelIndex()) const Q_DECL_OVERRIDE;
+    bool canFetchMore(const QModelIndex &parent) const Q_DECL_OVERRIDE;
+    void fetchMore(const QModelIndex &parent) Q_DECL_OVERRIDE;
 
     void deleteItem(const QModelIndex &index);
 
+    /**
+     * Creates the items of all the entries now, instead of when they are
+     * shown. For searching in them.
+     */
+    void fetchAllEntries();
+
 public Q_SLOTS:
     void clear();
 
 private Q_SLOTS:
+    void slotFetchMore();
     void slotEntryAdded(const KonqHistoryEntry &);
     void slotEntryRemoved(const KonqHistoryEntry &);
 
 private:
     enum SignalEmission { EmitSignals, DontEmitSignals };
+    void init(const KonqHistoryList &entries);
+    void fetchBatch(SignalEmission se);
+    void fetchAll();
+    void fetchGroup(KHM::GroupEntry *group);
     KHM::Entry *entryFromIndex(const QModelIndex &index, bool returnRootIfNull = false) const;
     KHM::GroupEntry *getGroupItem(const QUrl &url, SignalEmission se);
     QModelIndex indexFor(KHM::HistoryEntry *entry) const;
     QModelIndex indexFor(KHM::GroupEntry *entry) const;
 
     KHM::RootEntry *m_root;
+    // the entries not sorted into groups yet, from m_pendingIndex on
+    KonqHistoryList m_pendingEntries;
+    int m_pendingIndex;
+    // the urls added or removed since, whose pending entries are skipped
+    QSet<QUrl> m_supersededUrls;
 };
 
 #endif // KONQ_HISTORYMODEL_H
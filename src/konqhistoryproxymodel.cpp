@@ -22,12 +22,17 @@
 #include "konqhistory.h"
 #include "konqhistorysettings.h"
 
+#include <QTimer>
+
 KonqHistoryProxyModel::KonqHistoryProxyModel(KonqHistorySettings *settings, QObject *parent)
     : KSortFilterProxyModel(parent)
     , m_settings(settings)
+    , m_dateThresholdsValid(false)
 {
     setDynamicSortFilter(true);
     setFilterCaseSensitivity(Qt::CaseInsensitive);
+    // searching matches every row once, and refines as the user types
+    setCachesFilterResults(true);
 
     connect(m_settings, &KonqHistorySettings::settingsChanged, this, &KonqHistoryProxyModel::slotSettingsChanged);
 }
@@ -55,27 +60,13 @@ QVariant KonqHistoryProxyModel::data(const QModelIndex &index, int role) const
             }
             break;
         case Qt::FontRole: {
-            const QDateTime current = QDateTime::currentDateTime();
+            updateDateThresholds();
             const QDateTime entryDate = source_index.data(KonqHistory::LastVisitedRole).toDateTime();
 
-            QDateTime dt;
-            if (m_settings->m_metricYoungerThan == KonqHistorySettings::DAYS) {
-                dt = current.addDays(-int(m_settings->m_valueYoungerThan));
-            } else {
-                dt = current.addSecs(-(int(m_settings->m_valueYoungerThan) * 60));
-            }
-
-            if (entryDate > dt) {
+            if (entryDate > m_youngerThan) {
                 res = qVariantFromValue(m_settings->m_fontYoungerThan);
-            } else {
-                if (m_settings->m_metricOlderThan == KonqHistorySettings::DAYS) {
-                    dt = current.addDays(-int(m_settings->m_valueOlderThan));
-                } else {
-                    dt = current.addSecs(-(int(m_settings->m_valueOlderThan) * 60));
-                }
-                if (entryDate < dt) {
-                    res = qVariantFromValue(m_settings->m_fontOlderThan);
-                }
+            } else if (entryDate < m_olderThan) {
+                res = qVariantFromValue(m_settings->m_fontOlderThan);
             }
             break;
         }
@@ -113,6 +104,36 @@ bool KonqHistoryProxyModel::lessThan(const QModelIndex &left, const QModelIndex
 
 void KonqHistoryProxyModel::slotSettingsChanged()
 {
+    m_dateThresholdsValid = false;
     reset();
 }
 
+// The views ask for the fonts of all the visible items when they repaint,
+// the thresholds stay valid until the event loop runs again.
+void KonqHistoryProxyModel::updateDateThresholds() const
+{
+    if (m_dateThresholdsValid) {
+        return;
+    }
+
+    const QDateTime current = QDateTime::currentDateTime();
+    if (m_settings->m_metricYoungerThan == KonqHistorySettings::DAYS) {
+        m_youngerThan = current.addDays(-int(m_settings->m_valueYoungerThan));
+    } else {
+        m_youngerThan = current.addSecs(-(int(m_settings->m_valueYoungerThan) * 60));
+    }
+    if (m_settings->m_metricOlderThan == KonqHistorySettings::DAYS) {
+        m_olderThan = current.addDays(-int(m_settings->m_valueOlderThan));
+    } else {
+        m_olderThan = current.addSecs(-(int(m_settings->m_valueOlderThan) * 60));
+    }
+
+    m_dateThresholdsValid = true;
+    QTimer::singleShot(0, const_cast<KonqHistoryProxyModel *>(this), SLOT(slotInvalidateDateThresholds()));
+}
+
+void KonqHistoryProxyModel::slotInvalidateDateThresholds()
+{
+    m_dateThresholdsValid = false;
+}
+
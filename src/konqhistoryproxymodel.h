@@ -22,6 +22,8 @@
 
 #include "ksortfilterproxymodel.h"
 
+#include <QDateTime>
+
 class KonqHistorySettings;
 
 /**
@@ -46,9 +48,16 @@ protected:
 
 private Q_SLOTS:
     void slotSettingsChanged();
+    void slotInvalidateDateThresholds();
 
 private:
+    void updateDateThresholds() const;
+
     KonqHistorySettings *m_settings;
+    // the dates the fonts change at, computed once per repaint
+    mutable QDateTime m_youngerThan;
+    mutable QDateTime m_olderThan;
+    mutable bool m_dateThresholdsValid;
 };
 
 #endif // KONQ_HISTORYPROXYMODEL_H
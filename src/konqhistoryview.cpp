@@ -206,6 +206,10 @@ void KonqHistoryView::slotFilterTextChanged(const QString &text)
 
 void KonqHistoryView::slotTimerTimeout()
 {
+    // the proxy model only searches the entries which were expanded
+    if (!m_searchLineEdit->text().isEmpty()) {
+        m_historyModel->fetchAllEntries();
+    }
     m_historyProxyModel->setFilterFixedString(m_searchLineEdit->text());
 }
 
@@ -49,6 +49,7 @@
 #include "konqbookmarkbar.h"
 #include "konqundomanager.h"
 #include "konqhistorydialog.h"
+#include "konqcompletionindex.h"
 #include <config-konqueror.h>
 #include <kstringhandler.h>
 
@@ -137,7 +138,6 @@
 #include <kparts/browseropenorsavequestion.h>
 #include <KParts/OpenUrlEvent>
 #include <KParts/BrowserHostExtension>
-#include <KCompletionMatches>
 #include <kacceleratormanager.h>
 #include <kuser.h>
 #include <kxmlguifactory.h>
@@ -161,10 +161,13 @@ static KBookmarkManager *s_bookmarkManager = 0;
 QList<KonqMainWindow *> *KonqMainWindow::s_lstViews = 0;
 KConfig *KonqMainWindow::s_comboConfig = 0;
 KCompletion *KonqMainWindow::s_pCompletion = 0;
+KonqCompletionIndex *KonqMainWindow::s_pCompletionIndex = 0;
 
 KonqOpenURLRequest KonqOpenURLRequest::null;
 
 static const unsigned short int s_closedItemsListLength = 10;
+// the most history items the completion box shows
+static const int s_completionItemsLimit = 100;
 
 static void raiseWindow(KonqMainWindow *window)
 {
@@ -196,6 +199,8 @@ KonqMainWindow::KonqMainWindow(const QUrl &initialURL)
     , m_pBookmarkMenu(0)
     , m_configureDialog(0)
     , m_pURLCompletion(0)
+    , m_pCompletionMatcher(0)
+    , m_urlCompletionItemsFirst(true)
     , m_isPopupWithProxyWindow(false)
 {
     if (!s_lstViews) {
@@ -242,6 +247,7 @@ KonqMainWindow::KonqMainWindow(const QUrl &initialURL)
 
         KonqHistoryManager *mgr = new KonqHistoryManager(s_bookmarkManager);
         s_pCompletion = mgr->completionObject();
+        s_pCompletionIndex = mgr->completionIndex();
 
         // setup the completion object before createGUI(), so that the combo
         // picks up the correct mode from the HistoryManager (in slotComboPlugged)
@@ -313,6 +319,7 @@ KonqMainWindow::~KonqMainWindow()
 
     delete m_pViewManager;
     m_pViewManager = 0;
+    KonqSessionManager::self()->windowClosed(this);
 
     if (s_lstViews) {
         s_lstViews->removeAll(this);
@@ -1983,6 +1990,8 @@ void KonqMainWindow::slotPartActivated(KParts::Part *part)
 
     qDebug() << "New current view" << newView;
     m_currentView = newView;
+    // The current tab is saved with the session
+    KonqSessionManager::self()->markWindowDirty(this);
     if (newView) {
         m_paShowStatusBar->setChecked(newView->frame()->statusbar()->isVisible());
     }
@@ -2166,6 +2175,7 @@ void KonqMainWindow::viewCountChanged()
     // This is called (by the view manager) when the number of views changes.
     linkableViewCountChanged();
     viewsChanged();
+    KonqSessionManager::self()->markWindowDirty(this);
 }
 
 void KonqMainWindow::viewsChanged()
@@ -2951,6 +2961,10 @@ void KonqMainWindow::initCombo()
     m_pURLCompletion = new KUrlCompletion();
     m_pURLCompletion->setCompletionMode(s_pCompletion->completionMode());
 
+    m_pCompletionMatcher = new KonqCompletionMatcher(this);
+    connect(m_pCompletionMatcher, &KonqCompletionMatcher::finished,
+            this, &KonqMainWindow::slotHistoryCompletionFinished);
+
     // This only turns completion off. ~ is still there in the result
     // We do want completion of user names, right?
     //m_pURLCompletion->setReplaceHome( false );  // Leave ~ alone! Will be taken care of by filters!!
@@ -3015,17 +3029,19 @@ void KonqMainWindow::slotMakeCompletion(const QString &text)
         if (completion.isNull() && !m_pURLCompletion->isRunning()) {
             // No match() signal will come from m_pURLCompletion
             // ask the global one
-            // tell the static completion object about the current completion mode
-            completion = s_pCompletion->makeCompletion(text);
-
             // some special handling necessary for CompletionPopup
             if (m_combo->completionMode() == KCompletion::CompletionPopup ||
                     m_combo->completionMode() == KCompletion::CompletionPopupAuto) {
-                m_combo->setCompletedItems(historyPopupCompletionItems(text));
-            }
-
-            else if (!completion.isNull()) {
-                m_combo->setCompletedText(completion);
+                // To be continued in slotHistoryCompletionFinished()...
+                m_urlCompletionItems.clear();
+                m_pCompletionMatcher->start(*s_pCompletionIndex, text, KonqCompletionMatcher::PrefixMatches,
+                                            s_completionItemsLimit);
+            } else {
+                // tell the static completion object about the current completion mode
+                completion = s_pCompletion->makeCompletion(text);
+                if (!completion.isNull()) {
+                    m_combo->setCompletedText(completion);
+                }
             }
         } else {
             // To be continued in slotMatch()...
@@ -3044,17 +3060,41 @@ void KonqMainWindow::slotSubstringcompletion(const QString &text)
     }
 
     QString currentURL = m_currentView->url().toDisplayString();
-    bool filesFirst = currentURL.startsWith('/') ||
-                      currentURL.startsWith(QLatin1String("file:/"));
-    QStringList items;
-    if (filesFirst && m_pURLCompletion) {
-        items = m_pURLCompletion->substringCompletion(text);
+    m_urlCompletionItemsFirst = currentURL.startsWith('/') ||
+                                currentURL.startsWith(QLatin1String("file:/"));
+    m_urlCompletionItems.clear();
+    if (m_pURLCompletion) {
+        m_urlCompletionItems = m_pURLCompletion->substringCompletion(text);
     }
 
-    items += s_pCompletion->substringCompletion(text);
-    if (!filesFirst && m_pURLCompletion) {
-        items += m_pURLCompletion->substringCompletion(text);
+    // best ranked first, by address and title
+    // To be continued in slotHistoryCompletionFinished()...
+    m_pCompletionMatcher->start(*s_pCompletionIndex, text, KonqCompletionMatcher::SubstringMatches,
+                                s_completionItemsLimit);
+}
+
+// Handle finished() from m_pCompletionMatcher, for the latest keystroke only
+void KonqMainWindow::slotHistoryCompletionFinished(const QString &text, KonqCompletionMatcher::Mode mode,
+        const QStringList &matches)
+{
+    if (!m_combo) {
+        return;
+    }
+
+    QStringList items;
+    if (mode == KonqCompletionMatcher::PrefixMatches) {
+        items = m_urlCompletionItems;
+        items += historyPopupCompletionItems(text, matches);
+        items.removeDuplicates();  // when items from completion are also in history
+        // items.sort(); // should we?
+    } else if (m_urlCompletionItemsFirst) {
+        items = m_urlCompletionItems;
+        items += matches;
+    } else {
+        items = matches;
+        items += m_urlCompletionItems;
     }
+    m_urlCompletionItems.clear();
 
     m_combo->setCompletedItems(items);
 }
@@ -3095,11 +3135,11 @@ void KonqMainWindow::slotMatch(const QString &match)
         // some special handling necessary for CompletionPopup
         if (m_combo->completionMode() == KCompletion::CompletionPopup ||
                 m_combo->completionMode() == KCompletion::CompletionPopupAuto) {
-            QStringList items = m_pURLCompletion->allMatches();
-            items += historyPopupCompletionItems(m_combo->currentText());
-            items.removeDuplicates();  // when items from completion are also in history
-            // items.sort(); // should we?
-            m_combo->setCompletedItems(items);
+            // To be continued in slotHistoryCompletionFinished()...
+            m_urlCompletionItems = m_pURLCompletion->allMatches();
+            m_urlCompletionItemsFirst = true;
+            m_pCompletionMatcher->start(*s_pCompletionIndex, m_combo->currentText(),
+                                        KonqCompletionMatcher::PrefixMatches, s_completionItemsLimit);
         } else if (!match.isNull()) {
             m_combo->setCompletedText(match);
         }
@@ -4697,6 +4737,23 @@ void KonqMainWindow::saveProperties(KConfigGroup &config)
     }
 }
 
+void KonqMainWindow::saveAutosaveProperties(KConfigGroup &config)
+{
+    if (m_fullyConstructed) {
+        KonqFrameBase::Options flags = KonqFrameBase::saveHistoryItems | KonqFrameBase::saveCachedHistory;
+        m_pViewManager->saveViewConfigToGroup(config, flags);
+    }
+}
+
+void KonqMainWindow::updateVisibleHistoryEntries()
+{
+    foreach (KonqView *view, m_mapViews) {
+        if (view->frame()->isVisible()) {
+            view->updateHistoryEntryIfChanged();
+        }
+    }
+}
+
 void KonqMainWindow::readProperties(const KConfigGroup &configGroup)
 {
     m_pViewManager->loadViewConfigFromGroup(configGroup, QString() /*no profile name*/);
@@ -5150,6 +5207,8 @@ void KonqMainWindow::addBookmarksIntoCompletion(const KBookmarkGroup &group)
 
         QString u = url.toDisplayString();
         s_pCompletion->addItem(u);
+        // the index finds it without scheme and "www." already
+        s_pCompletionIndex->addItem(u);
 
         if (url.isLocalFile()) {
             s_pCompletion->addItem(url.toLocalFile());
@@ -5198,153 +5257,13 @@ static QString hp_tryPrepend(const QString &s)
     return (s.startsWith(QLatin1String("www.")) ? "http://" : "http://www.") + s;
 }
 
-static void hp_removeDupe(KCompletionMatches &l, const QString &dupe,
-                          KCompletionMatches::Iterator it_orig)
+QStringList KonqMainWindow::historyPopupCompletionItems(const QString &s, const QStringList &matches)
 {
-    KCompletionMatches::Iterator it = it_orig + 1;
-    while (it != l.end()) {
-        if ((*it).value() == dupe) {
-            (*it_orig).first = qMax((*it_orig).first, (*it).key());
-            it = l.erase(it);
-            continue;
-        }
-        ++it;
-    }
-}
-
-// remove duplicates like 'http://www.kde.org' and 'http://www.kde.org/'
-// (i.e. the trailing slash)
-// some duplicates are also created by prepending protocols
-static void hp_removeDuplicates(KCompletionMatches &l)
-{
-    QString http = QStringLiteral("http://");
-    QString ftp = QStringLiteral("ftp://ftp.");
-    QString file = QStringLiteral("file:");
-    QString file2 = QStringLiteral("file://");
-    l.removeDuplicates();
-    for (KCompletionMatches::Iterator it = l.begin();
-            it != l.end();
-            ++it) {
-        QString str = (*it).value();
-        if (str.startsWith(http)) {
-            if (str.indexOf('/', 7) < 0) {    // http://something<noslash>
-                hp_removeDupe(l, str + '/', it);
-                hp_removeDupe(l, str.mid(7) + '/', it);
-            } else if (str[ str.length() - 1 ] == '/') {
-                hp_removeDupe(l, str.left(str.length() - 1), it);
-                hp_removeDupe(l, str.left(str.length() - 1).mid(7), it);
-            }
-            hp_removeDupe(l, str.mid(7), it);
-        } else if (str.startsWith(ftp)) { // ftp://ftp.
-            hp_removeDupe(l, str.mid(6), it);    // remove dupes without ftp://
-        } else if (str.startsWith(file2)) {
-            hp_removeDupe(l, str.mid(7), it);    // remove dupes without file://
-        } else if (str.startsWith(file)) {
-            hp_removeDupe(l, str.mid(5), it);    // remove dupes without file:
-        }
-    }
-}
-
-static void hp_removeCommonPrefix(KCompletionMatches &l, const QString &prefix)
-{
-    for (KCompletionMatches::Iterator it = l.begin();
-            it != l.end();
-        ) {
-        if ((*it).value().startsWith(prefix)) {
-            it = l.erase(it);
-            continue;
-        }
-        ++it;
-    }
-}
-
-// don't include common prefixes like 'http://', i.e. when s == 'h', include
-// http://hotmail.com but don't include everything just starting with 'http://'
-static void hp_checkCommonPrefixes(KCompletionMatches &matches, const QString &s)
-{
-    static const char *const prefixes[] = {
-        "http://",
-        "https://",
-        "www.",
-        "ftp://",
-        "http://www.",
-        "https://www.",
-        "ftp://ftp.",
-        "file:",
-        "file://",
-        NULL
-    };
-    for (const char *const *pos = prefixes;
-            *pos != NULL;
-            ++pos) {
-        QString prefix = *pos;
-        if (prefix.startsWith(s)) {
-            hp_removeCommonPrefix(matches, prefix);
-        }
-    }
-}
-
-QStringList KonqMainWindow::historyPopupCompletionItems(const QString &s)
-{
-    const QString http = QStringLiteral("http://");
-    const QString https = QStringLiteral("https://");
-    const QString www = QStringLiteral("http://www.");
-    const QString wwws = QStringLiteral("https://www.");
-    const QString ftp = QStringLiteral("ftp://");
-    const QString ftpftp = QStringLiteral("ftp://ftp.");
-    const QString file = QStringLiteral("file:"); // without /, because people enter /usr etc.
-    const QString file2 = QStringLiteral("file://");
     if (s.isEmpty()) {
         return QStringList();
     }
-    KCompletionMatches matches = s_pCompletion->allWeightedMatches(s);
-    hp_checkCommonPrefixes(matches, s);
-    bool checkDuplicates = false;
-    if (!s.startsWith(ftp)) {
-        matches += s_pCompletion->allWeightedMatches(ftp + s);
-        if (QStringLiteral("ftp.").startsWith(s)) {
-            hp_removeCommonPrefix(matches, ftpftp);
-        }
-        checkDuplicates = true;
-    }
-    if (!s.startsWith(https)) {
-        matches += s_pCompletion->allWeightedMatches(https + s);
-        if (QStringLiteral("www.").startsWith(s)) {
-            hp_removeCommonPrefix(matches, wwws);
-        }
-        checkDuplicates = true;
-    }
-    if (!s.startsWith(http)) {
-        matches += s_pCompletion->allWeightedMatches(http + s);
-        if (QStringLiteral("www.").startsWith(s)) {
-            hp_removeCommonPrefix(matches, www);
-        }
-        checkDuplicates = true;
-    }
-    if (!s.startsWith(www)) {
-        matches += s_pCompletion->allWeightedMatches(www + s);
-        checkDuplicates = true;
-    }
-    if (!s.startsWith(wwws)) {
-        matches += s_pCompletion->allWeightedMatches(wwws + s);
-        checkDuplicates = true;
-    }
-    if (!s.startsWith(ftpftp)) {
-        matches += s_pCompletion->allWeightedMatches(ftpftp + s);
-        checkDuplicates = true;
-    }
-    if (!s.startsWith(file)) {
-        matches += s_pCompletion->allWeightedMatches(file + s);
-        checkDuplicates = true;
-    }
-    if (!s.startsWith(file2)) {
-        matches += s_pCompletion->allWeightedMatches(file2 + s);
-        checkDuplicates = true;
-    }
-    if (checkDuplicates) {
-        hp_removeDuplicates(matches);
-    }
-    QStringList items = matches.list();
+    // one lookup found the items with and without scheme or "www."
+    QStringList items = matches;
     if (items.count() == 0
             && !s.contains(':') && !s.isEmpty() && s[ 0 ] != '/') {
         QString pre = hp_tryPrepend(s);
@@ -5460,6 +5379,12 @@ bool KonqMainWindow::refuseExecutingKonqueror(const QString &mimeType)
 
 bool KonqMainWindow::event(QEvent *e)
 {
+    if (e->type() == QEvent::WindowDeactivate) {
+        // The views don't tell when they are scrolled, see
+        // KonqSessionManager::autoSaveSession()
+        updateVisibleHistoryEntries();
+    }
+
     if (e->type() == QEvent::StatusTip) {
         if (m_currentView && m_currentView->frame()->statusbar()) {
             KonqFrameStatusBar *statusBar = m_currentView->frame()->statusbar();
@@ -36,6 +36,7 @@
 #include <kservice.h>
 
 #include "konqcombo.h"
+#include "konqcompletionmatcher.h"
 #include "konqframe.h"
 #include "konqframecontainer.h"
 #include "konqopenurlrequest.h"
@@ -67,6 +68,7 @@ class ToggleViewGUIClient;
 class KonqRun;
 class KConfigGroup;
 class KonqHistoryDialog;
+class KonqCompletionIndex;
 struct HistoryEntry;
 class QLineEdit;
 
@@ -151,6 +153,20 @@ public:
     void saveProperties(KConfigGroup &config) Q_DECL_OVERRIDE;
     void readProperties(const KConfigGroup &config) Q_DECL_OVERRIDE;
 
+    /**
+     * Like saveProperties(), but the views which didn't change since they
+     * were last saved write the same history again, without serializing it.
+     * Used by the session autosave.
+     */
+    void saveAutosaveProperties(KConfigGroup &config);
+
+    /**
+     * Updates the history entries of the views in the current tab, if the
+     * state of their part changed, e.g. they were scrolled.
+     * See KonqView::updateHistoryEntryIfChanged().
+     */
+    void updateVisibleHistoryEntries();
+
     void setInitialFrameName(const QString &name);
 
     void reparseConfiguration();
@@ -461,6 +477,7 @@ private Q_SLOTS:
     void slotSubstringcompletion(const QString &);
     void slotRotation(KCompletionBase::KeyBindingType);
     void slotMatch(const QString &);
+    void slotHistoryCompletionFinished(const QString &text, KonqCompletionMatcher::Mode mode, const QStringList &matches);
     void slotClearHistory();
     void slotClearComboHistory();
 
@@ -540,12 +557,11 @@ private:
     static void addBookmarksIntoCompletion(const KBookmarkGroup &group);
 
     /**
-    * Returns all matches of the url-history for @p s. If there are no direct
-    * matches, it will try completing with http:// prepended, and if there's
-    * still no match, then http://www. Due to that, this is only usable for
-    * popupcompletion and not for manual or auto-completion.
+    * Returns the @p matches of the url-history for @p s. If there are none,
+    * it will try completing with http://www. prepended. Due to that, this is
+    * only usable for popupcompletion and not for manual or auto-completion.
     */
-    static QStringList historyPopupCompletionItems(const QString &s = QString());
+    static QStringList historyPopupCompletionItems(const QString &s, const QStringList &matches);
 
     void startAnimation();
     void stopAnimation();
@@ -677,8 +693,16 @@ private: // members
     QPointer<KonqCombo> m_combo;
     static KConfig *s_comboConfig;
     KUrlCompletion *m_pURLCompletion;
+    // looks up the history matches off the GUI thread
+    KonqCompletionMatcher *m_pCompletionMatcher;
+    // the matches of m_pURLCompletion shown with the history matches,
+    // before them unless the view shows a remote URL
+    QStringList m_urlCompletionItems;
+    bool m_urlCompletionItemsFirst;
     // just a reference to KonqHistoryManager's completionObject
     static KCompletion *s_pCompletion;
+    // and to its completionIndex, for the popup completion
+    static KonqCompletionIndex *s_pCompletionIndex;
 
     ToggleViewGUIClient *m_toggleViewGUIClient;
 
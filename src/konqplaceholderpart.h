@@ -0,0 +1,41 @@
+/* This file is part of the KDE project
+   Copyright (c) 2016 The Konqueror developers
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; see the file COPYING.  If not, write to
+   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+*/
+
+#ifndef KONQ_PLACEHOLDERPART_H
+#define KONQ_PLACEHOLDERPART_H
+
+#include <KParts/ReadOnlyPart>
+
+/**
+ * The part of a view whose page isn't loaded: a background tab of a
+ * restored session, or one whose part was discarded. It only has an
+ * empty widget, KonqView replaces it with a part of its service when
+ * the view is shown, see KonqView::isRestorePending().
+ */
+class KonqPlaceholderPart : public KParts::ReadOnlyPart
+{
+    Q_OBJECT
+public:
+    KonqPlaceholderPart(QWidget *parentWidget, QObject *parent, const QVariantList &args);
+
+protected:
+    bool openFile() Q_DECL_OVERRIDE;
+};
+
+#endif /* KONQ_PLACEHOLDERPART_H */
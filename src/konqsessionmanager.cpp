@@ -24,6 +24,7 @@
 #include "konqsessionmanager_interface.h"
 #include "konqsessionmanageradaptor.h"
 #include "konqviewmanager.h"
+#include "konqview.h"
 #include "konqsettingsxt.h"
 
 #include <kglobal.h>
@@ -54,8 +55,21 @@
 #include <QDesktopWidget>
 #include <QStandardPaths>
 #include <QSessionManager>
+#include <QDataStream>
+#include <QSaveFile>
+#include <QRunnable>
+#include <QElapsedTimer>
+#include <QLoggingCategory>
 #include <KSharedConfig>
 
+#ifdef Q_OS_LINUX
+#include <unistd.h>
+#endif
+
+// The time and memory taken by restoring sessions, enable with
+// QT_LOGGING_RULES="org.kde.konqueror.session.debug=true"
+Q_LOGGING_CATEGORY(KONQ_SESSION_LOG, "org.kde.konqueror.session", QtWarningMsg)
+
 class KonqSessionManagerPrivate
 {
 public:
@@ -90,6 +104,164 @@ static const QList<KConfigGroup> windowConfigGroups(/*NOT const, we'll use write
     return groups;
 }
 
+// The autosave file is not a KConfig file, so that an autosave only has to
+// serialize the windows which changed. Its layout (QDataStream, Qt 5.6):
+//   quint32 magic, quint32 version, quint32 number of windows,
+//   then each window as a QByteArray, see writeGroup().
+// It is converted to a KConfig session file when taking its ownership, so
+// that the session restore code only deals with KConfig files.
+static const quint32 s_autosaveMagic = 0x4B515353; // "KQSS"
+static const quint32 s_autosaveVersion = 1;
+
+// A group is: its entries as a QMap<QString, QByteArray>, then its subgroup
+// names as a QStringList, followed by each subgroup. The entries are kept as
+// they are stored, since some of them, like the history states, are binary.
+static void writeGroup(QDataStream &stream, const KConfigGroup &group)
+{
+    QMap<QString, QByteArray> entries;
+    foreach (const QString &key, group.keyList()) {
+        entries.insert(key, group.readEntry(key, QByteArray()));
+    }
+    stream << entries;
+    const QStringList subGroups = group.groupList();
+    stream << subGroups;
+    foreach (const QString &name, subGroups) {
+        writeGroup(stream, group.group(name));
+    }
+}
+
+static void readGroup(QDataStream &stream, KConfigGroup group)
+{
+    QMap<QString, QByteArray> entries;
+    QStringList subGroups;
+    stream >> entries >> subGroups;
+    if (stream.status() != QDataStream::Ok) {
+        return;
+    }
+    for (QMap<QString, QByteArray>::ConstIterator it = entries.constBegin(); it != entries.constEnd(); ++it) {
+        group.writeEntry(it.key(), it.value());
+    }
+    foreach (const QString &name, subGroups) {
+        readGroup(stream, group.group(name));
+    }
+}
+
+QByteArray KonqSessionManager::saveWindowState(KonqMainWindow *window)
+{
+    KConfig config(QString(), KConfig::SimpleConfig); // in memory
+    KConfigGroup configGroup(&config, "Window");
+    window->saveAutosaveProperties(configGroup);
+
+    QByteArray state;
+    QDataStream stream(&state, QIODevice::WriteOnly);
+    stream.setVersion(QDataStream::Qt_5_6);
+    writeGroup(stream, configGroup);
+    return state;
+}
+
+bool KonqSessionManager::writeAutosaveFile(const QString &filePath, const QList<QByteArray> &windowStates)
+{
+    QSaveFile file(filePath);
+    if (!file.open(QIODevice::WriteOnly)) {
+        qWarning() << "Could not write the autosave file" << filePath << file.errorString();
+        return false;
+    }
+    QDataStream stream(&file);
+    stream.setVersion(QDataStream::Qt_5_6);
+    stream << s_autosaveMagic << s_autosaveVersion << quint32(windowStates.count());
+    foreach (const QByteArray &state, windowStates) {
+        stream << state;
+    }
+    if (stream.status() != QDataStream::Ok || !file.commit()) {
+        qWarning() << "Could not write the autosave file" << filePath << file.errorString();
+        return false;
+    }
+    return true;
+}
+
+void KonqSessionManager::convertAutosaveFile(const QString &filePath)
+{
+    QFile file(filePath);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return;
+    }
+    QDataStream stream(&file);
+    stream.setVersion(QDataStream::Qt_5_6);
+    quint32 magic, version, count;
+    stream >> magic >> version >> count;
+    if (stream.status() != QDataStream::Ok || magic != s_autosaveMagic) {
+        return;
+    }
+    QList<QByteArray> windowStates;
+    if (version == s_autosaveVersion) {
+        for (quint32 i = 0; i < count; ++i) {
+            QByteArray state;
+            stream >> state;
+            if (stream.status() != QDataStream::Ok) {
+                qWarning() << "Truncated autosave file" << filePath;
+                break;
+            }
+            windowStates.append(state);
+        }
+    } else {
+        qWarning() << "Unknown autosave file version" << version << "in" << filePath;
+    }
+    file.close();
+
+    QFile::remove(filePath);
+    KConfig config(filePath, KConfig::SimpleConfig);
+    for (int i = 0; i < windowStates.count(); ++i) {
+        QDataStream windowStream(windowStates.at(i));
+        windowStream.setVersion(QDataStream::Qt_5_6);
+        readGroup(windowStream, KConfigGroup(&config, "Window" + QString::number(i)));
+    }
+    KConfigGroup configGroup(&config, "General");
+    configGroup.writeEntry("Number of Windows", windowStates.count());
+    config.sync();
+}
+
+/**
+ * @returns the resident memory size of the process in bytes, or 0 if unknown.
+ * Only used for the KONQ_SESSION_LOG output of the session restore.
+ */
+static qint64 residentMemorySize()
+{
+#ifdef Q_OS_LINUX
+    QFile file(QStringLiteral("/proc/self/statm"));
+    if (file.open(QIODevice::ReadOnly)) {
+        const QList<QByteArray> fields = file.readAll().split(' ');
+        if (fields.count() > 1) {
+            return fields.at(1).toLongLong() * sysconf(_SC_PAGESIZE);
+        }
+    }
+#endif
+    return 0;
+}
+
+/**
+ * Writes the autosave file in a worker thread, then calls
+ * KonqSessionManager::slotAutoSaveFinished().
+ */
+class KonqSessionAutoSaveJob : public QRunnable
+{
+public:
+    KonqSessionAutoSaveJob(const QString &filePath, const QList<QByteArray> &windowStates, QObject *receiver)
+        : m_filePath(filePath), m_windowStates(windowStates), m_receiver(receiver)
+    {
+    }
+
+    void run() Q_DECL_OVERRIDE
+    {
+        const bool success = KonqSessionManager::writeAutosaveFile(m_filePath, m_windowStates);
+        QMetaObject::invokeMethod(m_receiver, "slotAutoSaveFinished", Qt::QueuedConnection, Q_ARG(bool, success));
+    }
+
+private:
+    QString m_filePath;
+    QList<QByteArray> m_windowStates;
+    QObject *m_receiver;
+};
+
 SessionRestoreDialog::SessionRestoreDialog(const QStringList &sessionFilePaths, QWidget *parent)
     : KDialog(parent, 0)
     , m_sessionItemsCount(0)
@@ -361,8 +533,10 @@ KonqSessionManager::KonqSessionManager()
     : m_autosaveDir(QStandardPaths::writableLocation(QStandardPaths::DataLocation) + QLatin1Char('/') + "autosave")
     , m_autosaveEnabled(false) // so that enableAutosave works
     , m_createdOwnedByDir(false)
-    , m_sessionConfig(0)
+    , m_windowListChanged(false)
 {
+    m_autoSaveThreadPool.setMaxThreadCount(1);
+
     // Initialize dbus interfaces
     new KonqSessionManagerAdaptor(this);
 
@@ -388,10 +562,9 @@ KonqSessionManager::KonqSessionManager()
 
 KonqSessionManager::~KonqSessionManager()
 {
-    if (m_sessionConfig) {
-        QFile::remove(m_sessionConfig->name());
+    if (m_autosaveEnabled) {
+        removeAutosaveFile();
     }
-    delete m_sessionConfig;
 }
 
 // Don't restore preloaded konquerors
@@ -410,11 +583,16 @@ void KonqSessionManager::disableAutosave()
 
     m_autosaveEnabled = false;
     m_autoSaveTimer.stop();
-    if (m_sessionConfig) {
-        QFile::remove(m_sessionConfig->name());
-        delete m_sessionConfig;
-        m_sessionConfig = 0;
-    }
+    removeAutosaveFile();
+}
+
+void KonqSessionManager::removeAutosaveFile()
+{
+    // Don't let a pending save write the file again
+    m_autoSaveThreadPool.waitForDone();
+    QFile::remove(m_autosaveFilePath);
+    m_windowStates.clear();
+    m_dirtyWindows.clear();
 }
 
 void KonqSessionManager::enableAutosave()
@@ -423,14 +601,13 @@ void KonqSessionManager::enableAutosave()
         return;
     }
 
-    // Create the config file for autosaving current session
-    QString filename = QLatin1String("autosave/") + m_baseService;
-    const QString filePath = QStandardPaths::writableLocation(QStandardPaths::DataLocation) + QLatin1Char('/') + filename;
-
-    delete m_sessionConfig;
-    m_sessionConfig = new KConfig(filePath, KConfig::SimpleConfig);
-    //qDebug() << "config filename:" << m_sessionConfig->name();
+    // The file for autosaving current session, written by autoSaveSession()
+    QDir().mkpath(m_autosaveDir);
+    m_autosaveFilePath = m_autosaveDir + QLatin1Char('/') + m_baseService;
+    //qDebug() << "autosave filename:" << m_autosaveFilePath;
 
+    // So that the first autosave writes the file, even without windows
+    m_windowListChanged = true;
     m_autosaveEnabled = true;
     m_autoSaveTimer.start();
 }
@@ -463,19 +640,68 @@ void KonqSessionManager::autoSaveSession()
         m_autoSaveTimer.stop();
     }
 
-    saveCurrentSessionToFile(m_sessionConfig);
-    m_sessionConfig->sync();
-    m_sessionConfig->markAsClean();
+    // Only save again the windows which changed since the last autosave,
+    // and of those only the views which changed. The views of the active
+    // window's current tab can be scrolled, which only they can tell.
+    bool changed = m_windowListChanged;
+    QList<QByteArray> windowStates;
+    QList<KonqMainWindow *> *mainWindows = KonqMainWindow::mainWindowList();
+    if (mainWindows) {
+        foreach (KonqMainWindow *window, *mainWindows) {
+            if (window->isActiveWindow()) {
+                window->updateVisibleHistoryEntries();
+            }
+            QHash<KonqMainWindow *, QByteArray>::iterator it = m_windowStates.find(window);
+            if (it == m_windowStates.end()) {
+                it = m_windowStates.insert(window, saveWindowState(window));
+                changed = true;
+            } else if (m_dirtyWindows.contains(window)) {
+                const QByteArray state = saveWindowState(window);
+                if (state != *it) {
+                    *it = state;
+                    changed = true;
+                }
+            }
+            windowStates.append(*it);
+        }
+    }
+    // Saving the views whose history changed marks their windows as
+    // changed again
+    m_dirtyWindows.clear();
+    m_windowListChanged = false;
 
-    // Now that we have saved current session it's safe to remove our owned_by
-    // directory
-    deleteOwnedSessions();
+    if (changed) {
+        // slotAutoSaveFinished() is called once the file is written
+        m_autoSaveThreadPool.start(new KonqSessionAutoSaveJob(m_autosaveFilePath, windowStates, this));
+    }
 
     if (isActive) {
         m_autoSaveTimer.start();
     }
 }
 
+void KonqSessionManager::slotAutoSaveFinished(bool success)
+{
+    // Now that we have saved current session it's safe to remove our owned_by
+    // directory
+    if (success && m_autosaveEnabled) {
+        deleteOwnedSessions();
+    }
+}
+
+void KonqSessionManager::markWindowDirty(KonqMainWindow *window)
+{
+    m_dirtyWindows.insert(window);
+}
+
+void KonqSessionManager::windowClosed(KonqMainWindow *window)
+{
+    m_dirtyWindows.remove(window);
+    if (m_windowStates.remove(window)) {
+        m_windowListChanged = true;
+    }
+}
+
 void KonqSessionManager::saveCurrentSessions(const QString &path)
 {
     emit saveCurrentSession(path);
@@ -550,6 +776,7 @@ QStringList KonqSessionManager::takeSessionsOwnership()
                     const QString newFileName = dirForMyOwnedSessionFiles() +
                                                 '/' + it2.fileName();
                     QFile::rename(it2.filePath(), newFileName);
+                    convertAutosaveFile(newFileName);
                     sessionFilePaths.append(newFileName);
                 }
                 // Remove the old directory
@@ -561,6 +788,7 @@ QStringList KonqSessionManager::takeSessionsOwnership()
                 const QString newFileName = dirForMyOwnedSessionFiles() + '/' +
                                             it.fileName();
                 QFile::rename(it.filePath(), newFileName);
+                convertAutosaveFile(newFileName);
                 sessionFilePaths.append(newFileName);
             }
         }
@@ -595,15 +823,43 @@ void KonqSessionManager::restoreSession(const QString &sessionFilePath, bool
         return;
     }
 
+    QElapsedTimer timer;
+    timer.start();
+    const bool logging = KONQ_SESSION_LOG().isDebugEnabled();
+    const qint64 memoryBefore = logging ? residentMemorySize() : 0;
+
     KConfig config(sessionFilePath, KConfig::SimpleConfig);
     const QList<KConfigGroup> groups = windowConfigGroups(config);
+    QList<KonqMainWindow *> windows;
     Q_FOREACH (const KConfigGroup &configGroup, groups) {
         if (!openTabsInsideCurrentWindow) {
-            KonqViewManager::openSavedWindow(configGroup)->show();
+            KonqMainWindow *window = KonqViewManager::openSavedWindow(configGroup);
+            window->show();
+            windows.append(window);
         } else {
             parent->viewManager()->openSavedWindow(configGroup, true);
         }
     }
+
+    if (!logging) {
+        return;
+    }
+    if (openTabsInsideCurrentWindow) {
+        windows.append(parent);
+    }
+    int viewCount = 0;
+    int pendingCount = 0;
+    Q_FOREACH (KonqMainWindow *window, windows) {
+        Q_FOREACH (KonqView *view, window->viewMap()) {
+            ++viewCount;
+            if (view->isRestorePending()) {
+                ++pendingCount;
+            }
+        }
+    }
+    qCDebug(KONQ_SESSION_LOG) << "Restored" << sessionFilePath << "in" << timer.elapsed() << "ms:"
+                              << viewCount << "views," << pendingCount << "without a part until shown,"
+                              << (residentMemorySize() - memoryBefore) / 1024 << "KiB more resident memory";
 }
 
 static void removeDiscardedSessions(const QStringList &sessionFiles, const QStringList &discardedSessions)
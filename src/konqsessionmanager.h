@@ -25,6 +25,9 @@
 #include <QTimer>
 #include <QStringList>
 #include <QString>
+#include <QHash>
+#include <QSet>
+#include <QThreadPool>
 
 #include <kconfig.h>
 #include <kdialog.h>
@@ -160,6 +163,36 @@ public:
      */
     QString autosaveDirectory() const;
 
+    /**
+     * Marks @p window as changed, so that the next autosave saves it again.
+     * Only the windows which were marked are saved again, and of those only
+     * the views whose history changed.
+     */
+    void markWindowDirty(KonqMainWindow *window);
+
+    /**
+     * Forgets the autosaved state of @p window, which is being deleted.
+     */
+    void windowClosed(KonqMainWindow *window);
+
+    /**
+     * @returns the state of @p window, as written to the autosave file
+     */
+    static QByteArray saveWindowState(KonqMainWindow *window);
+
+    /**
+     * Writes the autosave file @p filePath, with the states of the windows
+     * returned by saveWindowState().
+     * @returns false, with a warning, if it couldn't be written
+     */
+    static bool writeAutosaveFile(const QString &filePath, const QList<QByteArray> &windowStates);
+
+    /**
+     * Converts the autosave file @p filePath to a KConfig session file, in place.
+     * Does nothing if it is already a KConfig file, as written by older versions.
+     */
+    static void convertAutosaveFile(const QString &filePath);
+
 public Q_SLOTS:
     /**
      * Ask the user with a KPassivePopup ballon if session should be restored
@@ -186,6 +219,7 @@ public Q_SLOTS:
 
 private Q_SLOTS:
     void slotCommitData(QSessionManager &sm);
+    void slotAutoSaveFinished(bool success);
 
 private:
     KonqSessionManager();
@@ -205,13 +239,26 @@ private:
     }
 
     void saveCurrentSessionToFile(KConfig *);
+
+    /**
+     * Waits for the pending autosave, removes the autosave file and forgets
+     * the autosaved states.
+     */
+    void removeAutosaveFile();
 private:
     QTimer m_autoSaveTimer;
     QString m_autosaveDir;
     QString m_baseService;
     bool m_autosaveEnabled;
     bool m_createdOwnedByDir;
-    KConfig *m_sessionConfig;
+    QString m_autosaveFilePath;
+    // The autosave file is written by one thread, so that the saves are
+    // written in order
+    QThreadPool m_autoSaveThreadPool;
+    // The last autosaved state of each window, see saveWindowState()
+    QHash<KonqMainWindow *, QByteArray> m_windowStates;
+    QSet<KonqMainWindow *> m_dirtyWindows;
+    bool m_windowListChanged;
 
 Q_SIGNALS: // DBUS signals
     /**
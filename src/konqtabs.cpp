@@ -41,6 +41,7 @@
 #include "konqmisc.h"
 #include "konqsettingsxt.h"
 #include "konqframevisitor.h"
+#include "konqsessionmanager.h"
 
 #include <kacceleratormanager.h>
 #include <konqpixmapprovider.h>
@@ -290,6 +291,7 @@ void KonqFrameTabs::slotMovedTab(int from, int to)
     KonqFrameBase *fromFrame = m_childFrameList.at(from);
     m_childFrameList.removeAll(fromFrame);
     m_childFrameList.insert(to, fromFrame);
+    KonqSessionManager::self()->markWindowDirty(m_pViewManager->mainWindow());
 
     KonqFrameBase *currentFrame = dynamic_cast<KonqFrameBase *>(currentWidget());
     if (currentFrame && !m_pViewManager->isLoadingProfile()) {
@@ -30,6 +30,8 @@
 #include "konqbrowseriface.h"
 #include "konqhistorymanager.h"
 #include "konqpixmapprovider.h"
+#include "konqsessionmanager.h"
+#include "konqplaceholderpart.h"
 
 #include <kio/job.h>
 #include <kio/jobuidelegate.h>
@@ -67,6 +69,9 @@
 
 //#define DEBUG_HISTORY
 
+// Incremented each time a view is activated, see KonqView::lastActivation()
+static quint64 s_lastActivation = 0;
+
 KonqView::KonqView(KonqViewFactory &viewFactory,
                    KonqFrame *viewFrame,
                    KonqMainWindow *mainWindow,
@@ -111,6 +116,8 @@ KonqView::KonqView(KonqViewFactory &viewFactory,
     m_bBuiltinView = false;
     m_bURLDropHandling = false;
     m_bErrorURL = false;
+    m_bRestorePending = false;
+    m_lastActivation = ++s_lastActivation;
 
 #ifdef KActivities_FOUND
     m_activityResourceInstance = new KActivities::ResourceInstance(mainWindow->winId(), this);
@@ -149,6 +156,10 @@ void KonqView::openUrl(const QUrl &url, const QString &locationBarURL,
 {
     qDebug() << "url=" << url << "locationBarURL=" << locationBarURL;
 
+    // The history entry which wasn't restored yet stays in the back history
+    m_bRestorePending = false;
+    replacePlaceholderPart();
+
     setPartMimeType();
 
     KParts::OpenUrlArguments args;
@@ -716,6 +727,7 @@ void KonqView::createHistoryEntry()
         while (current != m_lstHistory.last()) {
             delete m_lstHistory.takeLast();
         }
+        current->compressState();
     }
     // Append a new entry
 #ifdef DEBUG_HISTORY
@@ -726,6 +738,7 @@ void KonqView::createHistoryEntry()
 #ifdef DEBUG_HISTORY
     qDebug() << "at=" << historyIndex() << "count=" << m_lstHistory.count();
 #endif
+    historyChanged();
 }
 
 void KonqView::appendHistoryEntry(HistoryEntry *historyEntry)
@@ -736,6 +749,7 @@ void KonqView::appendHistoryEntry(HistoryEntry *historyEntry)
     }
 
     m_lstHistory.append(historyEntry);
+    m_cachedHistoryConfig.clear();
 }
 
 void KonqView::updateHistoryEntry(bool saveLocationBarURL)
@@ -743,14 +757,15 @@ void KonqView::updateHistoryEntry(bool saveLocationBarURL)
     Q_ASSERT(!m_bLockHistory);   // should never happen
 
     HistoryEntry *current = currentHistoryEntry();
-    if (!current) {
+    if (!current || m_bRestorePending) {
+        // The part doesn't show the current entry yet, keep its state
         return;
     }
 
     current->reload = false; // We have a state for it now.
+    QByteArray buffer;
     if (browserExtension()) {
-        current->buffer = QByteArray(); // Start with empty buffer.
-        QDataStream stream(&current->buffer, QIODevice::WriteOnly);
+        QDataStream stream(&buffer, QIODevice::WriteOnly);
 
         browserExtension()->saveState(stream);
     }
@@ -775,9 +790,34 @@ void KonqView::updateHistoryEntry(bool saveLocationBarURL)
     current->strServiceName = m_service->desktopEntryName();
 
     current->doPost = m_doPost;
-    current->postData = m_doPost ? m_postData : QByteArray();
+    current->setState(buffer, m_doPost ? m_postData : QByteArray());
     current->postContentType = m_doPost ? m_postContentType : QString();
     current->pageReferrer = m_pageReferrer;
+
+    historyChanged();
+}
+
+void KonqView::updateHistoryEntryIfChanged()
+{
+    HistoryEntry *current = currentHistoryEntry();
+    if (!m_pPart || m_bLockHistory || !current || m_bRestorePending) {
+        return;
+    }
+    QByteArray buffer;
+    if (browserExtension()) {
+        QDataStream stream(&buffer, QIODevice::WriteOnly);
+        browserExtension()->saveState(stream);
+    }
+    if (buffer != current->buffer() || m_pPart->url() != current->url ||
+            m_caption != current->title || m_sLocationBarURL != current->locationBarURL) {
+        updateHistoryEntry(true);
+    }
+}
+
+void KonqView::historyChanged()
+{
+    m_cachedHistoryConfig.clear();
+    KonqSessionManager::self()->markWindowDirty(m_pMainWindow);
 }
 
 void KonqView::goHistory(int steps)
@@ -815,7 +855,9 @@ void KonqView::go(int steps)
 
     stop();
 
+    currentHistoryEntry()->compressState();
     setHistoryIndex(newPos);   // sets current item
+    historyChanged();
 
 #ifdef DEBUG_HISTORY
     qDebug() << "New position" << historyIndex();
@@ -828,6 +870,7 @@ void KonqView::restoreHistory()
 {
     HistoryEntry h(*currentHistoryEntry());   // make a copy of the current history entry, as the data
     // the pointer points to will change with the following calls
+    m_bRestorePending = false;
 
 #ifdef DEBUG_HISTORY
     qDebug() << "Restoring servicetype/name, and location bar URL from history:" << h.locationBarURL;
@@ -840,21 +883,39 @@ void KonqView::restoreHistory()
         qWarning() << "Couldn't change view mode to" << h.strServiceType << h.strServiceName;
         return /*false*/;
     }
+    if (!replacePlaceholderPart()) {
+        qWarning() << "Couldn't create the part of" << h.strServiceType << h.strServiceName;
+        return;
+    }
 
     setPartMimeType();
 
     aboutToOpenURL(h.url);
 
-    if (h.reload == false && browserExtension()) {
+    if (h.canRestoreState() && browserExtension()) {
         //qDebug() << "Restoring view from stream";
-        QDataStream stream(h.buffer);
+        QDataStream stream(h.buffer());
 
         browserExtension()->restoreState(stream);
 
         m_doPost = h.doPost;
         m_postContentType = h.postContentType;
-        m_postData = h.postData;
+        m_postData = h.postData();
+        m_pageReferrer = h.pageReferrer;
+    } else if (h.doPost && browserExtension()) {
+        // The state was dropped, but the page is the result of a POST:
+        // post the data again, if the user agrees, like reloading does
+        m_doPost = h.doPost;
+        m_postContentType = h.postContentType;
+        m_postData = h.postData();
         m_pageReferrer = h.pageReferrer;
+        KParts::OpenUrlArguments args;
+        KParts::BrowserArguments browserArgs;
+        if (prepareReload(args, browserArgs, false)) {
+            m_pPart->setArguments(args);
+            browserExtension()->setBrowserArguments(browserArgs);
+            m_pPart->openUrl(h.url);
+        }
     } else {
         m_pPart->openUrl(h.url);
     }
@@ -886,14 +947,63 @@ void KonqView::copyHistory(KonqView *other)
         appendHistoryEntry(new HistoryEntry(*he));
     }
     setHistoryIndex(other->historyIndex());
+    historyChanged();
 }
 
 QUrl KonqView::url() const
 {
     Q_ASSERT(m_pPart);
+    if (m_bRestorePending) {
+        return m_lstHistory.at(m_lstHistoryIndex)->url;
+    }
     return m_pPart->url();
 }
 
+void KonqView::restorePendingHistory()
+{
+    if (m_bRestorePending) {
+        restoreHistory();
+    }
+}
+
+void KonqView::setActivated()
+{
+    m_lastActivation = ++s_lastActivation;
+}
+
+bool KonqView::discard()
+{
+    if (m_bRestorePending || m_bLoading || m_pRun || m_bLockHistory || m_bPassiveMode ||
+            m_bToggleView || m_bLinkedView || m_bFollowActive || m_pKonqFrame->isVisible() ||
+            !currentHistoryEntry()) {
+        return false;
+    }
+
+    // Keep the state of the page (scroll position...), restored when shown again
+    updateHistoryEntry(true);
+
+    qDebug() << "Discarding the part of" << url();
+    KonqViewFactory viewFactory = KonqViewFactory::placeholder();
+    m_bRestorePending = true;
+    switchView(viewFactory); // deletes the old part
+    return true;
+}
+
+bool KonqView::replacePlaceholderPart()
+{
+    if (!qobject_cast<KonqPlaceholderPart *>(m_pPart)) {
+        return true;
+    }
+    KonqFactory konqFactory;
+    KonqViewFactory viewFactory = konqFactory.createView(m_serviceType, m_service->desktopEntryName(),
+                                  0, 0, 0, true /*forceAutoEmbed*/);
+    if (viewFactory.isNull()) {
+        return false;
+    }
+    switchView(viewFactory);
+    return !qobject_cast<KonqPlaceholderPart *>(m_pPart);
+}
+
 QUrl KonqView::upUrl() const
 {
     QUrl currentURL;
@@ -1292,6 +1402,183 @@ bool KonqView::supportsMimeType(const QString &mimeType) const
     return false;
 }
 
+/**
+ * The state of a history entry, shared by its copies: the copies of the
+ * history of a duplicated tab, the closed tabs... It is never modified,
+ * setState() creates a new one, except when compressing or dropping it.
+ */
+class HistoryEntryState : public QSharedData
+{
+public:
+    HistoryEntryState(const QByteArray &_buffer, const QByteArray &_postData);
+    ~HistoryEntryState();
+
+    qint64 size() const
+    {
+        return buffer.size() + postData.size();
+    }
+
+    QByteArray buffer; // compressed with qCompress() if compressed is true
+    QByteArray postData;
+    bool compressed;
+    bool dropped;
+
+    // The states in HistoryStateCache, from the least recently used
+    HistoryEntryState *previous;
+    HistoryEntryState *next;
+};
+
+/**
+ * Accounts for the memory used by the states of all the history entries,
+ * and drops the least recently used ones when it exceeds the limit.
+ */
+class HistoryStateCache
+{
+public:
+    HistoryStateCache()
+        : m_first(0), m_last(0), m_size(0)
+    {
+    }
+
+    void insert(HistoryEntryState *state)
+    {
+        state->previous = m_last;
+        state->next = 0;
+        if (m_last) {
+            m_last->next = state;
+        } else {
+            m_first = state;
+        }
+        m_last = state;
+        m_size += state->size();
+        dropOverLimit();
+    }
+
+    void remove(HistoryEntryState *state)
+    {
+        if (state->previous) {
+            state->previous->next = state->next;
+        } else {
+            m_first = state->next;
+        }
+        if (state->next) {
+            state->next->previous = state->previous;
+        } else {
+            m_last = state->previous;
+        }
+        m_size -= state->size();
+    }
+
+    void touch(HistoryEntryState *state)
+    {
+        if (state != m_last) {
+            remove(state);
+            insert(state);
+        }
+    }
+
+    void resize(qint64 delta)
+    {
+        m_size += delta;
+    }
+
+private:
+    void dropOverLimit()
+    {
+        const qint64 maxSize = qint64(KonqSettings::maximumHistoryStateSize()) * 1024;
+        // The most recent state is kept whatever its size
+        while (m_size > maxSize && m_first != m_last) {
+            HistoryEntryState *state = m_first;
+            remove(state);
+            // The POST data is kept, to post it again when the entry is reloaded.
+            // It stays accounted for until the state is deleted.
+            state->buffer.clear();
+            state->dropped = true;
+            m_size += state->postData.size();
+        }
+    }
+
+    HistoryEntryState *m_first;
+    HistoryEntryState *m_last;
+    qint64 m_size;
+};
+
+Q_GLOBAL_STATIC(HistoryStateCache, s_historyStateCache)
+
+HistoryEntryState::HistoryEntryState(const QByteArray &_buffer, const QByteArray &_postData)
+    : buffer(_buffer), postData(_postData), compressed(false), dropped(false)
+{
+    s_historyStateCache()->insert(this);
+}
+
+HistoryEntryState::~HistoryEntryState()
+{
+    if (s_historyStateCache.isDestroyed()) {
+        return;
+    }
+    if (dropped) {
+        s_historyStateCache()->resize(-postData.size());
+    } else {
+        s_historyStateCache()->remove(this);
+    }
+}
+
+HistoryEntry::HistoryEntry()
+    : doPost(false), pageSecurity(KonqMainWindow::NotCrypted), reload(false)
+{
+}
+
+HistoryEntry::HistoryEntry(const HistoryEntry &other) = default;
+
+HistoryEntry::~HistoryEntry()
+{
+}
+
+HistoryEntry &HistoryEntry::operator=(const HistoryEntry &other) = default;
+
+QByteArray HistoryEntry::buffer() const
+{
+    if (!m_state || m_state->dropped) {
+        return QByteArray();
+    }
+    s_historyStateCache()->touch(m_state.data());
+    return m_state->compressed ? qUncompress(m_state->buffer) : m_state->buffer;
+}
+
+QByteArray HistoryEntry::postData() const
+{
+    return m_state ? m_state->postData : QByteArray();
+}
+
+void HistoryEntry::setState(const QByteArray &buffer, const QByteArray &postData, bool compressed)
+{
+    if (buffer.isEmpty() && postData.isEmpty()) {
+        m_state.reset();
+    } else {
+        m_state = new HistoryEntryState(buffer, postData);
+        m_state->compressed = compressed && !buffer.isEmpty();
+    }
+}
+
+void HistoryEntry::compressState()
+{
+    // Small states don't compress well
+    if (!m_state || m_state->compressed || m_state->dropped || m_state->buffer.size() < 256) {
+        return;
+    }
+    const QByteArray compressed = qCompress(m_state->buffer);
+    if (compressed.size() < m_state->buffer.size()) {
+        s_historyStateCache()->resize(compressed.size() - m_state->buffer.size());
+        m_state->buffer = compressed;
+        m_state->compressed = true;
+    }
+}
+
+bool HistoryEntry::canRestoreState() const
+{
+    return !reload && !(m_state && m_state->dropped);
+}
+
 void HistoryEntry::saveConfig(KConfigGroup &config, const QString &prefix, const KonqFrameBase::Options &options)
 {
     if (options & KonqFrameBase::saveURLs) {
@@ -1304,10 +1591,15 @@ void HistoryEntry::saveConfig(KConfigGroup &config, const QString &prefix, const
         config.writeEntry(QStringLiteral("Url").prepend(prefix), url.url());
         config.writeEntry(QStringLiteral("LocationBarURL").prepend(prefix), locationBarURL);
         config.writeEntry(QStringLiteral("Title").prepend(prefix), title);
-        config.writeEntry(QStringLiteral("Buffer").prepend(prefix), buffer);
+        // As it is, not to uncompress the states of all the entries each time
+        // the session is saved. Older versions only know "Buffer".
+        const bool compressed = m_state && m_state->compressed && !m_state->dropped;
+        const QByteArray state = m_state && !m_state->dropped ? m_state->buffer : QByteArray();
+        config.writeEntry(QStringLiteral("Buffer").prepend(prefix), compressed ? QByteArray() : state);
+        config.writeEntry(QStringLiteral("CompressedBuffer").prepend(prefix), compressed ? state : QByteArray());
         config.writeEntry(QStringLiteral("StrServiceType").prepend(prefix), strServiceType);
         config.writeEntry(QStringLiteral("StrServiceName").prepend(prefix), strServiceName);
-        config.writeEntry(QStringLiteral("PostData").prepend(prefix), postData);
+        config.writeEntry(QStringLiteral("PostData").prepend(prefix), postData());
         config.writeEntry(QStringLiteral("PostContentType").prepend(prefix), postContentType);
         config.writeEntry(QStringLiteral("DoPost").prepend(prefix), doPost);
         config.writeEntry(QStringLiteral("PageReferrer").prepend(prefix), pageReferrer);
@@ -1328,10 +1620,15 @@ void HistoryEntry::loadItem(const KConfigGroup &config, const QString &prefix, c
         url = QUrl(config.readEntry(QStringLiteral("Url").prepend(prefix), ""));
         locationBarURL = config.readEntry(QStringLiteral("LocationBarURL").prepend(prefix), "");
         title = config.readEntry(QStringLiteral("Title").prepend(prefix), "");
-        buffer = config.readEntry(QStringLiteral("Buffer").prepend(prefix), QByteArray());
         strServiceType = config.readEntry(QStringLiteral("StrServiceType").prepend(prefix), "");
         strServiceName = config.readEntry(QStringLiteral("StrServiceName").prepend(prefix), "");
-        postData = config.readEntry(QStringLiteral("PostData").prepend(prefix), QByteArray());
+        const QByteArray compressedState = config.readEntry(QStringLiteral("CompressedBuffer").prepend(prefix), QByteArray());
+        if (!compressedState.isEmpty()) {
+            setState(compressedState, config.readEntry(QStringLiteral("PostData").prepend(prefix), QByteArray()), true);
+        } else {
+            setState(config.readEntry(QStringLiteral("Buffer").prepend(prefix), QByteArray()),
+                     config.readEntry(QStringLiteral("PostData").prepend(prefix), QByteArray()));
+        }
         postContentType = config.readEntry(QStringLiteral("PostContentType").prepend(prefix), "");
         doPost = config.readEntry(QStringLiteral("DoPost").prepend(prefix), false);
         pageReferrer = config.readEntry(QStringLiteral("PageReferrer").prepend(prefix), "");
@@ -1353,29 +1650,54 @@ void KonqView::saveConfig(KConfigGroup &config, const QString &prefix, const Kon
     if (options & KonqFrameBase::saveURLs) {
         config.writePathEntry(QStringLiteral("URL").prepend(prefix), url().url());
     } else if (options & KonqFrameBase::saveHistoryItems) {
-        if (m_pPart && !m_bLockHistory) {
-            updateHistoryEntry(true);
+        if (!(options & KonqFrameBase::saveCachedHistory)) {
+            saveHistoryConfig(config, prefix);
+            return;
         }
-        QList<HistoryEntry *>::Iterator it = m_lstHistory.begin();
-        for (int i = 0; it != m_lstHistory.end(); ++it, ++i) {
-            // In order to not end up with a huge config file, we only save full
-            // history for current history item
-            KonqFrameBase::Options options;
-            if (i == m_lstHistoryIndex) {
-                options = KonqFrameBase::saveHistoryItems;
-            } else {
-                options = KonqFrameBase::saveURLs;
+        // Serializing the history of every view each time the session is
+        // autosaved is too slow with many tabs, so reuse it until it changes.
+        // The prefix changes when the view is moved to another tab or frame.
+        if (m_cachedHistoryConfig.isEmpty() || m_cachedHistoryPrefix != prefix) {
+            KConfig cache(QString(), KConfig::SimpleConfig); // in memory
+            KConfigGroup cacheGroup(&cache, "View");
+            saveHistoryConfig(cacheGroup, prefix);
+            m_cachedHistoryConfig.clear();
+            foreach (const QString &key, cacheGroup.keyList()) {
+                m_cachedHistoryConfig.insert(key, cacheGroup.readEntry(key, QByteArray()));
             }
+            m_cachedHistoryPrefix = prefix;
+        }
+        for (QMap<QString, QByteArray>::ConstIterator it = m_cachedHistoryConfig.constBegin();
+                it != m_cachedHistoryConfig.constEnd(); ++it) {
+            config.writeEntry(it.key(), it.value());
+        }
+    }
+}
 
-            (*it)->saveConfig(config, QLatin1String("HistoryItem")
-                              + QString::number(i).prepend(prefix), options);
+void KonqView::saveHistoryConfig(KConfigGroup &config, const QString &prefix)
+{
+    if (m_pPart && !m_bLockHistory) {
+        updateHistoryEntry(true);
+    }
+    QList<HistoryEntry *>::Iterator it = m_lstHistory.begin();
+    for (int i = 0; it != m_lstHistory.end(); ++it, ++i) {
+        // In order to not end up with a huge config file, we only save full
+        // history for current history item
+        KonqFrameBase::Options options;
+        if (i == m_lstHistoryIndex) {
+            options = KonqFrameBase::saveHistoryItems;
+        } else {
+            options = KonqFrameBase::saveURLs;
         }
-        config.writeEntry(QStringLiteral("CurrentHistoryItem").prepend(prefix), m_lstHistoryIndex);
-        config.writeEntry(QStringLiteral("NumberOfHistoryItems").prepend(prefix), historyLength());
+
+        (*it)->saveConfig(config, QLatin1String("HistoryItem")
+                          + QString::number(i).prepend(prefix), options);
     }
+    config.writeEntry(QStringLiteral("CurrentHistoryItem").prepend(prefix), m_lstHistoryIndex);
+    config.writeEntry(QStringLiteral("NumberOfHistoryItems").prepend(prefix), historyLength());
 }
 
-void KonqView::loadHistoryConfig(const KConfigGroup &config, const QString &prefix)
+void KonqView::loadHistoryConfig(const KConfigGroup &config, const QString &prefix, bool restoreOnDemand)
 {
     // First, remove any history
     qDeleteAll(m_lstHistory);
@@ -1387,6 +1709,7 @@ void KonqView::loadHistoryConfig(const KConfigGroup &config, const QString &pref
     // No history to restore..
     if (historySize == 0) {
         createHistoryEntry();
+        replacePlaceholderPart();
         return;
     }
 
@@ -1414,6 +1737,19 @@ void KonqView::loadHistoryConfig(const KConfigGroup &config, const QString &pref
 
     // set and load the correct history index
     setHistoryIndex(currentIndex);
+
+    if (restoreOnDemand && !m_pKonqFrame->isVisible()) {
+        // Only show the title and the icon of the current entry, until the
+        // view is shown, see KonqFrame::showEvent()
+        const HistoryEntry *current = currentHistoryEntry();
+        m_bRestorePending = true;
+        setLocationBarURL(current->locationBarURL);
+        setPageSecurity(current->pageSecurity);
+        setCaption(current->title.isEmpty() ? current->locationBarURL : current->title);
+        setTabIcon(current->url);
+        return;
+    }
+
     restoreHistory();
 }
 
@@ -28,16 +28,19 @@
 #include <kmimetype.h>
 
 #include <QtCore/QList>
+#include <QtCore/QMap>
 
 #include <QtCore/QObject>
 #include <QtCore/QStringList>
 #include <QtCore/QPointer>
 #include <QtCore/QEvent>
+#include <QtCore/QSharedDataPointer>
 
 #include <config-konqueror.h>
 
 class KonqRun;
 class KonqFrame;
+class HistoryEntryState;
 class KonqBrowserInterface;
 namespace KParts
 {
@@ -54,22 +57,52 @@ class ResourceInstance;
 
 // TODO: make the history-handling code reuseable (e.g. in kparts) for people who want to use a
 // khtml-based browser in some apps. Back/forward support is all in here currently.
-struct HistoryEntry {
+struct KONQ_TESTS_EXPORT HistoryEntry {
+    HistoryEntry();
+    HistoryEntry(const HistoryEntry &other);
+    ~HistoryEntry();
+    HistoryEntry &operator=(const HistoryEntry &other);
+
     void loadItem(const KConfigGroup &config, const QString &prefix, const KonqFrameBase::Options &options);
     void saveConfig(KConfigGroup &config, const QString &prefix, const KonqFrameBase::Options &options);
 
+    /**
+     * The state saved by the browser extension of the part, and the POST data.
+     * They are shared by the copies of the entry, and accounted for in the
+     * history memory of the process. When it exceeds
+     * KonqSettings::maximumHistoryStateSize(), the states of the least recently
+     * used entries are dropped, and these entries are reloaded when restored.
+     * The POST data is kept. @p compressed tells that @p buffer was
+     * compressed by compressState().
+     */
+    QByteArray buffer() const;
+    QByteArray postData() const;
+    void setState(const QByteArray &buffer, const QByteArray &postData, bool compressed = false);
+
+    /**
+     * Compresses the state, for an entry which isn't the current one anymore.
+     */
+    void compressState();
+
+    /**
+     * Returns true if the state can be restored, false if the entry has to be
+     * reloaded.
+     */
+    bool canRestoreState() const;
+
     QUrl url;
     QString locationBarURL; // can be different from url when showing a index.html
     QString title;
-    QByteArray buffer;
     QString strServiceType;
     QString strServiceName;
-    QByteArray postData;
     QString postContentType;
     bool doPost;
     QString pageReferrer;
     KonqMainWindow::PageSecurity pageSecurity;
     bool reload; // This is used when History entry is restored from a config file
+
+private:
+    QExplicitlySharedDataPointer<HistoryEntryState> m_state;
 };
 
 /* This class represents a child of the main view. The main view maintains
@@ -190,6 +223,7 @@ public:
     void setHistoryIndex(int index)
     {
         m_lstHistoryIndex = index;
+        m_cachedHistoryConfig.clear();
     }
 
     /**
@@ -503,7 +537,56 @@ public:
      * Saves config in a KConfigGroup
      */
     void saveConfig(KConfigGroup &config, const QString &prefix, const KonqFrameBase::Options &options);
-    void loadHistoryConfig(const KConfigGroup &config, const QString &prefix);
+
+    /**
+     * Loads the history saved by saveConfig() and restores its current entry.
+     * @param restoreOnDemand if true and the view is hidden (e.g. in a background
+     * tab), the current entry is only restored when the view is first shown,
+     * see isRestorePending()
+     */
+    void loadHistoryConfig(const KConfigGroup &config, const QString &prefix, bool restoreOnDemand = false);
+
+    /**
+     * Returns true if the current history entry wasn't restored yet: the part
+     * doesn't show it, only the tab title and icon do. url() returns the URL of
+     * that entry. If the view was created with KonqViewFactory::placeholder(),
+     * its part is only created when the entry is restored.
+     */
+    bool isRestorePending() const
+    {
+        return m_bRestorePending;
+    }
+
+    /**
+     * Updates the current history entry if the part's state, e.g. its scroll
+     * position, or its URL or title changed since the entry was updated.
+     * Parts don't tell when they are scrolled, so the session autosave calls
+     * this for the views which can be.
+     */
+    void updateHistoryEntryIfChanged();
+
+    /**
+     * Called when the view becomes the active one.
+     */
+    void setActivated();
+
+    /**
+     * Returns when the view was last activated, or created: the greater, the
+     * more recently. Only meant to compare views.
+     */
+    quint64 lastActivation() const
+    {
+        return m_lastActivation;
+    }
+
+    /**
+     * Replaces the part of this hidden view by a KonqPlaceholderPart, to free
+     * its memory, keeping its history. The view is restored when shown again, as if it had been
+     * loaded with loadHistoryConfig(..., true).
+     * @returns false if the view can't be discarded: it is shown, loading,
+     * passive, linked...
+     */
+    bool discard();
 
     static QStringList childFrameNames(KParts::ReadOnlyPart *part);
 
@@ -539,6 +622,11 @@ public Q_SLOTS:
 
     void setPageSecurity(int);
 
+    /**
+     * Restores the current history entry, if isRestorePending()
+     */
+    void restorePendingHistory();
+
     // connected to the KROP's KIO::Job
     // but also to KonqRun's job
     void slotInfoMessage(KJob *, const QString &msg);
@@ -570,6 +658,12 @@ private:
      */
     void switchView(KonqViewFactory &viewFactory);
 
+    /**
+     * If the view wasn't loaded yet, replaces its KonqPlaceholderPart by a
+     * part of its service. Returns false if that part can't be created.
+     */
+    bool replacePlaceholderPart();
+
     /**
      * Connects the internal part to the main window.
      * Do this after creating it and before inserting it.
@@ -593,6 +687,17 @@ private:
      */
     void updateHistoryEntry(bool saveLocationBarURL);
 
+    /**
+     * Forgets the history saved by saveConfig() and tells the session
+     * manager that the window changed.
+     */
+    void historyChanged();
+
+    /**
+     * Writes the history entries, as saveConfig() does with saveHistoryItems.
+     */
+    void saveHistoryConfig(KConfigGroup &config, const QString &prefix);
+
     void aboutToOpenURL(const QUrl &url, const KParts::OpenUrlArguments &args = KParts::OpenUrlArguments());
 
     void setPartMimeType();
@@ -618,6 +723,14 @@ private:
      * The current position in the history
      */
     int m_lstHistoryIndex;
+    /**
+     * The history entries written by the last saveConfig() with
+     * saveCachedHistory, and the prefix of their keys. Empty when the
+     * history changed since.
+     */
+    QMap<QString, QByteArray> m_cachedHistoryConfig;
+    QString m_cachedHistoryPrefix;
+    quint64 m_lastActivation;
 
     /**
      * The post data that _resulted_ in this page.
@@ -652,6 +765,7 @@ private:
     uint m_bURLDropHandling: 1;
     uint m_bDisableScrolling: 1;
     uint m_bErrorURL: 1;
+    uint m_bRestorePending: 1;
     KService::List m_partServiceOffers;
     KService::List m_appServiceOffers;
     KService::Ptr m_service;
@@ -48,8 +48,11 @@
 #include <QApplication>
 #include <QDesktopWidget>
 #include <QStandardPaths>
+#include <QTimer>
 #include <KSharedConfig>
 
+#include <algorithm>
+
 //#define DEBUG_VIEWMGR
 
 KonqViewManager::KonqViewManager(KonqMainWindow *mainWindow)
@@ -58,6 +61,7 @@ KonqViewManager::KonqViewManager(KonqMainWindow *mainWindow)
     m_pMainWindow = mainWindow;
 
     m_bLoadingProfile = false;
+    m_bRestoreOnDemand = false;
     m_tabContainer = 0;
 
     setIgnoreExplictFocusRequests(true);
@@ -373,7 +377,10 @@ KonqMainWindow *KonqViewManager::openSavedWindow(const KConfigGroup &configGroup
         // Window size comes from the applyMainWindowSettings call below
     }
 
-    mainWindow->viewManager()->loadRootItem(configGroup, mainWindow, QUrl(), true, QUrl());
+    KonqViewManager *viewManager = mainWindow->viewManager();
+    viewManager->m_bRestoreOnDemand = KonqSettings::restoreTabsOnDemand();
+    viewManager->loadRootItem(configGroup, mainWindow, QUrl(), true, QUrl());
+    viewManager->m_bRestoreOnDemand = false;
     mainWindow->applyMainWindowSettings(configGroup);
     mainWindow->activateChild();
 
@@ -389,7 +396,9 @@ KonqMainWindow *KonqViewManager::openSavedWindow(const KConfigGroup &configGroup
     if (!openTabsInsideCurrentWindow) {
         return KonqViewManager::openSavedWindow(configGroup);
     } else {
+        m_bRestoreOnDemand = KonqSettings::restoreTabsOnDemand();
         loadRootItem(configGroup, tabContainer(), QUrl(), true, QUrl());
+        m_bRestoreOnDemand = false;
 #ifndef NDEBUG
         printFullHierarchy();
 #endif
@@ -702,6 +711,49 @@ void KonqViewManager::viewCountChanged()
         sb->showActiveViewIndicator(bShowActiveViewIndicator && !it.value()->isPassiveMode());
         sb->showLinkedViewIndicator(bShowLinkedViewIndicator && !it.value()->isFollowActive());
     }
+
+    // Once the tab operation is done
+    QTimer::singleShot(0, &KonqViewManager::discardTabsOverBudget);
+}
+
+static bool lessRecentlyActivated(const KonqView *view1, const KonqView *view2)
+{
+    return view1->lastActivation() < view2->lastActivation();
+}
+
+void KonqViewManager::discardTabsOverBudget()
+{
+    const int maxLoadedTabs = KonqSettings::maxLoadedTabs();
+    QList<KonqMainWindow *> *mainWindows = KonqMainWindow::mainWindowList();
+    if (maxLoadedTabs <= 0 || !mainWindows) {
+        return;
+    }
+
+    int loadedCount = 0;
+    QList<KonqView *> candidates;
+    foreach (KonqMainWindow *window, *mainWindows) {
+        foreach (KonqView *view, window->viewMap()) {
+            if (!view->isRestorePending()) {
+                ++loadedCount;
+                if (view != window->currentView()) {
+                    candidates.append(view);
+                }
+            }
+        }
+    }
+    if (loadedCount <= maxLoadedTabs) {
+        return;
+    }
+
+    std::sort(candidates.begin(), candidates.end(), lessRecentlyActivated);
+    foreach (KonqView *view, candidates) {
+        if (loadedCount <= maxLoadedTabs) {
+            break;
+        }
+        if (view->discard()) {
+            --loadedCount;
+        }
+    }
 }
 
 void KonqViewManager::clear()
@@ -1022,6 +1074,8 @@ void KonqViewManager::slotActivePartChanged(KParts::Part *newPart)
     if (view->frame()->parentContainer() == 0L) {
         return;
     }
+    view->setActivated();
+    QTimer::singleShot(0, &KonqViewManager::discardTabsOverBudget);
     if (!m_bLoadingProfile)  {
         view->frame()->statusbar()->updateActiveStatus();
         view->frame()->parentContainer()->setActiveChild(view->frame());
@@ -1150,6 +1204,13 @@ void KonqViewManager::loadItem(const KConfigGroup &cfg, KonqFrameContainerBase *
         if (parent == m_pMainWindow) {
             parent = tabContainer();
         }
+        const QString keyHistoryItems = QStringLiteral("NumberOfHistoryItems").prepend(prefix);
+        const bool restoreOnDemand = m_bRestoreOnDemand && openUrl && !passiveMode && cfg.hasKey(keyHistoryItems);
+        if (restoreOnDemand) {
+            // The part of the service is only created when the view is shown,
+            // see KonqView::loadHistoryConfig()
+            viewFactory = KonqViewFactory::placeholder();
+        }
         KonqView *childView = setupView(parent, viewFactory, service, partServiceOffers, appServiceOffers, serviceType, passiveMode, openAfterCurrentPage, pos);
 
         if (!childView->isFollowActive()) {
@@ -1167,9 +1228,8 @@ void KonqViewManager::loadItem(const KConfigGroup &cfg, KonqFrameContainerBase *
         }
 
         if (openUrl) {
-            const QString keyHistoryItems = QStringLiteral("NumberOfHistoryItems").prepend(prefix);
             if (cfg.hasKey(keyHistoryItems)) {
-                childView->loadHistoryConfig(cfg, prefix);
+                childView->loadHistoryConfig(cfg, prefix, restoreOnDemand);
                 m_pMainWindow->updateHistoryActions();
             } else {
                 // determine URL
@@ -275,6 +275,13 @@ public:
      */
     static KonqMainWindow *openSavedWindow(const KConfigGroup &configGroup);
 
+    /**
+     * If more views than KonqSettings::maxLoadedTabs() have a loaded part,
+     * in all the windows, discards the parts of the least recently activated
+     * hidden views, see KonqView::discard().
+     */
+    static void discardTabsOverBudget();
+
 public Q_SLOTS:
     /**
      * Opens a previously closed window in a new window
@@ -360,6 +367,9 @@ private:
     KonqFrameTabs *m_tabContainer;
 
     bool m_bLoadingProfile;
+    // Whether the hidden views of the saved windows being opened are only
+    // restored when shown, see KonqView::loadHistoryConfig()
+    bool m_bRestoreOnDemand;
 
     QMap<QString /*display name*/, QString /*path to file*/> m_mapProfileNames;
 };
@@ -19,6 +19,8 @@
 
 #include "ksortfilterproxymodel.h"
 
+#include <QHash>
+
 /**
  * Private class that helps to provide binary compatibility between releases.
  * @internal
@@ -30,10 +32,61 @@ public:
     KSortFilterProxyModelPrivate()
     {
         showAllChildren = false;
+        cachesFilterResults = false;
+        filterRole = -1;
+        filterKeyColumn = -1;
     }
     ~KSortFilterProxyModelPrivate() {}
 
+    /**
+     * Forgets the results of another filter. They are kept for refining
+     * when @p regExp only narrows the previous fixed string down.
+     */
+    void updateFilter(const QRegExp &regExp, int role, int column)
+    {
+        if (regExp == filterRegExp && role == filterRole && column == filterKeyColumn) {
+            return;
+        }
+        const bool refines = role == filterRole && column == filterKeyColumn
+                             && regExp.patternSyntax() == QRegExp::FixedString
+                             && filterRegExp.patternSyntax() == QRegExp::FixedString
+                             && regExp.caseSensitivity() == filterRegExp.caseSensitivity()
+                             && !filterRegExp.isEmpty()
+                             && regExp.pattern().contains(filterRegExp.pattern(), regExp.caseSensitivity());
+        if (refines) {
+            // what didn't match before doesn't match now, and
+            // previousRowMatches might know of rows rowMatches doesn't
+            for (QHash<QModelIndex, bool>::const_iterator it = rowMatches.constBegin(); it != rowMatches.constEnd(); ++it) {
+                previousRowMatches.insert(it.key(), it.value());
+            }
+        } else {
+            previousRowMatches.clear();
+        }
+        rowMatches.clear();
+        childMatches.clear();
+        filterRegExp = regExp;
+        filterRole = role;
+        filterKeyColumn = column;
+    }
+
+    void clear()
+    {
+        rowMatches.clear();
+        previousRowMatches.clear();
+        childMatches.clear();
+    }
+
     bool showAllChildren;
+    bool cachesFilterResults;
+
+    // the filter the results are for
+    QRegExp filterRegExp;
+    int filterRole;
+    int filterKeyColumn;
+    // by the first column of the source rows
+    QHash<QModelIndex, bool> rowMatches;
+    QHash<QModelIndex, bool> previousRowMatches;
+    QHash<QModelIndex, bool> childMatches;
 };
 
 KSortFilterProxyModel::KSortFilterProxyModel(QObject *parent)
@@ -52,16 +105,18 @@ bool KSortFilterProxyModel::filterAcceptsRow(int source_row, const QModelIndex &
         return true;    //Shortcut for common case
     }
 
-    if (QSortFilterProxyModel::filterAcceptsRow(source_row, source_parent)) {
+    if (d_ptr->cachesFilterResults) {
+        d_ptr->updateFilter(filterRegExp(), filterRole(), filterKeyColumn());
+    }
+
+    if (rowMatches(source_row, source_parent)) {
         return true;
     }
 
     //one of our children might be accepted, so accept this row if one of our children are accepted.
     QModelIndex source_index = sourceModel()->index(source_row, 0, source_parent);
-    for (int i = 0; i < sourceModel()->rowCount(source_index); i++) {
-        if (filterAcceptsRow(i, source_index)) {
-            return true;
-        }
+    if (childMatches(source_index)) {
+        return true;
     }
 
     //one of our parents might be accepted, so accept this row if one of our parents is accepted.
@@ -70,7 +125,7 @@ bool KSortFilterProxyModel::filterAcceptsRow(int source_row, const QModelIndex &
         while (parent_index.isValid()) {
             int row = parent_index.row();
             parent_index = parent_index.parent();
-            if (QSortFilterProxyModel::filterAcceptsRow(row, parent_index)) {
+            if (rowMatches(row, parent_index)) {
                 return true;
             }
         }
@@ -79,6 +134,48 @@ bool KSortFilterProxyModel::filterAcceptsRow(int source_row, const QModelIndex &
     return false;
 }
 
+bool KSortFilterProxyModel::rowMatches(int source_row, const QModelIndex &source_parent) const
+{
+    if (!d_ptr->cachesFilterResults) {
+        return QSortFilterProxyModel::filterAcceptsRow(source_row, source_parent);
+    }
+
+    const QModelIndex source_index = sourceModel()->index(source_row, 0, source_parent);
+    QHash<QModelIndex, bool>::const_iterator it = d_ptr->rowMatches.constFind(source_index);
+    if (it != d_ptr->rowMatches.constEnd()) {
+        return it.value();
+    }
+
+    it = d_ptr->previousRowMatches.constFind(source_index);
+    const bool matches = (it == d_ptr->previousRowMatches.constEnd() || it.value())
+                         && QSortFilterProxyModel::filterAcceptsRow(source_row, source_parent);
+    d_ptr->rowMatches.insert(source_index, matches);
+    return matches;
+}
+
+bool KSortFilterProxyModel::childMatches(const QModelIndex &source_index) const
+{
+    if (d_ptr->cachesFilterResults) {
+        QHash<QModelIndex, bool>::const_iterator it = d_ptr->childMatches.constFind(source_index);
+        if (it != d_ptr->childMatches.constEnd()) {
+            return it.value();
+        }
+    }
+
+    bool matches = false;
+    for (int i = 0; i < sourceModel()->rowCount(source_index); i++) {
+        if (rowMatches(i, source_index) || childMatches(sourceModel()->index(i, 0, source_index))) {
+            matches = true;
+            break;
+        }
+    }
+
+    if (d_ptr->cachesFilterResults) {
+        d_ptr->childMatches.insert(source_index, matches);
+    }
+    return matches;
+}
+
 bool KSortFilterProxyModel::showAllChildren() const
 {
     return d_ptr->showAllChildren;
@@ -92,3 +189,41 @@ void KSortFilterProxyModel::setShowAllChildren(bool showAllChildren)
     invalidateFilter();
 }
 
+bool KSortFilterProxyModel::cachesFilterResults() const
+{
+    return d_ptr->cachesFilterResults;
+}
+
+void KSortFilterProxyModel::setCachesFilterResults(bool cachesFilterResults)
+{
+    if (cachesFilterResults == d_ptr->cachesFilterResults) {
+        return;
+    }
+    d_ptr->cachesFilterResults = cachesFilterResults;
+    d_ptr->clear();
+}
+
+void KSortFilterProxyModel::setSourceModel(QAbstractItemModel *model)
+{
+    if (sourceModel()) {
+        disconnect(sourceModel(), Q_NULLPTR, this, SLOT(clearFilterResults()));
+    }
+    d_ptr->clear();
+
+    // before QSortFilterProxyModel, which filters the changed rows again
+    if (model) {
+        connect(model, SIGNAL(rowsInserted(QModelIndex,int,int)), this, SLOT(clearFilterResults()));
+        connect(model, SIGNAL(rowsRemoved(QModelIndex,int,int)), this, SLOT(clearFilterResults()));
+        connect(model, SIGNAL(rowsMoved(QModelIndex,int,int,QModelIndex,int)), this, SLOT(clearFilterResults()));
+        connect(model, SIGNAL(dataChanged(QModelIndex,QModelIndex,QVector<int>)), this, SLOT(clearFilterResults()));
+        connect(model, SIGNAL(layoutChanged(QList<QPersistentModelIndex>,QAbstractItemModel::LayoutChangeHint)),
+                this, SLOT(clearFilterResults()));
+        connect(model, SIGNAL(modelReset()), this, SLOT(clearFilterResults()));
+    }
+    QSortFilterProxyModel::setSourceModel(model);
+}
+
+void KSortFilterProxyModel::clearFilterResults()
+{
+    d_ptr->clear();
+}
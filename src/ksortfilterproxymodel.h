@@ -22,19 +22,22 @@
 
 #include <QSortFilterProxyModel>
 
+#include "konqprivate_export.h"
+
 /**
  * @class KSortFilterProxyModel
  *
  * This class extends QSortFilterProxyModel to allow filtering for a matching child
  * in a tree.
  * It can also show all the children of a matching parent, if setShowAllChildren is set.
+ * With setCachesFilterResults, every row is matched once per filter string.
  *
  * @author John Tapsell <tapsell@kde.org>
  * @since 4.4
  */
 class KSortFilterProxyModelPrivate;
 
-class KSortFilterProxyModel
+class KONQUERORPRIVATE_EXPORT KSortFilterProxyModel
     : public QSortFilterProxyModel
 {
     Q_OBJECT
@@ -51,11 +54,32 @@ public:
      *  This is false by default. */
     void setShowAllChildren(bool showAllChildren);
 
+    /*! Whether the filter results of the rows are remembered until the
+     *  filter or the source model change.
+     *  This is false by default. */
+    bool cachesFilterResults() const;
+    /*! Set whether to remember the filter results of the rows, so that a
+     *  row is matched once per filter, and not again for each of its
+     *  parents. When a fixed string filter is extended, only the rows which
+     *  matched the previous one are matched again.
+     *  This is false by default. */
+    void setCachesFilterResults(bool cachesFilterResults);
+
+    /*! \reimp */
+    void setSourceModel(QAbstractItemModel *sourceModel) Q_DECL_OVERRIDE;
+
 protected:
     /*! \reimp */
     bool filterAcceptsRow(int source_row, const QModelIndex &source_parent) const Q_DECL_OVERRIDE;
     KSortFilterProxyModelPrivate *const d_ptr;
 
+private Q_SLOTS:
+    void clearFilterResults();
+
+private:
+    bool rowMatches(int source_row, const QModelIndex &source_parent) const;
+    bool childMatches(const QModelIndex &source_index) const;
+
     Q_DISABLE_COPY(KSortFilterProxyModel)
 };
 #endif
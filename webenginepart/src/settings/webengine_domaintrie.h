@@ -0,0 +1,178 @@
+/* This file is part of the KDE project
+
+   Copyright (C) 2016 The Konqueror developers
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Library General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library; see the file COPYING.LIB.  If not, write to
+   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+*/
+
+#ifndef WEBENGINE_DOMAINTRIE_H
+#define WEBENGINE_DOMAINTRIE_H
+
+#include <QString>
+#include <QStringRef>
+#include <QVector>
+
+#include <algorithm>
+
+namespace KDEPrivate
+{
+
+// Settings by domain, as the per-domain JavaScript, Java and plugin policies.
+// A domain is either a host name, e.g. kde.org, which applies to that host
+// only, or starts with a dot, e.g. .kde.org, and applies to all the hosts
+// below it.
+//
+// Domains are kept in a trie of their labels, top-level domain first, so the
+// value of a host is found in one walk over its labels, without allocating.
+// Domains are expected in lower case.
+//
+// References to values are valid until the next insertion.
+template<typename T>
+class DomainTrie
+{
+public:
+    DomainTrie()
+    {
+        clear();
+    }
+
+    // The value of domain, inserted as a copy of value if there is none
+    T &insert(const QString &domain, const T &value)
+    {
+        int exact;
+        const int node = addNode(domain, &exact);
+        int &index = exact ? m_nodes[node].exact : m_nodes[node].subdomains;
+        if (index == -1) {
+            index = m_values.size();
+            m_values.append(value);
+        }
+        return m_values[index];
+    }
+
+    T &operator[](const QString &domain)
+    {
+        return insert(domain, T());
+    }
+
+    // The value for host: the one of host itself, else the one of the
+    // closest domain above it, or 0
+    const T *lookup(const QString &host) const
+    {
+        int node = 0;
+        int found = -1;
+        int end = host.length();
+        while (end >= 0) {
+            const int dot = end > 0 ? host.lastIndexOf(QLatin1Char('.'), end - 1) : -1;
+            const int child = findChild(node, QStringRef(&host, dot + 1, end - dot - 1));
+            if (child == -1)
+                break;
+            node = child;
+            if (dot == -1) {
+                // all of host
+                if (m_nodes.at(node).exact != -1)
+                    found = m_nodes.at(node).exact;
+                break;
+            }
+            if (m_nodes.at(node).subdomains != -1)
+                found = m_nodes.at(node).subdomains;
+            end = dot;
+        }
+        return found == -1 ? 0 : &m_values.at(found);
+    }
+
+    bool isEmpty() const
+    {
+        return m_values.isEmpty();
+    }
+
+    int size() const
+    {
+        return m_values.size();
+    }
+
+    void clear()
+    {
+        m_nodes.clear();
+        m_nodes.append(Node());
+        m_values.clear();
+    }
+
+private:
+    struct Node {
+        Node()
+            : exact(-1), subdomains(-1)
+        {
+        }
+
+        QString label;
+        QVector<int> children;  // sorted by label
+        int exact;              // indexes in m_values, or -1
+        int subdomains;
+    };
+
+    int findChild(int node, const QStringRef &label) const
+    {
+        const QVector<int> &children = m_nodes.at(node).children;
+        QVector<int>::const_iterator it = std::lower_bound(children.constBegin(), children.constEnd(), label,
+                                                           [this](int child, const QStringRef &key) {
+            return key.compare(m_nodes.at(child).label) > 0;
+        });
+        if (it != children.constEnd() && label == m_nodes.at(*it).label)
+            return *it;
+        return -1;
+    }
+
+    // The node of domain, without its leading dot, added if needed
+    int addNode(const QString &domain, int *exact)
+    {
+        *exact = !domain.startsWith(QLatin1Char('.'));
+        const int start = *exact ? 0 : 1;
+        int node = 0;
+        int end = domain.length();
+        while (end >= start) {
+            const int dot = end > start ? domain.lastIndexOf(QLatin1Char('.'), end - 1) : start - 1;
+            const int labelStart = qMax(dot, start - 1) + 1;
+            const QStringRef label(&domain, labelStart, end - labelStart);
+            int child = findChild(node, label);
+            if (child == -1) {
+                child = m_nodes.size();
+                Node newNode;
+                newNode.label = label.toString();
+                m_nodes.append(newNode);
+                QVector<int> &children = m_nodes[node].children;
+                QVector<int>::iterator it = std::lower_bound(children.begin(), children.end(), label,
+                                                             [this](int c, const QStringRef &key) {
+                    return key.compare(m_nodes.at(c).label) > 0;
+                });
+                children.insert(it, child);
+            }
+            node = child;
+            if (dot < start)
+                break;
+            end = dot;
+        }
+        return node;
+    }
+
+    QVector<Node> m_nodes;      // the root first
+    QVector<T> m_values;
+};
+
+}
+
+#endif // WEBENGINE_DOMAINTRIE_H
+
+// kate: indent-width 4; replace-tabs on; tab-width 4; space-indent on;
@@ -22,323 +22,1446 @@
 
 #include "webengine_filter.h"
 
+#include <QCryptographicHash>
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
 #include <QHash>
-#include <QBitArray>
-
-// rolling hash parameters
-#define HASH_P (1997)
-#define HASH_Q (17509)
-// HASH_MOD = (HASH_P^7) % HASH_Q
-#define HASH_MOD (523)
+#include <QMap>
+#include <QRegExp>
+#include <QSaveFile>
+#include <QScopedPointer>
+#include <QSet>
+#include <QSharedPointer>
+#include <QTextStream>
+#include <QVector>
+#include <QReadLocker>
+#include <QWriteLocker>
 
+#include <algorithm>
+#include <cstring>
 
 using namespace KDEPrivate;
 
-// Updateable Multi-String Matcher based on Rabin-Karp's algorithm
-class StringsMatcher {
+enum {
+    ResourceTypeCount = 10,
+    // one for the rules of all types, and one per type
+    AutomatonCount = ResourceTypeCount + 1
+};
+
+// Compiled filters are kept in a flat binary layout, so that they can be
+// used in place from a cache file mapped in memory. A blob starts with a
+// table of sections, each an array of one of the records below.
+enum Section {
+    RulesSection,               // RuleRecord
+    DomainsSection,             // DomainRecord
+    StringsSection,             // ushort, the UTF-16 text of everything
+    HostsSection,               // HostRecord, sorted by host
+    HostRulesSection,           // quint32, rules indexed by host
+    UnindexedRulesSection,      // quint32
+    RegExpsSection,             // RegExpRecord
+    HidingRulesSection,         // HidingRecord
+    HidingHostsSection,         // HostRecord, sorted by host
+    HidingHostRulesSection,     // quint32, hiding rules indexed by host
+    GenericHidingRulesSection,  // quint32
+    // then for each automaton: nodes, edge chars, edge targets, occurrences, root table
+    AutomatonSections,
+    SectionCount = AutomatonSections + AutomatonCount * 5
+};
+
+struct SectionRecord {
+    quint32 count;
+    quint32 offset;
+};
+
+struct BlobHeader {
+    quint32 sectionCount;
+    SectionRecord sections[SectionCount];
+};
+
+struct RuleRecord {
+    enum Flag {
+        StartAnchor = 0x1,  // |pattern
+        EndAnchor = 0x2,    // pattern|
+        HostAnchor = 0x4,   // ||pattern
+        MatchCase = 0x8,
+        ThirdParty = 0x10,
+        FirstParty = 0x20
+    };
+
+    quint32 text;           // offsets and lengths in the strings
+    quint32 textLength;
+    quint32 pattern;        // lower case unless MatchCase, with * and ^
+    quint32 patternLength;
+    quint32 firstDomain;    // $domain= option
+    quint32 domainCount;
+    qint32 regExp;          // index in the regexps, or -1
+    quint32 types;
+    quint32 flags;
+};
+
+struct DomainRecord {
+    quint32 name;
+    quint32 nameLength;
+    quint32 exclude;
+};
+
+struct HostRecord {
+    quint32 name;
+    quint32 nameLength;
+    quint32 first;          // in the matching host rules section
+    quint32 count;
+};
+
+struct RegExpRecord {
+    quint32 pattern;
+    quint32 patternLength;
+    quint32 caseSensitive;
+};
+
+// A ##selector or #@#selector filter
+struct HidingRecord {
+    quint32 selector;
+    quint32 selectorLength;
+    quint32 firstDomain;
+    quint32 domainCount;
+    quint32 exception;
+};
+
+struct AutomatonNode {
+    qint32 firstEdge;       // children, in edge chars/targets, sorted by char
+    qint32 edgeCount;
+    qint32 fail;            // longest proper suffix which is in the trie
+    qint32 dictLink;        // longest proper suffix with occurrences, or -1
+    qint32 firstOccurrence;
+    qint32 occurrenceCount;
+    qint32 depth;           // fail and dictionary links go to lower depths
+};
+
+// The cache of a filter list holds its black and white lists
+struct CacheHeader {
+    char magic[4];
+    quint32 version;
+    quint32 byteOrder;
+    quint32 headerSize;
+    char checksum[16];      // MD5 of the list file
+    quint32 blackOffset;
+    quint32 blackSize;
+    quint32 whiteOffset;
+    quint32 whiteSize;
+};
+
+static const char s_cacheMagic[4] = { 'K', 'W', 'F', 'C' };
+static const quint32 s_cacheVersion = 1;
+static const quint32 s_byteOrderMark = 0x01020304;
+
+static inline int compareStrings(const QChar *a, int aLength, const QChar *b, int bLength)
+{
+    const int length = qMin(aLength, bLength);
+    for (int i = 0; i < length; ++i) {
+        if (a[i] != b[i])
+            return a[i].unicode() < b[i].unicode() ? -1 : 1;
+    }
+    return aLength - bLength;
+}
+
+// Separators are anything but a letter, a digit, or one of _ - . %
+static inline bool isSeparator(QChar c)
+{
+    return !(c.isLetterOrNumber() || c == QLatin1Char('_') || c == QLatin1Char('-')
+             || c == QLatin1Char('.') || c == QLatin1Char('%'));
+}
+
+static inline bool isHostEnd(QChar c)
+{
+    return c == QLatin1Char('^') || c == QLatin1Char('/') || c == QLatin1Char('*')
+        || c == QLatin1Char(':') || c == QLatin1Char('?');
+}
+
+// Whether pattern matches str from pos on, up to the end of str if endAnchor.
+// * matches any sequence of characters, ^ a separator or the end of str.
+static bool matchAt(const QString &str, int pos, const QChar *p, int patternLength, bool endAnchor)
+{
+    const QChar *s = str.unicode();
+    const int len = str.length();
+
+    int i = pos;
+    int j = 0;
+    int starPattern = -1;
+    int starString = 0;
+    for (;;) {
+        if (j == patternLength) {
+            if (!endAnchor || i == len)
+                return true;
+        } else if (p[j] == QLatin1Char('*')) {
+            starPattern = ++j;
+            starString = i;
+            continue;
+        } else if (p[j] == QLatin1Char('^')) {
+            if (i == len) {
+                ++j;
+                continue;
+            }
+            if (isSeparator(s[i])) {
+                ++i;
+                ++j;
+                continue;
+            }
+        } else if (i < len && p[j] == s[i]) {
+            ++i;
+            ++j;
+            continue;
+        }
+
+        // Let the last * match one more character
+        if (starPattern == -1 || starString >= len)
+            return false;
+        j = starPattern;
+        i = ++starString;
+    }
+}
+
+static inline bool isDomainOrSubdomain(const QString &host, const QChar *domain, int domainLength)
+{
+    const int start = host.length() - domainLength;
+    return start >= 0
+        && compareStrings(host.unicode() + start, domainLength, domain, domainLength) == 0
+        && (start == 0 || host.at(start - 1) == QLatin1Char('.'));
+}
+
+// $domain= and element hiding domains
+static bool appliesToHost(const QString &host, const QChar *strings, const DomainRecord *domains, int domainCount)
+{
+    bool hasIncludes = false;
+    bool included = false;
+    for (int i = 0; i < domainCount; ++i) {
+        const DomainRecord &domain = domains[i];
+        const bool matches = isDomainOrSubdomain(host, strings + domain.name, domain.nameLength);
+        if (domain.exclude) {
+            if (matches)
+                return false;
+        } else {
+            hasIncludes = true;
+            included = included || matches;
+        }
+    }
+    return !hasIncludes || included;
+}
+
+// a.com|~b.com, or a.com,~b.com for element hiding rules
+static void parseDomains(const QString &domains, QChar separator, QStringList &includeDomains, QStringList &excludeDomains)
+{
+    foreach (const QString &domain, domains.toLower().split(separator, QString::SkipEmptyParts)) {
+        if (domain.startsWith(QLatin1Char('~')))
+            excludeDomains.append(domain.mid(1));
+        else
+            includeDomains.append(domain);
+    }
+}
+
+// The domain a host was registered as, e.g. kde.org for www.kde.org
+static QString registrableDomain(const QUrl &url)
+{
+    const QString host = url.host();
+    const QString tld = url.topLevelDomain();
+    if (tld.isEmpty() || tld.length() >= host.length())
+        return host;
+    const QString name = host.left(host.length() - tld.length());
+    return name.mid(name.lastIndexOf(QLatin1Char('.')) + 1) + tld;
+}
+
+static int resourceType(const QString &option)
+{
+    if (option == QLatin1String("script"))
+        return FilterRequest::Script;
+    if (option == QLatin1String("image"))
+        return FilterRequest::Image;
+    if (option == QLatin1String("stylesheet"))
+        return FilterRequest::Stylesheet;
+    if (option == QLatin1String("object") || option == QLatin1String("object-subrequest"))
+        return FilterRequest::Object;
+    if (option == QLatin1String("xmlhttprequest"))
+        return FilterRequest::XmlHttpRequest;
+    if (option == QLatin1String("subdocument"))
+        return FilterRequest::SubDocument;
+    if (option == QLatin1String("media"))
+        return FilterRequest::Media;
+    if (option == QLatin1String("font"))
+        return FilterRequest::Font;
+    if (option == QLatin1String("ping"))
+        return FilterRequest::Ping;
+    if (option == QLatin1String("other"))
+        return FilterRequest::Other;
+    return 0;
+}
+
+// Options look like $opt1,~opt2,opt3=value
+static bool isOptionList(const QString &options)
+{
+    if (options.isEmpty())
+        return false;
+    foreach (const QString &option, options.split(QLatin1Char(','))) {
+        int k = option.startsWith(QLatin1Char('~')) ? 1 : 0;
+        const int start = k;
+        for (; k < option.length() && option.at(k) != QLatin1Char('='); ++k) {
+            const QChar c = option.at(k);
+            if (!(c.isLetterOrNumber() || c == QLatin1Char('-') || c == QLatin1Char('_')))
+                return false;
+        }
+        if (k == start)
+            return false;
+    }
+    return true;
+}
+
+// The longest part of pattern without wildcards
+static QString keyword(const QString &pattern)
+{
+    QString best;
+    int start = 0;
+    for (int k = 0; k <= pattern.length(); ++k) {
+        if (k == pattern.length() || pattern.at(k) == QLatin1Char('*') || pattern.at(k) == QLatin1Char('^')) {
+            if (k - start > best.length())
+                best = pattern.mid(start, k - start);
+            start = k + 1;
+        }
+    }
+    return best;
+}
+
+// Collects the parsed filters, and compiles them into a blob
+class FilterSetBuilder {
 public:
-    // add filter to matching set
-    void addString(const QString& pattern)
+    void addFilter(const QString& filter);
+
+    bool isEmpty() const
     {
-        if (pattern.length() < 8) {
-            // handle short string differently
-            shortStringFilters.append(pattern);
-        } else {
-            // use modified Rabin-Karp's algorithm with 8-length string hash
-            // i.e. store hash of first 8 chars in the HashMap for fast look-up
-            stringFilters.append(pattern);
-            int ind = stringFilters.size() - 1;
-            int current = 0;
-
-            // compute hash using rolling hash
-            // hash for string: x0,x1,x2...xn-1 will be:
-            // (p^(n-1)*x0 + p^(n-2)*x1 + ... + p * xn-2 + xn-1) % q
-            // where p and q some wisely-chosen integers
-            /*for (int k = 0; k < 8; ++k)*/
-            int len = pattern.length();
-            for (int k = len - 8; k < len; ++k)
-                current = (current * HASH_P + pattern[k].unicode()) % HASH_Q;
-
-            // insert computed hash value into HashMap
-            QHash<int, QVector<int> >::iterator it = stringFiltersHash.find(current + 1);
-            if (it == stringFiltersHash.end()) {
-                QVector<int> list;
-                list.append(ind);
-                stringFiltersHash.insert(current + 1, list);
-                fastLookUp.setBit(current);
-            } else {
-                it->append(ind);
-            }
+        return rules.isEmpty() && hidingRules.isEmpty();
+    }
+
+    QByteArray compile() const;
+
+private:
+    struct Rule {
+        QString text;
+        QString pattern;
+        QStringList includeDomains;
+        QStringList excludeDomains;
+        int regExp;
+        int types;
+        int flags;
+    };
+
+    struct HidingRule {
+        QString selector;
+        QStringList includeDomains;
+        QStringList excludeDomains;
+        bool exception;
+    };
+
+    static bool parseOptions(const QString &options, Rule &rule);
+
+    QVector<Rule> rules;
+    QVector<QPair<QString, bool> > regExps; // pattern, case sensitive
+    QVector<HidingRule> hidingRules;
+};
+
+// Returns false for the options we can't honour, which disable the filter
+bool FilterSetBuilder::parseOptions(const QString &options, Rule &rule)
+{
+    int includeTypes = 0;
+    int excludeTypes = 0;
+    foreach (const QString &option, options.split(QLatin1Char(','))) {
+        const bool inverse = option.startsWith(QLatin1Char('~'));
+        const QString name = (inverse ? option.mid(1) : option).toLower();
+        const int type = resourceType(name);
+        if (type != 0) {
+            if (inverse)
+                excludeTypes |= type;
+            else
+                includeTypes |= type;
+        } else if (name == QLatin1String("third-party")) {
+            rule.flags |= inverse ? RuleRecord::FirstParty : RuleRecord::ThirdParty;
+        } else if (name.startsWith(QLatin1String("domain=")) && !inverse) {
+            parseDomains(option.mid(7), QLatin1Char('|'), rule.includeDomains, rule.excludeDomains);
+        } else if (name == QLatin1String("match-case") && !inverse) {
+            rule.flags |= RuleRecord::MatchCase;
+        } else if (name != QLatin1String("collapse")) {
+            // popup, document, elemhide, sitekey... apply to what we don't see here
+            return false;
         }
     }
+    rule.types = (includeTypes != 0 ? includeTypes : int(FilterRequest::AllTypes)) & ~excludeTypes;
+    return rule.types != 0;
+}
+
+void FilterSetBuilder::addFilter(const QString& filterStr)
+{
+    QString filter = filterStr.trimmed();
+
+    /** ignore empty lines, comments and the [Adblock Plus 2.0] header */
+    if (filter.isEmpty() || filter.startsWith(QLatin1Char('!'))
+        || (filter.startsWith(QLatin1Char('[')) && filter.endsWith(QLatin1Char(']'))))
+        return;
+
+    // Element hiding rules: domains##selector and domains#@#selector
+    int hidingPos = filter.indexOf(QLatin1String("##"));
+    const int exceptionPos = filter.indexOf(QLatin1String("#@#"));
+    if (hidingPos != -1 || exceptionPos != -1) {
+        HidingRule rule;
+        rule.exception = hidingPos == -1 || (exceptionPos != -1 && exceptionPos < hidingPos);
+        if (rule.exception)
+            hidingPos = exceptionPos;
+        rule.selector = filter.mid(hidingPos + (rule.exception ? 3 : 2)).trimmed();
+        parseDomains(filter.left(hidingPos), QLatin1Char(','), rule.includeDomains, rule.excludeDomains);
+        if (!rule.selector.isEmpty())
+            hidingRules.append(rule);
+        return;
+    }
+
+    // #?# and #$# are extended element hiding and snippets
+    if (filter.contains(QLatin1String("#?#")) || filter.contains(QLatin1String("#$#")))
+        return;
+
+    // Strip leading @@
+    if (filter.startsWith(QLatin1String("@@")))
+        filter.remove(0, 2);
+
+    Rule rule;
+    rule.text = filter;
+    rule.regExp = -1;
+    rule.types = FilterRequest::AllTypes;
+    rule.flags = 0;
+
+    const int dollar = filter.lastIndexOf(QLatin1Char('$'));
+    if (dollar != -1 && isOptionList(filter.mid(dollar + 1))) {
+        if (!parseOptions(filter.mid(dollar + 1), rule))
+            return;
+        filter.truncate(dollar);
+    }
 
+    // Perhaps nothing left?
+    if (filter.isEmpty())
+        return;
 
-    // check if string match at least one string from matching set
-    bool isMatched(const QString& str, QString *by = 0) const
+    // Is it a regexp filter?
+    if (filter.length()>2 && filter.startsWith(QLatin1Char('/')) && filter.endsWith(QLatin1Char('/')))
     {
-        // check short strings first
-        for (int i = 0; i < shortStringFilters.size(); ++i) {
-            if (str.contains(shortStringFilters[i]))
-            {
-                if (by != 0) *by = shortStringFilters[i];
-                return true;
+        const QString inside = filter.mid(1, filter.length()-2);
+        const bool caseSensitive = rule.flags & RuleRecord::MatchCase;
+        if (!QRegExp(inside, caseSensitive ? Qt::CaseSensitive : Qt::CaseInsensitive).isValid())
+            return;
+        rule.regExp = regExps.size();
+        regExps.append(qMakePair(inside, caseSensitive));
+        rules.append(rule);
+        return;
+    }
+
+    if (filter.startsWith(QLatin1String("||"))) {
+        rule.flags |= RuleRecord::HostAnchor;
+        filter.remove(0, 2);
+    } else if (filter.startsWith(QLatin1Char('|'))) {
+        rule.flags |= RuleRecord::StartAnchor;
+        filter.remove(0, 1);
+    }
+    if (filter.endsWith(QLatin1Char('|'))) {
+        rule.flags |= RuleRecord::EndAnchor;
+        filter.chop(1);
+    }
+
+    // Wildcards at the ends make anchors pointless
+    int first = 0;
+    int last = filter.length() - 1;
+    while (first < filter.length() && filter.at(first) == QLatin1Char('*'))
+        ++first;
+    while (last >= first && filter.at(last) == QLatin1Char('*'))
+        --last;
+    if (first > 0)
+        rule.flags &= ~(RuleRecord::StartAnchor | RuleRecord::HostAnchor);
+    if (last < filter.length() - 1)
+        rule.flags &= ~RuleRecord::EndAnchor;
+    filter = filter.mid(first, last - first + 1);
+
+    rule.pattern = (rule.flags & RuleRecord::MatchCase) ? filter : filter.toLower();
+    rules.append(rule);
+}
+
+// Appends the sections of a blob
+class BlobWriter {
+public:
+    BlobWriter()
+        : m_data(sizeof(BlobHeader), '\0')
+    {
+        std::memset(&m_header, 0, sizeof(m_header));
+        m_header.sectionCount = SectionCount;
+    }
+
+    template<typename T>
+    void addSection(int section, const QVector<T> &items)
+    {
+        while (m_data.size() % 4)
+            m_data.append('\0');
+        m_header.sections[section].count = items.size();
+        m_header.sections[section].offset = m_data.size();
+        m_data.append(reinterpret_cast<const char *>(items.constData()), items.size() * sizeof(T));
+    }
+
+    QByteArray finish()
+    {
+        std::memcpy(m_data.data(), &m_header, sizeof(m_header));
+        return m_data;
+    }
+
+private:
+    BlobHeader m_header;
+    QByteArray m_data;
+};
+
+// Collects UTF-16 strings for the strings section
+class StringPool {
+public:
+    quint32 add(const QString &str)
+    {
+        const quint32 offset = m_data.size();
+        m_data.resize(offset + str.length());
+        std::memcpy(m_data.data() + offset, str.utf16(), str.length() * sizeof(ushort));
+        return offset;
+    }
+
+    const QVector<ushort> &data() const
+    {
+        return m_data;
+    }
+
+private:
+    QVector<ushort> m_data;
+};
+
+static void addDomains(const QStringList &includeDomains, const QStringList &excludeDomains,
+                       StringPool &strings, QVector<DomainRecord> &domains)
+{
+    foreach (const QString &domain, includeDomains) {
+        const DomainRecord record = { strings.add(domain), quint32(domain.length()), 0 };
+        domains.append(record);
+    }
+    foreach (const QString &domain, excludeDomains) {
+        const DomainRecord record = { strings.add(domain), quint32(domain.length()), 1 };
+        domains.append(record);
+    }
+}
+
+static void addHostTable(const QMap<QString, QVector<quint32> > &table, StringPool &strings,
+                         BlobWriter &writer, int hostsSection, int idsSection)
+{
+    QVector<HostRecord> hosts;
+    QVector<quint32> ids;
+    // QMap iterates in the order of QString::operator<, the one of compareStrings()
+    for (QMap<QString, QVector<quint32> >::const_iterator it = table.constBegin(); it != table.constEnd(); ++it) {
+        const HostRecord record = { strings.add(it.key()), quint32(it.key().length()),
+                                    quint32(ids.size()), quint32(it.value().size()) };
+        hosts.append(record);
+        ids += it.value();
+    }
+    writer.addSection(hostsSection, hosts);
+    writer.addSection(idsSection, ids);
+}
+
+// Builds an Aho-Corasick automaton finding the keywords
+static void addAutomaton(const QVector<QPair<QString, quint32> > &keywords, BlobWriter &writer, int firstSection)
+{
+    // Build the trie. Edges are kept in a hash keyed by (parent, char) meanwhile.
+    QHash<quint64, int> trieEdges;
+    QVector<QVector<qint32> > nodeOccurrences(1);
+    for (int i = 0; i < keywords.size(); ++i) {
+        const QString &keyword = keywords.at(i).first;
+        int node = 0;
+        for (int k = 0; k < keyword.length(); ++k) {
+            const quint64 key = (quint64(node) << 16) | keyword.at(k).unicode();
+            QHash<quint64, int>::const_iterator it = trieEdges.constFind(key);
+            if (it != trieEdges.constEnd()) {
+                node = it.value();
+            } else {
+                const int newNode = nodeOccurrences.size();
+                trieEdges.insert(key, newNode);
+                nodeOccurrences.append(QVector<qint32>());
+                node = newNode;
             }
         }
+        nodeOccurrences[node].append(keywords.at(i).second);
+    }
 
-        int len = str.length();
-        int k;
+    // Flatten the edges, sorted by parent then char
+    QVector<quint64> keys;
+    keys.reserve(trieEdges.size());
+    for (QHash<quint64, int>::const_iterator it = trieEdges.constBegin(); it != trieEdges.constEnd(); ++it)
+        keys.append(it.key());
+    std::sort(keys.begin(), keys.end());
 
-        int current = 0;
-        int next = 0;
-        // compute hash for first 8 characters
-        for (k = 0; k < 8 && k < len; ++k)
-            current = (current * HASH_P + str[k].unicode()) % HASH_Q;
+    const int nodeCount = nodeOccurrences.size();
+    QVector<AutomatonNode> nodes(nodeCount);
+    QVector<ushort> edgeChars(keys.size());
+    QVector<qint32> edgeTargets(keys.size());
+    for (int i = 0; i < nodeCount; ++i) {
+        AutomatonNode &n = nodes[i];
+        n.firstEdge = 0;
+        n.edgeCount = 0;
+        n.fail = 0;
+        n.dictLink = -1;
+        n.depth = 0;
+    }
+    for (int i = 0; i < keys.size(); ++i) {
+        const int parent = int(keys.at(i) >> 16);
+        edgeChars[i] = ushort(keys.at(i) & 0xffff);
+        edgeTargets[i] = trieEdges.value(keys.at(i));
+        if (nodes[parent].edgeCount++ == 0)
+            nodes[parent].firstEdge = i;
+    }
+    trieEdges.clear();
 
-        QHash<int, QVector<int> >::const_iterator hashEnd = stringFiltersHash.end();
-        // main Rabin-Karp's algorithm loop
-        for (k = 7; k < len; ++k, current = next) {
-            // roll the hash if not at the end
-            // (calculate hash for the next iteration)
-            if (k + 1 < len)
-                next = (HASH_P * ((current + HASH_Q - ((HASH_MOD * str[k - 7].unicode()) % HASH_Q)) % HASH_Q) + str[k + 1].unicode()) % HASH_Q;
+    QVector<qint32> occurrences;
+    for (int i = 0; i < nodeCount; ++i) {
+        nodes[i].firstOccurrence = occurrences.size();
+        nodes[i].occurrenceCount = nodeOccurrences.at(i).size();
+        occurrences += nodeOccurrences.at(i);
+    }
 
-            if (!fastLookUp.testBit(current))
-                continue;
+    QVector<qint32> rootAscii(128, 0);
+    for (int e = 0; e < nodes.at(0).edgeCount; ++e) {
+        const ushort c = edgeChars.at(nodes.at(0).firstEdge + e);
+        if (c < 128)
+            rootAscii[c] = edgeTargets.at(nodes.at(0).firstEdge + e);
+    }
 
-            // look-up the hash in the HashMap and check all strings
-            QHash<int, QVector<int> >::const_iterator it = stringFiltersHash.find(current + 1);
-
-            // check possible strings
-            if (it != hashEnd) {
-                for (int j = 0; j < it->size(); ++j) {
-                    int index = it->value(j);
-                    // check if we got simple string or REs prefix
-                    if (index >= 0) {
-                        int flen = stringFilters[index].length();
-                        if (k - flen + 1 >= 0 && stringFilters[index] == str.midRef(k - flen + 1 , flen))
-                        {
-                            if (by != 0) *by = stringFilters[index];
-                            return true;
-                        }
-                    } else {
-                        index = -index - 1;
-                        int flen = rePrefixes[index].length();
-                        if (k - 8 + flen < len && rePrefixes[index] == str.midRef(k - 7, flen))
-                        {
-                            int remStart = k - 7 + flen;
-                            QString remainder = QString::fromRawData(str.unicode() + remStart,
-                                                                    str.length() - remStart);
-                            if (reFilters[index].exactMatch(remainder)) {
-                                if (by != 0) *by = rePrefixes[index]+reFilters[index].pattern();
-                                return true;
-                            }
-                        }
+    // Failure and dictionary links, breadth first
+    QVector<int> queue;
+    queue.reserve(nodeCount);
+    queue.append(0);
+    for (int q = 0; q < queue.size(); ++q) {
+        const int node = queue.at(q);
+        const AutomatonNode n = nodes.at(node);
+        for (int e = n.firstEdge; e < n.firstEdge + n.edgeCount; ++e) {
+            const ushort c = edgeChars.at(e);
+            const int target = edgeTargets.at(e);
+            int fail = 0;
+            if (node != 0) {
+                int f = n.fail;
+                for (;;) {
+                    // child of f through c
+                    const ushort *first = edgeChars.constData() + nodes.at(f).firstEdge;
+                    const ushort *last = first + nodes.at(f).edgeCount;
+                    const ushort *it = std::lower_bound(first, last, c);
+                    const int t = (it != last && *it == c) ? edgeTargets.at(it - edgeChars.constData()) : -1;
+                    if (t != -1 && t != target) {
+                        fail = t;
+                        break;
                     }
+                    if (f == 0)
+                        break;
+                    f = nodes.at(f).fail;
                 }
             }
+            nodes[target].depth = n.depth + 1;
+            nodes[target].fail = fail;
+            nodes[target].dictLink = nodes.at(fail).occurrenceCount > 0 ? fail : nodes.at(fail).dictLink;
+            queue.append(target);
         }
+    }
 
-        return false;
+    writer.addSection(firstSection, nodes);
+    writer.addSection(firstSection + 1, edgeChars);
+    writer.addSection(firstSection + 2, edgeTargets);
+    writer.addSection(firstSection + 3, occurrences);
+    writer.addSection(firstSection + 4, rootAscii);
+}
+
+QByteArray FilterSetBuilder::compile() const
+{
+    BlobWriter writer;
+    StringPool strings;
+
+    QVector<RuleRecord> ruleRecords;
+    QVector<DomainRecord> domains;
+    QMap<QString, QVector<quint32> > hostRules;
+    QVector<quint32> unindexedRules;
+    QVector<QPair<QString, quint32> > keywords[AutomatonCount];
+
+    ruleRecords.reserve(rules.size());
+    for (int id = 0; id < rules.size(); ++id) {
+        const Rule &rule = rules.at(id);
+        RuleRecord record;
+        record.text = strings.add(rule.text);
+        record.textLength = rule.text.length();
+        record.pattern = strings.add(rule.pattern);
+        record.patternLength = rule.pattern.length();
+        record.firstDomain = domains.size();
+        addDomains(rule.includeDomains, rule.excludeDomains, strings, domains);
+        record.domainCount = domains.size() - record.firstDomain;
+        record.regExp = rule.regExp;
+        record.types = rule.types;
+        record.flags = rule.flags;
+        ruleRecords.append(record);
+
+        if (rule.regExp != -1) {
+            unindexedRules.append(id);
+            continue;
+        }
+
+        // ||host^ and ||host/ go by host; || followed by a part of a host can't
+        if (rule.flags & RuleRecord::HostAnchor) {
+            int end = 0;
+            while (end < rule.pattern.length() && !isHostEnd(rule.pattern.at(end)))
+                ++end;
+            if (end > 0 && end < rule.pattern.length() && rule.pattern.at(end) != QLatin1Char('*')) {
+                hostRules[rule.pattern.left(end).toLower()].append(id);
+                continue;
+            }
+        }
+
+        // By the longest literal part of their pattern, rules for all the
+        // types in the first automaton, the others in those of their types
+        const QString word = keyword(rule.pattern).toLower();
+        if (word.isEmpty()) {
+            unindexedRules.append(id);
+        } else if (rule.types == FilterRequest::AllTypes) {
+            keywords[0].append(qMakePair(word, quint32(id)));
+        } else {
+            for (int i = 0; i < ResourceTypeCount; ++i) {
+                if (rule.types & (1 << i))
+                    keywords[i + 1].append(qMakePair(word, quint32(id)));
+            }
+        }
     }
 
-    // add filter to matching set with wildcards (*,?) in it
-    void addWildedString(const QString& prefix, const QRegExp& rx)
-    {
-        rePrefixes.append(prefix);
-        reFilters.append(rx);
-        int index = -rePrefixes.size();
-
-        int current = 0;
-        for (int k = 0; k < 8; ++k)
-            current = (current * HASH_P + prefix[k].unicode()) % HASH_Q;
-
-        // insert computed hash value into HashMap
-        QHash<int, QVector<int> >::iterator it = stringFiltersHash.find(current + 1);
-        if (it == stringFiltersHash.end()) {
-            QVector<int> list;
-            list.append(index);
-            stringFiltersHash.insert(current + 1, list);
-            fastLookUp.setBit(current);
+    QVector<RegExpRecord> regExpRecords;
+    for (int i = 0; i < regExps.size(); ++i) {
+        const RegExpRecord record = { strings.add(regExps.at(i).first), quint32(regExps.at(i).first.length()),
+                                      regExps.at(i).second ? 1u : 0u };
+        regExpRecords.append(record);
+    }
+
+    QVector<HidingRecord> hidingRecords;
+    QMap<QString, QVector<quint32> > hidingHostRules;
+    QVector<quint32> genericHidingRules;
+    for (int id = 0; id < hidingRules.size(); ++id) {
+        const HidingRule &rule = hidingRules.at(id);
+        HidingRecord record;
+        record.selector = strings.add(rule.selector);
+        record.selectorLength = rule.selector.length();
+        record.firstDomain = domains.size();
+        addDomains(rule.includeDomains, rule.excludeDomains, strings, domains);
+        record.domainCount = domains.size() - record.firstDomain;
+        record.exception = rule.exception;
+        hidingRecords.append(record);
+
+        if (rule.includeDomains.isEmpty()) {
+            genericHidingRules.append(id);
         } else {
-            it->append(index);
+            foreach (const QString &domain, rule.includeDomains)
+                hidingHostRules[domain].append(id);
+        }
+    }
+
+    writer.addSection(RulesSection, ruleRecords);
+    writer.addSection(DomainsSection, domains);
+    addHostTable(hostRules, strings, writer, HostsSection, HostRulesSection);
+    writer.addSection(UnindexedRulesSection, unindexedRules);
+    writer.addSection(RegExpsSection, regExpRecords);
+    writer.addSection(HidingRulesSection, hidingRecords);
+    addHostTable(hidingHostRules, strings, writer, HidingHostsSection, HidingHostRulesSection);
+    writer.addSection(GenericHidingRulesSection, genericHidingRules);
+    for (int i = 0; i < AutomatonCount; ++i)
+        addAutomaton(keywords[i], writer, AutomatonSections + i * 5);
+    // last, once all the strings are in
+    writer.addSection(StringsSection, strings.data());
+
+    return writer.finish();
+}
+
+// A view on the automaton of a blob
+struct Automaton {
+    const AutomatonNode *nodes;
+    int nodeCount;
+    const ushort *edgeChars;
+    const qint32 *edgeTargets;
+    int edgeCount;
+    const qint32 *occurrences;
+    int occurrenceCount;
+    const qint32 *rootAscii;
+
+    int child(int node, ushort c) const
+    {
+        if (node == 0 && c < 128)
+            return rootAscii[c];
+        const AutomatonNode &n = nodes[node];
+        const ushort *first = edgeChars + n.firstEdge;
+        const ushort *last = first + n.edgeCount;
+        const ushort *it = std::lower_bound(first, last, c);
+        if (it != last && *it == c)
+            return edgeTargets[it - edgeChars];
+        return -1;
+    }
+
+    int next(int node, ushort c) const
+    {
+        for (;;) {
+            const int target = child(node, c);
+            if (target != -1)
+                return target;
+            if (node == 0)
+                return 0;
+            node = nodes[node].fail;
         }
     }
 
-    void clear()
+    // Calls accept with the id of every keyword found in str, in the order of
+    // their end, until it returns true. Returns whether accept returned true.
+    template<typename Accept>
+    bool findMatch(const QString& str, Accept accept) const
     {
-        stringFilters.clear();
-        shortStringFilters.clear();
-        reFilters.clear();
-        rePrefixes.clear();
-        stringFiltersHash.clear();
-        fastLookUp.resize(HASH_Q);
-        fastLookUp.fill(0, 0, HASH_Q);
+        if (nodeCount <= 1)
+            return false;
+
+        const QChar *data = str.unicode();
+        const int len = str.length();
+        int state = 0;
+        for (int k = 0; k < len; ++k) {
+            state = next(state, data[k].unicode());
+
+            for (int node = nodes[state].occurrenceCount > 0 ? state : nodes[state].dictLink;
+                 node != -1; node = nodes[node].dictLink) {
+                const AutomatonNode &n = nodes[node];
+                for (int o = n.firstOccurrence; o < n.firstOccurrence + n.occurrenceCount; ++o) {
+                    if (accept(occurrences[o]))
+                        return true;
+                }
+            }
+        }
+
+        return false;
     }
+};
+
+namespace KDEPrivate {
+
+// Compiled filters, used in place from a blob in memory or in a mapped cache file
+class CompiledFilters {
+public:
+    // data must outlive the object, unless it is kept by owner or file
+    bool attach(const uchar *data, qint64 size);
+
+    int findRule(const FilterRequest &request) const;
+    QString ruleText(int id) const;
+
+    // Adds the selectors of host and the exceptions to them
+    void addHidingSelectors(const QString &host, QStringList &selectors, QSet<QString> &exceptions) const;
+
+    QString name;               // of the filter list
+    QByteArray owner;
+    QSharedPointer<QFile> file;
 
 private:
-    QVector<QString> stringFilters;
-    QVector<QString> shortStringFilters;
-    QVector<QRegExp> reFilters;
-    QVector<QString> rePrefixes;
-    QBitArray fastLookUp;
+    template<typename T>
+    bool section(int index, const T *&items, int &count) const;
 
-    QHash<int, QVector<int> > stringFiltersHash;
+    bool ruleMatches(const RuleRecord &rule, const FilterRequest &request) const;
+    const HostRecord *findHost(const HostRecord *hosts, int hostCount, const QChar *host, int hostLength) const;
+    bool checkString(quint32 offset, quint32 length) const
+    {
+        return offset <= quint32(stringCount) && length <= quint32(stringCount) - offset;
+    }
+
+    const uchar *m_data;
+    qint64 m_size;
+
+    const RuleRecord *rules;
+    int ruleCount;
+    const DomainRecord *domains;
+    int domainCount;
+    const QChar *strings;
+    int stringCount;
+    const HostRecord *hosts;
+    int hostCount;
+    const quint32 *hostRules;
+    int hostRuleCount;
+    const quint32 *unindexedRules;
+    int unindexedRuleCount;
+    const HidingRecord *hidingRules;
+    int hidingRuleCount;
+    const HostRecord *hidingHosts;
+    int hidingHostCount;
+    const quint32 *hidingHostRules;
+    int hidingHostRuleCount;
+    const quint32 *genericHidingRules;
+    int genericHidingRuleCount;
+    Automaton automatons[AutomatonCount];
+    QVector<QRegExp> regExps;
 };
 
+class FilterSetPrivate {
+public:
+    FilterSetPrivate()
+        : builderCompiled(true)
+    {
+    }
 
-// We only want a subset of features of wildcards -- just the 
-// star, so we escape the rest before passing to QRegExp. 
-// The \ is escaped due to a QRegExp bug.
-// ### we really should rather parse it ourselves, in order to 
-// handle adblock-special things like | and ^ properly.
-static QRegExp fromAdBlockWildcard(const QString& wcStr) {
-    QRegExp rx;
-    rx.setPatternSyntax(QRegExp::Wildcard);
-
-    QString out;
-    for (int p = 0; p < wcStr.length(); ++p) {
-        QChar c = wcStr[p];
-        if (c == QLatin1Char('?'))
-            out += QLatin1String("[?]");
-        else if (c == QLatin1Char('['))
-            out += QLatin1String("[[]");
-        else if (c == QLatin1Char('\\'))
-            out += QLatin1String("[\\]");
-        else
-            out += c;
+    ~FilterSetPrivate()
+    {
+        qDeleteAll(lists);
     }
 
-    rx.setPattern(out);
-    return rx;
+    // the filters added one by one
+    FilterSetBuilder builder;
+    QScopedPointer<CompiledFilters> builderFilters;
+    bool builderCompiled;
+
+    // the filter lists
+    QList<CompiledFilters *> lists;
+};
+
 }
 
-FilterSet::FilterSet()
-    :stringFiltersMatcher(new StringsMatcher)
+template<typename T>
+bool CompiledFilters::section(int index, const T *&items, int &count) const
 {
+    const BlobHeader *header = reinterpret_cast<const BlobHeader *>(m_data);
+    const SectionRecord &record = header->sections[index];
+    if (record.offset % 4 != 0 || record.offset > m_size
+        || record.count > quint64(m_size - record.offset) / sizeof(T))
+        return false;
+    items = reinterpret_cast<const T *>(m_data + record.offset);
+    count = record.count;
+    return true;
 }
 
-FilterSet::~FilterSet()
+bool CompiledFilters::attach(const uchar *data, qint64 size)
+{
+    m_data = data;
+    m_size = size;
+    if (size < qint64(sizeof(BlobHeader)) || quintptr(data) % 4 != 0
+        || reinterpret_cast<const BlobHeader *>(data)->sectionCount != SectionCount)
+        return false;
+
+    const ushort *stringData;
+    int regExpCount;
+    const RegExpRecord *regExpRecords;
+    if (!section(RulesSection, rules, ruleCount)
+        || !section(DomainsSection, domains, domainCount)
+        || !section(StringsSection, stringData, stringCount)
+        || !section(HostsSection, hosts, hostCount)
+        || !section(HostRulesSection, hostRules, hostRuleCount)
+        || !section(UnindexedRulesSection, unindexedRules, unindexedRuleCount)
+        || !section(RegExpsSection, regExpRecords, regExpCount)
+        || !section(HidingRulesSection, hidingRules, hidingRuleCount)
+        || !section(HidingHostsSection, hidingHosts, hidingHostCount)
+        || !section(HidingHostRulesSection, hidingHostRules, hidingHostRuleCount)
+        || !section(GenericHidingRulesSection, genericHidingRules, genericHidingRuleCount))
+        return false;
+    strings = reinterpret_cast<const QChar *>(stringData);
+
+    // Check the references, a broken cache must not make us crash
+    for (int i = 0; i < domainCount; ++i) {
+        if (!checkString(domains[i].name, domains[i].nameLength))
+            return false;
+    }
+    for (int i = 0; i < ruleCount; ++i) {
+        const RuleRecord &rule = rules[i];
+        if (!checkString(rule.text, rule.textLength) || !checkString(rule.pattern, rule.patternLength)
+            || rule.firstDomain > quint32(domainCount) || rule.domainCount > quint32(domainCount) - rule.firstDomain
+            || rule.regExp < -1 || rule.regExp >= regExpCount)
+            return false;
+    }
+    for (int i = 0; i < hidingRuleCount; ++i) {
+        const HidingRecord &rule = hidingRules[i];
+        if (!checkString(rule.selector, rule.selectorLength)
+            || rule.firstDomain > quint32(domainCount) || rule.domainCount > quint32(domainCount) - rule.firstDomain)
+            return false;
+    }
+    for (int i = 0; i < hostCount; ++i) {
+        if (!checkString(hosts[i].name, hosts[i].nameLength)
+            || hosts[i].first > quint32(hostRuleCount) || hosts[i].count > quint32(hostRuleCount) - hosts[i].first)
+            return false;
+    }
+    for (int i = 0; i < hidingHostCount; ++i) {
+        if (!checkString(hidingHosts[i].name, hidingHosts[i].nameLength)
+            || hidingHosts[i].first > quint32(hidingHostRuleCount)
+            || hidingHosts[i].count > quint32(hidingHostRuleCount) - hidingHosts[i].first)
+            return false;
+    }
+    for (int i = 0; i < hostRuleCount; ++i) {
+        if (hostRules[i] >= quint32(ruleCount))
+            return false;
+    }
+    for (int i = 0; i < unindexedRuleCount; ++i) {
+        if (unindexedRules[i] >= quint32(ruleCount))
+            return false;
+    }
+    for (int i = 0; i < hidingHostRuleCount; ++i) {
+        if (hidingHostRules[i] >= quint32(hidingRuleCount))
+            return false;
+    }
+    for (int i = 0; i < genericHidingRuleCount; ++i) {
+        if (genericHidingRules[i] >= quint32(hidingRuleCount))
+            return false;
+    }
+
+    for (int a = 0; a < AutomatonCount; ++a) {
+        Automaton &automaton = automatons[a];
+        const int first = AutomatonSections + a * 5;
+        int rootCount;
+        if (!section(first, automaton.nodes, automaton.nodeCount)
+            || !section(first + 1, automaton.edgeChars, automaton.edgeCount)
+            || !section(first + 2, automaton.edgeTargets, rootCount)
+            || rootCount != automaton.edgeCount
+            || !section(first + 3, automaton.occurrences, automaton.occurrenceCount)
+            || !section(first + 4, automaton.rootAscii, rootCount)
+            || rootCount != 128 || automaton.nodeCount < 1 || automaton.nodes[0].depth != 0)
+            return false;
+        for (int i = 0; i < automaton.edgeCount; ++i) {
+            if (automaton.edgeTargets[i] < 1 || automaton.edgeTargets[i] >= automaton.nodeCount)
+                return false;
+        }
+        // Links going up in depth, matching can't loop
+        for (int i = 0; i < automaton.nodeCount; ++i) {
+            const AutomatonNode &n = automaton.nodes[i];
+            if (n.firstEdge < 0 || n.edgeCount < 0 || n.firstEdge > automaton.edgeCount - n.edgeCount
+                || n.firstOccurrence < 0 || n.occurrenceCount < 0
+                || n.firstOccurrence > automaton.occurrenceCount - n.occurrenceCount
+                || n.fail < 0 || n.fail >= automaton.nodeCount
+                || n.dictLink < -1 || n.dictLink >= automaton.nodeCount
+                || (i != 0 && automaton.nodes[n.fail].depth >= n.depth)
+                || (n.dictLink != -1 && automaton.nodes[n.dictLink].depth >= n.depth))
+                return false;
+            for (int e = n.firstEdge; e < n.firstEdge + n.edgeCount; ++e) {
+                if (automaton.nodes[automaton.edgeTargets[e]].depth != n.depth + 1)
+                    return false;
+            }
+        }
+        for (int i = 0; i < automaton.occurrenceCount; ++i) {
+            if (automaton.occurrences[i] < 0 || automaton.occurrences[i] >= ruleCount)
+                return false;
+        }
+        for (int i = 0; i < 128; ++i) {
+            if (automaton.rootAscii[i] < 0 || automaton.rootAscii[i] >= automaton.nodeCount
+                || (automaton.rootAscii[i] != 0 && automaton.nodes[automaton.rootAscii[i]].depth != 1))
+                return false;
+        }
+    }
+
+    regExps.clear();
+    for (int i = 0; i < regExpCount; ++i) {
+        const RegExpRecord &record = regExpRecords[i];
+        if (!checkString(record.pattern, record.patternLength))
+            return false;
+        regExps.append(QRegExp(QString(strings + record.pattern, record.patternLength),
+                               record.caseSensitive ? Qt::CaseSensitive : Qt::CaseInsensitive));
+    }
+
+    return true;
+}
+
+QString CompiledFilters::ruleText(int id) const
 {
-    delete stringFiltersMatcher;
+    return QString(strings + rules[id].text, rules[id].textLength);
 }
 
-void FilterSet::addFilter(const QString& filterStr)
+bool CompiledFilters::ruleMatches(const RuleRecord &rule, const FilterRequest &request) const
 {
-    QString filter = filterStr;
+    if (!(rule.types & request.types))
+        return false;
+    if ((rule.flags & RuleRecord::ThirdParty) && !request.thirdParty)
+        return false;
+    if ((rule.flags & RuleRecord::FirstParty) && request.thirdParty)
+        return false;
+    if (rule.domainCount > 0 && !appliesToHost(request.pageHost, strings, domains + rule.firstDomain, rule.domainCount))
+        return false;
 
-    /** ignore special lines starting with "[", "!", "&", or "#" or contain "#" (comments or features are not supported by KHTML's AdBlock */
-    QChar firstChar = filter.at(0);
-    if (firstChar == QLatin1Char('[') || firstChar == QLatin1Char('!') || firstChar == QLatin1Char('&') || firstChar == QLatin1Char('#') || filter.contains(QLatin1Char('#')))
-        return;
+    if (rule.regExp != -1)
+        return request.url.contains(regExps.at(rule.regExp));
 
-    // Strip leading @@
-    int first = 0;
-    int last  = filter.length() - 1;
-    if (filter.startsWith(QLatin1String("@@")))
-        first = 2;
+    const QString &url = (rule.flags & RuleRecord::MatchCase) ? request.url : request.lowerUrl;
+    const bool endAnchor = rule.flags & RuleRecord::EndAnchor;
+    const QChar *pattern = strings + rule.pattern;
+    const int patternLength = rule.patternLength;
 
-    // Strip options, we ignore them for now.
-    // TODO: Add support for filters with options. See #310230.
-    int dollar = filter.lastIndexOf(QLatin1Char('$'));
-    if (dollar != -1) {
-        return;
+    if (rule.flags & RuleRecord::StartAnchor)
+        return matchAt(url, 0, pattern, patternLength, endAnchor);
+
+    if (rule.flags & RuleRecord::HostAnchor) {
+        // at the start of the host or of one of its labels
+        if (request.hostStart == -1)
+            return false;
+        const int hostEnd = request.hostStart + request.host.length();
+        for (int pos = request.hostStart; pos < hostEnd; ++pos) {
+            if ((pos == request.hostStart || url.at(pos - 1) == QLatin1Char('.'))
+                && matchAt(url, pos, pattern, patternLength, endAnchor))
+                return true;
+        }
+        return false;
     }
 
-    // Perhaps nothing left?
-    if (first > last)
-        return;
+    if (patternLength == 0)
+        return true;
 
-    filter = filter.mid(first, last - first + 1);
+    const QChar first = pattern[0];
+    for (int pos = 0; pos < url.length(); ++pos) {
+        if (first != QLatin1Char('^')) {
+            pos = url.indexOf(first, pos);
+            if (pos == -1)
+                return false;
+        }
+        if (matchAt(url, pos, pattern, patternLength, endAnchor))
+            return true;
+    }
+    return false;
+}
 
-    // Is it a regexp filter?
-    if (filter.length()>2 && filter.startsWith(QLatin1Char('/')) && filter.endsWith(QLatin1Char('/')))
-    {
-        QString inside = filter.mid(1, filter.length()-2);
-        QRegExp rx(inside);
-        reFilters.append(rx);
-//         qDebug() << "R:" << inside;
+const HostRecord *CompiledFilters::findHost(const HostRecord *hostTable, int count, const QChar *host, int hostLength) const
+{
+    const HostRecord *it = std::lower_bound(hostTable, hostTable + count, 0, [&](const HostRecord &record, int) {
+        return compareStrings(strings + record.name, record.nameLength, host, hostLength) < 0;
+    });
+    if (it != hostTable + count && compareStrings(strings + it->name, it->nameLength, host, hostLength) == 0)
+        return it;
+    return 0;
+}
+
+int CompiledFilters::findRule(const FilterRequest &request) const
+{
+    // host and its parent domains
+    const QString &host = request.host;
+    for (int pos = 0; pos != -1 && pos < host.length(); ) {
+        const HostRecord *record = findHost(hosts, hostCount, host.unicode() + pos, host.length() - pos);
+        if (record) {
+            for (quint32 i = record->first; i < record->first + record->count; ++i) {
+                if (ruleMatches(rules[hostRules[i]], request))
+                    return hostRules[i];
+            }
+        }
+        pos = host.indexOf(QLatin1Char('.'), pos);
+        if (pos != -1)
+            ++pos;
     }
-    else
-    {
-        // Nope, a wildcard one.
-        // Note: For these, we also need to handle |.
 
-        // Strip wildcards at the ends
-        first = 0;
-        last  = filter.length() - 1;
+    int found = -1;
+    auto accept = [&](int id) {
+        if (!ruleMatches(rules[id], request))
+            return false;
+        found = id;
+        return true;
+    };
 
-        while (first < filter.length() && filter[first] == QLatin1Char('*'))
-            ++first;
+    if (automatons[0].findMatch(request.lowerUrl, accept))
+        return found;
 
-        while (last >= 0 && filter[last] == QLatin1Char('*'))
-            --last;
+    for (int i = 0; i < ResourceTypeCount; ++i) {
+        if ((request.types & (1 << i)) && automatons[i + 1].findMatch(request.lowerUrl, accept))
+            return found;
+    }
 
-        if (first > last)
-            filter = QStringLiteral("*"); // erm... Well, they asked for it.
-        else
-            filter = filter.mid(first, last - first + 1);
+    for (int i = 0; i < unindexedRuleCount; ++i) {
+        if (ruleMatches(rules[unindexedRules[i]], request))
+            return unindexedRules[i];
+    }
 
-        // Now, do we still have any wildcard stuff left?
-        if (filter.contains(QLatin1String("*")))
-        {
-            // check if we can use RK first (and then check full RE for the rest) for better performance
-            int aPos = filter.indexOf('*');
-            if (aPos < 0)
-                aPos = filter.length();
-            if (aPos > 7) {
-                QRegExp rx = fromAdBlockWildcard(filter.mid(aPos) + QLatin1Char('*'));
-                // We pad the final r.e. with * so we can check for an exact match
-                stringFiltersMatcher->addWildedString(filter.mid(0, aPos), rx);
-            } else {
-                QRegExp rx = fromAdBlockWildcard(filter);
-                reFilters.append(rx);
-            }
+    return -1;
+}
+
+void CompiledFilters::addHidingSelectors(const QString &host, QStringList &selectors, QSet<QString> &exceptions) const
+{
+    QVector<quint32> candidates;
+    for (int i = 0; i < genericHidingRuleCount; ++i)
+        candidates.append(genericHidingRules[i]);
+    for (int pos = 0; pos != -1 && pos < host.length(); ) {
+        const HostRecord *record = findHost(hidingHosts, hidingHostCount, host.unicode() + pos, host.length() - pos);
+        if (record) {
+            for (quint32 i = record->first; i < record->first + record->count; ++i)
+                candidates.append(hidingHostRules[i]);
         }
-        else
-        {
-            // Fast path
-            stringFiltersMatcher->addString(filter);
+        pos = host.indexOf(QLatin1Char('.'), pos);
+        if (pos != -1)
+            ++pos;
+    }
+
+    foreach (quint32 id, candidates) {
+        const HidingRecord &rule = hidingRules[id];
+        if (appliesToHost(host, strings, domains + rule.firstDomain, rule.domainCount)) {
+            const QString selector(strings + rule.selector, rule.selectorLength);
+            if (rule.exception)
+                exceptions.insert(selector);
+            else
+                selectors.append(selector);
         }
     }
 }
 
-bool FilterSet::isUrlMatched(const QString& url)
+FilterRequest::FilterRequest(const QUrl &url, const QUrl &pageUrl, ResourceType type)
+    : url(url.toString()),
+      pageHost(pageUrl.host()),
+      types(type),
+      thirdParty(!pageHost.isEmpty() && registrableDomain(url) != registrableDomain(pageUrl))
 {
-    if (stringFiltersMatcher->isMatched(url))
-        return true;
+    init(url);
+}
 
-    for (int c = 0; c < reFilters.size(); ++c)
-    {
-        if (url.contains(reFilters[c]))
-            return true;
+FilterRequest::FilterRequest(const QString &url)
+    : url(url),
+      types(AllTypes),
+      thirdParty(false)
+{
+    init(QUrl(url));
+}
+
+void FilterRequest::init(const QUrl &parsedUrl)
+{
+    lowerUrl = url.toLower();
+    host = parsedUrl.host();
+    hostStart = -1;
+    if (!host.isEmpty()) {
+        const int schemeEnd = lowerUrl.indexOf(QLatin1String("://"));
+        hostStart = lowerUrl.indexOf(host, schemeEnd == -1 ? 0 : schemeEnd + 3);
     }
+}
 
-    return false;
+static CompiledFilters *compiledFilters(const QString &name, const QByteArray &data)
+{
+    CompiledFilters *filters = new CompiledFilters;
+    filters->name = name;
+    filters->owner = data;
+    if (!filters->attach(reinterpret_cast<const uchar *>(data.constData()), data.size())) {
+        delete filters;
+        return 0;
+    }
+    return filters;
 }
 
-QString FilterSet::urlMatchedBy(const QString& url)
+FilterSet::FilterSet()
+    :d(new FilterSetPrivate)
 {
-    QString by;
+}
 
-    if (stringFiltersMatcher->isMatched(url, &by))
-        return by;
+FilterSet::~FilterSet()
+{
+    delete d;
+}
 
-    for (int c = 0; c < reFilters.size(); ++c)
-    {
-        if (url.contains(reFilters[c]))
+void FilterSet::addFilter(const QString& filterStr)
+{
+    QWriteLocker locker(&lock);
+    d->builder.addFilter(filterStr);
+    d->builderCompiled = false;
+}
+
+void FilterSet::ensureCompiled(QReadLocker &locker)
+{
+    // Filters may have been added in between, hence the loop
+    while (!d->builderCompiled) {
+        locker.unlock();
         {
-            by = reFilters[c].pattern();
-            break;
+            QWriteLocker writeLocker(&lock);
+            if (!d->builderCompiled) {
+                d->builderFilters.reset();
+                if (!d->builder.isEmpty())
+                    d->builderFilters.reset(compiledFilters(QString(), d->builder.compile()));
+                d->builderCompiled = true;
+            }
         }
+        locker.relock();
+    }
+}
+
+bool FilterSet::isUrlMatched(const QString& url)
+{
+    return isMatched(FilterRequest(url));
+}
+
+QString FilterSet::urlMatchedBy(const QString& url)
+{
+    return matchedBy(FilterRequest(url));
+}
+
+bool FilterSet::isMatched(const FilterRequest& request)
+{
+    return !matchedBy(request).isNull();
+}
+
+QString FilterSet::matchedBy(const FilterRequest& request)
+{
+    QReadLocker locker(&lock);
+    ensureCompiled(locker);
+
+    if (d->builderFilters) {
+        const int id = d->builderFilters->findRule(request);
+        if (id != -1)
+            return d->builderFilters->ruleText(id);
+    }
+    foreach (const CompiledFilters *filters, d->lists) {
+        const int id = filters->findRule(request);
+        if (id != -1)
+            return filters->ruleText(id);
     }
+    return QString();
+}
 
-    return by;
+QStringList FilterSet::elementHidingSelectors(const QString& host)
+{
+    QReadLocker locker(&lock);
+    ensureCompiled(locker);
+
+    QStringList candidates;
+    QSet<QString> exceptions;
+    if (d->builderFilters)
+        d->builderFilters->addHidingSelectors(host, candidates, exceptions);
+    foreach (const CompiledFilters *filters, d->lists)
+        filters->addHidingSelectors(host, candidates, exceptions);
+
+    QStringList selectors;
+    QSet<QString> seen;
+    foreach (const QString &selector, candidates) {
+        if (!exceptions.contains(selector) && !seen.contains(selector)) {
+            seen.insert(selector);
+            selectors.append(selector);
+        }
+    }
+    return selectors;
 }
 
 void FilterSet::clear()
 {
-    reFilters.clear();
-    stringFiltersMatcher->clear();
+    QWriteLocker locker(&lock);
+    delete d;
+    d = new FilterSetPrivate;
+}
+
+void FilterSet::addList(CompiledFilters *filters)
+{
+    QWriteLocker locker(&lock);
+    for (int i = 0; i < d->lists.size(); ++i) {
+        if (d->lists.at(i)->name == filters->name) {
+            delete d->lists.at(i);
+            d->lists[i] = filters;
+            return;
+        }
+    }
+    d->lists.append(filters);
+}
+
+// Uses the cache if it was made from the list with the given checksum
+static bool loadCache(const QString &listFileName, const QString &cacheFileName, const QByteArray &checksum,
+                      QScopedPointer<CompiledFilters> &black, QScopedPointer<CompiledFilters> &white)
+{
+    QSharedPointer<QFile> file(new QFile(cacheFileName));
+    if (!file->open(QIODevice::ReadOnly) || file->size() < qint64(sizeof(CacheHeader)))
+        return false;
+
+    const uchar *data = file->map(0, file->size());
+    if (!data)
+        return false;
+    const CacheHeader *header = reinterpret_cast<const CacheHeader *>(data);
+    const quint64 size = file->size();
+    if (std::memcmp(header->magic, s_cacheMagic, sizeof(s_cacheMagic)) != 0
+        || header->version != s_cacheVersion || header->byteOrder != s_byteOrderMark
+        || header->headerSize != sizeof(CacheHeader)
+        || checksum.size() != sizeof(header->checksum)
+        || std::memcmp(header->checksum, checksum.constData(), sizeof(header->checksum)) != 0
+        || header->blackOffset > size || header->blackSize > size - header->blackOffset
+        || header->whiteOffset > size || header->whiteSize > size - header->whiteOffset)
+        return false;
+
+    black.reset(new CompiledFilters);
+    white.reset(new CompiledFilters);
+    if (!black->attach(data + header->blackOffset, header->blackSize)
+        || !white->attach(data + header->whiteOffset, header->whiteSize))
+        return false;
+
+    black->name = white->name = listFileName;
+    black->file = white->file = file;
+    return true;
+}
+
+static void writeCache(const QString &cacheFileName, const QByteArray &checksum,
+                       const QByteArray &black, const QByteArray &white)
+{
+    QDir().mkpath(QFileInfo(cacheFileName).absolutePath());
+    QSaveFile file(cacheFileName);
+    if (!file.open(QIODevice::WriteOnly)) {
+        qWarning() << "Cannot write filter cache" << cacheFileName;
+        return;
+    }
+
+    // blobs are aligned on 8 bytes
+    CacheHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, s_cacheMagic, sizeof(s_cacheMagic));
+    header.version = s_cacheVersion;
+    header.byteOrder = s_byteOrderMark;
+    header.headerSize = sizeof(CacheHeader);
+    std::memcpy(header.checksum, checksum.constData(), sizeof(header.checksum));
+    header.blackOffset = (sizeof(CacheHeader) + 7) & ~7;
+    header.blackSize = black.size();
+    header.whiteOffset = (header.blackOffset + header.blackSize + 7) & ~7;
+    header.whiteSize = white.size();
+
+    QByteArray data(reinterpret_cast<const char *>(&header), sizeof(header));
+    data.resize(header.blackOffset);
+    data.append(black);
+    data.append(QByteArray(header.whiteOffset - data.size(), '\0'));
+    data.append(white);
+    file.write(data);
+    if (!file.commit())
+        qWarning() << "Cannot write filter cache" << cacheFileName;
+}
+
+bool FilterSet::loadFilterList(const QString &listFileName, const QString &cacheFileName,
+                               FilterSet &blackList, FilterSet &whiteList, bool *fromCache)
+{
+    if (fromCache)
+        *fromCache = false;
+
+    QFile list(listFileName);
+    if (!list.open(QIODevice::ReadOnly))
+        return false;
+    const QByteArray content = list.readAll();
+    list.close();
+    const QByteArray checksum = QCryptographicHash::hash(content, QCryptographicHash::Md5);
+
+    QScopedPointer<CompiledFilters> blackFilters;
+    QScopedPointer<CompiledFilters> whiteFilters;
+    if (loadCache(listFileName, cacheFileName, checksum, blackFilters, whiteFilters)) {
+        blackList.addList(blackFilters.take());
+        whiteList.addList(whiteFilters.take());
+        if (fromCache)
+            *fromCache = true;
+        return true;
+    }
+
+    FilterSetBuilder black;
+    FilterSetBuilder white;
+    QTextStream stream(content);
+    stream.setCodec("UTF-8");
+    while (!stream.atEnd()) {
+        const QString line = stream.readLine();
+        /** white list lines start with "@@" */
+        if (line.startsWith(QLatin1String("@@")))
+            white.addFilter(line);
+        else
+            black.addFilter(line);
+    }
+
+    const QByteArray blackData = black.compile();
+    const QByteArray whiteData = white.compile();
+    blackFilters.reset(compiledFilters(listFileName, blackData));
+    whiteFilters.reset(compiledFilters(listFileName, whiteData));
+    if (!blackFilters || !whiteFilters) {
+        // A bug in compile(), don't cache it
+        qWarning() << "Cannot use the filters compiled from" << listFileName;
+        return false;
+    }
+    writeCache(cacheFileName, checksum, blackData, whiteData);
+
+    blackList.addList(blackFilters.take());
+    whiteList.addList(whiteFilters.take());
+    return true;
 }
 
 // kate: indent-width 4; replace-tabs on; tab-width 4; space-indent on;
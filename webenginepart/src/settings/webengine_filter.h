@@ -24,16 +24,60 @@
 #define WEBENGNINE_FILTER_P_H
 
 #include <QString>
-#include <QRegExp>
-#include <QVector>
+#include <QStringList>
+#include <QReadWriteLock>
+#include <QUrl>
 #include <webenginepart.h>
 
-class StringsMatcher;
+class QReadLocker;
 
 namespace KDEPrivate
 {
+class FilterSetPrivate;
+class CompiledFilters;
+
+// A request checked against the filters: the url, the page it is made for
+// and the type of the requested resource.
+struct FilterRequest {
+    // The resource types AdBlock Plus options can restrict filters to
+    enum ResourceType {
+        Other = 0x1,
+        Script = 0x2,
+        Image = 0x4,
+        Stylesheet = 0x8,
+        Object = 0x10,
+        XmlHttpRequest = 0x20,
+        SubDocument = 0x40,
+        Media = 0x80,
+        Font = 0x100,
+        Ping = 0x200,
+        AllTypes = 0x3ff
+    };
+
+    FilterRequest(const QUrl &url, const QUrl &pageUrl, ResourceType type);
+
+    // A request of unknown type, from an unknown page: only $third-party
+    // and $domain filters can't match it.
+    explicit FilterRequest(const QString &url);
+
+    QString url;
+    QString lowerUrl;
+    QString host;       // lower case
+    int hostStart;      // position of host in url, -1 without host
+    QString pageHost;
+    int types;
+    bool thirdParty;
+
+private:
+    void init(const QUrl &parsedUrl);
+};
+
 // This represents a set of filters that may match URLs.
-// Currently it supports a subset of AddBlock Plus functionality.
+// It supports the AdBlock Plus filter syntax: wildcards, anchors, separators,
+// regexps, options restricting filters to resource types, domains or third
+// party requests, and element hiding rules. Filters are indexed by the domain
+// they are anchored to and by the resource types they apply to.
+// It can be used from several threads at once.
 class FilterSet {
 public:
     FilterSet();
@@ -46,11 +90,30 @@ public:
     bool isUrlMatched(const QString& url);
     QString urlMatchedBy(const QString& url);
 
+    bool isMatched(const FilterRequest& request);
+    // returns the filter matching request, as written without the leading @@
+    QString matchedBy(const FilterRequest& request);
+
+    // The CSS selectors of the elements to hide in the pages of host
+    QStringList elementHidingSelectors(const QString& host);
+
     void clear();
 
+    // Loads the filter list in listFile into blackList and whiteList, in
+    // place of what was loaded from it before. Lists are compiled once into
+    // cacheFile, which is mapped in memory as long as its list doesn't change.
+    // Returns false if listFile can't be read.
+    static bool loadFilterList(const QString &listFile, const QString &cacheFile,
+                               FilterSet &blackList, FilterSet &whiteList, bool *fromCache = 0);
+
 private:
-    QVector<QRegExp> reFilters;
-    StringsMatcher* stringFiltersMatcher;
+    void addList(CompiledFilters *filters);
+
+    // compiles pending filters, with locker relocked afterwards
+    void ensureCompiled(QReadLocker &locker);
+
+    QReadWriteLock lock;
+    FilterSetPrivate* d;
 };
 
 }
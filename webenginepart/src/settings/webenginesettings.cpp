@@ -20,6 +20,7 @@
 #include "webenginesettings.h"
 
 #include "webengine_filter.h"
+#include "webengine_domaintrie.h"
 
 #include <KConfig>
 #include <KSharedConfig>
@@ -32,6 +33,7 @@
 #include <QtWebEngineWidgets/QWebEngineSettings>
 #include <QFontDatabase>
 #include <QFileInfo>
+#include <QAtomicInt>
 
 // browser window color defaults -- Bernd
 #define HTML_DEFAULT_LNK_COLOR Qt::blue
@@ -77,7 +79,7 @@ struct KPerDomainSettings {
 #endif
 };
 
-typedef QMap<QString,KPerDomainSettings> PolicyMap;
+typedef KDEPrivate::DomainTrie<KPerDomainSettings> PolicyMap;
 
 class WebEngineSettingsData
 {
@@ -97,7 +99,6 @@ public:
     bool m_follow_system_colors : 1;
     bool m_allowTabulation : 1;
     bool m_autoSpellCheck : 1;
-    bool m_adFilterEnabled : 1;
     bool m_hideAdsEnabled : 1;
     bool m_jsPopupBlockerPassivePopup : 1;
     bool m_accessKeysEnabled : 1;
@@ -137,6 +138,8 @@ public:
     QStringList fonts;
     QStringList defaultFonts;
 
+    // read from the request interceptor, off the GUI thread
+    QAtomicInt m_adFilterEnabled;
     KDEPrivate::FilterSet adBlackList;
     KDEPrivate::FilterSet adWhiteList;
     QList< QPair< QString, QChar > > m_fallbackAccessKeysAssignments;
@@ -150,22 +153,12 @@ class WebEngineSettingsPrivate : public QObject, public WebEngineSettingsData
 public:
     void adblockFilterLoadList(const QString& filename)
     {
-        /** load list file and process each line */
-        QFile file(filename);
-        if (file.open(QIODevice::ReadOnly)) {
-            QTextStream ts(&file);
-            QString line = ts.readLine();
-            while (!line.isEmpty()) {
-                //kDebug() << "Adding filter:" << line;
-                /** white list lines start with "@@" */
-                if (line.startsWith(QLatin1String("@@")))
-                    adWhiteList.addFilter(line);
-                else
-                    adBlackList.addFilter(line);
-                line = ts.readLine();
-            }
-            file.close();
-        }
+        /** the list is compiled once, then used from its cache */
+        const QString cacheFileName = QStandardPaths::writableLocation(QStandardPaths::CacheLocation)
+                                      + QLatin1String("/adblock/") + QFileInfo(filename).fileName()
+                                      + QLatin1String(".cache");
+        if (!KDEPrivate::FilterSet::loadFilterList(filename, cacheFileName, adBlackList, adWhiteList))
+            qDebug() << "Cannot read filter list" << filename;
     }
 
 public Q_SLOTS:
@@ -206,14 +199,9 @@ static KPerDomainSettings &setup_per_domain_policy(WebEngineSettingsPrivate* con
   if (domain.isEmpty())
     qWarning() << "setup_per_domain_policy: domain is empty";
 
-  const QString ldomain = domain.toLower();
-  PolicyMap::iterator it = d->domainPolicy.find(ldomain);
-  if (it == d->domainPolicy.end()) {
-    // simply copy global domain settings (they should have been initialized
-    // by this time)
-    it = d->domainPolicy.insert(ldomain,d->global);
-  }
-  return *it;
+  // simply copy global domain settings if not existent (they should have
+  // been initialized by this time)
+  return d->domainPolicy.insert(domain.toLower(), d->global);
 }
 
 template<typename T>
@@ -341,7 +329,10 @@ void WebEngineSettings::init( KConfig * config, bool reset )
 
   KConfigGroup cgFilter( config, "Filter Settings" );
 
-  if ((reset || cgFilter.exists()) && (d->m_adFilterEnabled = cgFilter.readEntry("Enabled", false)))
+  if (reset || cgFilter.exists())
+      d->m_adFilterEnabled.store(cgFilter.readEntry("Enabled", false));
+
+  if ((reset || cgFilter.exists()) && d->m_adFilterEnabled.load())
   {
       d->m_hideAdsEnabled = cgFilter.readEntry("Shrink", false);
 
@@ -767,36 +758,15 @@ static const KPerDomainSettings& lookup_hostname_policy(const WebEngineSettingsP
     return d->global;
   }
 
-  const PolicyMap::const_iterator notfound = d->domainPolicy.constEnd();
-
-  // First check whether there is a perfect match.
-  PolicyMap::const_iterator it = d->domainPolicy.find(hostname);
-  if( it != notfound ) {
+  // The entry of the host itself, else the one of the closest domain above
+  // it, e.g. .kde.org for www.kde.org
+  const KPerDomainSettings *settings = d->domainPolicy.lookup(hostname);
+  if (settings) {
 #ifdef DEBUG_SETTINGS
-    kDebug() << "perfect match";
-    (*it).dump(hostname);
+    kDebug() << "match";
+    settings->dump(hostname);
 #endif
-    // yes, use it (unless dunno)
-    return *it;
-  }
-
-  // Now, check for partial match.  Chop host from the left until
-  // there's no dots left.
-  QString host_part = hostname;
-  int dot_idx = -1;
-  while( (dot_idx = host_part.indexOf(QChar('.'))) >= 0 ) {
-    host_part.remove(0,dot_idx);
-    it = d->domainPolicy.find(host_part);
-    Q_ASSERT(notfound == d->domainPolicy.end());
-    if( it != notfound ) {
-#ifdef DEBUG_SETTINGS
-      kDebug() << "partial match";
-      (*it).dump(host_part);
-#endif
-      return *it;
-    }
-    // assert(host_part[0] == QChar('.'));
-    host_part.remove(0,1); // Chop off the dot.
+    return *settings;
   }
 
   // No domain-specific entry: use global domain
@@ -824,7 +794,7 @@ bool WebEngineSettings::favIconsEnabled() const
 
 bool WebEngineSettings::isAdFilterEnabled() const
 {
-    return d->m_adFilterEnabled;
+    return d->m_adFilterEnabled.load();
 }
 
 bool WebEngineSettings::isHideAdsEnabled() const
@@ -834,7 +804,7 @@ bool WebEngineSettings::isHideAdsEnabled() const
 
 bool WebEngineSettings::isAdFiltered( const QString &url ) const
 {
-    if (!d->m_adFilterEnabled)
+    if (!d->m_adFilterEnabled.load())
         return false;
 
     if (url.startsWith(QLatin1String("data:")))
@@ -843,6 +813,17 @@ bool WebEngineSettings::isAdFiltered( const QString &url ) const
     return d->adBlackList.isUrlMatched(url) && !d->adWhiteList.isUrlMatched(url);
 }
 
+bool WebEngineSettings::isAdFiltered( const KDEPrivate::FilterRequest &request ) const
+{
+    if (!d->m_adFilterEnabled.load())
+        return false;
+
+    if (request.url.startsWith(QLatin1String("data:")))
+        return false;
+
+    return d->adBlackList.isMatched(request) && !d->adWhiteList.isMatched(request);
+}
+
 QString WebEngineSettings::adFilteredBy( const QString &url, bool *isWhiteListed ) const
 {
     QString m = d->adWhiteList.urlMatchedBy(url);
@@ -862,6 +843,14 @@ QString WebEngineSettings::adFilteredBy( const QString &url, bool *isWhiteListed
     return m;
 }
 
+QStringList WebEngineSettings::adElementHidingSelectors( const QString &host ) const
+{
+    if (!d->m_adFilterEnabled.load())
+        return QStringList();
+
+    return d->adBlackList.elementHidingSelectors(host);
+}
+
 void WebEngineSettings::addAdFilter( const QString &url )
 {
     KConfigGroup config = KSharedConfig::openConfig( QStringLiteral("khtmlrc"), KConfig::NoGlobals )->group( "Filter Settings" );
@@ -33,6 +33,10 @@ class KConfigGroup;
 struct KPerDomainSettings;
 class WebEngineSettingsPrivate;
 
+namespace KDEPrivate {
+struct FilterRequest;
+}
+
 /**
  * Settings for the HTML view.
  */
@@ -80,12 +84,14 @@ public:
     bool isLoadPluginsOnDemandEnabled() const;
     bool isInternalPluginHandlingDisabled() const;
 
-    // AdBlocK Filtering
+    // AdBlocK Filtering, isAdFiltered() may be called from any thread
     bool isAdFiltered( const QString &url ) const;
+    bool isAdFiltered( const KDEPrivate::FilterRequest &request ) const;
     bool isAdFilterEnabled() const;
     bool isHideAdsEnabled() const;
     void addAdFilter( const QString &url );
     QString adFilteredBy( const QString &url, bool *isWhiteListed = 0 ) const;
+    QStringList adElementHidingSelectors( const QString &host ) const;
 
     // Access Keys
     bool accessKeysEnabled() const;
@@ -25,6 +25,7 @@
 #include "webenginepart.h"
 #include "websslinfo.h"
 #include "webengineview.h"
+#include "webengineurlrequestinterceptor.h"
 #include "settings/webenginesettings.h"
 #include <QWebEngineSettings>
 #include <QWebEngineProfile>
@@ -52,6 +53,8 @@
 #include <QWebEngineHistoryItem>
 #include <QWebEngineDownloadItem>
 #include <QUrlQuery>
+#include <QJsonArray>
+#include <QJsonDocument>
 #include <KConfigGroup>
 //#include <QWebSecurityOrigin>
 #include "utils.h"
@@ -81,6 +84,8 @@ WebEnginePage::WebEnginePage(WebEnginePart *part, QWidget *parent)
     {
         this->profile()->setHttpUserAgent(this->profile()->httpUserAgent() + " Konqueror (WebEnginePart)");
     }
+    // Installs the AdBlocK filters
+    WebEngineUrlRequestInterceptor::self();
 }
 
 WebEnginePage::~WebEnginePage()
@@ -98,6 +103,39 @@ void WebEnginePage::setSslInfo (const WebSslInfo& info)
     m_sslInfo = info;
 }
 
+int WebEnginePage::blockedRequestCount() const
+{
+    return WebEngineUrlRequestInterceptor::self()->statistics(url()).blockedRequests;
+}
+
+qint64 WebEnginePage::blockedBytes() const
+{
+    return WebEngineUrlRequestInterceptor::self()->statistics(url()).savedBytes;
+}
+
+void WebEnginePage::hideAdElements()
+{
+    WebEngineSettings *settings = WebEngineSettings::self();
+    if (!settings->isHideAdsEnabled())
+        return;
+
+    const QStringList selectors = settings->adElementHidingSelectors(url().host());
+    if (selectors.isEmpty())
+        return;
+
+    // One rule per selector, so that those the engine doesn't understand only drop themselves
+    QString css;
+    foreach (const QString &selector, selectors)
+        css += selector + QLatin1String(" { display: none !important; }\n");
+
+    const QString cssArray = QString::fromUtf8(QJsonDocument(QJsonArray() << css).toJson(QJsonDocument::Compact));
+    runJavaScript(QStringLiteral("(function(css) {"
+                                 " var style = document.createElement('style');"
+                                 " style.textContent = css;"
+                                 " (document.head || document.documentElement).appendChild(style);"
+                                 " })(%1[0]);").arg(cssArray));
+}
+
 static void checkForDownloadManager(QWidget* widget, QString& cmd)
 {
     cmd.clear();
@@ -339,6 +377,7 @@ void WebEnginePage::slotLoadFinished(bool ok)
                     reply->url(), shouldResetSslInfo);
 #endif
             setPageJScriptPolicy(url());
+            hideAdElements();
         }
     } else {
     // Handle any error...
@@ -68,6 +68,18 @@ public:
      */
     void downloadRequest(QWebEngineDownloadItem* request);
 
+    /**
+     * Returns the number of requests blocked by the AdBlocK filters for the
+     * pages showing the url of this page, since its main frame was last loaded.
+     */
+    int blockedRequestCount() const;
+
+    /**
+     * Returns an estimate of the bytes the blocked requests would have
+     * downloaded.
+     */
+    qint64 blockedBytes() const;
+
 Q_SIGNALS:
     /**
      * This signal is emitted whenever a user cancels/aborts a load resource
@@ -111,6 +123,7 @@ private:
     bool checkFormData(const QNetworkRequest& req) const;
     bool handleMailToUrl (const QUrl& , NavigationType type) const;
     void setPageJScriptPolicy(const QUrl& url);
+    void hideAdElements();
 
 private:
     enum WebEnginePageSecurity { PageUnencrypted, PageEncrypted, PageMixed };
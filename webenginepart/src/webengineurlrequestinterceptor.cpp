@@ -0,0 +1,152 @@
+/*
+ * This file is part of the KDE project.
+ *
+ * Copyright (C) 2016 The Konqueror developers
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation; either version 2.1 of the License, or (at your
+ * option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "webengineurlrequestinterceptor.h"
+
+#include "settings/webenginesettings.h"
+#include "settings/webengine_filter.h"
+
+#include <QWebEngineProfile>
+#include <QMutexLocker>
+
+// Pages which are never reloaded must not make the counters grow forever
+static const int s_maxCountedPages = 1000;
+
+// Rough median sizes of the resources of web pages
+static qint64 estimatedSize(QWebEngineUrlRequestInfo::ResourceType type)
+{
+    switch (type) {
+    case QWebEngineUrlRequestInfo::ResourceTypeSubFrame:
+        return 40 * 1024;
+    case QWebEngineUrlRequestInfo::ResourceTypeScript:
+        return 20 * 1024;
+    case QWebEngineUrlRequestInfo::ResourceTypeStylesheet:
+        return 10 * 1024;
+    case QWebEngineUrlRequestInfo::ResourceTypeImage:
+        return 12 * 1024;
+    case QWebEngineUrlRequestInfo::ResourceTypeFontResource:
+        return 30 * 1024;
+    case QWebEngineUrlRequestInfo::ResourceTypeMedia:
+    case QWebEngineUrlRequestInfo::ResourceTypeObject:
+        return 100 * 1024;
+    case QWebEngineUrlRequestInfo::ResourceTypePing:
+        return 0;
+    default:
+        return 2 * 1024;
+    }
+}
+
+static KDEPrivate::FilterRequest::ResourceType filterType(QWebEngineUrlRequestInfo::ResourceType type)
+{
+    switch (type) {
+    case QWebEngineUrlRequestInfo::ResourceTypeSubFrame:
+        return KDEPrivate::FilterRequest::SubDocument;
+    case QWebEngineUrlRequestInfo::ResourceTypeScript:
+    case QWebEngineUrlRequestInfo::ResourceTypeWorker:
+    case QWebEngineUrlRequestInfo::ResourceTypeSharedWorker:
+    case QWebEngineUrlRequestInfo::ResourceTypeServiceWorker:
+        return KDEPrivate::FilterRequest::Script;
+    case QWebEngineUrlRequestInfo::ResourceTypeStylesheet:
+        return KDEPrivate::FilterRequest::Stylesheet;
+    case QWebEngineUrlRequestInfo::ResourceTypeImage:
+    case QWebEngineUrlRequestInfo::ResourceTypeFavicon:
+        return KDEPrivate::FilterRequest::Image;
+    case QWebEngineUrlRequestInfo::ResourceTypeFontResource:
+        return KDEPrivate::FilterRequest::Font;
+    case QWebEngineUrlRequestInfo::ResourceTypeObject:
+        return KDEPrivate::FilterRequest::Object;
+    case QWebEngineUrlRequestInfo::ResourceTypeMedia:
+        return KDEPrivate::FilterRequest::Media;
+    case QWebEngineUrlRequestInfo::ResourceTypeXhr:
+        return KDEPrivate::FilterRequest::XmlHttpRequest;
+    case QWebEngineUrlRequestInfo::ResourceTypePing:
+        return KDEPrivate::FilterRequest::Ping;
+    default:
+        return KDEPrivate::FilterRequest::Other;
+    }
+}
+
+WebEngineUrlRequestInterceptor::WebEngineUrlRequestInterceptor(QObject *parent)
+    : QWebEngineUrlRequestInterceptor(parent)
+{
+}
+
+WebEngineUrlRequestInterceptor *WebEngineUrlRequestInterceptor::self()
+{
+    static WebEngineUrlRequestInterceptor *s_self = Q_NULLPTR;
+    if (!s_self) {
+        QWebEngineProfile *profile = QWebEngineProfile::defaultProfile();
+        s_self = new WebEngineUrlRequestInterceptor(profile);
+        profile->setRequestInterceptor(s_self);
+    }
+    return s_self;
+}
+
+void WebEngineUrlRequestInterceptor::interceptRequest(QWebEngineUrlRequestInfo &info)
+{
+    // Never block what the user asked for, start counting afresh instead
+    if (info.resourceType() == QWebEngineUrlRequestInfo::ResourceTypeMainFrame) {
+        resetStatistics(info.requestUrl());
+        return;
+    }
+
+    if (filterRequest(info.requestUrl(), info.firstPartyUrl(), info.resourceType()))
+        info.block(true);
+}
+
+bool WebEngineUrlRequestInterceptor::filterRequest(const QUrl &requestUrl, const QUrl &firstPartyUrl,
+                                                   QWebEngineUrlRequestInfo::ResourceType type)
+{
+    WebEngineSettings *settings = WebEngineSettings::self();
+    if (!settings->isAdFilterEnabled())
+        return false;
+    const KDEPrivate::FilterRequest request(requestUrl, firstPartyUrl, filterType(type));
+    if (!settings->isAdFiltered(request))
+        return false;
+
+    const qint64 size = estimatedSize(type);
+    QMutexLocker locker(&m_mutex);
+    if (m_statistics.size() >= s_maxCountedPages && !m_statistics.contains(firstPartyUrl))
+        m_statistics.clear();
+    Statistics &statistics = m_statistics[firstPartyUrl];
+    statistics.blockedRequests++;
+    statistics.savedBytes += size;
+    m_totalStatistics.blockedRequests++;
+    m_totalStatistics.savedBytes += size;
+    return true;
+}
+
+WebEngineUrlRequestInterceptor::Statistics WebEngineUrlRequestInterceptor::statistics(const QUrl &firstPartyUrl) const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_statistics.value(firstPartyUrl);
+}
+
+void WebEngineUrlRequestInterceptor::resetStatistics(const QUrl &firstPartyUrl)
+{
+    QMutexLocker locker(&m_mutex);
+    m_statistics.remove(firstPartyUrl);
+}
+
+WebEngineUrlRequestInterceptor::Statistics WebEngineUrlRequestInterceptor::totalStatistics() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_totalStatistics;
+}
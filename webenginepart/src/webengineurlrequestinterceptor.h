@@ -0,0 +1,92 @@
+/*
+ * This file is part of the KDE project.
+ *
+ * Copyright (C) 2016 The Konqueror developers
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation; either version 2.1 of the License, or (at your
+ * option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef WEBENGINEURLREQUESTINTERCEPTOR_H
+#define WEBENGINEURLREQUESTINTERCEPTOR_H
+
+#include "kwebenginepartlib_export.h"
+
+#include <QWebEngineUrlRequestInterceptor>
+
+#include <QHash>
+#include <QMutex>
+#include <QUrl>
+
+/**
+ * Blocks the requests matched by the AdBlocK filters of WebEngineSettings.
+ *
+ * QtWebEngine calls interceptRequest() on its IO thread, for every request
+ * of every page of the profile. It doesn't tell which page a request is for,
+ * only the url of its main frame, so the blocked requests are counted per
+ * first party url: pages showing the same url share their counters. The
+ * counters of a url start over each time a main frame loads it. The totals
+ * of the profile are counted too.
+ */
+class KWEBENGINEPARTLIB_EXPORT WebEngineUrlRequestInterceptor : public QWebEngineUrlRequestInterceptor
+{
+    Q_OBJECT
+public:
+    struct Statistics
+    {
+        Statistics() : blockedRequests(0), savedBytes(0) {}
+        int blockedRequests;
+        // Estimated from the type of the blocked resources, as they are never downloaded
+        qint64 savedBytes;
+    };
+
+    /**
+     * Returns the interceptor of the default profile, installing it on
+     * the first call. Must be called from the GUI thread.
+     */
+    static WebEngineUrlRequestInterceptor *self();
+
+    void interceptRequest(QWebEngineUrlRequestInfo &info) Q_DECL_OVERRIDE;
+
+    /**
+     * Returns true if the filters block a request of @p type for @p requestUrl,
+     * made by a page showing @p firstPartyUrl, and counts it then.
+     * Thread-safe.
+     */
+    bool filterRequest(const QUrl &requestUrl, const QUrl &firstPartyUrl,
+                       QWebEngineUrlRequestInfo::ResourceType type);
+
+    /**
+     * Returns the counters of the pages showing @p firstPartyUrl.
+     */
+    Statistics statistics(const QUrl &firstPartyUrl) const;
+
+    /**
+     * Starts counting afresh for the pages showing @p firstPartyUrl.
+     */
+    void resetStatistics(const QUrl &firstPartyUrl);
+
+    /**
+     * Returns the counters of all the pages of the profile.
+     */
+    Statistics totalStatistics() const;
+
+private:
+    explicit WebEngineUrlRequestInterceptor(QObject *parent = Q_NULLPTR);
+
+    mutable QMutex m_mutex;
+    QHash<QUrl, Statistics> m_statistics;
+    Statistics m_totalStatistics;
+};
+
+#endif // WEBENGINEURLREQUESTINTERCEPTOR_H